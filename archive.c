@@ -0,0 +1,916 @@
+#include "archive.h"
+#include "walk.h"
+#include "outbuf.h"
+#include "strlib.h"
+#include "task.h"
+#include "tasklog.h"
+#include "logstore.h"
+#include "shard.h"
+#include "merkle.h"
+#include "linkidx.h"
+#include "snapshot.h"
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ * A project packed into one file:
+ *
+ *   magic | record... | toc entry... | footer
+ *   record:    type(1) pathlen(4) datalen(8) path data
+ *   toc entry: type(1) pathlen(4) offset(8) path
+ *   footer:    tocoffset(8) toccount(8) checksum(8) tocmagic
+ *
+ * The numbers are little endian, the checksum is FNV-1a of everything
+ * before the footer. The records go in the walk order, so a directory
+ * always precedes its content, and the links into the project are kept
+ * relative to its root ("~/...") to be valid wherever it's imported.
+ *
+ * A project kept in the log is packed the same way, every task being a
+ * directory with its task file, so the archive can be imported into a
+ * project of either kind. Into the log only the task files and the links
+ * into the project go, with the shards left out of their paths.
+ *
+ * What is made of the rest (the hashes, the link index, the snapshot and
+ * the generation) is neither packed nor unpacked: it's counted again for
+ * the imported tasks, and the links are added to the index of the
+ * project they're imported into by the caller.
+ */
+
+enum {
+	rec_dir = 1,
+	rec_file = 2,
+	rec_link = 3,
+	rec_header_size = 13,
+	footer_size = 32,
+	magic_size = 8,
+	io_bufsize = 1 << 20,
+	default_toc_size = 1024,
+};
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static unsigned long long fnv_update(unsigned long long h, const char *data,
+	long long len)
+{
+	long long i;
+	for(i = 0; i < len; i++) {
+		h ^= (unsigned char)data[i];
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+static void put_le(char *dest, unsigned long long value, int size)
+{
+	int i;
+	for(i = 0; i < size; i++) {
+		dest[i] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+static unsigned long long get_le(const char *src, int size)
+{
+	unsigned long long value = 0;
+	int i;
+	for(i = size-1; i >= 0; i--)
+		value = (value << 8) | (unsigned char)src[i];
+	return value;
+}
+
+struct toc_entry {
+	char type;
+	char *path;
+	unsigned long long offset;
+};
+
+struct toc {
+	struct toc_entry *items;
+	long long count;
+	long long size;
+};
+
+static void toc_init(struct toc *toc)
+{
+	toc->count = 0;
+	toc->size = default_toc_size;
+	toc->items = malloc(sizeof(*(toc->items))*toc->size);
+}
+
+static void toc_add(struct toc *toc, char type, const char *path,
+	unsigned long long offset)
+{
+	if(toc->count == toc->size) {
+		toc->size *= 2;
+		toc->items = realloc(toc->items, sizeof(*(toc->items))*toc->size);
+	}
+	toc->items[toc->count].type = type;
+	toc->items[toc->count].path = string_duplicate(path);
+	toc->items[toc->count].offset = offset;
+	toc->count++;
+}
+
+static void toc_free(struct toc *toc)
+{
+	long long i;
+	for(i = 0; i < toc->count; i++)
+		free(toc->items[i].path);
+	free(toc->items);
+}
+
+struct writer {
+	struct outbuf ob;
+	unsigned long long hash;
+	unsigned long long offset;
+	struct toc toc;
+	const char *root;
+	dev_t outdev;		/* the archive itself mustn't be packed */
+	ino_t outino;
+	char failed;
+};
+
+static void writer_put(struct writer *w, const char *data, long long len)
+{
+	w->hash = fnv_update(w->hash, data, len);
+	w->offset += len;
+	if(outbuf_write(&w->ob, data, len) != 0)
+		w->failed = 1;
+}
+
+static void put_record(struct writer *w, char type, const char *path,
+	unsigned long long datalen)
+{
+	char header[rec_header_size];
+	long long plen = strlen(path);
+	toc_add(&w->toc, type, path, w->offset);
+	header[0] = type;
+	put_le(header+1, plen, 4);
+	put_le(header+5, datalen, 8);
+	writer_put(w, header, sizeof(header));
+	writer_put(w, path, plen);
+}
+
+/* the file is made of the others, see the comment at the top */
+static char is_derived(const char *path)
+{
+	const char *name = strrchr(path, '/');
+	if(name)
+		return strcmp(name+1, HASH_FILE) == 0;
+	return strcmp(path, HASH_FILE) == 0 || strcmp(path, LINKS_FILE) == 0 ||
+		strcmp(path, SNAPSHOT_FILE) == 0 || 
+		strcmp(path, GENERATION_FILE) == 0;
+}
+
+static char put_file(struct writer *w, const struct walk_entry *ent)
+{
+	char buf[65536];
+	struct stat st;
+	unsigned long long left;
+	int fd = openat(ent->dirfd, ent->name, O_RDONLY);
+	if(fd == -1)
+		return -1;
+	if(fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	if(st.st_dev == w->outdev && st.st_ino == w->outino) {
+		close(fd);
+		return 0;
+	}
+	put_record(w, rec_file, ent->path, st.st_size);
+	for(left = st.st_size; left > 0; ) {
+		ssize_t rc = read(fd, buf, left < sizeof(buf) ? left : sizeof(buf));
+		if(rc <= 0) { /* it's been truncated, keep the promised length */
+			memset(buf, 0, sizeof(buf));
+			rc = left < sizeof(buf) ? left : sizeof(buf);
+		}
+		writer_put(w, buf, rc);
+		left -= rc;
+	}
+	close(fd);
+	return 0;
+}
+
+static char put_link(struct writer *w, const struct walk_entry *ent)
+{
+	char target[4096];
+	const char *data = target;
+	long long rlen = strlen(w->root);
+	ssize_t len;
+	len = readlinkat(ent->dirfd, ent->name, target, sizeof(target)-1);
+	if(len == -1)
+		return -1;
+	target[len] = 0;
+	if(strncmp(target, w->root, rlen) == 0 && 
+		(target[rlen] == '/' || target[rlen] == 0)) {
+		target[rlen-1] = '~';
+		data = target+rlen-1;
+	}
+	put_record(w, rec_link, ent->path, strlen(data));
+	writer_put(w, data, strlen(data));
+	return 0;
+}
+
+static int export_entry(const struct walk_entry *ent, void *usrdata)
+{
+	struct writer *w = usrdata;
+	char ok = 0;
+	switch(ent->event) {
+		case walk_pre:
+			put_record(w, rec_dir, ent->path, 0);
+			break;
+		case walk_file:
+			if(!is_derived(ent->path))
+				ok = put_file(w, ent);
+			break;
+		case walk_link:
+			ok = put_link(w, ent);
+			break;
+		case walk_post:
+		case walk_dup:
+		case walk_cycle:
+			break;
+	}
+	return (ok != 0 || w->failed) ? walk_stop : walk_continue;
+}
+
+static void put_toc(struct writer *w)
+{
+	char buf[footer_size];
+	unsigned long long tocoffset = w->offset;
+	long long i;
+	for(i = 0; i < w->toc.count; i++) {
+		struct toc_entry *ent = &w->toc.items[i];
+		long long plen = strlen(ent->path);
+		buf[0] = ent->type;
+		put_le(buf+1, plen, 4);
+		put_le(buf+5, ent->offset, 8);
+		writer_put(w, buf, rec_header_size);
+		writer_put(w, ent->path, plen);
+	}
+	put_le(buf, tocoffset, 8);
+	put_le(buf+8, w->toc.count, 8);
+	put_le(buf+16, w->hash, 8);
+	memcpy(buf+24, ARCHIVE_TOC_MAGIC, magic_size);
+	if(outbuf_write(&w->ob, buf, footer_size) != 0)
+		w->failed = 1;
+}
+
+static char writer_init(struct writer *w, int outfd, const char *root)
+{
+	struct stat st;
+	if(fstat(outfd, &st) == -1)
+		return -1;
+	w->hash = FNV_OFFSET;
+	w->offset = 0;
+	w->root = root;
+	w->outdev = st.st_dev;
+	w->outino = st.st_ino;
+	w->failed = 0;
+	toc_init(&w->toc);
+	outbuf_init(&w->ob, outfd);
+	w->ob.size = io_bufsize;
+	w->ob.data = realloc(w->ob.data, w->ob.size);
+	writer_put(w, ARCHIVE_MAGIC, magic_size);
+	return 0;
+}
+
+static char writer_finish(struct writer *w, char ok)
+{
+	if(ok == 0)
+		put_toc(w);
+	if(outbuf_flush(&w->ob) != 0)
+		w->failed = 1;
+	outbuf_free(&w->ob);
+	toc_free(&w->toc);
+	return (ok != 0 || w->failed) ? -1 : 0;
+}
+
+char archive_export(int dirfd, const char *path, const char *root,
+	int outfd)
+{
+	struct writer w;
+	if(writer_init(&w, outfd, root) != 0)
+		return -1;
+	return writer_finish(&w, walk(dirfd, path, 0, export_entry, &w));
+}
+
+static char *join(const char *dir, const char *name)
+{
+	return dir[0] ? strings_concatenate(dir, "/", name, NULL) :
+		string_duplicate(name);
+}
+
+static void put_log_link(struct writer *w, const char *path,
+	const char *target)
+{
+	char *data = target[0] ? strings_concatenate("~/", target, NULL) :
+		string_duplicate("~");
+	put_record(w, rec_link, path, strlen(data));
+	writer_put(w, data, strlen(data));
+	free(data);
+}
+
+static void put_log_task(struct writer *w, struct tasklog *log,
+	const char *path)
+{
+	char **names, *data;
+	long long len, count, i;
+	put_record(w, rec_dir, path, 0);
+	data = tasklog_get(log, path, &len);
+	if(data) {
+		char *file = join(path, TASK_CORE_FILE);
+		put_record(w, rec_file, file, len);
+		writer_put(w, data, len);
+		free(file);
+		free(data);
+	}
+	names = logstore_list(log, path, 1, &count);
+	for(i = 0; i < count && !w->failed; i++) {
+		char *cpath = join(path, names[i]);
+		char *target = tasklog_readlink(log, cpath);
+		if(target)
+			put_log_link(w, cpath, target);
+		else
+			put_log_task(w, log, cpath);
+		free(target);
+		free(cpath);
+	}
+	logstore_free_list(names, count);
+}
+
+char archive_export_log(struct tasklog *log, int outfd)
+{
+	struct writer w;
+	if(writer_init(&w, outfd, "") != 0)
+		return -1;
+	put_log_task(&w, log, "");
+	return writer_finish(&w, 0);
+}
+
+/* where the records go, nothing is written without it */
+struct destination {
+	int fd;
+	const char *root;		/* the links into the project lead there */
+	struct tasklog *log;	/* the fd isn't used then */
+	const char *path;		/* in the log */
+	struct toc links;		/* of the log, made once the tasks are there */
+	struct toc targets;
+	archive_link_fn_t fn;	/* for the links made in the fd */
+	void *usrdata;
+};
+
+struct reader {
+	int fd;
+	char *buf;
+	long long len;
+	long long pos;
+	unsigned long long hash;
+	unsigned long long left;	/* bytes before the toc */
+};
+
+/* gives the next len bytes from the buffer, len is at most io_bufsize */
+static const char *reader_get(struct reader *r, long long len)
+{
+	const char *data;
+	if(len > (long long)r->left)
+		return NULL;
+	if(r->pos+len > r->len) {
+		ssize_t rc;
+		memmove(r->buf, r->buf+r->pos, r->len-r->pos);
+		r->len -= r->pos;
+		r->pos = 0;
+		while(r->len < len) {
+			rc = read(r->fd, r->buf+r->len, io_bufsize-r->len);
+			if(rc <= 0)
+				return NULL;
+			r->len += rc;
+		}
+	}
+	data = r->buf+r->pos;
+	r->pos += len;
+	r->left -= len;
+	r->hash = fnv_update(r->hash, data, len);
+	return data;
+}
+
+static char *get_link_target(const char *data, long long len, 
+	const char *root)
+{
+	char *target;
+	if(len > 0 && data[0] == '~') {
+		long long rlen = strlen(root);
+		target = malloc(rlen+len);
+		memcpy(target, root, rlen);
+		memcpy(target+rlen, data+1, len-1);
+		target[rlen+len-1] = 0;
+		return target;
+	}
+	target = malloc(len+1);
+	memcpy(target, data, len);
+	target[len] = 0;
+	return target;
+}
+
+static char read_file_data(struct reader *r, int fd, 
+	unsigned long long datalen)
+{
+	char ok = 0;
+	while(datalen > 0) {
+		long long chunk = datalen < io_bufsize/2 ? datalen : io_bufsize/2;
+		const char *data = reader_get(r, chunk);
+		if(!data)
+			return -1;
+		if(fd != -1 && write(fd, data, chunk) != chunk)
+			ok = -1;
+		datalen -= chunk;
+	}
+	return ok;
+}
+
+/*
+ * Every directory is made before any file is written. One which is there
+ * already has to be a directory itself, not a link leading out of it.
+ */
+static char make_dirs(const struct toc *toc, int dstfd)
+{
+	struct stat st;
+	long long i;
+	for(i = 0; i < toc->count; i++) {
+		const char *path = toc->items[i].path;
+		if(toc->items[i].type != rec_dir || !path[0])
+			continue;
+		if(mkdirat(dstfd, path, 0777) == 0)
+			continue;
+		if(errno != EEXIST)
+			return -1;
+		if(fstatat(dstfd, path, &st, AT_SYMLINK_NOFOLLOW) == -1)
+			return -1;
+		if(!S_ISDIR(st.st_mode)) {
+			errno = ENOTDIR;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* relative, with no empty, "." or ".." component */
+static char is_safe_path(const char *path)
+{
+	const char *p = path;
+	if(!*p || *p == '/')
+		return 0;
+	for(;;) {
+		long long len = strcspn(p, "/");
+		if(len == 0 || (len == 1 && p[0] == '.') ||
+			(len == 2 && p[0] == '.' && p[1] == '.'))
+			return 0;
+		if(!p[len])
+			return 1;
+		p += len+1;
+	}
+}
+
+static int toc_path_cmp(const void *a, const void *b)
+{
+	return strcmp((*(const struct toc_entry **)a)->path,
+		(*(const struct toc_entry **)b)->path);
+}
+
+static const struct toc_entry *find_entry(struct toc_entry **sorted,
+	long long count, const char *path)
+{
+	struct toc_entry key, *keyp = &key, **found;
+	key.path = (char *)path;
+	found = bsearch(&keyp, sorted, count, sizeof(*sorted), toc_path_cmp);
+	return found ? *found : NULL;
+}
+
+/*
+ * Nothing may be written outside of the destination: every path is safe,
+ * is there once, and its parent is a directory of the archive, so no path
+ * goes through a link, and only the root has the empty one.
+ */
+static char check_toc(const struct toc *toc)
+{
+	struct toc_entry **sorted;
+	long long i;
+	char ok = 0;
+	if(toc->count == 0)
+		return 0;
+	sorted = malloc(sizeof(*sorted)*toc->count);
+	for(i = 0; i < toc->count; i++)
+		sorted[i] = &toc->items[i];
+	qsort(sorted, toc->count, sizeof(*sorted), toc_path_cmp);
+	for(i = 0; i < toc->count && ok == 0; i++) {
+		const struct toc_entry *ent = &toc->items[i], *parent;
+		char *slash, *dir;
+		if(i > 0 && strcmp(sorted[i-1]->path, sorted[i]->path) == 0) {
+			ok = -1;
+			break;
+		}
+		if(!ent->path[0]) {
+			if(ent->type != rec_dir)
+				ok = -1;
+			continue;
+		}
+		if(!is_safe_path(ent->path)) {
+			ok = -1;
+			break;
+		}
+		slash = strrchr(ent->path, '/');
+		dir = string_duplicate(ent->path);
+		dir[slash ? slash-ent->path : 0] = 0;
+		parent = find_entry(sorted, toc->count, dir);
+		if(!parent || parent->type != rec_dir)
+			ok = -1;
+		free(dir);
+	}
+	free(sorted);
+	return ok;
+}
+
+static char read_toc(int fd, struct toc *toc, unsigned long long *tocoffset,
+	unsigned long long *checksum)
+{
+	char footer[footer_size], *data, *p;
+	unsigned long long count, i;
+	off_t size = lseek(fd, 0, SEEK_END);
+	if(size < magic_size+footer_size)
+		return -1;
+	if(pread(fd, footer, footer_size, size-footer_size) != footer_size)
+		return -1;
+	if(memcmp(footer+24, ARCHIVE_TOC_MAGIC, magic_size) != 0)
+		return -1;
+	*tocoffset = get_le(footer, 8);
+	count = get_le(footer+8, 8);
+	*checksum = get_le(footer+16, 8);
+	if(*tocoffset > (unsigned long long)size-footer_size)
+		return -1;
+	size = size-footer_size-*tocoffset;
+	data = malloc(size+1);
+	if(pread(fd, data, size, *tocoffset) != size) {
+		free(data);
+		return -1;
+	}
+	toc_init(toc);
+	for(p = data, i = 0; i < count && p+rec_header_size <= data+size; i++) {
+		long long plen = get_le(p+1, 4);
+		char type = p[0], saved;
+		if(p+rec_header_size+plen > data+size)
+			break;
+		saved = p[rec_header_size+plen];
+		p[rec_header_size+plen] = 0;
+		toc_add(toc, type, p+rec_header_size, get_le(p+5, 8));
+		p[rec_header_size+plen] = saved;
+		p += rec_header_size+plen;
+	}
+	free(data);
+	return i == count ? 0 : -1;
+}
+
+static char *read_data(struct reader *r, unsigned long long datalen)
+{
+	char *buf = malloc(datalen+1);
+	unsigned long long pos = 0;
+	while(pos < datalen) {
+		long long chunk = datalen-pos < io_bufsize/2 ? 
+			datalen-pos : io_bufsize/2;
+		const char *data = reader_get(r, chunk);
+		if(!data) {
+			free(buf);
+			return NULL;
+		}
+		memcpy(buf+pos, data, chunk);
+		pos += chunk;
+	}
+	return buf;
+}
+
+/* the path in the log of the task the archive path is of */
+static char *get_log_path(const struct destination *dst, const char *path)
+{
+	char *logical = shard_logical(path), *result;
+	result = logical[0] ? join(dst->path, logical) : 
+		string_duplicate(dst->path);
+	free(logical);
+	return result;
+}
+
+/* a task path which isn't in the log yet is made an empty task */
+static char import_log_dir(struct destination *dst, const char *path)
+{
+	char *logpath = get_log_path(dst, path);
+	char ok = 0;
+	if(!tasklog_exists(dst->log, logpath))
+		ok = tasklog_put(dst->log, logpath, "", 0);
+	free(logpath);
+	return ok;
+}
+
+/* only the task files are kept, the rest is read through */
+static char import_log_file(struct reader *r, struct destination *dst,
+	const char *path, unsigned long long datalen)
+{
+	const char *name = strrchr(path, '/');
+	char *data, *dir, *logpath;
+	char ok;
+	name = name ? name+1 : path;
+	if(strcmp(name, TASK_CORE_FILE) != 0)
+		return read_file_data(r, -1, datalen);
+	data = read_data(r, datalen);
+	if(!data)
+		return -1;
+	dir = string_duplicate(path);
+	dir[name > path ? name-path-1 : 0] = 0;
+	logpath = get_log_path(dst, dir);
+	ok = tasklog_put(dst->log, logpath, data, datalen);
+	free(logpath);
+	free(dir);
+	free(data);
+	return ok;
+}
+
+/* a link leading out of the project has no place in the log */
+static void import_log_link(struct destination *dst, const char *path,
+	const char *data, long long len)
+{
+	char *target, *logtarget;
+	if(len == 0 || data[0] != '~' || (len > 1 && data[1] != '/'))
+		return;
+	target = malloc(len);
+	memcpy(target, data+1, len-1);
+	target[len-1] = 0;
+	logtarget = get_log_path(dst, target[0] ? target+1 : target);
+	toc_add(&dst->targets, rec_link, logtarget, 0);
+	free(logtarget);
+	logtarget = get_log_path(dst, path);
+	toc_add(&dst->links, rec_link, logtarget, 0);
+	free(logtarget);
+	free(target);
+}
+
+/* a link replaces a link, never a task, and one into nowhere is dropped */
+static char make_log_links(struct destination *dst)
+{
+	long long i;
+	char ok = 0;
+	for(i = 0; i < dst->links.count; i++) {
+		const char *path = dst->links.items[i].path;
+		char *old = tasklog_readlink(dst->log, path);
+		if(old)
+			tasklog_remove(dst->log, path);
+		free(old);
+		if(!tasklog_exists(dst->log, dst->targets.items[i].path))
+			continue;
+		if(tasklog_link(dst->log, path, dst->targets.items[i].path) != 0)
+			ok = -1;
+	}
+	return ok;
+}
+
+/* the content changes, so the hash is counted again when it's asked for */
+static void forget_hash(int dstfd, const char *path)
+{
+	char *hashpath = path[0] ? strings_concatenate(path, "/", HASH_FILE, 
+		NULL) : string_duplicate(HASH_FILE);
+	unlinkat(dstfd, hashpath, 0);
+	free(hashpath);
+}
+
+/*
+ * The records have to be the ones of the toc, which has been checked.
+ * Without the destination they're only read through.
+ */
+static char import_records(struct reader *r, const struct toc *toc,
+	unsigned long long tocoffset, struct destination *dst)
+{
+	int dstfd = dst && !dst->log ? dst->fd : -1;
+	long long i;
+	char ok = 0;
+	for(i = 0; r->left > 0; i++) {
+		unsigned long long offset = tocoffset-r->left, plen, datalen;
+		const char *header = reader_get(r, rec_header_size), *data;
+		const struct toc_entry *ent;
+		char type;
+		int fd = -1;
+		if(!header || i >= toc->count)
+			return -1;
+		ent = &toc->items[i];
+		type = header[0];
+		plen = get_le(header+1, 4);
+		datalen = get_le(header+5, 8);
+		if(type != ent->type || offset != ent->offset ||
+			plen != strlen(ent->path) || !(data = reader_get(r, plen)) ||
+			memcmp(data, ent->path, plen) != 0)
+			return -1;
+		switch(type) {
+			case rec_file:
+				if(is_derived(ent->path)) {	/* packed by an older version */
+					if(read_file_data(r, -1, datalen) != 0)
+						ok = -1;
+					break;
+				}
+				if(dst && dst->log) {
+					if(import_log_file(r, dst, ent->path, datalen) != 0)
+						ok = -1;
+					break;
+				}
+				/* whatever is there goes, a link is never written through */
+				if(dstfd != -1) {
+					if(unlinkat(dstfd, ent->path, 0) == -1 && errno != ENOENT)
+						ok = -1;
+					fd = openat(dstfd, ent->path,
+						O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW, 0666);
+					if(fd == -1)
+						ok = -1;
+				}
+				if(read_file_data(r, fd, datalen) != 0)
+					ok = -1;
+				if(fd != -1)
+					close(fd);
+				break;
+			case rec_link:
+				if(datalen >= io_bufsize/2 || 
+					!(data = reader_get(r, datalen)))
+					return -1;
+				if(dst && dst->log)
+					import_log_link(dst, ent->path, data, datalen);
+				else if(dstfd != -1) {
+					char *target = get_link_target(data, datalen, dst->root);
+					unlinkat(dstfd, ent->path, 0);
+					if(symlinkat(target, dstfd, ent->path) == -1)
+						ok = -1;
+					else if(dst->fn)
+						dst->fn(target, ent->path, dst->usrdata);
+					free(target);
+				}
+				break;
+			case rec_dir:	/* directories are made already */
+				if(dst && dst->log && import_log_dir(dst, ent->path) != 0)
+					ok = -1;
+				if(dstfd != -1)
+					forget_hash(dstfd, ent->path);
+				if(read_file_data(r, -1, datalen) != 0)
+					ok = -1;
+				break;
+			default:
+				return -1;
+		}
+	}
+	return i == toc->count ? ok : -1;
+}
+
+static char read_records(struct reader *r, const struct toc *toc,
+	unsigned long long tocoffset, struct destination *dst)
+{
+	const char *magic;
+	char ok;
+	r->buf = malloc(io_bufsize);
+	r->len = 0;
+	r->pos = 0;
+	r->hash = FNV_OFFSET;
+	r->left = tocoffset;
+	lseek(r->fd, 0, SEEK_SET);
+	magic = reader_get(r, magic_size);
+	if(!magic || memcmp(magic, ARCHIVE_MAGIC, magic_size) != 0)
+		ok = -1;
+	else
+		ok = import_records(r, toc, tocoffset, dst);
+	free(r->buf);
+	return ok;
+}
+
+/*
+ * The first pass: the records are matched against the toc and everything
+ * before the footer, the toc included, is summed, with nothing written.
+ */
+static char verify_archive(int fd, const struct toc *toc,
+	unsigned long long tocoffset, unsigned long long checksum)
+{
+	char buf[65536];
+	struct reader r;
+	off_t pos = tocoffset, end = lseek(fd, 0, SEEK_END)-footer_size;
+	ssize_t rc;
+	r.fd = fd;
+	if(read_records(&r, toc, tocoffset, NULL) != 0)
+		return -1;
+	while(pos < end) {
+		rc = pread(fd, buf, end-pos < sizeof(buf) ? end-pos : sizeof(buf),
+			pos);
+		if(rc <= 0)
+			return -1;
+		r.hash = fnv_update(r.hash, buf, rc);
+		pos += rc;
+	}
+	return r.hash == checksum ? 0 : -1;
+}
+
+/*
+ * The archive is checked whole before anything is made: a corrupted or
+ * a crafted one is refused without leaving a partly imported tree.
+ */
+static char load_archive(int infd, struct toc *toc,
+	unsigned long long *tocoffset)
+{
+	unsigned long long checksum;
+	if(read_toc(infd, toc, tocoffset, &checksum) != 0) {
+		errno = EBADMSG;
+		return -1;
+	}
+	if(check_toc(toc) != 0 ||
+		verify_archive(infd, toc, *tocoffset, checksum) != 0) {
+		toc_free(toc);
+		errno = EBADMSG;
+		return -1;
+	}
+	return 0;
+}
+
+char archive_import(int infd, int dirfd, const char *path, const char *root,
+	archive_link_fn_t fn, void *usrdata)
+{
+	struct destination dst;
+	struct reader r;
+	struct toc toc;
+	unsigned long long tocoffset;
+	char ok;
+	if(load_archive(infd, &toc, &tocoffset) != 0)
+		return -1;
+	dst.fd = openat(dirfd, path, O_RDONLY|O_DIRECTORY);
+	dst.root = root;
+	dst.log = NULL;
+	dst.fn = fn;
+	dst.usrdata = usrdata;
+	if(dst.fd == -1 || make_dirs(&toc, dst.fd) != 0) {
+		toc_free(&toc);
+		if(dst.fd != -1)
+			close(dst.fd);
+		return -1;
+	}
+	r.fd = infd;
+	ok = read_records(&r, &toc, tocoffset, &dst);
+	toc_free(&toc);
+	close(dst.fd);
+	return ok;
+}
+
+/* no directory of the archive may be a link in the log */
+static char check_log_dirs(const struct toc *toc, struct destination *dst)
+{
+	long long i;
+	for(i = 0; i < toc->count; i++) {
+		char *logpath, *target;
+		if(toc->items[i].type != rec_dir)
+			continue;
+		logpath = get_log_path(dst, toc->items[i].path);
+		target = tasklog_readlink(dst->log, logpath);
+		free(logpath);
+		if(target) {
+			free(target);
+			errno = ENOTDIR;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+char archive_import_log(int infd, struct tasklog *log, const char *path)
+{
+	struct destination dst;
+	struct reader r;
+	struct toc toc;
+	unsigned long long tocoffset;
+	char ok;
+	if(!tasklog_exists(log, path)) {
+		errno = ENOENT;
+		return -1;
+	}
+	if(load_archive(infd, &toc, &tocoffset) != 0)
+		return -1;
+	dst.fd = -1;
+	dst.root = NULL;
+	dst.log = log;
+	dst.path = path;
+	dst.fn = NULL;
+	dst.usrdata = NULL;
+	if(check_log_dirs(&toc, &dst) != 0) {
+		toc_free(&toc);
+		return -1;
+	}
+	toc_init(&dst.links);
+	toc_init(&dst.targets);
+	r.fd = infd;
+	ok = read_records(&r, &toc, tocoffset, &dst);
+	if(ok == 0)
+		ok = make_log_links(&dst);
+	toc_free(&dst.links);
+	toc_free(&dst.targets);
+	toc_free(&toc);
+	return ok;
+}
@@ -0,0 +1,19 @@
+#ifndef ARCHIVE_H_SENTRY
+#define ARCHIVE_H_SENTRY
+
+#define ARCHIVE_MAGIC "TSKARCH1"
+#define ARCHIVE_TOC_MAGIC "TSKTOC01"
+
+struct tasklog;
+
+/* called for every imported symlink, linkpath is relative to the path */
+typedef void (*archive_link_fn_t)(const char *target, const char *linkpath,
+	void *usrdata);
+
+char archive_export(int dirfd, const char *path, const char *root,
+	int outfd);
+char archive_import(int infd, int dirfd, const char *path, const char *root,
+	archive_link_fn_t fn, void *usrdata);
+char archive_export_log(struct tasklog *log, int outfd);
+char archive_import_log(int infd, struct tasklog *log, const char *path);
+#endif
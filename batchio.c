@@ -0,0 +1,425 @@
+#include "batchio.h"
+#include "trace.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ * Reads many small files at once. With io_uring all the opens of a batch
+ * are submitted together, then all the reads and then all the closes, so
+ * a directory of tasks costs three round trips to the kernel instead of
+ * three per task. Where io_uring isn't available (old kernels, seccomp)
+ * the files are read by a pool of threads instead.
+ */
+
+enum {
+	ring_entries = 256,
+	first_read_size = 4096,	/* most of the task files fit in it */
+	max_workers = 8,
+	files_per_worker = 8,
+};
+
+struct uring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+};
+
+struct batchio {
+	struct uring ring;
+	char has_ring;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned wait)
+{
+	return syscall(__NR_io_uring_enter, fd, submit, wait, 
+		IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static void ring_unmap(struct uring *r)
+{
+	if(r->sqes && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_size);
+	if(r->cq_ptr && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_size);
+	if(r->sq_ptr && r->sq_ptr != MAP_FAILED)
+		munmap(r->sq_ptr, r->sq_size);
+}
+
+static char ring_init(struct uring *r)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+	memset(&p, 0, sizeof(p));
+	memset(r, 0, sizeof(*r));
+	r->fd = uring_setup(ring_entries, &p);
+	if(r->fd == -1)
+		return -1;
+	r->sq_size = p.sq_off.array+p.sq_entries*sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(r->cq_size > r->sq_size)
+			r->sq_size = r->cq_size;
+		r->cq_size = r->sq_size;
+	}
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ|PROT_WRITE, 
+		MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ptr = r->sq_ptr;
+	else
+		r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ|PROT_WRITE, 
+			MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if(r->sq_ptr == MAP_FAILED || r->cq_ptr == MAP_FAILED || 
+		r->sqes == MAP_FAILED) {
+		ring_unmap(r);
+		close(r->fd);
+		return -1;
+	}
+	sq = r->sq_ptr;
+	cq = r->cq_ptr;
+	r->sq_head = (unsigned *)(sq+p.sq_off.head);
+	r->sq_tail = (unsigned *)(sq+p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq+p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq+p.sq_off.array);
+	r->cq_head = (unsigned *)(cq+p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq+p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq+p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq+p.cq_off.cqes);
+	return 0;
+}
+
+static struct io_uring_sqe *ring_get_sqe(struct uring *r, unsigned i)
+{
+	unsigned tail = *r->sq_tail+i;
+	unsigned idx = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[idx] = idx;
+	return sqe;
+}
+
+/* 
+ * Submits the prepared entries and waits for all of them, res gets the
+ * results by the user_data of the entries.
+ */
+static char ring_run(struct uring *r, unsigned count, int *res)
+{
+	unsigned submitted = 0, done = 0;
+	__atomic_store_n(r->sq_tail, *r->sq_tail+count, __ATOMIC_RELEASE);
+	while(done < count) {
+		unsigned head, tail;
+		/* the entries taken are reported, the rest is submitted again */
+		int rc = uring_enter(r->fd, count-submitted, count-done);
+		if(rc == -1 && errno != EINTR)
+			return -1;
+		if(rc > 0)
+			submitted += rc;
+		head = *r->cq_head;
+		tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+		for(; head != tail; head++) {
+			struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+			res[cqe->user_data] = cqe->res;
+			done++;
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+struct batchio *batchio_open()
+{
+	struct batchio *bio = malloc(sizeof(*bio));
+	bio->has_ring = ring_init(&bio->ring) == 0;
+	return bio;
+}
+
+void batchio_close(struct batchio *bio)
+{
+	if(!bio)
+		return;
+	if(bio->has_ring) {
+		ring_unmap(&bio->ring);
+		close(bio->ring.fd);
+	}
+	free(bio);
+}
+
+/* the part of the file which hasn't fit in the first read */
+static void read_rest(int fd, struct batch_file *f)
+{
+	struct stat st;
+	long long size;
+	if(fstat(fd, &st) == -1)
+		return;
+	size = st.st_size > f->len ? st.st_size : f->len*2;
+	for(;;) {
+		ssize_t rc;
+		f->data = realloc(f->data, size+1);
+		rc = pread(fd, f->data+f->len, size-f->len, f->len);
+		if(rc <= 0)
+			break;
+		f->len += rc;
+		if(f->len < size)
+			break;
+		size *= 2;
+	}
+	f->data[f->len] = 0;
+}
+
+/* the head is read up to first_read_size, the file may go on after it */
+static void read_head(int fd, struct batch_file *f)
+{
+	for(;;) {
+		ssize_t rc = read(fd, f->data+f->len, first_read_size-f->len);
+		if(rc == -1 && errno == EINTR)
+			continue;
+		if(rc <= 0)
+			break;
+		f->len += rc;
+		if(f->len == first_read_size) {
+			f->is_head = 1;
+			break;
+		}
+	}
+	f->data[f->len] = 0;
+}
+
+static void read_file(int dirfd, struct batch_file *f, char whole)
+{
+	int fd = openat(dirfd, f->path, O_RDONLY);
+	f->data = NULL;
+	f->len = 0;
+	f->err = 0;
+	f->is_head = 0;
+	if(fd == -1) {
+		f->err = errno;
+		return;
+	}
+	f->data = malloc(first_read_size+1);
+	f->data[0] = 0;
+	if(whole)
+		read_rest(fd, f);
+	else
+		read_head(fd, f);
+	close(fd);
+}
+
+static void close_fds(const int *fds, unsigned count)
+{
+	unsigned i;
+	for(i = 0; i < count; i++)
+		if(fds[i] >= 0)
+			close(fds[i]);
+}
+
+/* 
+ * Returns -1 if the ring can't do it, so the batch is to be read again,
+ * with the files it has opened closed.
+ */
+static char ring_read_batch(struct uring *r, int dirfd, 
+	struct batch_file *files, unsigned count, char whole)
+{
+	int fds[ring_entries], res[ring_entries];
+	unsigned i, n;
+	for(i = 0; i < count; i++) {
+		fds[i] = -1;
+		struct io_uring_sqe *sqe = ring_get_sqe(r, i);
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = dirfd;
+		sqe->addr = (unsigned long long)files[i].path;
+		sqe->open_flags = O_RDONLY|O_CLOEXEC;
+		sqe->user_data = i;
+	}
+	if(ring_run(r, count, fds) != 0) {
+		close_fds(fds, count);
+		return -1;
+	}
+	for(i = 0, n = 0; i < count; i++) {
+		struct io_uring_sqe *sqe;
+		files[i].data = NULL;
+		files[i].len = 0;
+		files[i].err = fds[i] < 0 ? -fds[i] : 0;
+		files[i].is_head = 0;
+		if(fds[i] < 0)
+			continue;
+		files[i].data = malloc(first_read_size+1);
+		sqe = ring_get_sqe(r, n);
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = fds[i];
+		sqe->addr = (unsigned long long)files[i].data;
+		sqe->len = first_read_size;
+		sqe->off = 0;
+		sqe->user_data = i;
+		n++;
+	}
+	if(n > 0 && ring_run(r, n, res) != 0) {
+		close_fds(fds, count);
+		return -1;
+	}
+	for(i = 0, n = 0; i < count; i++) {
+		struct io_uring_sqe *sqe;
+		if(fds[i] < 0)
+			continue;
+		if(res[i] < 0) {
+			files[i].err = -res[i];
+			free(files[i].data);
+			files[i].data = NULL;
+		} else {
+			files[i].len = res[i];
+			files[i].data[res[i]] = 0;
+			if(res[i] == first_read_size) {
+				if(whole)
+					read_rest(fds[i], &files[i]);
+				else
+					files[i].is_head = 1;
+			}
+		}
+		sqe = ring_get_sqe(r, n);
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = fds[i];
+		sqe->user_data = i;
+		res[i] = 1;		/* none of them is closed yet */
+		n++;
+	}
+	if(n > 0 && ring_run(r, n, res) != 0) {
+		for(i = 0; i < count; i++)
+			if(fds[i] >= 0 && res[i] == 1)
+				close(fds[i]);
+		return -1;
+	}
+	/* kernels before 5.6 know io_uring, but not these operations */
+	for(i = 0; i < count; i++)
+		if(files[i].err == EINVAL)
+			return -1;
+	return 0;
+}
+
+struct pool {
+	int dirfd;
+	struct batch_file *files;
+	long long count;
+	long long next;		/* the first file not taken by a worker */
+	char whole;
+	pthread_mutex_t lock;
+};
+
+static void *read_worker(void *data)
+{
+	struct pool *pl = data;
+	for(;;) {
+		long long i;
+		pthread_mutex_lock(&pl->lock);
+		i = pl->next++;
+		pthread_mutex_unlock(&pl->lock);
+		if(i >= pl->count)
+			break;
+		read_file(pl->dirfd, &pl->files[i], pl->whole);
+	}
+	return NULL;
+}
+
+/* the reads wait for the disk rather than CPU, so the CPUs aren't counted */
+static void pool_read(int dirfd, struct batch_file *files, long long count,
+	char whole)
+{
+	pthread_t workers[max_workers];
+	struct pool pl;
+	int i, wcount, started = 0;
+	pl.dirfd = dirfd;
+	pl.files = files;
+	pl.count = count;
+	pl.next = 0;
+	pl.whole = whole;
+	pthread_mutex_init(&pl.lock, NULL);
+	wcount = count/files_per_worker;
+	if(wcount > max_workers)
+		wcount = max_workers;
+	for(i = 1; i < wcount; i++) {
+		if(pthread_create(&workers[started], NULL, read_worker, &pl) != 0)
+			break;
+		started++;
+	}
+	read_worker(&pl);
+	for(i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+	pthread_mutex_destroy(&pl.lock);
+}
+
+static char read_batch(struct batchio *bio, int dirfd, 
+	struct batch_file *files, long long count, char whole)
+{
+	long long i;
+	if(!bio || !files)
+		return -1;
+	for(i = 0; i < count; i++) {
+		files[i].data = NULL;
+		files[i].len = 0;
+		files[i].err = 0;
+		files[i].is_head = 0;
+	}
+	for(i = 0; bio->has_ring && i < count; i += ring_entries) {
+		long long n = count-i < ring_entries ? count-i : ring_entries;
+		long long j;
+		if(ring_read_batch(&bio->ring, dirfd, files+i, n, whole) == 0)
+			continue;
+		for(j = 0; j < n; j++) {
+			free(files[i+j].data);
+			files[i+j].data = NULL;
+		}
+		bio->has_ring = 0;
+		ring_unmap(&bio->ring);
+		close(bio->ring.fd);
+		pool_read(dirfd, files+i, count-i, whole);
+		return 0;
+	}
+	if(!bio->has_ring)
+		pool_read(dirfd, files, count, whole);
+	return 0;
+}
+
+static char read_traced_batch(struct batchio *bio, int dirfd,
+	struct batch_file *files, long long count, char whole)
+{
+	long long start = trace_begin();
+	char ok = read_batch(bio, dirfd, files, count, whole);
+	if(start) {
+		char arg[32];
+		sprintf(arg, "%lld files", count);
+		trace_end(start, "io", whole ? "batch_read" : "batch_read_heads",
+			arg);
+	}
+	return ok;
+}
+
+char batchio_read(struct batchio *bio, int dirfd, struct batch_file *files,
+	long long count)
+{
+	return read_traced_batch(bio, dirfd, files, count, 1);
+}
+
+/* the files are read up to a size most of them fit in, see is_head */
+char batchio_read_heads(struct batchio *bio, int dirfd,
+	struct batch_file *files, long long count)
+{
+	return read_traced_batch(bio, dirfd, files, count, 0);
+}
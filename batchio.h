@@ -0,0 +1,21 @@
+#ifndef BATCHIO_H_SENTRY
+#define BATCHIO_H_SENTRY
+
+/* a file to be read whole, data is malloc'ed and belongs to the caller */
+struct batch_file {
+	const char *path;	/* relative to the dirfd of the batch */
+	char *data;
+	long long len;
+	int err;			/* errno of the failed read, 0 otherwise */
+	char is_head;		/* only the start of the file has been read */
+};
+
+struct batchio;
+
+struct batchio *batchio_open();
+void batchio_close(struct batchio *bio);
+char batchio_read(struct batchio *bio, int dirfd, struct batch_file *files,
+	long long count);
+char batchio_read_heads(struct batchio *bio, int dirfd,
+	struct batch_file *files, long long count);
+#endif
@@ -0,0 +1,429 @@
+#include "strlib.h"
+#include "list.h"
+#include "path.h"
+#include "task.h"
+#include "params.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Microbenchmarks of the functions the parser, the completion and the
+ * listing spend their time in. Every benchmark is warmed up while the
+ * number of operations taking about min_rep_ns is found, then repeated
+ * and reported as one JSON object with the fastest and the median time
+ * per operation, the time stamp counter ticks and the allocations per
+ * operation. The allocations are counted by wrapping malloc at link
+ * time, see the bench target of the Makefile; memwrap.c isn't linked in,
+ * as its bookkeeping would be timed along. Before the benchmarks the
+ * vector versions of the string functions are checked against the
+ * scalar ones, and nothing is measured if they differ.
+ *
+ * bench [name] [--reps=N] -- run the benchmarks whose names contain name.
+ */
+
+#define REPS_PARAM "--reps"
+
+enum {
+	default_reps = 7,
+	max_reps = 101,
+	min_rep_ns = 20000000,
+	check_max_len = 160,
+};
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static long long allocs_count, allocs_bytes;
+
+void *__wrap_malloc(size_t size)
+{
+	allocs_count++;
+	allocs_bytes += size;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	allocs_count++;
+	allocs_bytes += count*size;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocs_count++;
+	allocs_bytes += size;
+	return __real_realloc(ptr, size);
+}
+
+/* glibc's strdup doesn't go through the wrapped malloc */
+char *__wrap_strdup(const char *s)
+{
+	long long len = strlen(s)+1;
+	char *copy = __wrap_malloc(len);
+	if(copy)
+		memcpy(copy, s, len);
+	return copy;
+}
+
+static unsigned long long get_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static double get_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e9+ts.tv_nsec;
+}
+
+/* keeps the results alive, so the calls aren't optimized out */
+static volatile long long sink;
+
+static const char *command_lines[] = {
+	"set -m completed=false,name=*bug* info \"fixed in \\\"2.1\\\" at last\"",
+	"go ~/work/project/backend/api",
+	"show . --sort=deadline --limit=20 --offset=40",
+	"mk release-2.4",
+	"find */bug*,completed!=true --format=jsonl",
+	"cp -r ../templates/sprint sprint-14",
+	NULL
+};
+
+static const char *escaped_texts[] = {
+	"first line\\nsecond line\\tafter a tab",
+	"a \\\"quoted\\\" word and a \\\\ backslash",
+	"plain text without any escapes at all, only words and spaces",
+	NULL
+};
+
+static const char *completions[] = {
+	"help", "exit", "init", "mk", "rm", "go", "show", "ln", "mv", "set",
+	"clear", "cp", "sync", "export", "import", "reshard", "find",
+	"import-csv", "import-todotxt", "grep", "name", "info", "completed",
+	"from", "to", "type", "backend", "backlog", "bugs", "frontend",
+	"infrastructure", "release-2.3", "release-2.4", "retrospective",
+	"sprint-13", "sprint-14"
+};
+
+static const long long completions_count =
+	sizeof(completions)/sizeof(*completions);
+
+static const char *prefixes[] = { "s", "sh", "re", "import-", "back", "x" };
+
+static const char *path_pairs[][2] = {
+	{ "/home/user/tasks/project", "backend/api" },
+	{ "work/project", "sprint-14/retrospective" },
+	{ "/", "tasks" },
+	{ "a/b/c/d/e/f", "g/h" },
+};
+
+static const char task_text[] =
+	"name Move the storage to the new cluster\n"
+	"completed false\n"
+	"from 2026-10-01\n"
+	"to 2026-11-15\n"
+	"info The old cluster goes read-only on the first of November, so\n"
+	" every service has to be moved before. The order is: the queues,\n"
+	" the caches, the databases and the blob storage at last.\n"
+	" Rollback plan: keep the old cluster writable for the databases\n"
+	" until the migration of the blob storage is checked.\n"
+	" Owners: storage team, with the platform team on call.\n";
+
+static void bench_get_tokens(long long n)
+{
+	long long i;
+	for(i = 0; i < n; i++) {
+		char **tokens = get_tokens(command_lines[i % 6]);
+		long long j;
+		for(j = 0; tokens[j]; j++)
+			free(tokens[j]);
+		sink += j;
+		free(tokens);
+	}
+}
+
+static void bench_strings_concatenate(long long n)
+{
+	long long i;
+	for(i = 0; i < n; i++) {
+		char *s = strings_concatenate(path_pairs[i & 3][0], "/",
+			path_pairs[i & 3][1], "/", TASK_CORE_FILE, NULL);
+		sink += s[0];
+		free(s);
+	}
+}
+
+static void bench_set_special_chars(long long n)
+{
+	char buf[128];
+	long long i;
+	for(i = 0; i < n; i++) {
+		strcpy(buf, escaped_texts[i % 3]);
+		set_special_chars(buf);
+		sink += buf[0];
+	}
+}
+
+static void bench_get_strings_by_prefix(long long n)
+{
+	long long i;
+	for(i = 0; i < n; i++) {
+		const char **matches = get_strings_by_prefix(completions,
+			completions_count, prefixes[i % 6]);
+		sink += matches[0] != NULL;
+		free(matches);
+	}
+}
+
+static void bench_list_append(long long n)
+{
+	struct list *lst = list_create(NULL);
+	long long i;
+	for(i = 0; i < n; i++)
+		list_append(lst, completions[i % completions_count]);
+	sink += lst->count;
+	list_free(lst);
+}
+
+static void bench_paths_union(long long n)
+{
+	long long i;
+	for(i = 0; i < n; i++) {
+		char *path = paths_union(path_pairs[i & 3][0], path_pairs[i & 3][1]);
+		sink += path[0];
+		free(path);
+	}
+}
+
+static void parse_task(long long n, int fields)
+{
+	long long i;
+	for(i = 0; i < n; i++) {
+		struct task *task = task_parse_fields(task_text,
+			sizeof(task_text)-1, fields, 0);
+		sink += task != NULL;
+		task_free(task);
+	}
+}
+
+static void bench_parse_listed(long long n)
+{
+	parse_task(n, task_fld_listed);
+}
+
+static void bench_parse_all(long long n)
+{
+	parse_task(n, task_fld_all);
+}
+
+static char long_line[1024+64];
+
+static void scan_line(long long n, long long len)
+{
+	long long i, offset;
+	long_line[len] = 0;
+	for(i = 0; i < n; i++) {
+		char *word = get_word(long_line+(i & 7), &offset);
+		sink += string_length(long_line+(i & 7))+offset;
+		free(word);
+	}
+	long_line[len] = 'a';
+}
+
+static void bench_scan_64(long long n)
+{
+	scan_line(n, 64);
+}
+
+static void bench_scan_1024(long long n)
+{
+	scan_line(n, 1024);
+}
+
+struct bench {
+	const char *name;
+	void (*run)(long long n);
+	char per_simd;	/* run once for every vector instruction set */
+};
+
+static const struct bench benches[] = {
+	{ "get_tokens", bench_get_tokens, 1 },
+	{ "strings_concatenate", bench_strings_concatenate, 0 },
+	{ "set_special_chars", bench_set_special_chars, 0 },
+	{ "get_strings_by_prefix", bench_get_strings_by_prefix, 1 },
+	{ "list_append", bench_list_append, 0 },
+	{ "paths_union", bench_paths_union, 0 },
+	{ "task_parse_listed", bench_parse_listed, 0 },
+	{ "task_parse_all", bench_parse_all, 0 },
+	{ "get_word_length_64", bench_scan_64, 1 },
+	{ "get_word_length_1024", bench_scan_1024, 1 },
+	{ NULL, NULL, 0 }
+};
+
+static const char *simd_names[] = { "scalar", "sse2", "avx2" };
+
+static int double_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void run_bench(const struct bench *b, const char *suffix, int reps,
+	char first)
+{
+	double ns[max_reps], start;
+	unsigned long long ticks = 0, tstart;
+	long long n = 1, count, bytes, i;
+	for(;;) {
+		start = get_ns();
+		b->run(n);
+		if(get_ns()-start >= min_rep_ns)
+			break;
+		n *= 2;
+	}
+	count = allocs_count;
+	bytes = allocs_bytes;
+	for(i = 0; i < reps; i++) {
+		tstart = get_ticks();
+		start = get_ns();
+		b->run(n);
+		ns[i] = (get_ns()-start)/n;
+		ticks += get_ticks()-tstart;
+	}
+	count = allocs_count-count;
+	bytes = allocs_bytes-bytes;
+	qsort(ns, reps, sizeof(*ns), double_cmp);
+	printf("%s\n    {\"name\": \"%s%s\", \"ops\": %lld, \"reps\": %d, "
+		"\"ns_per_op_min\": %.2f, \"ns_per_op_median\": %.2f, "
+		"\"ticks_per_op\": %.2f, \"allocs_per_op\": %.2f, "
+		"\"bytes_per_op\": %.2f}", first ? "" : ",", b->name, suffix, n,
+		reps, ns[0], ns[reps/2], (double)ticks/(n*reps),
+		(double)count/(n*reps), (double)bytes/(n*reps));
+}
+
+static char check_failed(const char *func, simd_t simd, long long offset,
+	long long len)
+{
+	fprintf(stderr, "bench: %s with %s differs from scalar at offset %lld, "
+		"length %lld\n", func, simd_names[simd], offset, len);
+	return -1;
+}
+
+/*
+ * The strings end right before a page which can't be read, so a vector
+ * load going past the end of a string shows up as a crash.
+ */
+static char check_strlib()
+{
+	long long page = sysconf(_SC_PAGESIZE), offset, len, i;
+	char *mem, *end, prefix[check_max_len+2];
+	mem = mmap(NULL, page*2, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(mem == MAP_FAILED || mprotect(mem+page, page, PROT_NONE) != 0)
+		return -1;
+	end = mem+page;
+	srand(1);
+	for(len = 0; len < check_max_len; len++) {
+		for(offset = 0; offset < 64; offset++) {
+			char *s = end-len-1-offset;
+			const char *strs[2];
+			long long plen, slen, wlen, woffset;
+			const char **matches;
+			char *word, matched;
+			simd_t simd;
+			for(i = 0; i < len; i++)
+				s[i] = "ab c"[rand() % 4];
+			s[len] = 0;
+			plen = rand() % (len+2);
+			for(i = 0; i < plen; i++)
+				prefix[i] = i < len ? s[i] : 'a';
+			if(plen > 0 && rand() % 3 == 0)
+				prefix[rand() % plen] = 'x';
+			prefix[plen] = 0;
+			strs[0] = s;
+			strs[1] = NULL;
+			strlib_set_simd(simd_scalar);
+			slen = string_length(s);
+			word = get_word(s, &wlen);
+			free(word);
+			matches = get_strings_by_prefix(strs, 1, prefix);
+			matched = matches[0] != NULL;
+			free(matches);
+			for(simd = simd_sse2; simd <= simd_avx2; simd++) {
+				if(strlib_set_simd(simd) != 0)
+					continue;
+				if(string_length(s) != slen)
+					return check_failed("string_length", simd, offset, len);
+				word = get_word(s, &woffset);
+				free(word);
+				if(woffset != wlen)
+					return check_failed("get_word", simd, offset, len);
+				matches = get_strings_by_prefix(strs, 1, prefix);
+				if((matches[0] != NULL) != matched)
+					return check_failed("get_strings_by_prefix", simd,
+						offset, len);
+				free(matches);
+			}
+		}
+	}
+	munmap(mem, page*2);
+	return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+	const struct bench *b;
+	const char *filter, *reps_value;
+	simd_t best, simd;
+	int reps = default_reps;
+	char first = 1;
+	filter = param_get_operand(argv+1, 0);
+	reps_value = param_get_value(argv, REPS_PARAM);
+	if(reps_value) {
+		reps = atoi(reps_value);
+		if(reps < 1 || reps > max_reps) {
+			fprintf(stderr, "bench: %s is between 1 and %d\n", REPS_PARAM,
+				max_reps);
+			return 1;
+		}
+	}
+	best = strlib_get_simd();
+	if(check_strlib() != 0)
+		return 1;
+	memset(long_line, 'a', sizeof(long_line));
+	printf("{\"simd\": \"%s\", \"benchmarks\": [", simd_names[best]);
+	for(b = benches; b->name; b++) {
+		if(filter && !strstr(b->name, filter))
+			continue;
+		if(!b->per_simd) {
+			strlib_set_simd(best);
+			run_bench(b, "", reps, first);
+			first = 0;
+			continue;
+		}
+		for(simd = simd_scalar; simd <= best; simd++) {
+			char suffix[16];
+			if(strlib_set_simd(simd) != 0)
+				continue;
+			sprintf(suffix, "/%s", simd_names[simd]);
+			run_bench(b, suffix, reps, first);
+			first = 0;
+		}
+	}
+	printf("\n]}\n");
+	return 0;
+}
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include "copy.h"
+#include "walk.h"
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ * The copy is made in two passes. The first one walks the source creating
+ * all the directories and links and collecting the files, the second one
+ * copies the files by a pool of threads. The data is shared with FICLONE
+ * if the file system can do it, otherwise it's copied inside of the kernel
+ * with copy_file_range and only then with read/write.
+ */
+
+struct copy_job {
+	char *path;		/* relative to both roots */
+};
+
+struct copier {
+	int srcfd;
+	int dstfd;
+	int flags;
+	struct copy_job *jobs;
+	long long count;
+	long long size;
+	long long next;		/* the first job not taken by a worker */
+	char failed;
+	pthread_mutex_t lock;
+	copy_link_fn_t fn;
+	void *usrdata;
+};
+
+enum { 
+	default_jobs_size = 256, 
+	max_workers = 8,
+	files_per_worker = 16,	/* fewer files aren't worth a thread */
+	copy_bufsize = 65536,
+};
+
+static void add_job(struct copier *cp, const char *path)
+{
+	if(cp->count == cp->size) {
+		cp->size *= 2;
+		cp->jobs = realloc(cp->jobs, sizeof(*(cp->jobs))*cp->size);
+	}
+	cp->jobs[cp->count].path = strdup(path);
+	cp->count++;
+}
+
+static char copy_link(struct copier *cp, const struct walk_entry *ent)
+{
+	char target[4096];
+	ssize_t len;
+	len = readlinkat(ent->dirfd, ent->name, target, sizeof(target)-1);
+	if(len == -1)
+		return -1;
+	target[len] = 0;
+	if(symlinkat(target, cp->dstfd, ent->path) == -1)
+		return -1;
+	if(cp->fn)
+		cp->fn(target, ent->path, cp->usrdata);
+	return 0;
+}
+
+static int prepare_entry(const struct walk_entry *ent, void *usrdata)
+{
+	struct copier *cp = usrdata;
+	switch(ent->event) {
+		case walk_pre:
+			if(ent->depth == 0)
+				return walk_continue;
+			if(!(cp->flags & copy_recursive)) /* it's a subtask */
+				return walk_skip;
+			if(mkdirat(cp->dstfd, ent->path, 0777) == -1)
+				return walk_stop;
+			return walk_continue;
+		case walk_file:
+			add_job(cp, ent->path);
+			return walk_continue;
+		case walk_link:
+			if(!(cp->flags & copy_recursive))
+				return walk_continue;
+			return copy_link(cp, ent) == 0 ? walk_continue : walk_stop;
+		case walk_post:
+		case walk_dup:
+		case walk_cycle:
+			return walk_continue;
+	}
+	return walk_continue;
+}
+
+static char copy_data(int in, int out)
+{
+	char buf[copy_bufsize];
+	ssize_t rc;
+	if(ioctl(out, FICLONE, in) == 0)
+		return 0;
+	for(;;) {
+		rc = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+		if(rc == 0)
+			return 0;
+		if(rc == -1)
+			break;
+	}
+	if(errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+		errno != EOPNOTSUPP)
+		return -1;
+	while((rc = read(in, buf, sizeof(buf))) > 0) {
+		char *p = buf;
+		while(rc > 0) {
+			ssize_t wc = write(out, p, rc);
+			if(wc == -1)
+				return -1;
+			p += wc;
+			rc -= wc;
+		}
+	}
+	return rc == 0 ? 0 : -1;
+}
+
+char copy_file_at(int srcdirfd, const char *src, int dstdirfd, 
+	const char *dst)
+{
+	int in, out;
+	struct stat st;
+	char ok;
+	in = openat(srcdirfd, src, O_RDONLY);
+	if(in == -1)
+		return -1;
+	if(fstat(in, &st) == -1) {
+		close(in);
+		return -1;
+	}
+	out = openat(dstdirfd, dst, O_WRONLY|O_CREAT|O_TRUNC, st.st_mode & 0777);
+	if(out == -1) {
+		close(in);
+		return -1;
+	}
+	ok = copy_data(in, out);
+	close(in);
+	if(close(out) == -1)
+		ok = -1;
+	return ok;
+}
+
+static void *copy_worker(void *data)
+{
+	struct copier *cp = data;
+	for(;;) {
+		long long i;
+		char ok;
+		pthread_mutex_lock(&cp->lock);
+		i = cp->failed ? cp->count : cp->next++;
+		pthread_mutex_unlock(&cp->lock);
+		if(i >= cp->count)
+			break;
+		ok = copy_file_at(cp->srcfd, cp->jobs[i].path, cp->dstfd,
+			cp->jobs[i].path);
+		if(ok != 0) {
+			pthread_mutex_lock(&cp->lock);
+			cp->failed = 1;
+			pthread_mutex_unlock(&cp->lock);
+		}
+	}
+	return NULL;
+}
+
+static int get_workers_count(long long jobs)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	long long count = jobs/files_per_worker;
+	if(ncpu < 1)
+		ncpu = 1;
+	if(count > ncpu)
+		count = ncpu;
+	if(count > max_workers)
+		count = max_workers;
+	return count < 1 ? 1 : count;
+}
+
+static void copy_files(struct copier *cp)
+{
+	pthread_t workers[max_workers];
+	int i, count, started = 0;
+	count = get_workers_count(cp->count);
+	for(i = 1; i < count; i++) {
+		if(pthread_create(&workers[started], NULL, copy_worker, cp) != 0)
+			break;
+		started++;
+	}
+	copy_worker(cp);
+	for(i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+}
+
+char copy_tree(int srcdirfd, const char *src, int dstdirfd, const char *dst,
+	int flags, copy_link_fn_t fn, void *usrdata)
+{
+	struct copier cp;
+	long long i;
+	char ok;
+	cp.srcfd = openat(srcdirfd, src, O_RDONLY|O_DIRECTORY);
+	if(cp.srcfd == -1)
+		return -1;
+	if(mkdirat(dstdirfd, dst, 0777) == -1) {
+		close(cp.srcfd);
+		return -1;
+	}
+	cp.dstfd = openat(dstdirfd, dst, O_RDONLY|O_DIRECTORY);
+	if(cp.dstfd == -1) {
+		close(cp.srcfd);
+		return -1;
+	}
+	cp.flags = flags;
+	cp.count = 0;
+	cp.next = 0;
+	cp.size = default_jobs_size;
+	cp.jobs = malloc(sizeof(*(cp.jobs))*cp.size);
+	cp.failed = 0;
+	cp.fn = fn;
+	cp.usrdata = usrdata;
+	pthread_mutex_init(&cp.lock, NULL);
+	ok = walk(cp.srcfd, ".", 0, prepare_entry, &cp);
+	if(ok == 0) {
+		copy_files(&cp);
+		ok = cp.failed ? -1 : 0;
+	}
+	for(i = 0; i < cp.count; i++)
+		free(cp.jobs[i].path);
+	free(cp.jobs);
+	pthread_mutex_destroy(&cp.lock);
+	close(cp.srcfd);
+	close(cp.dstfd);
+	return ok;
+}
@@ -0,0 +1,16 @@
+#ifndef COPY_H_SENTRY
+#define COPY_H_SENTRY
+
+enum copy_flags {
+	copy_recursive = 1,
+};
+
+/* called for every copied symlink, linkpath is relative to the copy */
+typedef void (*copy_link_fn_t)(const char *target, const char *linkpath,
+	void *usrdata);
+
+char copy_tree(int srcdirfd, const char *src, int dstdirfd, const char *dst,
+	int flags, copy_link_fn_t fn, void *usrdata);
+char copy_file_at(int srcdirfd, const char *src, int dstdirfd, 
+	const char *dst);
+#endif
@@ -1,89 +1,51 @@
 #include "fslib.h"
 #include "strlib.h"
 #include "memlib.h"
+#include "walk.h"
 #include <sys/stat.h>
 #include <stddef.h>
 #include <unistd.h>
 #include <string.h>
-#include <dirent.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <errno.h>
 
-#define CRNT_LEVEL "."
-#define TOP_LEVEL ".."
-
-char create_block(const char *dirname, const char *filename, int *pfd)
+char create_block(int dirfd, const char *dirname, const char *filename,
+    int *pfd)
 {
     char ok;
-    int fd;
-    char *fullname;
-    ok = mkdir(dirname, 0777);
+    int fd, blockfd;
+    ok = mkdirat(dirfd, dirname, 0777);
     if(ok != 0)
         return -1;
-    fullname = strings_concatenate(dirname, "/", filename, NULL);
-    fd = open(fullname, O_WRONLY|O_CREAT, 0666);
+    blockfd = openat(dirfd, dirname, O_RDONLY|O_DIRECTORY);
+    if(blockfd == -1)
+        return -2;
+    fd = openat(blockfd, filename, O_WRONLY|O_CREAT, 0666);
+    close(blockfd);
     if(fd == -1)
         return -2;
     *pfd = fd;
     return 0;
 }
 
-static char *get_fullname(char *dest, unsigned long long dsize, 
-    const char *name, const char *base)
+static int remove_entry(const struct walk_entry *ent, void *usrdata)
 {
-    long long blen, nlen;
-    if(!dest)
-        return NULL;
-    blen = strlen(base);
-    nlen = strlen(name);
-    if(blen+nlen > dsize)
-        return NULL;
-    strcpy(dest, base);
-    if(blen > 0) {
-        dest[blen] = '/';
-        dest[blen+1] = 0;
-    }
-    strcat(dest, name);
-    return dest;
-}
-
-enum { buffer_size = 2048 };
-static char remove_dir_aux(const char *name, const char *base)
-{
-    char buf[buffer_size];
-    struct dirent *dent;
-    char *fullname;
-    char stat;
-    DIR *dir;
-    if(!name || !base)
-        return -1;
-    if((strcmp(name, CRNT_LEVEL) == 0) || (strcmp(name, TOP_LEVEL) == 0))
-        return 0;
-    fullname = get_fullname(buf, sizeof(buf), name, base);
-    if(!fullname)
-        return -1;
-    dir = opendir(fullname);
-    if(!dir) /* we guess that it's a file then */
-        return unlink(fullname);
-    while((dent = readdir(dir)) != NULL) {
-        stat = remove_dir_aux(dent->d_name, fullname);
-        if(stat != 0)
-            break;
-    }
-    closedir(dir);
-    stat = rmdir(fullname);
-    if(stat != 0)
-        return -1;
-    return 0;
+    int flags;
+    if(ent->event == walk_pre)
+        return walk_continue;
+    flags = ent->event == walk_post ? AT_REMOVEDIR : 0;
+    if(unlinkat(ent->dirfd, ent->name, flags) == -1)
+        return walk_stop;
+    return walk_continue;
 }
 
-char remove_dir(const char *name)
+char remove_dir(int dirfd, const char *name)
 {
 	if(!name)
         return -1;
-    return remove_dir_aux(name, "");
+    return walk(dirfd, name, 0, remove_entry, NULL);
 }
 
 char *fgets_m(char *s, int size, FILE *stream)
@@ -2,8 +2,9 @@
 #define FSLIB_H_SENTRY
 #include <stdio.h>
 
-char create_block(const char *dirname, const char *filename, int *pfd);
-char remove_dir(const char *name);
+char create_block(int dirfd, const char *dirname, const char *filename,
+    int *pfd);
+char remove_dir(int dirfd, const char *name);
 char *fgets_m(char *s, int size, FILE *stream);
 char *get_shortname(const char *fullname);
 #endif
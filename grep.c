@@ -0,0 +1,529 @@
+#define _GNU_SOURCE
+#include "grep.h"
+#include "task.h"
+#include "scan.h"
+#include "outbuf.h"
+#include "tasklog.h"
+#include "logstore.h"
+#include "walk.h"
+#include <regex.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ * Looks for a regular expression in the names and the infos of all the
+ * subtasks. The run of plain characters every match has to contain is
+ * taken out of the expression, and a file without it is dropped after a
+ * memmem over its data, so the regex engine runs only on the lines which
+ * can match. The files are searched by a pool of threads in batches and
+ * the lines found are printed batch by batch in the order of the walk.
+ * Every thread compiles the expression for itself, as regexec locks the
+ * one it's given. The tasks of the log are read while they're collected,
+ * so the workers only search them.
+ */
+
+#define ERE_SPECIAL ".[]()*+?{}|^$\\"
+
+enum {
+	grep_batch_size = 1024,
+	default_files_size = 256,
+	max_workers = 8,
+	files_per_worker = 16,	/* fewer files aren't worth a thread */
+	first_read_size = 65536,
+};
+
+struct grep {
+	char *pattern;
+	int cflags;
+	char *literal;		/* NULL if every line has to be matched */
+	long long litlen;
+};
+
+struct grep_file {
+	char *path;			/* the way it's printed */
+	char *phys;			/* of the task file */
+	char *data;			/* NULL unless it's been read already */
+	long long len;
+	struct outbuf out;	/* the lines found */
+	char found;
+};
+
+/* a link to follow once the subtree has been collected */
+struct grep_link {
+	char *path;
+	char *phys;
+};
+
+struct searcher {
+	const struct grep *g;
+	int dirfd;
+	const char *prefix;
+	struct scan_cache *cache;
+	struct tasklog *log;	/* NULL unless the tasks are in the log */
+	struct walk_set *seen;	/* NULL unless the links are followed */
+	struct grep_link *links;	/* not followed yet */
+	long long link_count;
+	long long link_size;
+	struct outbuf *ob;
+	struct grep_file *files;
+	long long count;
+	long long size;
+	long long next;		/* the first file not taken by a worker */
+	long long found;
+	pthread_mutex_t lock;
+};
+
+/* returns the closing bracket of the expression starting at p */
+static const char *skip_bracket(const char *p)
+{
+	p++;
+	if(*p == '^')
+		p++;
+	if(*p == ']')
+		p++;
+	for(; *p && *p != ']'; p++) {
+		if(p[0] == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+			const char *end = strchr(p+2, ']');
+			if(!end)
+				break;
+			p = end;
+		}
+	}
+	return *p ? p : p-1;
+}
+
+static void end_run(const char *run, long long rlen, char **best,
+	long long *blen)
+{
+	if(rlen <= *blen)
+		return;
+	free(*best);
+	*best = malloc(rlen+1);
+	memcpy(*best, run, rlen);
+	(*best)[rlen] = 0;
+	*blen = rlen;
+}
+
+/*
+ * The longest run of plain characters outside of the groups, which every
+ * match has to contain, NULL if there's none or there are alternatives.
+ */
+static char *get_literal(const char *re, long long *len)
+{
+	char *run = malloc(strlen(re)+1), *best = NULL;
+	long long rlen = 0, blen = 0;
+	int depth = 0;
+	const char *p;
+	for(p = re; *p; p++) {
+		char c = *p, plain = 0;
+		switch(c) {
+			case '|':
+				free(run);
+				free(best);
+				return NULL;
+			case '\\':
+				if(p[1] && strchr(ERE_SPECIAL, p[1])) {
+					c = *++p;
+					plain = 1;
+				} else if(p[1])
+					p++;	/* \w, \b and the like */
+				break;
+			case '[':
+				p = skip_bracket(p);
+				break;
+			case '(':
+				depth++;
+				break;
+			case ')':
+				depth--;
+				break;
+			case '*':
+			case '?':
+				if(rlen > 0)
+					rlen--;
+				break;
+			case '{':
+				if(rlen > 0)
+					rlen--;
+				while(p[1] && *p != '}')
+					p++;
+				break;
+			case '+':
+			case '.':
+			case '^':
+			case '$':
+				break;
+			default:
+				plain = 1;
+		}
+		if(plain && depth == 0) {
+			run[rlen++] = c;
+			continue;
+		}
+		end_run(run, rlen, &best, &blen);
+		rlen = 0;
+	}
+	end_run(run, rlen, &best, &blen);
+	free(run);
+	*len = blen;
+	return best;
+}
+
+struct grep *grep_new(const char *pattern, char icase)
+{
+	struct grep *g;
+	regex_t re;
+	int cflags = REG_EXTENDED|REG_NOSUB|(icase ? REG_ICASE : 0);
+	if(regcomp(&re, pattern, cflags) != 0)
+		return NULL;
+	regfree(&re);
+	g = malloc(sizeof(*g));
+	g->pattern = strdup(pattern);
+	g->cflags = cflags;
+	g->litlen = 0;
+	/* the case of the text isn't known to memmem */
+	g->literal = icase ? NULL : get_literal(pattern, &g->litlen);
+	return g;
+}
+
+void grep_free(struct grep *g)
+{
+	if(!g)
+		return;
+	free(g->pattern);
+	free(g->literal);
+	free(g);
+}
+
+static char *join(const char *dir, const char *name)
+{
+	long long dlen = strlen(dir), nlen = strlen(name);
+	char *path;
+	if(dlen == 0)
+		return strdup(name);
+	path = malloc(dlen+nlen+2);
+	memcpy(path, dir, dlen);
+	path[dlen] = '/';
+	memcpy(path+dlen+1, name, nlen+1);
+	return path;
+}
+
+static char read_file(int dirfd, const char *path, char **buf,
+	long long *size, long long *len)
+{
+	int fd = openat(dirfd, path, O_RDONLY);
+	if(fd == -1)
+		return -1;
+	*len = 0;
+	for(;;) {
+		ssize_t rc;
+		if(*len == *size) {
+			*size = *size ? *size*2 : first_read_size;
+			*buf = realloc(*buf, *size);
+		}
+		rc = read(fd, *buf+*len, *size-*len);
+		if(rc == -1 && errno == EINTR)
+			continue;
+		if(rc <= 0)
+			break;
+		*len += rc;
+	}
+	close(fd);
+	return 0;
+}
+
+static char match_line(const regex_t *re, const char *s, long long len)
+{
+	regmatch_t m;
+	m.rm_so = 0;
+	m.rm_eo = len;
+	return regexec(re, s, 1, &m, REG_STARTEND) == 0;
+}
+
+static const char *get_searched_field(const char *name, long long len)
+{
+	if(len == sizeof(TNAME_FLD)-1 && memcmp(name, TNAME_FLD, len) == 0)
+		return TNAME_FLD;
+	if(len == sizeof(TINFO_FLD)-1 && memcmp(name, TINFO_FLD, len) == 0)
+		return TINFO_FLD;
+	return NULL;
+}
+
+/* the lines found are "path:field:line:text", the line is of the field */
+static void search_lines(const struct grep *g, const regex_t *re,
+	struct grep_file *f, const char *data, long long len)
+{
+	const char *p = data, *end = data+len, *field = NULL;
+	long long line = 0;
+	while(p < end) {
+		const char *lend = memchr(p, '\n', end-p);
+		if(!lend)
+			lend = end;
+		if(*p != ' ') {
+			const char *wend = memchr(p, ' ', lend-p);
+			if(!wend)
+				wend = lend;
+			field = get_searched_field(p, wend-p);
+			line = 0;
+			p = wend;
+		}
+		line++;
+		while(p < lend && *p == ' ')
+			p++;
+		if(field &&
+			(!g->literal || memmem(p, lend-p, g->literal, g->litlen)) &&
+			match_line(re, p, lend-p)) {
+			if(!f->found)
+				outbuf_init(&f->out, -1);
+			f->found = 1;
+			outbuf_printf(&f->out, "%s:%s:%lld:", f->path, field, line);
+			outbuf_write(&f->out, p, lend-p);
+			outbuf_putc(&f->out, '\n');
+		}
+		p = lend+1;
+	}
+}
+
+static void *search_worker(void *data)
+{
+	struct searcher *s = data;
+	const struct grep *g = s->g;
+	regex_t re;
+	char *buf = NULL;
+	const char *text;
+	long long size = 0, len;
+	if(regcomp(&re, g->pattern, g->cflags) != 0)
+		return NULL;
+	for(;;) {
+		struct grep_file *f;
+		long long i;
+		pthread_mutex_lock(&s->lock);
+		i = s->next++;
+		pthread_mutex_unlock(&s->lock);
+		if(i >= s->count)
+			break;
+		f = &s->files[i];
+		if(f->data) {
+			text = f->data;
+			len = f->len;
+		} else if(!s->log &&
+			read_file(s->dirfd, f->phys, &buf, &size, &len) == 0)
+			text = buf;
+		else
+			continue;
+		if(g->literal && !memmem(text, len, g->literal, g->litlen))
+			continue;
+		search_lines(g, &re, f, text, len);
+	}
+	regfree(&re);
+	free(buf);
+	return NULL;
+}
+
+static int get_workers_count(long long files)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	long long count = files/files_per_worker;
+	if(ncpu < 1)
+		ncpu = 1;
+	if(count > ncpu)
+		count = ncpu;
+	if(count > max_workers)
+		count = max_workers;
+	return count < 1 ? 1 : count;
+}
+
+/* the files collected so far are searched and their lines printed */
+static void search_batch(struct searcher *s)
+{
+	pthread_t workers[max_workers];
+	int i, count, started = 0;
+	long long j;
+	s->next = 0;
+	count = get_workers_count(s->count);
+	for(i = 1; i < count; i++) {
+		if(pthread_create(&workers[started], NULL, search_worker, s) != 0)
+			break;
+		started++;
+	}
+	search_worker(s);
+	for(i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+	for(j = 0; j < s->count; j++) {
+		struct grep_file *f = &s->files[j];
+		if(f->found) {
+			outbuf_write(s->ob, f->out.data, f->out.len);
+			outbuf_free(&f->out);
+			s->found++;
+		}
+		free(f->path);
+		free(f->phys);
+		free(f->data);
+	}
+	s->count = 0;
+}
+
+static void add_file(struct searcher *s, const char *path, const char *phys)
+{
+	struct grep_file *f;
+	if(s->count == s->size) {
+		s->size = s->size ? s->size*2 : default_files_size;
+		s->files = realloc(s->files, sizeof(*(s->files))*s->size);
+	}
+	f = &s->files[s->count];
+	f->path = join(s->prefix, path);
+	f->phys = s->log ? strdup(phys) : join(phys, TASK_CORE_FILE);
+	f->data = s->log ? tasklog_get(s->log, phys, &f->len) : NULL;
+	f->found = 0;
+	s->count++;
+	if(s->count == grep_batch_size)
+		search_batch(s);
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct scan_entry *)a)->name,
+		((const struct scan_entry *)b)->name);
+}
+
+static void defer_link(struct searcher *s, char *path, char *phys)
+{
+	if(s->link_count == s->link_size) {
+		s->link_size = s->link_size ? s->link_size*2 : default_files_size;
+		s->links = realloc(s->links, sizeof(*(s->links))*s->link_size);
+	}
+	s->links[s->link_count].path = path;
+	s->links[s->link_count].phys = phys;
+	s->link_count++;
+}
+
+/*
+ * The links are skipped, or put off to follow_links, so every task is
+ * searched once.
+ */
+static void collect(struct searcher *s, const char *path, const char *phys)
+{
+	struct scan_entry *ents;
+	long long i, count = 0;
+	ents = scan_dir(s->dirfd, phys[0] ? phys : ".", s->cache, &count);
+	if(count > 0)
+		qsort(ents, count, sizeof(*ents), entry_cmp);
+	for(i = 0; i < count; i++) {
+		char *cpath, *cphys;
+		if(ents[i].is_link && !s->seen)
+			continue;
+		cpath = join(path, ents[i].name);
+		cphys = join(phys, scan_entry_path(&ents[i]));
+		if(ents[i].is_link) {
+			defer_link(s, cpath, cphys);
+			continue;
+		}
+		if(!s->seen || walk_set_add(s->seen, s->dirfd, cphys) == 0) {
+			add_file(s, cpath, cphys);
+			collect(s, cpath, cphys);
+		}
+		free(cpath);
+		free(cphys);
+	}
+	scan_free(ents, count);
+}
+
+/*
+ * The links go after the whole subtree, so a task in it is searched at
+ * its own place and a link leads only to the tasks not searched yet.
+ */
+static void follow_links(struct searcher *s)
+{
+	long long i;
+	for(i = 0; i < s->link_count; i++) {
+		struct grep_link l = s->links[i];
+		if(walk_set_add(s->seen, s->dirfd, l.phys) == 0) {
+			add_file(s, l.path, l.phys);
+			collect(s, l.path, l.phys);
+		}
+		free(l.path);
+		free(l.phys);
+	}
+	free(s->links);
+}
+
+static void collect_log(struct searcher *s, const char *path,
+	const char *start)
+{
+	char **names, *full = join(start, path);
+	long long i, count;
+	names = logstore_list(s->log, full, 0, &count);
+	free(full);
+	for(i = 0; i < count; i++) {
+		char *cpath = join(path, names[i]);
+		char *cfull = join(start, cpath);
+		add_file(s, cpath, cfull);
+		collect_log(s, cpath, start);
+		free(cpath);
+		free(cfull);
+	}
+	logstore_free_list(names, count);
+}
+
+static void init_searcher(struct searcher *s, const struct grep *g,
+	const char *prefix, struct outbuf *ob)
+{
+	s->g = g;
+	s->dirfd = -1;
+	s->prefix = prefix;
+	s->cache = NULL;
+	s->log = NULL;
+	s->seen = NULL;
+	s->links = NULL;
+	s->link_count = s->link_size = 0;
+	s->ob = ob;
+	s->files = NULL;
+	s->count = s->size = 0;
+	s->found = 0;
+	pthread_mutex_init(&s->lock, NULL);
+}
+
+/* returns the number of the tasks found, prefix is put before the paths */
+long long grep_run(const struct grep *g, int dirfd, const char *prefix,
+	struct scan_cache *cache, int flags, struct outbuf *ob)
+{
+	struct searcher s;
+	init_searcher(&s, g, prefix, ob);
+	s.dirfd = dirfd;
+	s.cache = cache;
+	if(flags & walk_follow) {
+		s.seen = walk_set_new();
+		walk_set_add(s.seen, dirfd, ".");
+	}
+	collect(&s, "", "");
+	if(s.seen) {
+		follow_links(&s);
+		walk_set_free(s.seen);
+	}
+	search_batch(&s);
+	pthread_mutex_destroy(&s.lock);
+	free(s.files);
+	return s.found;
+}
+
+/* the same for the subtasks of the path in the log */
+long long grep_run_log(const struct grep *g, struct tasklog *log,
+	const char *path, const char *prefix, struct outbuf *ob)
+{
+	struct searcher s;
+	if(!tasklog_exists(log, path)) {
+		errno = ENOENT;
+		return -1;
+	}
+	init_searcher(&s, g, prefix, ob);
+	s.log = log;
+	collect_log(&s, "", path);
+	search_batch(&s);
+	pthread_mutex_destroy(&s.lock);
+	free(s.files);
+	return s.found;
+}
@@ -0,0 +1,15 @@
+#ifndef GREP_H_SENTRY
+#define GREP_H_SENTRY
+
+struct grep;
+struct scan_cache;
+struct outbuf;
+struct tasklog;
+
+struct grep *grep_new(const char *pattern, char icase);
+void grep_free(struct grep *g);
+long long grep_run(const struct grep *g, int dirfd, const char *prefix,
+	struct scan_cache *cache, int flags, struct outbuf *ob);
+long long grep_run_log(const struct grep *g, struct tasklog *log,
+	const char *path, const char *prefix, struct outbuf *ob);
+#endif
@@ -0,0 +1,833 @@
+#include "ingest.h"
+#include "task.h"
+#include "shard.h"
+#include "merkle.h"
+#include "strlib.h"
+#include "tasklog.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <ctype.h>
+
+/*
+ * Bulk import of the task lists kept by the other programs. The input is
+ * read in chunks: every line becomes the complete text of its task file
+ * right away, the chunk is sorted by the parent and cut into groups, and
+ * the groups are created by a pool of threads, each task with a mkdirat
+ * and a single write. The parents are made on the way with a filter file
+ * created with O_EXCL, so the groups don't depend on each other: whatever
+ * order they come in, a parent never overwrites the task the input has
+ * for it.
+ *
+ * The tasks of a CSV with the path column keep their paths, so importing
+ * it again rewrites them. The others are named after their names with
+ * the line number appended if the name is taken.
+ *
+ * The directories which get new children lose their hashes, which are
+ * recounted by the caller from the destination up.
+ *
+ * Into the log the same items are put one by one, as it has one writer.
+ */
+
+enum {
+	chunk_size = 16384,
+	group_size = 256,
+	groups_per_worker = 4,	/* fewer groups aren't worth a thread */
+	max_workers = 8,
+	read_bufsize = 65536,
+	max_slug_len = 40,
+	date_len = 10,
+};
+
+#define CSV_PATH "path"
+#define CSV_SEP ','
+#define CSV_QUOTE '"'
+#define DEFAULT_SLUG "task"
+
+struct item {
+	char *parent;	/* relative to the destination, "" for itself */
+	char *name;
+	char *data;		/* the whole task file */
+	long long len;
+	long long line;
+	char unique;	/* the name may be changed if it's taken */
+};
+
+struct importer {
+	int dstfd;
+	struct tasklog *log;	/* NULL unless the tasks go into the log */
+	const char *dstpath;	/* in the log */
+	struct item *items;
+	long long count;
+	long long *groups;	/* the first item of each group and the end */
+	long long group_count;
+	long long next;		/* the first group not taken by a worker */
+	struct ingest_stats stats;
+	pthread_mutex_t lock;
+};
+
+struct reader {
+	int fd;
+	char buf[read_bufsize];
+	long long pos;
+	long long len;
+	long long line;
+};
+
+struct strbuf {
+	char *data;
+	long long len;
+	long long size;
+};
+
+/* the columns of the CSV, -1 for the missing ones */
+struct csv_columns {
+	int path;
+	int name;
+	int info;
+	int completed;
+	int from;
+	int to;
+	int type;
+};
+
+struct csv_record {
+	struct strbuf *fields;
+	int count;
+	int size;
+};
+
+static int reader_getc(struct reader *r)
+{
+	if(r->pos == r->len) {
+		ssize_t rc;
+		do {
+			rc = read(r->fd, r->buf, sizeof(r->buf));
+		} while(rc == -1 && errno == EINTR);
+		if(rc <= 0)
+			return EOF;
+		r->len = rc;
+		r->pos = 0;
+	}
+	return (unsigned char)r->buf[r->pos++];
+}
+
+static void strbuf_putc(struct strbuf *sb, char c)
+{
+	if(sb->len+1 >= sb->size) {
+		sb->size = sb->size ? sb->size*2 : 64;
+		sb->data = realloc(sb->data, sb->size);
+	}
+	sb->data[sb->len++] = c;
+}
+
+static void strbuf_end(struct strbuf *sb)
+{
+	strbuf_putc(sb, 0);
+	sb->len--;
+}
+
+/* returns -1 at the end of the input */
+static char read_line(struct reader *r, struct strbuf *sb)
+{
+	int c;
+	sb->len = 0;
+	while((c = reader_getc(r)) != EOF && c != '\n')
+		strbuf_putc(sb, c);
+	if(c == EOF && sb->len == 0)
+		return -1;
+	if(sb->len > 0 && sb->data[sb->len-1] == '\r')
+		sb->len--;
+	strbuf_end(sb);
+	r->line++;
+	return 0;
+}
+
+static struct strbuf *add_field(struct csv_record *rec)
+{
+	if(rec->count == rec->size) {
+		int i;
+		rec->size = rec->size ? rec->size*2 : 8;
+		rec->fields = realloc(rec->fields,
+			sizeof(*(rec->fields))*rec->size);
+		for(i = rec->count; i < rec->size; i++) {
+			rec->fields[i].data = NULL;
+			rec->fields[i].len = 0;
+			rec->fields[i].size = 0;
+		}
+	}
+	rec->fields[rec->count].len = 0;
+	return &rec->fields[rec->count++];
+}
+
+/* RFC 4180: quoted fields may hold separators, newlines and "" for " */
+static char read_csv_record(struct reader *r, struct csv_record *rec)
+{
+	int c = reader_getc(r);
+	if(c == EOF)
+		return -1;
+	rec->count = 0;
+	r->line++;
+	for(;;) {
+		struct strbuf *f = add_field(rec);
+		char quoted = c == CSV_QUOTE;
+		if(quoted)
+			c = reader_getc(r);
+		while(c != EOF) {
+			if(quoted && c == CSV_QUOTE) {
+				c = reader_getc(r);
+				if(c != CSV_QUOTE) {
+					quoted = 0;
+					continue;
+				}
+			} else if(!quoted && (c == CSV_SEP || c == '\n'))
+				break;
+			strbuf_putc(f, c);
+			c = reader_getc(r);
+		}
+		if(f->len > 0 && f->data[f->len-1] == '\r')
+			f->len--;
+		strbuf_end(f);
+		if(c != CSV_SEP)
+			return 0;
+		c = reader_getc(r);
+	}
+}
+
+static void free_record(struct csv_record *rec)
+{
+	int i;
+	for(i = 0; i < rec->size; i++)
+		free(rec->fields[i].data);
+	free(rec->fields);
+}
+
+/* the name as a short lowercase word the file systems won't mind */
+static char *get_slug(const char *s)
+{
+	char *slug = malloc(max_slug_len+1);
+	long long len = 0;
+	char dash = 0;
+	for(; *s && len+2 <= max_slug_len; s++) {
+		unsigned char c = *s;
+		if(!isalnum(c)) {
+			dash = 1;
+			continue;
+		}
+		if(dash && len > 0)
+			slug[len++] = '-';
+		dash = 0;
+		slug[len++] = tolower(c);
+	}
+	slug[len] = 0;
+	if(len == 0)
+		strcpy(slug, DEFAULT_SLUG);
+	return slug;
+}
+
+static char is_valid_name(const char *name, long long len)
+{
+	return len > 0 && name[0] != '.' && !memchr(name, '/', len);
+}
+
+static char is_date(const char *s)
+{
+	int i;
+	for(i = 0; i < date_len; i++) {
+		if(i == 4 || i == 7 ? s[i] != '-' : !isdigit((unsigned char)s[i]))
+			return 0;
+	}
+	return s[date_len] == ' ' || s[date_len] == 0;
+}
+
+static struct task *new_task()
+{
+	return task_parse("", 0);
+}
+
+static void fill_item(struct item *it, const char *parent, const char *name,
+	struct task *task, long long line, char unique)
+{
+	it->parent = strdup(parent);
+	it->name = strdup(name);
+	it->data = task_serialize(task, &it->len);
+	it->line = line;
+	it->unique = unique;
+}
+
+/*
+ * "x 2024-05-02 (A) 2024-05-01 Call mom +family @phone due:2024-05-10":
+ * the completion mark and date, the priority, the creation date which is
+ * taken as "from", the description with "+project" which is the filter
+ * the task goes into and "due:" which is taken as "to". Returns 1 for an
+ * empty line.
+ */
+static char parse_todo(const char *s, long long line, struct item *it)
+{
+	struct task *task;
+	const char *p;
+	char *project = NULL, *slug, from[date_len+1], to[date_len+1];
+	char completed = 0;
+	while(*s == ' ')
+		s++;
+	if(!*s)
+		return 1;
+	from[0] = to[0] = 0;
+	if(s[0] == 'x' && s[1] == ' ') {
+		completed = 1;
+		for(s += 2; *s == ' '; s++)
+			;
+		if(is_date(s))
+			for(s += date_len; *s == ' '; s++)
+				;
+	}
+	if(s[0] == '(' && isupper((unsigned char)s[1]) && s[2] == ')' &&
+		s[3] == ' ')
+		s += 4;
+	if(is_date(s)) {
+		memcpy(from, s, date_len);
+		from[date_len] = 0;
+		for(s += date_len; *s == ' '; s++)
+			;
+	}
+	for(p = s; *p; ) {
+		long long len = strcspn(p, " ");
+		if(p[0] == '+' && !project && is_valid_name(p+1, len-1)) {
+			project = malloc(len);
+			memcpy(project, p+1, len-1);
+			project[len-1] = 0;
+		} else if(strncmp(p, "due:", 4) == 0 && len == 4+date_len &&
+			is_date(p+4)) {
+			memcpy(to, p+4, date_len);
+			to[date_len] = 0;
+		}
+		p += len;
+		while(*p == ' ')
+			p++;
+	}
+	task = new_task();
+	task_set_field(task, TNAME_FLD, s, 1);
+	task_set_field(task, TCOMPLETED_FLD, completed ? "true" : "false", 1);
+	task_set_field(task, TFROM_FLD, from, 1);
+	task_set_field(task, TTO_FLD, to, 1);
+	slug = get_slug(s);
+	fill_item(it, project ? project : "", slug, task, line, 1);
+	free(slug);
+	free(project);
+	task_free(task);
+	return 0;
+}
+
+static void get_columns(const struct csv_record *rec,
+	struct csv_columns *cols)
+{
+	int i;
+	cols->path = cols->name = cols->info = cols->completed = -1;
+	cols->from = cols->to = cols->type = -1;
+	for(i = 0; i < rec->count; i++) {
+		const char *name = rec->fields[i].data;
+		while(*name == ' ')
+			name++;
+		if(strcasecmp(name, CSV_PATH) == 0)
+			cols->path = i;
+		else if(strcasecmp(name, TNAME_FLD) == 0)
+			cols->name = i;
+		else if(strcasecmp(name, TINFO_FLD) == 0)
+			cols->info = i;
+		else if(strcasecmp(name, TCOMPLETED_FLD) == 0)
+			cols->completed = i;
+		else if(strcasecmp(name, TFROM_FLD) == 0)
+			cols->from = i;
+		else if(strcasecmp(name, TTO_FLD) == 0)
+			cols->to = i;
+		else if(strcasecmp(name, TTYPE_FLD) == 0)
+			cols->type = i;
+	}
+}
+
+static const char *get_field(const struct csv_record *rec, int col)
+{
+	if(col < 0 || col >= rec->count)
+		return NULL;
+	return rec->fields[col].data;
+}
+
+static char is_true(const char *value)
+{
+	return value && (strcasecmp(value, "true") == 0 ||
+		strcmp(value, "1") == 0 || strcasecmp(value, "x") == 0 ||
+		strcasecmp(value, "yes") == 0);
+}
+
+/* splits the path into the parent and the name, checking every part */
+static char split_path(const char *path, char **parent, const char **name)
+{
+	const char *p = path, *sep = strrchr(path, '/');
+	while(*p) {
+		long long len = strcspn(p, "/");
+		if(!is_valid_name(p, len))
+			return -1;
+		p += len;
+		if(*p == '/')
+			p++;
+	}
+	if(!sep) {
+		*parent = strdup("");
+		*name = path;
+		return *path ? 0 : -1;
+	}
+	*parent = malloc(sep-path+1);
+	memcpy(*parent, path, sep-path);
+	(*parent)[sep-path] = 0;
+	*name = sep+1;
+	return 0;
+}
+
+static char is_empty_record(const struct csv_record *rec)
+{
+	int i;
+	for(i = 0; i < rec->count; i++) {
+		if(rec->fields[i].len > 0)
+			return 0;
+	}
+	return 1;
+}
+
+static char parse_csv(const struct csv_record *rec,
+	const struct csv_columns *cols, long long line, struct item *it)
+{
+	const char *path = get_field(rec, cols->path);
+	const char *name = get_field(rec, cols->name);
+	const char *type = get_field(rec, cols->type);
+	const char *shortname;
+	char *parent, *slug = NULL;
+	struct task *task;
+	if(is_empty_record(rec))
+		return 1;
+	if(cols->path >= 0) {
+		if(!path || split_path(path, &parent, &shortname) != 0)
+			return -1;
+	} else {
+		if(!name || !*name)
+			return -1;
+		parent = strdup("");
+		slug = get_slug(name);
+		shortname = slug;
+	}
+	task = new_task();
+	task_set_field(task, TNAME_FLD, name ? name : "", 1);
+	task_set_field(task, TINFO_FLD, get_field(rec, cols->info), 1);
+	if(type && (strcmp(type, "filter") == 0 || strcmp(type, "f") == 0))
+		task_set_field(task, TTYPE_FLD, type, 1);
+	else {
+		task_set_field(task, TCOMPLETED_FLD,
+			is_true(get_field(rec, cols->completed)) ? "true" : "false", 1);
+		task_set_field(task, TFROM_FLD, get_field(rec, cols->from), 1);
+		task_set_field(task, TTO_FLD, get_field(rec, cols->to), 1);
+	}
+	fill_item(it, parent, shortname, task, line, cols->path < 0);
+	task_free(task);
+	free(parent);
+	free(slug);
+	return 0;
+}
+
+static char write_all(int fd, const char *data, long long len)
+{
+	while(len > 0) {
+		ssize_t wc = write(fd, data, len);
+		if(wc == -1) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += wc;
+		len -= wc;
+	}
+	return 0;
+}
+
+static char write_task_file(int dirfd, const char *dir, const char *data,
+	long long len, int flags)
+{
+	char *path = strings_concatenate(dir, "/", TASK_CORE_FILE, NULL);
+	int fd = openat(dirfd, path, O_WRONLY|O_CREAT|flags, 0666);
+	char ok;
+	free(path);
+	if(fd == -1)
+		return errno == EEXIST && (flags & O_EXCL) ? 0 : -1;
+	ok = write_all(fd, data, len);
+	return close(fd) == 0 ? ok : -1;
+}
+
+/* the hash of the shard a new child is in is out of date */
+static void drop_shard_hash(int dirfd, const char *phys)
+{
+	const char *sep = strrchr(phys, '/');
+	if(sep) {
+		char *hash = malloc(sep-phys+sizeof(HASH_FILE)+1);
+		memcpy(hash, phys, sep-phys+1);
+		strcpy(hash+(sep-phys+1), HASH_FILE);
+		unlinkat(dirfd, hash, 0);
+		free(hash);
+	}
+}
+
+/* the path of the new child, made in its shard if the task is sharded */
+static char *child_path(int dirfd, const char *name, char sharded)
+{
+	char *phys;
+	if(!sharded)
+		return strdup(name);
+	phys = shard_child_path(name);
+	shard_make_parent(dirfd, phys);
+	return phys;
+}
+
+static char make_parent_dir(int fd, const char *name, char **phys)
+{
+	struct task *task;
+	char *data;
+	long long len;
+	char ok = 0;
+	*phys = child_path(fd, name, shard_is_sharded(fd, "."));
+	unlinkat(fd, HASH_FILE, 0);
+	drop_shard_hash(fd, *phys);
+	if(mkdirat(fd, *phys, 0777) == -1)
+		return errno == EEXIST ? 0 : -1;
+	task = new_task();
+	task_set_field(task, TNAME_FLD, name, 1);
+	data = task_serialize(task, &len);
+	ok = write_task_file(fd, *phys, data, len, O_EXCL);
+	free(data);
+	task_free(task);
+	return ok;
+}
+
+/* opens the parent making the missing directories on the way */
+static int open_parent(int dstfd, const char *path)
+{
+	int fd = openat(dstfd, ".", O_RDONLY|O_DIRECTORY);
+	while(fd != -1 && *path) {
+		long long len = strcspn(path, "/");
+		char *name = malloc(len+1), *phys;
+		int nextfd = -1;
+		memcpy(name, path, len);
+		name[len] = 0;
+		if(make_parent_dir(fd, name, &phys) == 0)
+			nextfd = openat(fd, phys, O_RDONLY|O_DIRECTORY);
+		free(name);
+		free(phys);
+		close(fd);
+		fd = nextfd;
+		path += len;
+		if(*path == '/')
+			path++;
+	}
+	if(fd != -1)
+		unlinkat(fd, HASH_FILE, 0);
+	return fd;
+}
+
+static char create_item(int fd, char sharded, const struct item *it)
+{
+	char *name = strdup(it->name), *phys;
+	char renamed = 0, ok;
+	for(;;) {
+		phys = child_path(fd, name, sharded);
+		if(mkdirat(fd, phys, 0777) == 0 || (errno == EEXIST && !it->unique))
+			break;
+		free(phys);
+		if(errno != EEXIST || renamed) {
+			free(name);
+			return -1;
+		}
+		renamed = 1;
+		phys = malloc(strlen(name)+32);
+		sprintf(phys, "%s-%lld", name, it->line);
+		free(name);
+		name = phys;
+	}
+	ok = write_task_file(fd, phys, it->data, it->len, O_TRUNC);
+	if(ok == 0 && sharded)
+		drop_shard_hash(fd, phys);
+	free(phys);
+	free(name);
+	return ok;
+}
+
+static char *join(const char *dir, const char *name)
+{
+	return dir[0] ? strings_concatenate(dir, "/", name, NULL) : strdup(name);
+}
+
+/* the parents are made as in the directories, named after themselves */
+static char make_log_parents(struct importer *im, const char *parent)
+{
+	const char *p = parent;
+	char ok = 0;
+	while(*p && ok == 0) {
+		long long len = strcspn(p, "/");
+		char *prefix = malloc(p-parent+len+1), *path;
+		memcpy(prefix, parent, p-parent+len);
+		prefix[p-parent+len] = 0;
+		path = join(im->dstpath, prefix);
+		if(!tasklog_exists(im->log, path)) {
+			struct task *task = new_task();
+			char *data;
+			long long dlen;
+			task_set_field(task, TNAME_FLD, prefix+(p-parent), 1);
+			data = task_serialize(task, &dlen);
+			ok = tasklog_put(im->log, path, data, dlen);
+			free(data);
+			task_free(task);
+		}
+		free(path);
+		free(prefix);
+		p += len;
+		if(*p == '/')
+			p++;
+	}
+	return ok;
+}
+
+static char create_log_item(struct importer *im, const struct item *it)
+{
+	char *parent, *path;
+	char ok;
+	if(make_log_parents(im, it->parent) != 0)
+		return -1;
+	parent = join(im->dstpath, it->parent);
+	path = join(parent, it->name);
+	if(it->unique && tasklog_exists(im->log, path)) {
+		free(path);
+		path = malloc(strlen(parent)+strlen(it->name)+32);
+		sprintf(path, "%s%s%s-%lld", parent, parent[0] ? "/" : "",
+			it->name, it->line);
+		if(tasklog_exists(im->log, path)) {
+			free(path);
+			free(parent);
+			errno = EEXIST;
+			return -1;
+		}
+	}
+	ok = tasklog_put(im->log, path, it->data, it->len);
+	free(path);
+	free(parent);
+	return ok;
+}
+
+static void *import_worker(void *data)
+{
+	struct importer *im = data;
+	struct ingest_stats stats;
+	const char *parent = NULL;
+	char sharded = 0;
+	int fd = -1;
+	stats.imported = 0;
+	stats.failed = 0;
+	for(;;) {
+		long long g, i;
+		pthread_mutex_lock(&im->lock);
+		g = im->next++;
+		pthread_mutex_unlock(&im->lock);
+		if(g >= im->group_count)
+			break;
+		for(i = im->groups[g]; i < im->groups[g+1]; i++) {
+			const struct item *it = &im->items[i];
+			if(im->log) {
+				if(create_log_item(im, it) == 0)
+					stats.imported++;
+				else
+					stats.failed++;
+				continue;
+			}
+			if(!parent || strcmp(parent, it->parent) != 0) {
+				if(fd != -1)
+					close(fd);
+				parent = it->parent;
+				fd = open_parent(im->dstfd, parent);
+				sharded = fd != -1 && shard_is_sharded(fd, ".");
+			}
+			if(fd != -1 && create_item(fd, sharded, it) == 0)
+				stats.imported++;
+			else
+				stats.failed++;
+		}
+	}
+	if(fd != -1)
+		close(fd);
+	pthread_mutex_lock(&im->lock);
+	im->stats.imported += stats.imported;
+	im->stats.failed += stats.failed;
+	pthread_mutex_unlock(&im->lock);
+	return NULL;
+}
+
+static int get_workers_count(long long groups)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	long long count = groups/groups_per_worker;
+	if(ncpu < 1)
+		ncpu = 1;
+	if(count > ncpu)
+		count = ncpu;
+	if(count > max_workers)
+		count = max_workers;
+	return count < 1 ? 1 : count;
+}
+
+static int item_cmp(const void *a, const void *b)
+{
+	const struct item *i1 = a, *i2 = b;
+	int res = strcmp(i1->parent, i2->parent);
+	if(res != 0)
+		return res;
+	return i1->line < i2->line ? -1 : (i1->line > i2->line);
+}
+
+/* the groups are the runs of the same parent of at most group_size */
+static void make_groups(struct importer *im)
+{
+	long long i, start = 0;
+	im->group_count = 0;
+	for(i = 1; i <= im->count; i++) {
+		if(i < im->count && i-start < group_size &&
+			strcmp(im->items[i].parent, im->items[start].parent) == 0)
+			continue;
+		im->groups[im->group_count++] = start;
+		start = i;
+	}
+	im->groups[im->group_count] = im->count;
+}
+
+static void import_chunk(struct importer *im)
+{
+	pthread_t workers[max_workers];
+	int i, count, started = 0;
+	long long j;
+	qsort(im->items, im->count, sizeof(*(im->items)), item_cmp);
+	make_groups(im);
+	im->next = 0;
+	count = im->log ? 1 : get_workers_count(im->group_count);
+	for(i = 1; i < count; i++) {
+		if(pthread_create(&workers[started], NULL, import_worker, im) != 0)
+			break;
+		started++;
+	}
+	import_worker(im);
+	for(i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+	for(j = 0; j < im->count; j++) {
+		free(im->items[j].parent);
+		free(im->items[j].name);
+		free(im->items[j].data);
+	}
+	im->count = 0;
+}
+
+/* 
+ * Parses the next line into the item, parsed is 0 if it's done, 1 if the
+ * line is empty and -1 if it's wrong.
+ */
+static char parse_next(struct reader *r, ingest_t type, struct strbuf *line,
+	struct csv_record *rec, const struct csv_columns *cols,
+	struct item *it, char *parsed)
+{
+	if(type == ingest_todotxt) {
+		if(read_line(r, line) != 0)
+			return -1;
+		*parsed = parse_todo(line->data, r->line, it);
+	} else {
+		if(read_csv_record(r, rec) != 0)
+			return -1;
+		*parsed = parse_csv(rec, cols, r->line, it);
+	}
+	return 0;
+}
+
+static char ingest(struct importer *im, int infd, ingest_t type,
+	struct ingest_stats *stats)
+{
+	struct reader *r;
+	struct strbuf line;
+	struct csv_record rec;
+	struct csv_columns cols;
+	char parsed;
+	r = malloc(sizeof(*r));
+	r->fd = infd;
+	r->pos = r->len = r->line = 0;
+	line.data = NULL;
+	line.len = line.size = 0;
+	rec.fields = NULL;
+	rec.count = rec.size = 0;
+	if(type == ingest_csv) {
+		if(read_csv_record(r, &rec) == 0)
+			get_columns(&rec, &cols);
+		if(rec.count == 0 || (cols.path < 0 && cols.name < 0)) {
+			free_record(&rec);
+			free(r);
+			errno = EINVAL;	/* there's no header */
+			return -1;
+		}
+	}
+	im->items = malloc(sizeof(*(im->items))*chunk_size);
+	im->groups = malloc(sizeof(*(im->groups))*(chunk_size+1));
+	im->count = 0;
+	im->stats.imported = 0;
+	im->stats.failed = 0;
+	pthread_mutex_init(&im->lock, NULL);
+	while(parse_next(r, type, &line, &rec, &cols, &im->items[im->count],
+		&parsed) == 0) {
+		if(parsed == 0)
+			im->count++;
+		else if(parsed == -1)
+			im->stats.failed++;
+		if(im->count == chunk_size)
+			import_chunk(im);
+	}
+	import_chunk(im);
+	pthread_mutex_destroy(&im->lock);
+	*stats = im->stats;
+	free(im->items);
+	free(im->groups);
+	free(line.data);
+	free_record(&rec);
+	free(r);
+	return 0;
+}
+
+char ingest_file(int infd, ingest_t type, int dirfd, const char *path,
+	struct ingest_stats *stats)
+{
+	struct importer im;
+	char ok;
+	im.dstfd = openat(dirfd, path, O_RDONLY|O_DIRECTORY);
+	if(im.dstfd == -1)
+		return -1;
+	im.log = NULL;
+	im.dstpath = NULL;
+	ok = ingest(&im, infd, type, stats);
+	close(im.dstfd);
+	return ok;
+}
+
+char ingest_file_log(int infd, ingest_t type, struct tasklog *log,
+	const char *path, struct ingest_stats *stats)
+{
+	struct importer im;
+	if(!tasklog_exists(log, path)) {
+		errno = ENOENT;
+		return -1;
+	}
+	im.dstfd = -1;
+	im.log = log;
+	im.dstpath = path;
+	return ingest(&im, infd, type, stats);
+}
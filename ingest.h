@@ -0,0 +1,20 @@
+#ifndef INGEST_H_SENTRY
+#define INGEST_H_SENTRY
+
+typedef enum {
+	ingest_csv,
+	ingest_todotxt,
+} ingest_t;
+
+struct tasklog;
+
+struct ingest_stats {
+	long long imported;
+	long long failed;	/* the lines which couldn't be parsed or created */
+};
+
+char ingest_file(int infd, ingest_t type, int dirfd, const char *path,
+	struct ingest_stats *stats);
+char ingest_file_log(int infd, ingest_t type, struct tasklog *log,
+	const char *path, struct ingest_stats *stats);
+#endif
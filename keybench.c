@@ -0,0 +1,348 @@
+#include "task.h"
+#include "fslib.h"
+#include "params.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <sys/wait.h>
+
+/*
+ * The latency of the line editor: the shell is run under a pseudo
+ * terminal in a scratch project with one task of many subtasks, and the
+ * keystroke traces are replayed into it one key at a time. A key's
+ * latency is the time from writing it to the last byte of the echo, the
+ * echo being over once the terminal has been quiet for quiet_ms. The
+ * latencies and the bytes written back are reported per trace as one
+ * JSON object, the way bench reports its results.
+ *
+ * A trace file has a trace per line: its name, a space and the keys, with
+ * the C escapes \t, \n, \b, \e, \\ and \xHH; "\e[D" is one key. A trace
+ * named setup is typed without being measured, and one whose name starts
+ * with paste is written at once, as a terminal pastes it. The line is
+ * cleared with ^U after every trace. Lines starting with # are skipped.
+ *
+ * keybench [file...] [--task=path] [--subtasks=N]
+ */
+
+#define TASK_PARAM "--task"
+#define SUBTASKS_PARAM "--subtasks"
+#define DEFAULT_TASK "./task"
+#define BIG_TASK "big"
+#define UNIQUE_SUBTASK "release-notes"	/* the one not named t<N> */
+#define SETUP_TRACE "setup"
+#define PASTE_PREFIX "paste"
+#define CLEAR_LINE "\x15"
+
+enum {
+	default_subtasks = 5000,
+	quiet_ms = 5,
+	setup_quiet_ms = 200,	/* a command may pause between its lines */
+	silent_ms = 1000,	/* a key without an echo is given up after it */
+	max_keys = 4096,
+	max_line = 8192,
+};
+
+struct trace {
+	const char *name;
+	const char *keys;	/* escaped */
+};
+
+/* cd into the big task comes before the path completions */
+static const struct trace builtin_traces[] = {
+	{ "typing", "show ./" BIG_TASK " --sort=deadline --limit=20" },
+	{ "editing", "mv ./big/t1 ./big/t2\\e[D\\e[D\\e[D\\e[Dx\\b\\b"
+		"\\x01\\e[C\\e[Cz\\x05\\x17\\x17" },
+	{ "complete_command", "sh\\t\\x15gr\\t\\x15mems\\t" },
+	{ SETUP_TRACE, "go " BIG_TASK "\\n" },
+	{ "complete_unique", "show ./rel\\t" },
+	{ "complete_many", "show ./t1\\t" },
+	{ "paste_line", "set info The release notes for this sprint are kept "
+		"in the wiki, the checklist is the one of the last release with "
+		"the database migration added before the deploy of the api and "
+		"the workers, see the retrospective for the details." },
+	{ NULL, NULL }
+};
+
+static double get_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6+ts.tv_nsec/1e3;
+}
+
+static int hex_value(char c)
+{
+	if(c >= '0' && c <= '9')
+		return c-'0';
+	if(c >= 'a' && c <= 'f')
+		return c-'a'+10;
+	if(c >= 'A' && c <= 'F')
+		return c-'A'+10;
+	return -1;
+}
+
+/* returns the length of the keys written into buf */
+static long long unescape(const char *s, char *buf, long long size)
+{
+	long long len = 0;
+	for(; *s && len < size; s++) {
+		if(*s != '\\' || !s[1]) {
+			buf[len++] = *s;
+			continue;
+		}
+		s++;
+		switch(*s) {
+			case 't':
+				buf[len++] = '\t';
+				break;
+			case 'n':
+				buf[len++] = '\n';
+				break;
+			case 'b':
+				buf[len++] = '\b';
+				break;
+			case 'e':
+				buf[len++] = 27;
+				break;
+			case 'x':
+				if(hex_value(s[1]) >= 0 && hex_value(s[2]) >= 0) {
+					buf[len++] = hex_value(s[1])*16+hex_value(s[2]);
+					s += 2;
+					break;
+				}
+				/* fall through */
+			default:
+				buf[len++] = *s;
+		}
+	}
+	return len;
+}
+
+static long long get_key_len(const char *keys, long long len)
+{
+	if(keys[0] == 27 && len >= 3 && keys[1] == '[')
+		return 3;
+	return 1;
+}
+
+/*
+ * Reads what the shell writes back until it stops, returns the time of
+ * its last byte since start or -1 if nothing has come.
+ */
+static double read_echo(int fd, double start, int quiet, long long *bytes)
+{
+	char buf[65536];
+	double last = -1;
+	*bytes = 0;
+	for(;;) {
+		struct pollfd pfd;
+		ssize_t rc;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if(poll(&pfd, 1, last < 0 ? silent_ms : quiet) <= 0)
+			break;
+		rc = read(fd, buf, sizeof(buf));
+		if(rc <= 0)
+			break;
+		*bytes += rc;
+		last = get_us();
+	}
+	return last < 0 ? -1 : last-start;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double get_percentile(const double *sorted, long long count, int pct)
+{
+	return count ? sorted[(count-1)*pct/100] : 0;
+}
+
+static void replay(int fd, const char *name, const char *escaped,
+	char first)
+{
+	char keys[max_line];
+	double lat[max_keys];
+	long long len, pos, count = 0, silent = 0, total = 0, most = 0;
+	char paste = strncmp(name, PASTE_PREFIX, sizeof(PASTE_PREFIX)-1) == 0;
+	len = unescape(escaped, keys, sizeof(keys));
+	for(pos = 0; pos < len && count < max_keys; ) {
+		long long klen = paste ? len : get_key_len(keys+pos, len-pos);
+		long long bytes;
+		double start = get_us(), t;
+		if(write(fd, keys+pos, klen) != klen)
+			break;
+		pos += klen;
+		t = read_echo(fd, start, quiet_ms, &bytes);
+		total += bytes;
+		if(bytes > most)
+			most = bytes;
+		if(t < 0)
+			silent++;
+		else
+			lat[count++] = t;
+	}
+	if(write(fd, CLEAR_LINE, 1) == 1)
+		read_echo(fd, get_us(), quiet_ms, &len);
+	qsort(lat, count, sizeof(*lat), double_cmp);
+	printf("%s\n    {\"name\": \"%s\", \"keys\": %lld, \"silent\": %lld, "
+		"\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, "
+		"\"max_us\": %.1f, \"bytes_per_key\": %.1f, \"bytes_max\": %lld}",
+		first ? "" : ",", name, count+silent, silent,
+		get_percentile(lat, count, 50), get_percentile(lat, count, 90),
+		get_percentile(lat, count, 99), get_percentile(lat, count, 100),
+		count+silent ? (double)total/(count+silent) : 0, most);
+}
+
+/* the setup traces are typed whole and waited for, not measured */
+static void run_trace(int fd, const char *name, const char *keys,
+	char *first)
+{
+	if(strcmp(name, SETUP_TRACE) == 0) {
+		char buf[max_line];
+		long long len = unescape(keys, buf, sizeof(buf)), bytes;
+		if(write(fd, buf, len) == len)
+			read_echo(fd, get_us(), setup_quiet_ms, &bytes);
+		return;
+	}
+	replay(fd, name, keys, *first);
+	*first = 0;
+}
+
+static char run_file(int fd, const char *path, char *first)
+{
+	char line[max_line];
+	FILE *f = fopen(path, "r");
+	if(!f) {
+		perror(path);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f)) {
+		char *keys;
+		line[strcspn(line, "\n")] = 0;
+		if(line[0] == '#' || !line[0])
+			continue;
+		keys = strchr(line, ' ');
+		if(!keys)
+			continue;
+		*keys++ = 0;
+		run_trace(fd, line, keys, first);
+	}
+	fclose(f);
+	return 0;
+}
+
+static char run_task(const char *task, const char *dir, const char *cmd)
+{
+	int status;
+	pid_t pid = fork();
+	if(pid == -1)
+		return -1;
+	if(pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		if(null != -1)
+			dup2(null, 1);
+		if(chdir(dir) == 0)
+			execl(task, task, "-c", cmd, (char *)NULL);
+		perror(task);
+		_exit(127);
+	}
+	if(waitpid(pid, &status, 0) == -1)
+		return -1;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/* a project with one task of many subtasks, the way a big backlog is */
+static char make_project(const char *task, const char *dir, long long count)
+{
+	long long i;
+	int bigfd;
+	if(run_task(task, dir, "init") != 0 ||
+		run_task(task, dir, "mk " BIG_TASK) != 0)
+		return -1;
+	bigfd = open(dir, O_RDONLY|O_DIRECTORY);
+	if(bigfd == -1)
+		return -1;
+	for(i = 0; i <= count; i++) {
+		char name[32];
+		int fd;
+		if(i < count)
+			sprintf(name, BIG_TASK "/t%lld", i);
+		else
+			strcpy(name, BIG_TASK "/" UNIQUE_SUBTASK);
+		if(create_block(bigfd, name, TASK_CORE_FILE, &fd) != 0)
+			break;
+		task_make_file(fd, 0);
+		close(fd);
+	}
+	close(bigfd);
+	return i > count ? 0 : -1;
+}
+
+int main(int argc, const char *argv[])
+{
+	char dir[] = "/tmp/keybench.XXXXXX";
+	const struct trace *t;
+	const char *task, *value, *path;
+	struct winsize ws;
+	long long subtasks = default_subtasks, i, bytes;
+	char taskpath[4096], first = 1;
+	pid_t pid;
+	int fd;
+	task = param_get_value(argv, TASK_PARAM);
+	if(!task)
+		task = DEFAULT_TASK;
+	value = param_get_value(argv, SUBTASKS_PARAM);
+	if(value)
+		subtasks = atoll(value);
+	if(!realpath(task, taskpath)) {
+		perror(task);
+		return 1;
+	}
+	if(!mkdtemp(dir)) {
+		perror(dir);
+		return 1;
+	}
+	if(make_project(taskpath, dir, subtasks) != 0) {
+		fprintf(stderr, "keybench: failed to make the project in %s\n", dir);
+		remove_dir(AT_FDCWD, dir);
+		return 1;
+	}
+	memset(&ws, 0, sizeof(ws));
+	ws.ws_row = 24;
+	ws.ws_col = 80;
+	pid = forkpty(&fd, NULL, NULL, &ws);
+	if(pid == -1) {
+		perror("forkpty");
+		remove_dir(AT_FDCWD, dir);
+		return 1;
+	}
+	if(pid == 0) {
+		if(chdir(dir) == 0)
+			execl(taskpath, taskpath, (char *)NULL);
+		_exit(127);
+	}
+	read_echo(fd, get_us(), setup_quiet_ms, &bytes);	/* the first prompt */
+	printf("{\"subtasks\": %lld, \"traces\": [", subtasks);
+	if(!param_get_operand(argv+1, 0)) {
+		for(t = builtin_traces; t->name; t++)
+			run_trace(fd, t->name, t->keys, &first);
+	}
+	for(i = 0; (path = param_get_operand(argv+1, i)) != NULL; i++)
+		run_file(fd, path, &first);
+	printf("\n]}\n");
+	if(write(fd, "exit\n", 5) == 5)
+		read_echo(fd, get_us(), setup_quiet_ms, &bytes);
+	close(fd);
+	waitpid(pid, NULL, 0);
+	remove_dir(AT_FDCWD, dir);
+	return 0;
+}
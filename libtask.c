@@ -0,0 +1,198 @@
+#include "libtask.h"
+#include "task.h"
+#include "tasklog.h"
+#include "logstore.h"
+#include "listing.h"
+#include "query.h"
+#include "merkle.h"
+#include "shard.h"
+#include "scan.h"
+#include "grep.h"
+#include "strlib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+char libtask_open(struct libtask *lt, const char *root)
+{
+	lt->log = NULL;
+	lt->scan_cache = NULL;
+	lt->root = realpath(root, NULL);
+	if(!lt->root)
+		return -1;
+	lt->rootfd = open(lt->root, O_RDONLY|O_DIRECTORY);
+	if(lt->rootfd == -1) {
+		free(lt->root);
+		return -1;
+	}
+	if(faccessat(lt->rootfd, TASKLOG_FILE, F_OK, 0) == 0) {
+		lt->log = tasklog_open(lt->rootfd, TASKLOG_FILE, 0);
+		if(!lt->log) {
+			libtask_close(lt);
+			return -1;
+		}
+	}
+	lt->scan_cache = scan_cache_new();
+	return 0;
+}
+
+void libtask_close(struct libtask *lt)
+{
+	close(lt->rootfd);
+	free(lt->root);
+	tasklog_close(lt->log);
+	scan_cache_free(lt->scan_cache);
+}
+
+/* the path as it's stored, "" is turned into the root */
+static char *get_physpath(const struct libtask *lt, const char *path)
+{
+	return shard_resolve(lt->rootfd, path[0] ? path : ".");
+}
+
+static const char *get_logpath(const char *path)
+{
+	return strcmp(path, ".") == 0 ? "" : path;
+}
+
+struct task *libtask_read(const struct libtask *lt, const char *path)
+{
+	struct task *task;
+	char *physpath;
+	if(lt->log)
+		return logstore_read(lt->log, get_logpath(path));
+	physpath = get_physpath(lt, path);
+	task = task_read(lt->rootfd, physpath);
+	free(physpath);
+	return task;
+}
+
+char libtask_update_hashes(const struct libtask *lt, const char *path)
+{
+	struct merkle mk;
+	char *physpath;
+	char ok;
+	if(lt->log)
+		return 0;
+	mk.rootfd = lt->rootfd;
+	mk.root = lt->root;
+	physpath = get_physpath(lt, path);
+	ok = merkle_update(&mk, strcmp(physpath, ".") == 0 ? "" : physpath);
+	free(physpath);
+	return ok;
+}
+
+char libtask_write(struct libtask *lt, const char *path,
+	const struct task *task)
+{
+	char *physpath;
+	char ok;
+	if(lt->log)
+		return logstore_write(lt->log, get_logpath(path), task);
+	physpath = get_physpath(lt, path);
+	ok = task_write(lt->rootfd, physpath, task);
+	free(physpath);
+	if(ok != 0)
+		return -1;
+	return libtask_update_hashes(lt, path);
+}
+
+char libtask_show(const struct libtask *lt, const char *path,
+	const struct listing_opts *opts, struct outbuf *ob)
+{
+	struct listing_opts lopts = *opts;
+	struct task *task;
+	char *physpath;
+	char ok;
+	task = libtask_read(lt, path);
+	if(lt->log) {
+		ok = logstore_print(lt->log, task, get_logpath(path), opts, ob);
+		task_free(task);
+		return ok;
+	}
+	if(!lopts.cache)
+		lopts.cache = lt->scan_cache;
+	physpath = get_physpath(lt, path);
+	ok = task_print(task, lt->rootfd, physpath, &lopts, ob);
+	free(physpath);
+	task_free(task);
+	return ok;
+}
+
+static char *join(const char *dir, const char *name)
+{
+	if(!dir[0] || strcmp(dir, ".") == 0)
+		return string_duplicate(name);
+	return strings_concatenate(dir, "/", name, NULL);
+}
+
+/* the matches are given from the root, not from the path */
+char libtask_query(const struct libtask *lt, const char *path,
+	const char *query, char read_tasks, int flags,
+	struct query_match **matches, long long *count)
+{
+	struct query *q;
+	char *physpath;
+	long long i;
+	int fd;
+	q = query_parse(query);
+	if(!q) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(lt->log) {
+		if(!tasklog_exists(lt->log, get_logpath(path))) {
+			query_free(q);
+			errno = ENOENT;
+			return -1;
+		}
+		*matches = query_select_log(q, lt->log, get_logpath(path),
+			read_tasks, count);
+		query_free(q);
+		physpath = string_duplicate(get_logpath(path));
+	} else {
+		physpath = get_physpath(lt, path);
+		fd = openat(lt->rootfd, physpath, O_RDONLY|O_DIRECTORY);
+		if(fd == -1) {
+			free(physpath);
+			query_free(q);
+			return -1;
+		}
+		*matches = query_select(q, fd, lt->scan_cache, read_tasks, flags,
+			count);
+		close(fd);
+		query_free(q);
+	}
+	for(i = 0; i < *count; i++) {
+		struct query_match *m = &(*matches)[i];
+		char *mpath = join(path, m->path);
+		char *mphys = join(physpath, m->phys);
+		free(m->path);
+		free(m->phys);
+		m->path = mpath;
+		m->phys = mphys;
+	}
+	free(physpath);
+	return 0;
+}
+
+/* returns the number of the tasks found, -1 on error */
+long long libtask_grep(const struct libtask *lt, const char *path,
+	const struct grep *g, const char *prefix, int flags, struct outbuf *ob)
+{
+	char *physpath;
+	long long found;
+	int fd;
+	if(lt->log)
+		return grep_run_log(g, lt->log, get_logpath(path), prefix, ob);
+	physpath = get_physpath(lt, path);
+	fd = openat(lt->rootfd, physpath, O_RDONLY|O_DIRECTORY);
+	free(physpath);
+	if(fd == -1)
+		return -1;
+	found = grep_run(g, fd, prefix, lt->scan_cache, flags, ob);
+	close(fd);
+	return found;
+}
@@ -0,0 +1,40 @@
+#ifndef LIBTASK_H_SENTRY
+#define LIBTASK_H_SENTRY
+
+/*
+ * The project as a library: everything is reached through the handle, so
+ * the handles can be used from different threads at once, but a handle
+ * is not meant to be shared between them. The paths are relative to the
+ * project root, "" and "." being the root itself, and the output goes to
+ * the caller's buffer.
+ */
+
+struct task;
+struct tasklog;
+struct scan_cache;
+struct listing_opts;
+struct outbuf;
+struct query_match;
+struct grep;
+
+struct libtask {
+	int rootfd;
+	char *root;				/* absolute path of the project root */
+	struct tasklog *log;	/* NULL unless the tasks are kept in the log */
+	struct scan_cache *scan_cache;
+};
+
+char libtask_open(struct libtask *lt, const char *root);
+void libtask_close(struct libtask *lt);
+struct task *libtask_read(const struct libtask *lt, const char *path);
+char libtask_write(struct libtask *lt, const char *path,
+	const struct task *task);
+char libtask_show(const struct libtask *lt, const char *path,
+	const struct listing_opts *opts, struct outbuf *ob);
+char libtask_query(const struct libtask *lt, const char *path,
+	const char *query, char read_tasks, int flags,
+	struct query_match **matches, long long *count);
+long long libtask_grep(const struct libtask *lt, const char *path,
+	const struct grep *g, const char *prefix, int flags, struct outbuf *ob);
+char libtask_update_hashes(const struct libtask *lt, const char *path);
+#endif
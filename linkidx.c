@@ -0,0 +1,225 @@
+#include "linkidx.h"
+#include "strlib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*
+ * The index of all the links made by ln, kept in the project root as
+ * lines "target\tlink" sorted by target. It's as big as the number of
+ * links, so rm and mv look through it instead of through the project.
+ */
+
+enum { default_idx_size = 64, line_size = 8192 };
+
+#define LINKS_TMP_FILE LINKS_FILE ".tmp"
+
+static void idx_init(struct linkidx *idx)
+{
+	idx->count = 0;
+	idx->size = default_idx_size;
+	idx->items = malloc(sizeof(*(idx->items))*idx->size);
+	idx->changed = 0;
+}
+
+/* is path equal to prefix or is it inside of prefix subtree */
+static char is_subpath(const char *path, const char *prefix)
+{
+	long long len = strlen(prefix);
+	if(len == 0)
+		return 1;
+	if(strncmp(path, prefix, len) != 0)
+		return 0;
+	return path[len] == 0 || path[len] == '/';
+}
+
+static long long lower_bound(const struct linkidx *idx, const char *target)
+{
+	long long lo = 0, hi = idx->count;
+	while(lo < hi) {
+		long long mid = lo+(hi-lo)/2;
+		if(strcmp(idx->items[mid].target, target) < 0)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void idx_insert(struct linkidx *idx, char *target, char *link)
+{
+	long long pos;
+	if(idx->count == idx->size) {
+		idx->size *= 2;
+		idx->items = realloc(idx->items, sizeof(*(idx->items))*idx->size);
+	}
+	pos = lower_bound(idx, target);
+	memmove(&idx->items[pos+1], &idx->items[pos],
+		sizeof(*(idx->items))*(idx->count-pos));
+	idx->items[pos].target = target;
+	idx->items[pos].link = link;
+	idx->count++;
+}
+
+struct linkidx *linkidx_load(int rootfd)
+{
+	struct linkidx *idx;
+	char buf[line_size];
+	FILE *f;
+	int fd;
+	idx = malloc(sizeof(*idx));
+	idx_init(idx);
+	fd = openat(rootfd, LINKS_FILE, O_RDONLY);
+	if(fd == -1)
+		return idx;
+	f = fdopen(fd, "r");
+	if(!f) {
+		close(fd);
+		return idx;
+	}
+	while(fgets(buf, sizeof(buf), f)) {
+		char *sep = strchr(buf, '\t');
+		char *end = strchr(buf, '\n');
+		if(!sep || !end)
+			continue;
+		*sep = 0;
+		*end = 0;
+		idx_insert(idx, string_duplicate(buf), string_duplicate(sep+1));
+	}
+	fclose(f);
+	return idx;
+}
+
+char linkidx_save(struct linkidx *idx, int rootfd)
+{
+	long long i;
+	FILE *f;
+	int fd;
+	if(!idx || !idx->changed)
+		return 0;
+	fd = openat(rootfd, LINKS_TMP_FILE, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if(fd == -1)
+		return -1;
+	f = fdopen(fd, "w");
+	if(!f) {
+		close(fd);
+		return -1;
+	}
+	for(i = 0; i < idx->count; i++)
+		fprintf(f, "%s\t%s\n", idx->items[i].target, idx->items[i].link);
+	if(fclose(f) != 0 || renameat(rootfd, LINKS_TMP_FILE, rootfd, 
+		LINKS_FILE) != 0)
+		return -1;
+	idx->changed = 0;
+	return 0;
+}
+
+void linkidx_free(struct linkidx *idx)
+{
+	long long i;
+	if(!idx)
+		return;
+	for(i = 0; i < idx->count; i++) {
+		free(idx->items[i].target);
+		free(idx->items[i].link);
+	}
+	free(idx->items);
+	free(idx);
+}
+
+char linkidx_add(struct linkidx *idx, const char *target, const char *link)
+{
+	if(!idx || !target || !link)
+		return -1;
+	linkidx_remove(idx, link, NULL, NULL);
+	idx_insert(idx, string_duplicate(target), string_duplicate(link));
+	idx->changed = 1;
+	return 0;
+}
+
+static void idx_delete(struct linkidx *idx, long long pos)
+{
+	free(idx->items[pos].target);
+	free(idx->items[pos].link);
+	memmove(&idx->items[pos], &idx->items[pos+1],
+		sizeof(*(idx->items))*(idx->count-pos-1));
+	idx->count--;
+	idx->changed = 1;
+}
+
+/*
+ * Forgets the links placed inside of the removed subtree and the ones
+ * pointing into it; fn is called for the latter since they are left
+ * dangling and the caller should get rid of them.
+ */
+long long linkidx_remove(struct linkidx *idx, const char *path,
+	linkidx_fn_t fn, void *usrdata)
+{
+	long long i, count = 0;
+	if(!idx || !path)
+		return -1;
+	for(i = 0; i < idx->count; ) {
+		struct link_entry *ent = &idx->items[i];
+		if(is_subpath(ent->link, path)) {
+			idx_delete(idx, i);
+			continue;
+		}
+		if(is_subpath(ent->target, path)) {
+			if(fn)
+				fn(ent, usrdata);
+			idx_delete(idx, i);
+			count++;
+			continue;
+		}
+		i++;
+	}
+	return count;
+}
+
+static char *replace_prefix(const char *path, const char *oldprefix, 
+	const char *newprefix)
+{
+	return strings_concatenate(newprefix, path+strlen(oldprefix), NULL);
+}
+
+/*
+ * Moves the links placed inside of the subtree, and retargets the ones
+ * pointing into it calling fn for each of them so that the caller can
+ * rewrite the link itself.
+ */
+long long linkidx_move(struct linkidx *idx, const char *oldpath,
+	const char *newpath, linkidx_fn_t fn, void *usrdata)
+{
+	struct link_entry *moved;
+	long long i, mcount = 0, count = 0;
+	if(!idx || !oldpath || !newpath)
+		return -1;
+	moved = malloc(sizeof(*moved)*(idx->count+1));
+	for(i = 0; i < idx->count; i++) {
+		struct link_entry *ent = &idx->items[i];
+		char retarget = is_subpath(ent->target, oldpath);
+		if(!retarget && !is_subpath(ent->link, oldpath))
+			continue;
+		moved[mcount].target = retarget ?
+			replace_prefix(ent->target, oldpath, newpath) :
+			string_duplicate(ent->target);
+		moved[mcount].link = is_subpath(ent->link, oldpath) ?
+			replace_prefix(ent->link, oldpath, newpath) :
+			string_duplicate(ent->link);
+		if(retarget) {
+			if(fn)
+				fn(&moved[mcount], usrdata);
+			count++;
+		}
+		mcount++;
+		idx_delete(idx, i);
+		i--;
+	}
+	for(i = 0; i < mcount; i++)
+		idx_insert(idx, moved[i].target, moved[i].link);
+	idx->changed = idx->changed || mcount > 0;
+	free(moved);
+	return count;
+}
@@ -0,0 +1,29 @@
+#ifndef LINKIDX_H_SENTRY
+#define LINKIDX_H_SENTRY
+
+#define LINKS_FILE ".links"
+
+/* both paths are relative to the project root */
+struct link_entry {
+	char *target;
+	char *link;
+};
+
+struct linkidx {
+	struct link_entry *items;	/* sorted by target */
+	long long count;
+	long long size;
+	char changed;
+};
+
+typedef void (*linkidx_fn_t)(const struct link_entry *, void *);
+
+struct linkidx *linkidx_load(int rootfd);
+char linkidx_save(struct linkidx *idx, int rootfd);
+void linkidx_free(struct linkidx *idx);
+char linkidx_add(struct linkidx *idx, const char *target, const char *link);
+long long linkidx_remove(struct linkidx *idx, const char *path,
+	linkidx_fn_t fn, void *usrdata);
+long long linkidx_move(struct linkidx *idx, const char *oldpath,
+	const char *newpath, linkidx_fn_t fn, void *usrdata);
+#endif
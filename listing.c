@@ -0,0 +1,428 @@
+#include "listing.h"
+#include "task.h"
+#include "batchio.h"
+#include "path.h"
+#include "scan.h"
+#include "memlib.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Every listed child is reduced to an entry with the sort key computed 
+ * once, so the comparison is mostly an integer one and the task itself
+ * can be freed right after it has been read.
+ */
+struct listing_entry {
+	unsigned long long key;
+	unsigned long long subkey;
+	char *name;
+	char *shortname;
+	char *info;		/* the fields of the record, NULL for the text */
+	char *from;
+	char *to;
+	char is_filter;
+	char completed;
+};
+
+enum {
+	no_deadline = -1,	/* as unsigned it's the greatest key */
+	bad_deadline = -2,
+	default_entries_size = 256,
+	dir_batch_size = 256,
+};
+
+void listing_opts_init(struct listing_opts *opts)
+{
+	opts->sort = sort_none;
+	opts->limit = -1;
+	opts->offset = 0;
+	opts->cache = NULL;
+	opts->format = format_text;
+}
+
+sort_t listing_get_sort(const char *name)
+{
+	if(!name)
+		return sort_none;
+	if(strcmp(name, SORT_STATUS) == 0)
+		return sort_status;
+	if(strcmp(name, SORT_DEADLINE) == 0)
+		return sort_deadline;
+	if(strcmp(name, SORT_NAME) == 0)
+		return sort_name;
+	return sort_err;
+}
+
+/* first 8 bytes of the name packed so that integer order is strcmp order */
+static unsigned long long get_name_key(const char *name)
+{
+	unsigned long long key = 0;
+	int i;
+	for(i = 0; i < 8; i++) {
+		key <<= 8;
+		if(name && *name) {
+			key |= (unsigned char)*name;
+			name++;
+		}
+	}
+	return key;
+}
+
+/* "YYYY-MM-DD[ HH:MM]" becomes YYYYMMDDHHMM which keeps the order */
+static unsigned long long get_deadline_key(const char *dline)
+{
+	int year, month, day, hour = 0, min = 0, count;
+	if(!dline || !*dline)
+		return (unsigned long long)no_deadline;
+	count = sscanf(dline, "%d-%d-%d %d:%d", &year, &month, &day, &hour,
+		&min);
+	if(count < 3)
+		return (unsigned long long)bad_deadline;
+	return (((year*100ULL+month)*100+day)*100+hour)*100+min;
+}
+
+static unsigned long long get_status_key(const struct listing_item *item)
+{
+	if(item->is_filter)
+		return 2;
+	return item->completed ? 1 : 0;
+}
+
+void listing_item_fill(struct listing_item *item, const struct task *task,
+	const char *shortname)
+{
+	item->shortname = shortname;
+	item->name = task_get_name(task);
+	item->deadline = task_get_deadline(task);
+	item->info = task_get_field(task, TINFO_FLD);
+	item->from = task_get_field(task, TFROM_FLD);
+	item->to = task_get_field(task, TTO_FLD);
+	item->is_filter = task_is_filter(task);
+	item->completed = task_get_completed(task);
+}
+
+static void entry_fill(struct listing_entry *ent, 
+	const struct listing_item *item, const struct listing_opts *opts)
+{
+	char is_text = opts->format == format_text;
+	ent->name = (char *)(item->name ? item->name : "");	/* no name line */
+	ent->shortname = (char *)item->shortname;
+	ent->info = is_text ? NULL : (char *)item->info;
+	ent->from = is_text ? NULL : (char *)item->from;
+	ent->to = is_text ? NULL : (char *)item->to;
+	ent->is_filter = item->is_filter;
+	ent->completed = item->completed;
+	ent->subkey = get_name_key(item->name);
+	switch(opts->sort) {
+		case sort_status:
+			ent->key = get_status_key(item);
+			break;
+		case sort_deadline:
+			ent->key = get_deadline_key(item->deadline);
+			break;
+		case sort_name:
+		case sort_none:
+		case sort_err:
+			ent->key = ent->subkey;
+			ent->subkey = 0;
+			break;
+	}
+}
+
+static void entry_own(struct listing_entry *ent)
+{
+	ent->name = strdup(ent->name ? ent->name : "");
+	ent->shortname = strdup(ent->shortname);
+	ent->info = ent->info ? strdup(ent->info) : NULL;
+	ent->from = ent->from ? strdup(ent->from) : NULL;
+	ent->to = ent->to ? strdup(ent->to) : NULL;
+}
+
+static void entry_free(struct listing_entry *ent)
+{
+	free(ent->name);
+	free(ent->shortname);
+	free(ent->info);
+	free(ent->from);
+	free(ent->to);
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct listing_entry *e1 = a, *e2 = b;
+	int res;
+	if(e1->key != e2->key)
+		return e1->key < e2->key ? -1 : 1;
+	if(e1->subkey != e2->subkey)
+		return e1->subkey < e2->subkey ? -1 : 1;
+	res = strcmp(e1->name, e2->name);
+	if(res != 0)
+		return res;
+	return strcmp(e1->shortname, e2->shortname);
+}
+
+static void render_record(struct outbuf *ob, format_t format,
+	const struct listing_entry *ent)
+{
+	struct record rec;
+	rec.path = ent->shortname;
+	rec.name = ent->name;
+	rec.info = ent->info;
+	rec.from = ent->from;
+	rec.to = ent->to;
+	rec.is_filter = ent->is_filter;
+	rec.completed = ent->completed;
+	record_write(ob, format, &rec);
+}
+
+static void render_entry(struct outbuf *ob, const struct listing_entry *ent,
+	format_t format)
+{
+	const char *name = ent->name ? ent->name : "";
+	if(format != format_text) {
+		render_record(ob, format, ent);
+		return;
+	}
+	if(ent->is_filter) {
+		outbuf_puts(ob, name);
+	} else {
+		outbuf_puts(ob, ent->completed ? "[v] " : "[x] ");
+		outbuf_puts(ob, name);
+	}
+	outbuf_puts(ob, " (");
+	outbuf_puts(ob, ent->shortname);
+	outbuf_puts(ob, ")\n");
+}
+
+struct dir_source {
+	int fd;
+	struct scan_entry *ents;	/* the children which can be tasks */
+	long long ecount;
+	long long epos;
+	struct batchio *bio;
+	struct batch_file files[dir_batch_size];
+	const struct scan_entry *batch[dir_batch_size];
+	int fields;		/* of the children which are shown */
+	long long count;
+	long long pos;
+	struct task *task;	/* the one the last item has come from */
+};
+
+static void free_batch(struct dir_source *ds)
+{
+	long long i;
+	for(i = 0; i < ds->count; i++) {
+		free((char *)ds->files[i].path);
+		free(ds->files[i].data);
+	}
+	ds->count = 0;
+	ds->pos = 0;
+}
+
+/* the task files of the next children are read all at once */
+static char read_batch(struct dir_source *ds)
+{
+	free_batch(ds);
+	while(ds->count < dir_batch_size && ds->epos < ds->ecount) {
+		const struct scan_entry *ent = &ds->ents[ds->epos];
+		ds->batch[ds->count] = ent;
+		ds->files[ds->count].path = paths_union(scan_entry_path(ent), 
+			TASK_CORE_FILE);
+		ds->count++;
+		ds->epos++;
+	}
+	if(ds->count == 0)
+		return -1;
+	return batchio_read_heads(ds->bio, ds->fd, ds->files, ds->count);
+}
+
+static char next_dir_item(void *data, struct listing_item *item)
+{
+	struct dir_source *ds = data;
+	task_free(ds->task);
+	ds->task = NULL;
+	for(;;) {
+		const struct scan_entry *ent;
+		struct batch_file *f;
+		if(ds->pos == ds->count && read_batch(ds) != 0)
+			return -1;
+		f = &ds->files[ds->pos];
+		ent = ds->batch[ds->pos];
+		ds->pos++;
+		if(!f->data)
+			continue;
+		ds->task = task_parse_fields(f->data, f->len, ds->fields, 
+			f->is_head);
+		if(!ds->task && f->is_head)
+			ds->task = task_read_fields(ds->fd, scan_entry_path(ent),
+				ds->fields);
+		if(!ds->task)
+			continue;
+		listing_item_fill(item, ds->task, ent->name);
+		return 0;
+	}
+}
+
+static char next_item(const struct listing_source *src, 
+	struct listing_item *item)
+{
+	return src->next(src->data, item);
+}
+
+static void print_unsorted(const struct listing_source *src,
+	const struct listing_opts *opts, struct outbuf *ob)
+{
+	struct listing_entry ent;
+	struct listing_item item;
+	long long i;
+	for(i = 0; opts->limit < 0 || i < opts->offset+opts->limit; i++) {
+		if(next_item(src, &item) != 0)
+			break;
+		if(i >= opts->offset) {
+			entry_fill(&ent, &item, opts);
+			render_entry(ob, &ent, opts->format);
+		}
+	}
+}
+
+static void heap_sift_down(struct listing_entry *heap, long long count,
+	long long i)
+{
+	for(;;) {
+		long long largest = i, l = 2*i+1, r = 2*i+2;
+		struct listing_entry tmp;
+		if(l < count && entry_cmp(&heap[l], &heap[largest]) > 0)
+			largest = l;
+		if(r < count && entry_cmp(&heap[r], &heap[largest]) > 0)
+			largest = r;
+		if(largest == i)
+			return;
+		tmp = heap[i];
+		heap[i] = heap[largest];
+		heap[largest] = tmp;
+		i = largest;
+	}
+}
+
+static void heap_sift_up(struct listing_entry *heap, long long i)
+{
+	while(i > 0) {
+		long long parent = (i-1)/2;
+		struct listing_entry tmp;
+		if(entry_cmp(&heap[i], &heap[parent]) <= 0)
+			return;
+		tmp = heap[i];
+		heap[i] = heap[parent];
+		heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+/*
+ * With a limit only offset+limit smallest entries may ever be printed, so
+ * they are kept in a max-heap whose top is replaced by any smaller entry.
+ * Without a limit all the entries have to be kept.
+ */
+static void print_sorted(const struct listing_source *src,
+	const struct listing_opts *opts, struct outbuf *ob)
+{
+	struct listing_entry *ents, ent;
+	struct listing_item item;
+	long long count = 0, size = default_entries_size, bound, i, last;
+	char bounded = opts->limit >= 0;
+	bound = opts->offset+opts->limit;
+	if(bounded && bound <= 0)
+		return;
+	ents = malloc(sizeof(*ents)*size);
+	while(next_item(src, &item) == 0) {
+		entry_fill(&ent, &item, opts);
+		if(bounded && count == bound) {
+			if(entry_cmp(&ent, &ents[0]) < 0) {
+				entry_free(&ents[0]);
+				entry_own(&ent);
+				ents[0] = ent;
+				heap_sift_down(ents, count, 0);
+			}
+			continue;
+		}
+		if(count == size) {
+			size *= 2;
+			if(bounded && size > bound)
+				size = bound;
+			ents = realloc(ents, sizeof(*ents)*size);
+		}
+		entry_own(&ent);
+		ents[count] = ent;
+		count++;
+		if(bounded)
+			heap_sift_up(ents, count-1);
+	}
+	qsort(ents, count, sizeof(*ents), entry_cmp);
+	last = bounded && bound < count ? bound : count;
+	for(i = opts->offset; i < last; i++)
+		render_entry(ob, &ents[i], opts->format);
+	for(i = 0; i < count; i++)
+		entry_free(&ents[i]);
+	free(ents);
+}
+
+char listing_print_source(const struct listing_source *src,
+	const struct listing_opts *opts, struct outbuf *ob)
+{
+	mem_area_t prev;
+	long long start;
+	if(!src || !opts || !ob)
+		return -1;
+	start = trace_begin();
+	prev = mem_enter(mem_listing);
+	record_write_header(ob, opts->format);
+	if(opts->sort == sort_none)
+		print_unsorted(src, opts, ob);
+	else
+		print_sorted(src, opts, ob);
+	if(opts->format == format_text)
+		outbuf_putc(ob, '\n');
+	mem_leave(prev);
+	trace_end(start, "render", "render", NULL);
+	return 0;
+}
+
+char listing_print(int dirfd, const char *path, 
+	const struct listing_opts *opts, struct outbuf *ob)
+{
+	struct listing_source src;
+	struct dir_source ds;
+	char ok;
+	mem_area_t prev;
+	if(!path || !opts || !ob)
+		return -1;
+	ds.fd = openat(dirfd, path, O_RDONLY|O_DIRECTORY);
+	if(ds.fd == -1)
+		return -1;
+	prev = mem_enter(mem_listing);
+	ds.ents = scan_dir(ds.fd, ".", opts->cache, &ds.ecount);
+	if(!ds.ents) {
+		close(ds.fd);
+		mem_leave(prev);
+		return -1;
+	}
+	ds.epos = 0;
+	ds.bio = batchio_open();
+	ds.count = ds.pos = 0;
+	ds.task = NULL;
+	ds.fields = opts->format == format_text ? task_fld_listed : task_fld_all;
+	src.next = next_dir_item;
+	src.data = &ds;
+	ok = listing_print_source(&src, opts, ob);
+	task_free(ds.task);
+	free_batch(&ds);
+	batchio_close(ds.bio);
+	scan_free(ds.ents, ds.ecount);
+	close(ds.fd);
+	mem_leave(prev);
+	return ok;
+}
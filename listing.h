@@ -0,0 +1,59 @@
+#ifndef LISTING_H_SENTRY
+#define LISTING_H_SENTRY
+#include "outbuf.h"
+#include "record.h"
+
+#define SORT_STATUS "status"
+#define SORT_DEADLINE "deadline"
+#define SORT_NAME "name"
+
+struct scan_cache;
+
+typedef enum {
+	sort_err = -1,
+	sort_none,
+	sort_status,
+	sort_deadline,
+	sort_name,
+} sort_t;
+
+struct listing_opts {
+	sort_t sort;
+	long long limit;	/* -1 means there's no limit */
+	long long offset;
+	struct scan_cache *cache;	/* of the scanned directories, may be NULL */
+	format_t format;
+};
+
+struct task;
+
+/* what a listed child is shown and sorted by */
+struct listing_item {
+	const char *shortname;
+	const char *name;
+	const char *deadline;
+	const char *info;	/* these three are needed by the records only */
+	const char *from;
+	const char *to;
+	char is_filter;
+	char completed;
+};
+
+/* 
+ * Where the listed children come from: next fills the item, which stays
+ * valid until the next call, and returns -1 at the end.
+ */
+struct listing_source {
+	char (*next)(void *data, struct listing_item *item);
+	void *data;
+};
+
+void listing_opts_init(struct listing_opts *opts);
+sort_t listing_get_sort(const char *name);
+void listing_item_fill(struct listing_item *item, const struct task *task,
+	const char *shortname);
+char listing_print(int dirfd, const char *path, 
+	const struct listing_opts *opts, struct outbuf *ob);
+char listing_print_source(const struct listing_source *src,
+	const struct listing_opts *opts, struct outbuf *ob);
+#endif
@@ -0,0 +1,306 @@
+#include "logstore.h"
+#include "tasklog.h"
+#include "task.h"
+#include "listing.h"
+#include "strlib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+struct task *logstore_read(struct tasklog *log, const char *path)
+{
+	struct task *task;
+	long long len;
+	char *data = tasklog_get(log, path, &len);
+	if(!data)
+		return NULL;
+	task = task_parse(data, len);
+	free(data);
+	return task;
+}
+
+char logstore_write(struct tasklog *log, const char *path, 
+	const struct task *task)
+{
+	char *data;
+	long long len;
+	char ok;
+	if(!task || !task_is_edited(task))
+		return 0;
+	data = task_serialize(task, &len);
+	if(!data)
+		return -1;
+	ok = tasklog_put(log, path, data, len);
+	free(data);
+	return ok;
+}
+
+char logstore_make(struct tasklog *log, const char *path, char is_filter)
+{
+	const char *template = task_get_template(is_filter);
+	if(tasklog_exists(log, path)) {
+		errno = EEXIST;
+		return -1;
+	}
+	return tasklog_put(log, path, template, strlen(template));
+}
+
+struct log_children {
+	struct tasklog *log;
+	const char *path;
+	char **names;
+	long long count;
+	long long size;
+	long long pos;
+	char *cur;
+	struct task *task;	/* the one the last item has come from */
+	char links;			/* whether the links are listed */
+};
+
+static void add_child(const char *name, char is_link, void *usrdata)
+{
+	struct log_children *lc = usrdata;
+	if(is_link && !lc->links)
+		return;
+	if(lc->count == lc->size) {
+		lc->size = lc->size ? lc->size*2 : 16;
+		lc->names = realloc(lc->names, sizeof(*(lc->names))*lc->size);
+	}
+	lc->names[lc->count] = string_duplicate(name);
+	lc->count++;
+}
+
+static char next_log_item(void *data, struct listing_item *item)
+{
+	struct log_children *lc = data;
+	task_free(lc->task);
+	lc->task = NULL;
+	while(lc->pos < lc->count) {
+		char *path;
+		free(lc->cur);
+		lc->cur = lc->names[lc->pos];
+		lc->pos++;
+		path = lc->path[0] ? 
+			strings_concatenate(lc->path, "/", lc->cur, NULL) :
+			string_duplicate(lc->cur);
+		lc->task = logstore_read(lc->log, path);
+		free(path);
+		if(!lc->task)
+			continue;
+		listing_item_fill(item, lc->task, lc->cur);
+		return 0;
+	}
+	return -1;
+}
+
+char logstore_print(struct tasklog *log, const struct task *task, 
+	const char *path, const struct listing_opts *opts, struct outbuf *ob)
+{
+	struct log_children lc;
+	struct listing_source src;
+	char ok;
+	long long i;
+	lc.log = log;
+	lc.path = path;
+	lc.names = NULL;
+	lc.count = lc.size = lc.pos = 0;
+	lc.cur = NULL;
+	lc.task = NULL;
+	lc.links = 1;
+	if(tasklog_list(log, path, add_child, &lc) < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	src.next = next_log_item;
+	src.data = &lc;
+	ok = task_print_source(task, &src, opts, ob);
+	task_free(lc.task);
+	free(lc.cur);
+	for(i = lc.pos; i < lc.count; i++)
+		free(lc.names[i]);
+	free(lc.names);
+	return ok;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* the names of the children sorted, NULL with count -1 if there's no task */
+char **logstore_list(struct tasklog *log, const char *path, char links,
+	long long *count)
+{
+	struct log_children lc;
+	lc.names = NULL;
+	lc.count = lc.size = 0;
+	lc.links = links;
+	if(tasklog_list(log, path, add_child, &lc) < 0) {
+		*count = -1;
+		errno = ENOENT;
+		return NULL;
+	}
+	if(lc.count > 0)
+		qsort(lc.names, lc.count, sizeof(*(lc.names)), name_cmp);
+	*count = lc.count;
+	return lc.names;
+}
+
+void logstore_free_list(char **names, long long count)
+{
+	long long i;
+	for(i = 0; i < count; i++)
+		free(names[i]);
+	free(names);
+}
+
+static char *join(const char *dir, const char *name)
+{
+	return dir[0] ? strings_concatenate(dir, "/", name, NULL) :
+		string_duplicate(name);
+}
+
+static char is_subpath(const char *path, const char *prefix)
+{
+	long long len = strlen(prefix);
+	if(len == 0)
+		return 1;
+	return strncmp(path, prefix, len) == 0 && 
+		(path[len] == '/' || path[len] == 0);
+}
+
+/* the links are copied as they are, still leading to the same tasks */
+static char copy_node(struct tasklog *log, const char *src, const char *dst,
+	char recursive)
+{
+	char **names, *data;
+	long long len, count, i;
+	char ok = 0;
+	data = tasklog_get(log, src, &len);
+	ok = tasklog_put(log, dst, data ? data : "", data ? len : 0);
+	free(data);
+	if(!recursive || ok != 0)
+		return ok;
+	names = logstore_list(log, src, 1, &count);
+	for(i = 0; i < count && ok == 0; i++) {
+		char *csrc = join(src, names[i]), *cdst = join(dst, names[i]);
+		char *target = tasklog_readlink(log, csrc);
+		if(target)
+			ok = tasklog_link(log, cdst, target);
+		else
+			ok = copy_node(log, csrc, cdst, recursive);
+		free(target);
+		free(csrc);
+		free(cdst);
+	}
+	logstore_free_list(names, count);
+	return ok;
+}
+
+char logstore_copy(struct tasklog *log, const char *src, const char *dst,
+	char recursive)
+{
+	if(!tasklog_exists(log, src)) {
+		errno = ENOENT;
+		return -1;
+	}
+	if(tasklog_exists(log, dst)) {
+		errno = EEXIST;
+		return -1;
+	}
+	if(is_subpath(dst, src)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return copy_node(log, src, dst, recursive);
+}
+
+static char has_name(char **names, long long count, const char *name)
+{
+	return count > 0 &&
+		bsearch(&name, names, count, sizeof(*names), name_cmp) != NULL;
+}
+
+static char same_data(const char *a, long long alen, const char *b,
+	long long blen)
+{
+	return alen == blen && (!a) == (!b) && (!a || memcmp(a, b, alen) == 0);
+}
+
+/* 
+ * The tasks go first, the ones which are not in the source or are of the
+ * other kind than there are removed on the way.
+ */
+static char sync_tasks(struct tasklog *src, struct tasklog *dst,
+	const char *path)
+{
+	char **snames, **dnames, *sdata, *ddata;
+	long long slen = 0, dlen = 0, scount, dcount, i;
+	char ok = 0;
+	sdata = tasklog_get(src, path, &slen);
+	ddata = tasklog_get(dst, path, &dlen);
+	if(sdata && !same_data(sdata, slen, ddata, dlen))
+		ok = tasklog_put(dst, path, sdata, slen);
+	else if(!sdata && !tasklog_exists(dst, path))
+		ok = tasklog_put(dst, path, "", 0);
+	free(sdata);
+	free(ddata);
+	snames = logstore_list(src, path, 1, &scount);
+	dnames = logstore_list(dst, path, 1, &dcount);
+	for(i = 0; i < dcount && ok == 0; i++) {
+		char *sp = join(path, dnames[i]), *slink, *dlink;
+		slink = tasklog_readlink(src, sp);
+		dlink = tasklog_readlink(dst, sp);
+		if(!has_name(snames, scount, dnames[i]) || (!slink) != (!dlink))
+			ok = tasklog_remove(dst, sp);
+		free(slink);
+		free(dlink);
+		free(sp);
+	}
+	for(i = 0; i < scount && ok == 0; i++) {
+		char *sp = join(path, snames[i]), *slink;
+		slink = tasklog_readlink(src, sp);
+		if(!slink)
+			ok = sync_tasks(src, dst, sp);
+		free(slink);
+		free(sp);
+	}
+	logstore_free_list(snames, scount);
+	logstore_free_list(dnames, dcount);
+	return ok;
+}
+
+/* then the links, as all their targets are there now */
+static char sync_links(struct tasklog *src, struct tasklog *dst,
+	const char *path)
+{
+	char **names;
+	long long count, i;
+	char ok = 0;
+	names = logstore_list(src, path, 1, &count);
+	for(i = 0; i < count && ok == 0; i++) {
+		char *sp = join(path, names[i]), *slink, *dlink;
+		slink = tasklog_readlink(src, sp);
+		dlink = tasklog_readlink(dst, sp);
+		if(!slink)
+			ok = sync_links(src, dst, sp);
+		else if(!dlink || strcmp(slink, dlink) != 0) {
+			if(dlink)
+				tasklog_remove(dst, sp);
+			ok = tasklog_link(dst, sp, slink);
+		}
+		free(slink);
+		free(dlink);
+		free(sp);
+	}
+	logstore_free_list(names, count);
+	return ok;
+}
+
+/* makes the destination log equal to the source one */
+char logstore_sync(struct tasklog *src, struct tasklog *dst)
+{
+	if(sync_tasks(src, dst, "") != 0)
+		return -1;
+	return sync_links(src, dst, "");
+}
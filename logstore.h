@@ -0,0 +1,22 @@
+#ifndef LOGSTORE_H_SENTRY
+#define LOGSTORE_H_SENTRY
+
+struct tasklog;
+struct task;
+struct listing_opts;
+struct outbuf;
+
+/* tasks kept in the log, the paths are relative to the project root */
+struct task *logstore_read(struct tasklog *log, const char *path);
+char logstore_write(struct tasklog *log, const char *path, 
+	const struct task *task);
+char logstore_make(struct tasklog *log, const char *path, char is_filter);
+char logstore_print(struct tasklog *log, const struct task *task, 
+	const char *path, const struct listing_opts *opts, struct outbuf *ob);
+char **logstore_list(struct tasklog *log, const char *path, char links,
+	long long *count);
+void logstore_free_list(char **names, long long count);
+char logstore_copy(struct tasklog *log, const char *src, const char *dst,
+	char recursive);
+char logstore_sync(struct tasklog *src, struct tasklog *dst);
+#endif
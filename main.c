@@ -1,9 +1,14 @@
 #include "readline.h"
 #include "shell.h"
 #include "params.h"
+#include "memlib.h"
+#include "trace.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 #define TASKP_VERSION "task: v1.1.7\n"
+/* set to print the blocks not freed at exit */
+#define LEAKS_ENV "TASK_LEAKS"
 
 static int process_version_param()
 {
@@ -22,17 +27,39 @@ static int process_params(int argc, const char *argv[], char *terminate)
 		*terminate = 1;
 		return process_version_param();
 	}
+	pindex = param_search(argv, "-c", "--command", NULL);
+	if(pindex != -1) {
+		*terminate = 1;
+		if(!argv[pindex+1]) {
+			fputs("task: -c needs a command\n", stderr);
+			return 1;
+		}
+		return shell_exec(argv[pindex+1]);
+	}
 	return 0;
 }
 
 int main(int argc, const char *argv[])
 {
+	struct termios tconf;
+	const char *trace_path;
 	char status, terminate;
+	if(getenv(LEAKS_ENV)) {
+		mem_track_blocks();
+		atexit(mem_report_leaks);
+	}
+	trace_path = getenv(TRACE_ENV);
+	if(trace_path) {
+		if(trace_open(trace_path) == 0)
+			atexit(trace_close);
+		else
+			perror(trace_path);
+	}
 	status = process_params(argc, argv, &terminate);
 	if(terminate)
 		return status;
-	readline_start();
+	readline_start(&tconf);
     status = shell_run();
-	readline_end();
+	readline_end(&tconf);
     return status;
 }
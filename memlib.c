@@ -1,5 +1,52 @@
 #include "memlib.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+ * The counters are atomic, so the threads don't wait for each other to
+ * count. The size and the area of a block are kept by memwrap.c in front
+ * of it, so nothing has to be looked up when it's freed. The live blocks
+ * themselves are kept only for mem_report_leaks, once mem_track_blocks
+ * has been called, in a hash table of their addresses with linear
+ * probing. The table is mapped rather than allocated, as the allocations
+ * made for it would have to be counted in it.
+ */
+
+enum {
+	first_table_size = 4096,	/* a power of two */
+	max_leaks_shown = 10,
+};
+
+struct mem_block {
+	const void *ptr;	/* NULL if the slot is free */
+	long long size;
+	mem_area_t area;
+};
+
+/* blocks is allocs-frees, the total is summed when it's asked for */
+struct area_counters {
+	long long allocs;
+	long long frees;
+	long long bytes;
+	long long peak;
+	char pad[32];		/* the areas don't share a cache line */
+};
+
+static struct mem_block *table = NULL;
+static long long table_size = 0, table_count = 0;
+static char tracking = 0;
+static struct area_counters counters[mem_areas_count];
+static long long total_bytes = 0, total_peak = 0;
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread mem_area_t cur_area = mem_other;
+
+static const char *area_names[] = {
+	"other", "parser", "tokenizer", "completion", "listing"
+};
 
 void mem_free(void **mem)
 {
@@ -18,3 +65,185 @@ long long memory_items_count(const void **mem)
 		mem++;
 	return mem-tmp;
 }
+
+mem_area_t mem_enter(mem_area_t area)
+{
+	mem_area_t prev = cur_area;
+	cur_area = area;
+	return prev;
+}
+
+void mem_leave(mem_area_t prev)
+{
+	cur_area = prev;
+}
+
+const char *mem_area_name(mem_area_t area)
+{
+	return area >= 0 && area < mem_areas_count ? area_names[area] : NULL;
+}
+
+static long long get_slot(const void *ptr, long long size)
+{
+	uint64_t h = (uint64_t)(uintptr_t)ptr >> 4;
+	return (h*0x9e3779b97f4a7c15ULL >> 20) & (size-1);
+}
+
+static long long find_slot(const struct mem_block *tbl, long long size,
+	const void *ptr)
+{
+	long long i = get_slot(ptr, size);
+	while(tbl[i].ptr && tbl[i].ptr != ptr)
+		i = (i+1) & (size-1);
+	return i;
+}
+
+static char grow_table()
+{
+	long long size = table_size ? table_size*2 : first_table_size, i;
+	struct mem_block *tbl;
+	tbl = mmap(NULL, sizeof(*tbl)*size, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(tbl == MAP_FAILED)
+		return -1;
+	for(i = 0; i < table_size; i++)
+		if(table[i].ptr)
+			tbl[find_slot(tbl, size, table[i].ptr)] = table[i];
+	if(table)
+		munmap(table, sizeof(*table)*table_size);
+	table = tbl;
+	table_size = size;
+	return 0;
+}
+
+/* the blocks after it are moved back, so no probe chain is cut */
+static void remove_slot(long long i)
+{
+	long long j = i;
+	for(;;) {
+		long long home;
+		j = (j+1) & (table_size-1);
+		if(!table[j].ptr)
+			break;
+		home = get_slot(table[j].ptr, table_size);
+		if((j > i && (home <= i || home > j)) ||
+			(j < i && (home <= i && home > j))) {
+			table[i] = table[j];
+			i = j;
+		}
+	}
+	table[i].ptr = NULL;
+}
+
+static void raise_peak(long long *peak, long long bytes)
+{
+	long long old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+	while(bytes > old && !__atomic_compare_exchange_n(peak, &old, bytes, 1,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static void remove_block(const void *ptr)
+{
+	long long i;
+	if(!table)
+		return;
+	i = find_slot(table, table_size, ptr);
+	if(!table[i].ptr)
+		return;		/* allocated before the tracking began */
+	remove_slot(i);
+	table_count--;
+}
+
+static void add_block(const void *ptr, long long size, mem_area_t area)
+{
+	long long i;
+	if((table_count+1)*2 > table_size && grow_table() != 0)
+		return;
+	i = find_slot(table, table_size, ptr);
+	if(!table[i].ptr)
+		table_count++;
+	table[i].ptr = ptr;
+	table[i].size = size;
+	table[i].area = area;
+}
+
+/* the blocks allocated from now on are kept for mem_report_leaks */
+void mem_track_blocks()
+{
+	__atomic_store_n(&tracking, 1, __ATOMIC_RELEASE);
+}
+
+/* returns the area the block is charged to, to be given back when freed */
+mem_area_t mem_count_alloc(const void *ptr, long long size)
+{
+	struct area_counters *c = &counters[cur_area];
+	__atomic_add_fetch(&c->allocs, 1, __ATOMIC_RELAXED);
+	raise_peak(&c->peak, __atomic_add_fetch(&c->bytes, size,
+		__ATOMIC_RELAXED));
+	raise_peak(&total_peak, __atomic_add_fetch(&total_bytes, size,
+		__ATOMIC_RELAXED));
+	if(__atomic_load_n(&tracking, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&table_lock);
+		add_block(ptr, size, cur_area);
+		pthread_mutex_unlock(&table_lock);
+	}
+	return cur_area;
+}
+
+void mem_count_free(const void *ptr, long long size, mem_area_t area)
+{
+	struct area_counters *c = &counters[area];
+	__atomic_add_fetch(&c->frees, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&c->bytes, size, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&total_bytes, size, __ATOMIC_RELAXED);
+	if(__atomic_load_n(&tracking, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&table_lock);
+		remove_block(ptr);
+		pthread_mutex_unlock(&table_lock);
+	}
+}
+
+/* the counters are read one by one, so they may be a moment apart */
+void mem_get_stats(struct mem_stats *areas, struct mem_stats *total)
+{
+	int i;
+	memset(total, 0, sizeof(*total));
+	for(i = 0; i < mem_areas_count; i++) {
+		struct area_counters *c = &counters[i];
+		areas[i].allocs = __atomic_load_n(&c->allocs, __ATOMIC_RELAXED);
+		areas[i].frees = __atomic_load_n(&c->frees, __ATOMIC_RELAXED);
+		areas[i].blocks = areas[i].allocs-areas[i].frees;
+		areas[i].bytes = __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+		areas[i].peak = __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+		total->allocs += areas[i].allocs;
+		total->frees += areas[i].frees;
+		total->blocks += areas[i].blocks;
+		total->bytes += areas[i].bytes;
+	}
+	total->peak = __atomic_load_n(&total_peak, __ATOMIC_RELAXED);
+}
+
+/* the blocks still live are printed to stderr, meant to be called at exit */
+void mem_report_leaks()
+{
+	struct mem_block shown[max_leaks_shown];
+	struct mem_stats areas[mem_areas_count], total;
+	long long i, count = 0;
+	int area;
+	mem_get_stats(areas, &total);
+	pthread_mutex_lock(&table_lock);
+	for(i = 0; i < table_size && count < max_leaks_shown; i++)
+		if(table[i].ptr)
+			shown[count++] = table[i];
+	pthread_mutex_unlock(&table_lock);
+	fprintf(stderr, "leaks: %lld blocks, %lld bytes\n", total.blocks,
+		total.bytes);
+	for(area = 0; area < mem_areas_count; area++)
+		if(areas[area].blocks > 0)
+			fprintf(stderr, "leaks: %s: %lld blocks, %lld bytes\n",
+				area_names[area], areas[area].blocks, areas[area].bytes);
+	for(i = 0; i < count; i++)
+		fprintf(stderr, "leaks: %p, %lld bytes, %s\n", shown[i].ptr,
+			shown[i].size, area_names[shown[i].area]);
+}
@@ -1,6 +1,39 @@
 #ifndef MEMLIB_H_SENTRY
 #define MEMLIB_H_SENTRY
 
+/*
+ * The allocations are counted by the areas of the program they're made
+ * in. A thread is in one area at a time, which it enters and leaves
+ * around the code of the area, and an allocation is charged to the area
+ * it's made in until it's freed, wherever that happens. Nothing is
+ * counted unless the program is linked with the wrappers of memwrap.c.
+ */
+
+typedef enum {
+	mem_other,
+	mem_parser,
+	mem_tokenizer,
+	mem_completion,
+	mem_listing,
+	mem_areas_count
+} mem_area_t;
+
+struct mem_stats {
+	long long allocs;
+	long long frees;
+	long long blocks;	/* live ones */
+	long long bytes;	/* live ones */
+	long long peak;		/* the most bytes live at once */
+};
+
 void mem_free(void **mem);
 long long memory_items_count(const void **mem);
+mem_area_t mem_enter(mem_area_t area);
+void mem_leave(mem_area_t prev);
+mem_area_t mem_count_alloc(const void *ptr, long long size);
+void mem_count_free(const void *ptr, long long size, mem_area_t area);
+void mem_get_stats(struct mem_stats *areas, struct mem_stats *total);
+const char *mem_area_name(mem_area_t area);
+void mem_track_blocks();
+void mem_report_leaks();
 #endif
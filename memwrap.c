@@ -0,0 +1,116 @@
+#include "memlib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+/*
+ * Linked into the program and the bench with the MEMWRAP_LDFLAGS of the
+ * Makefile, so the allocations of all the modules are counted by memlib.
+ * The blocks glibc allocates for itself, like the ones of realpath, aren't
+ * seen.
+ *
+ * Every block is allocated with a header in front of it, which keeps its
+ * size and area for the free. The magic number lies over the high half
+ * of the size of glibc's own chunk, which is 0 for any chunk below 4 GB,
+ * so a block glibc has allocated is told apart and freed as it is.
+ */
+
+#define MEMWRAP_MAGIC 0xa110c8edU
+
+struct mem_header {
+	long long size;
+	mem_area_t area;
+	unsigned int magic;
+};
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+size_t __real_malloc_usable_size(void *ptr);
+
+/* NULL if the block hasn't been allocated by the wrappers */
+static struct mem_header *get_header(void *ptr)
+{
+	struct mem_header *h = (struct mem_header *)ptr-1;
+	return ptr && h->magic == MEMWRAP_MAGIC ? h : NULL;
+}
+
+static void *put_header(struct mem_header *h, size_t size)
+{
+	h->size = size;
+	h->area = mem_count_alloc(h+1, size);
+	h->magic = MEMWRAP_MAGIC;
+	return h+1;
+}
+
+void *__wrap_malloc(size_t size)
+{
+	struct mem_header *h;
+	if(size > (size_t)-1-sizeof(*h))
+		return NULL;
+	h = __real_malloc(size+sizeof(*h));
+	return h ? put_header(h, size) : NULL;
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	struct mem_header *h;
+	if(size && count > ((size_t)-1-sizeof(*h))/size)
+		return NULL;
+	h = __real_calloc(1, count*size+sizeof(*h));
+	return h ? put_header(h, count*size) : NULL;
+}
+
+void __wrap_free(void *ptr)
+{
+	struct mem_header *h = get_header(ptr);
+	if(!h) {
+		__real_free(ptr);
+		return;
+	}
+	mem_count_free(ptr, h->size, h->area);
+	h->magic = 0;
+	__real_free(h);
+}
+
+/* the block is counted as freed and allocated again, moved or not */
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	struct mem_header *h = get_header(ptr), *result;
+	if(!ptr)
+		return __wrap_malloc(size);
+	if(!h)
+		return __real_realloc(ptr, size);
+	if(size == 0) {
+		__wrap_free(ptr);
+		return NULL;
+	}
+	if(size > (size_t)-1-sizeof(*h))
+		return NULL;
+	mem_count_free(ptr, h->size, h->area);
+	result = __real_realloc(h, size+sizeof(*h));
+	if(!result) {
+		put_header(h, h->size);		/* it's left as it was */
+		return NULL;
+	}
+	return put_header(result, size);
+}
+
+/* the header isn't usable */
+size_t __wrap_malloc_usable_size(void *ptr)
+{
+	struct mem_header *h = get_header(ptr);
+	return h ? __real_malloc_usable_size(h)-sizeof(*h) :
+		__real_malloc_usable_size(ptr);
+}
+
+/* glibc's strdup doesn't go through the wrapped malloc */
+char *__wrap_strdup(const char *s)
+{
+	long long len = strlen(s)+1;
+	char *copy = __wrap_malloc(len);
+	if(copy)
+		memcpy(copy, s, len);
+	return copy;
+}
@@ -0,0 +1,322 @@
+#include "merkle.h"
+#include "task.h"
+#include "shard.h"
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+/*
+ * Every task directory keeps in HASH_FILE a hash of its main file combined
+ * with the hashes of all its children, so equal hashes mean equal subtrees
+ * and a change is seen at the root without reading the files below. The
+ * children are combined by a sum, that's why the order readdir returns
+ * them in doesn't matter.
+ *
+ * The project's GENERATION_FILE counts the updates, so what is made of
+ * the whole project (the snapshot) can tell it's been changed without
+ * comparing anything else.
+ */
+
+enum { 
+	hash_bufsize = 65536,
+	hash_strsize = 17,		/* 16 hex digits and '\n' */
+};
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static unsigned long long fnv_update(unsigned long long h, const char *data,
+	long long len)
+{
+	long long i;
+	for(i = 0; i < len; i++) {
+		h ^= (unsigned char)data[i];
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+static unsigned long long mix(unsigned long long h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+unsigned long long merkle_file_hash(int dirfd, const char *path)
+{
+	char buf[hash_bufsize];
+	unsigned long long h = FNV_OFFSET;
+	ssize_t rc;
+	int fd = openat(dirfd, path, O_RDONLY);
+	if(fd == -1)
+		return 0;
+	while((rc = read(fd, buf, sizeof(buf))) > 0)
+		h = fnv_update(h, buf, rc);
+	close(fd);
+	return h;
+}
+
+unsigned long long merkle_link_hash(const struct merkle *mk, 
+	const char *target)
+{
+	long long rlen = strlen(mk->root);
+	if(strncmp(target, mk->root, rlen) == 0 && 
+		(target[rlen] == '/' || target[rlen] == 0))
+		target += rlen;
+	return fnv_update(FNV_OFFSET, target, strlen(target));
+}
+
+static char is_hashed(const char *name)
+{
+	if(shard_is_dirname(name))
+		return 1;
+	return name[0] != '.' && strcmp(name, TASK_CORE_FILE) != 0;
+}
+
+static unsigned long long child_hash(const struct merkle *mk, int fd,
+	const char *name, unsigned char dtype)
+{
+	unsigned long long h = 0;
+	struct stat st;
+	if(dtype == DT_UNKNOWN) {
+		if(fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+			return 0;
+		dtype = S_ISDIR(st.st_mode) ? DT_DIR : 
+			(S_ISLNK(st.st_mode) ? DT_LNK : DT_REG);
+	}
+	if(dtype == DT_DIR) {
+		merkle_get(mk, fd, name, &h);
+	} else if(dtype == DT_LNK) {
+		char target[4096];
+		ssize_t len = readlinkat(fd, name, target, sizeof(target)-1);
+		if(len >= 0) {
+			target[len] = 0;
+			h = merkle_link_hash(mk, target);
+		}
+	} else
+		h = merkle_file_hash(fd, name);
+	return h;
+}
+
+static char node_hash(const struct merkle *mk, int fd, 
+	unsigned long long *hash)
+{
+	unsigned long long acc = 0;
+	struct dirent *dent;
+	DIR *dir;
+	int dupfd = dup(fd);
+	if(dupfd == -1)
+		return -1;
+	dir = fdopendir(dupfd);
+	if(!dir) {
+		close(dupfd);
+		return -1;
+	}
+	while((dent = readdir(dir)) != NULL) {
+		unsigned long long nh;
+		if(!is_hashed(dent->d_name))
+			continue;
+		nh = fnv_update(FNV_OFFSET, dent->d_name, strlen(dent->d_name));
+		acc += mix(nh ^ child_hash(mk, fd, dent->d_name, dent->d_type));
+	}
+	closedir(dir);
+	*hash = mix(merkle_file_hash(fd, TASK_CORE_FILE) ^ 
+		((acc << 17) | (acc >> 47)));
+	return 0;
+}
+
+char merkle_set(int dirfd, const char *path, unsigned long long hash)
+{
+	char buf[hash_strsize+1];
+	char *hashname;
+	int fd, len;
+	hashname = malloc(strlen(path)+sizeof(HASH_FILE)+1);
+	sprintf(hashname, "%s/%s", path, HASH_FILE);
+	fd = openat(dirfd, hashname, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	free(hashname);
+	if(fd == -1)
+		return -1;
+	len = sprintf(buf, "%016llx\n", hash);
+	if(write(fd, buf, len) != len) {
+		close(fd);
+		return -1;
+	}
+	return close(fd) == 0 ? 0 : -1;
+}
+
+/* the stored hash or a counted one if there's none yet */
+char merkle_get(const struct merkle *mk, int dirfd, const char *path,
+	unsigned long long *hash)
+{
+	char buf[hash_strsize+1];
+	ssize_t rc;
+	int fd, hfd;
+	fd = openat(dirfd, path, O_RDONLY|O_DIRECTORY);
+	if(fd == -1)
+		return -1;
+	hfd = openat(fd, HASH_FILE, O_RDONLY);
+	if(hfd != -1) {
+		rc = read(hfd, buf, hash_strsize);
+		close(hfd);
+		if(rc == hash_strsize) {
+			buf[rc] = 0;
+			if(sscanf(buf, "%llx", hash) == 1) {
+				close(fd);
+				return 0;
+			}
+		}
+	}
+	if(node_hash(mk, fd, hash) != 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	merkle_set(dirfd, path, *hash);
+	return 0;
+}
+
+static char rehash_dir(const struct merkle *mk, const char *path)
+{
+	unsigned long long hash;
+	int fd = openat(mk->rootfd, path[0] ? path : ".", O_RDONLY|O_DIRECTORY);
+	if(fd == -1)
+		return -1;
+	if(node_hash(mk, fd, &hash) == 0)
+		merkle_set(fd, ".", hash);
+	close(fd);
+	return 0;
+}
+
+/* cuts the last component off, returns 0 if there was none */
+static char path_up(char *path)
+{
+	char *sep;
+	if(!path[0])
+		return 0;
+	sep = strrchr(path, '/');
+	if(sep)
+		*sep = 0;
+	else
+		path[0] = 0;
+	return 1;
+}
+
+static char read_generation(int fd, unsigned long long *gen)
+{
+	char buf[hash_strsize+1];
+	ssize_t rc = pread(fd, buf, hash_strsize, 0);
+	*gen = 0;
+	if(rc < 0)
+		return -1;
+	buf[rc] = 0;
+	if(rc > 0 && sscanf(buf, "%llx", gen) != 1)
+		*gen = 0;
+	return 0;
+}
+
+unsigned long long merkle_generation(const struct merkle *mk)
+{
+	unsigned long long gen;
+	int fd = openat(mk->rootfd, GENERATION_FILE, O_RDONLY);
+	if(fd == -1)
+		return 0;
+	if(read_generation(fd, &gen) != 0)
+		gen = 0;
+	close(fd);
+	return gen;
+}
+
+/* counts one more change of the project, the lock keeps two from merging */
+char merkle_bump(const struct merkle *mk)
+{
+	char buf[hash_strsize+1];
+	unsigned long long gen;
+	char ok = -1;
+	int len, fd;
+	fd = openat(mk->rootfd, GENERATION_FILE, O_RDWR|O_CREAT, 0666);
+	if(fd == -1)
+		return -1;
+	if(flock(fd, LOCK_EX) == 0 && read_generation(fd, &gen) == 0) {
+		len = sprintf(buf, "%016llx\n", gen+1);
+		if(pwrite(fd, buf, len, 0) == len)
+			ok = 0;
+	}
+	close(fd);
+	return ok;
+}
+
+/* recounts the hashes from the changed directory up to the root */
+char merkle_update(const struct merkle *mk, const char *relpath)
+{
+	char *path = strdup(relpath);
+	char ok = merkle_bump(mk);
+	do {
+		if(rehash_dir(mk, path) != 0)
+			ok = -1;
+	} while(path_up(path));
+	free(path);
+	return ok;
+}
+
+static long long path_depth(const char *path)
+{
+	long long depth = path[0] ? 1 : 0;
+	for(; *path; path++) {
+		if(*path == '/')
+			depth++;
+	}
+	return depth;
+}
+
+/* the deepest first, so the children are counted before their parents */
+static int deeper_cmp(const void *a, const void *b)
+{
+	const char *pa = *(const char **)a, *pb = *(const char **)b;
+	long long da = path_depth(pa), db = path_depth(pb);
+	if(da != db)
+		return da > db ? -1 : 1;
+	return strcmp(pa, pb);
+}
+
+/*
+ * The same as merkle_update for each of the paths, but a directory they
+ * share is recounted once instead of once per path.
+ */
+char merkle_update_many(const struct merkle *mk, const char *relpaths[],
+	long long count)
+{
+	char **dirs;
+	long long i, n = 0, size = 0;
+	char ok = 0;
+	for(i = 0; i < count; i++)
+		size += path_depth(relpaths[i])+1;
+	if(size == 0)
+		return 0;
+	ok = merkle_bump(mk);
+	dirs = malloc(sizeof(*dirs)*size);
+	for(i = 0; i < count; i++) {
+		char *path = strdup(relpaths[i]);
+		do {
+			dirs[n++] = strdup(path);
+		} while(path_up(path));
+		free(path);
+	}
+	qsort(dirs, n, sizeof(*dirs), deeper_cmp);
+	for(i = 0; i < n; i++) {
+		if((i == 0 || strcmp(dirs[i], dirs[i-1]) != 0) && 
+			rehash_dir(mk, dirs[i]) != 0)
+			ok = -1;
+	}
+	for(i = 0; i < n; i++)
+		free(dirs[i]);
+	free(dirs);
+	return ok;
+}
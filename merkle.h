@@ -0,0 +1,24 @@
+#ifndef MERKLE_H_SENTRY
+#define MERKLE_H_SENTRY
+
+#define HASH_FILE ".hash"
+#define GENERATION_FILE ".generation"
+
+/* the project the hashes are counted in */
+struct merkle {
+	int rootfd;
+	const char *root;	/* absolute path, links into it are hashed relative */
+};
+
+char merkle_get(const struct merkle *mk, int dirfd, const char *path,
+	unsigned long long *hash);
+char merkle_set(int dirfd, const char *path, unsigned long long hash);
+char merkle_update(const struct merkle *mk, const char *relpath);
+char merkle_update_many(const struct merkle *mk, const char *relpaths[],
+	long long count);
+char merkle_bump(const struct merkle *mk);
+unsigned long long merkle_generation(const struct merkle *mk);
+unsigned long long merkle_file_hash(int dirfd, const char *path);
+unsigned long long merkle_link_hash(const struct merkle *mk, 
+	const char *target);
+#endif
@@ -0,0 +1,149 @@
+#include "outbuf.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+
+char outbuf_init(struct outbuf *ob, int fd)
+{
+	if(!ob)
+		return -1;
+	ob->fd = fd;
+	ob->len = 0;
+	ob->size = outbuf_default_size;
+	ob->data = malloc(sizeof(*(ob->data))*ob->size);
+	if(!ob->data)
+		return -1;
+	/* what stdio has buffered must reach the fd before our data does */
+	fflush(stdout);
+	return 0;
+}
+
+static char write_all(int fd, const char *data, long long len)
+{
+	while(len > 0) {
+		ssize_t wc = write(fd, data, len);
+		if(wc == -1) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += wc;
+		len -= wc;
+	}
+	return 0;
+}
+
+char outbuf_flush(struct outbuf *ob)
+{
+	char ok;
+	if(!ob || ob->len == 0 || ob->fd == -1)
+		return 0;
+	ok = write_all(ob->fd, ob->data, ob->len);
+	ob->len = 0;
+	return ok;
+}
+
+/* a buffer without fd grows instead of being flushed */
+static char make_room(struct outbuf *ob, long long len)
+{
+	char *data;
+	long long size = ob->size;
+	if(ob->fd != -1)
+		return outbuf_flush(ob);
+	while(ob->len+len > size)
+		size *= 2;
+	data = realloc(ob->data, size);
+	if(!data)
+		return -1;
+	ob->data = data;
+	ob->size = size;
+	return 0;
+}
+
+char outbuf_write(struct outbuf *ob, const char *s, long long len)
+{
+	if(!ob || !s)
+		return -1;
+	if(ob->len+len > ob->size) {
+		if(make_room(ob, len) != 0)
+			return -1;
+		if(len > ob->size) /* too big to be buffered at all */
+			return write_all(ob->fd, s, len);
+	}
+	memcpy(ob->data+ob->len, s, len);
+	ob->len += len;
+	return 0;
+}
+
+char outbuf_puts(struct outbuf *ob, const char *s)
+{
+	if(!s)
+		return -1;
+	return outbuf_write(ob, s, strlen(s));
+}
+
+char outbuf_putc(struct outbuf *ob, char c)
+{
+	if(!ob)
+		return -1;
+	if(ob->len == ob->size && make_room(ob, 1) != 0)
+		return -1;
+	ob->data[ob->len] = c;
+	ob->len++;
+	return 0;
+}
+
+char outbuf_printf(struct outbuf *ob, const char *fmt, ...)
+{
+	va_list vl;
+	long long avail;
+	int len;
+	if(!ob || !fmt)
+		return -1;
+	avail = ob->size-ob->len;
+	va_start(vl, fmt);
+	len = vsnprintf(ob->data+ob->len, avail, fmt, vl);
+	va_end(vl);
+	if(len < 0)
+		return -1;
+	if(len < avail) {
+		ob->len += len;
+		return 0;
+	}
+	if(make_room(ob, len+1) != 0)
+		return -1;
+	if(ob->fd == -1) {
+		va_start(vl, fmt);
+		vsnprintf(ob->data+ob->len, ob->size-ob->len, fmt, vl);
+		va_end(vl);
+		ob->len += len;
+		return 0;
+	}
+	if(len >= ob->size) {
+		char *tmp = malloc(len+1);
+		char ok;
+		va_start(vl, fmt);
+		vsnprintf(tmp, len+1, fmt, vl);
+		va_end(vl);
+		ok = write_all(ob->fd, tmp, len);
+		free(tmp);
+		return ok;
+	}
+	va_start(vl, fmt);
+	vsnprintf(ob->data, ob->size, fmt, vl);
+	va_end(vl);
+	ob->len = len;
+	return 0;
+}
+
+void outbuf_free(struct outbuf *ob)
+{
+	if(!ob)
+		return;
+	outbuf_flush(ob);
+	free(ob->data);
+	ob->data = NULL;
+}
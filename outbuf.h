@@ -0,0 +1,20 @@
+#ifndef OUTBUF_H_SENTRY
+#define OUTBUF_H_SENTRY
+
+enum { outbuf_default_size = 65536 };
+
+struct outbuf {
+	int fd;		/* -1 keeps all the data in memory */
+	char *data;
+	long long len;
+	long long size;
+};
+
+char outbuf_init(struct outbuf *ob, int fd);
+char outbuf_write(struct outbuf *ob, const char *s, long long len);
+char outbuf_puts(struct outbuf *ob, const char *s);
+char outbuf_putc(struct outbuf *ob, char c);
+char outbuf_printf(struct outbuf *ob, const char *fmt, ...);
+char outbuf_flush(struct outbuf *ob);
+void outbuf_free(struct outbuf *ob);
+#endif
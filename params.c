@@ -31,3 +31,28 @@ long long param_search(const char *params[], const char *paramname, ...)
 	va_end(vl);
 	return -1;
 }
+
+const char *param_get_value(const char *params[], const char *paramname)
+{
+	long long pindex;
+	const char *separator;
+	pindex = param_search(params, paramname, NULL);
+	if(pindex == -1)
+		return NULL;
+	separator = strchr(params[pindex], param_separator);
+	return separator ? separator+1 : "";
+}
+
+const char *param_get_operand(const char *params[], long long index)
+{
+	if(!params)
+		return NULL;
+	for(; *params; params++) {
+		if((*params)[0] == '-' && (*params)[1] != 0)
+			continue;
+		if(index == 0)
+			return *params;
+		index--;
+	}
+	return NULL;
+}
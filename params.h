@@ -1,4 +1,6 @@
 #ifndef PARAMS_H_SENTRY
 #define PARAMS_H_SENTRY
 long long param_search(const char *params[], const char *paramname, ...);
+const char *param_get_value(const char *params[], const char *paramname);
+const char *param_get_operand(const char *params[], long long index);
 #endif
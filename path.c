@@ -6,21 +6,6 @@ enum {
 	path_delim = '/',
 };
 
-char *get_shortpath(const char *root, const char *path)
-{
-	char *result;
-	char *match;
-	long long len;
-	match = strstr(path, root);
-	if(!match)
-		return NULL;
-	path += strlen(root);
-	len = strlen(path);
-	result = malloc(sizeof(*result)*(len+1));
-	memcpy(result, path, len+1);
-	return result;
-}
-
 char path_extend(char *path, const char *ext)
 {
 	long long len;
@@ -58,3 +43,104 @@ char is_abspath(const char *path)
 {
 	return path[0] == path_delim;
 }
+
+static char *get_real_location(const char *path)
+{
+	char *copy, *base, *realdir, *result;
+	long long len;
+	copy = strdup(path);
+	len = strlen(copy);
+	while(len > 1 && copy[len-1] == path_delim)
+		copy[--len] = 0;
+	base = strrchr(copy, path_delim);
+	if(!base) {
+		base = copy;
+		realdir = realpath(".", NULL);
+	} else {
+		*base = 0;
+		base++;
+		realdir = realpath(base == copy+1 ? "/" : copy, NULL);
+	}
+	if(!realdir || (strcmp(base, ".") == 0) || (strcmp(base, "..") == 0)) {
+		free(realdir);
+		free(copy);
+		return realpath(path, NULL);
+	}
+	result = paths_union(realdir, base);
+	free(realdir);
+	free(copy);
+	return result;
+}
+
+/*
+ * Returns the path relative to root without the leading slash or NULL
+ * if it's outside of root. The last component is resolved only on demand,
+ * so a link can be named by itself.
+ */
+char *path_get_relative(const char *root, const char *path, char resolve)
+{
+	char *real, *result;
+	if(!root || !path)
+		return NULL;
+	real = resolve ? realpath(path, NULL) : get_real_location(path);
+	if(!real)
+		return NULL;
+	result = path_strip_root(root, real);
+	free(real);
+	return result;
+}
+
+/*
+ * Resolves "." and ".." in an absolute path without touching the file
+ * system, so the symlinks are kept as they've been passed.
+ */
+char *path_normalize(const char *path)
+{
+	char *result;
+	long long len = 0;
+	if(!path || !is_abspath(path))
+		return NULL;
+	result = malloc(sizeof(*result)*(strlen(path)+2));
+	while(*path) {
+		const char *next;
+		long long clen;
+		while(*path == path_delim)
+			path++;
+		next = strchr(path, path_delim);
+		clen = next ? next-path : (long long)strlen(path);
+		if(clen == 0)
+			break;
+		if(clen == 1 && path[0] == '.') {
+			/* nothing to do */
+		} else if(clen == 2 && path[0] == '.' && path[1] == '.') {
+			while(len > 0 && result[len-1] != path_delim)
+				len--;
+			if(len > 0)
+				len--;
+		} else {
+			result[len] = path_delim;
+			memcpy(result+len+1, path, clen);
+			len += clen+1;
+		}
+		path += clen;
+	}
+	if(len == 0)
+		result[len++] = path_delim;
+	result[len] = 0;
+	return result;
+}
+
+/* the path below root without the leading slash or NULL if it's outside */
+char *path_strip_root(const char *root, const char *path)
+{
+	long long rlen;
+	if(!root || !path)
+		return NULL;
+	rlen = strlen(root);
+	while(rlen > 0 && root[rlen-1] == path_delim)
+		rlen--;
+	if(strncmp(path, root, rlen) != 0 || 
+		(path[rlen] != path_delim && path[rlen] != 0))
+		return NULL;
+	return strdup(path[rlen] ? path+rlen+1 : "");
+}
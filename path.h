@@ -1,8 +1,10 @@
 #ifndef PATH_H_SENTRY
 #define PATH_H_SENTRY
 
-char *get_shortpath(const char *root, const char *path);
 char *paths_union(const char *path1, const char *path2);
 char path_extend(char *path, const char *ext);
 char is_abspath(const char *path);
+char *path_get_relative(const char *root, const char *path, char resolve);
+char *path_normalize(const char *path);
+char *path_strip_root(const char *root, const char *path);
 #endif
@@ -0,0 +1,477 @@
+#include "query.h"
+#include "task.h"
+#include "scan.h"
+#include "batchio.h"
+#include "logstore.h"
+#include "walk.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+/*
+ * A query is a list of terms separated by QUERY_TERM_SEP, a task matches
+ * it if it matches all of them. A term "field=pattern" or "field!=pattern"
+ * compares a field of the task with a shell pattern, any other term is a
+ * pattern of the path relative to the task the search starts from, where
+ * '*' doesn't cross '/'. So a pattern of one component matches among the
+ * children, one of two components among the grandchildren and so on, and
+ * a query of the fields alone looks through the whole subtree.
+ *
+ * The links are neither followed nor matched, so each task is found once
+ * by the path it's stored under. In the log the path it's stored under is
+ * the path itself.
+ */
+
+enum {
+	select_batch_size = 256,
+	whole_subtree = -1,
+};
+
+typedef enum {
+	term_path,
+	term_equal,
+	term_differ,
+} term_t;
+
+struct term {
+	term_t type;
+	char *field;
+	char *pattern;
+};
+
+struct query {
+	struct term *terms;
+	int count;
+	int depth;			/* how deep the paths can match */
+	int fields;			/* which the terms compare, see task.h */
+};
+
+static const char *fields[] = { TNAME_FLD, TINFO_FLD, TCOMPLETED_FLD,
+	TFROM_FLD, TTO_FLD, TTYPE_FLD, NULL };
+
+static const int field_masks[] = { task_fld_name, task_fld_info,
+	task_fld_completed, task_fld_from, task_fld_to, task_fld_completed };
+
+/* the mask of the field to read, 0 if there's no such field */
+static int get_field_mask(const char *name, long long len)
+{
+	int i;
+	for(i = 0; fields[i]; i++) {
+		if((long long)strlen(fields[i]) == len && 
+			strncmp(fields[i], name, len) == 0)
+			return field_masks[i];
+	}
+	return 0;
+}
+
+static char *string_part(const char *s, long long len)
+{
+	char *part = malloc(len+1);
+	memcpy(part, s, len);
+	part[len] = 0;
+	return part;
+}
+
+static int path_depth(const char *pattern)
+{
+	int depth = 1;
+	for(; *pattern; pattern++) {
+		if(*pattern == '/')
+			depth++;
+	}
+	return depth;
+}
+
+static char parse_term(struct term *t, const char *s, long long len)
+{
+	const char *eq = memchr(s, '=', len);
+	long long flen;
+	if(!eq) {
+		t->type = term_path;
+		t->field = NULL;
+		t->pattern = string_part(s, len);
+		return 0;
+	}
+	flen = eq-s;
+	t->type = term_equal;
+	if(flen > 0 && s[flen-1] == '!') {
+		t->type = term_differ;
+		flen--;
+	}
+	if(!get_field_mask(s, flen))
+		return -1;
+	t->field = string_part(s, flen);
+	t->pattern = string_part(eq+1, len-(eq+1-s));
+	return 0;
+}
+
+struct query *query_parse(const char *str)
+{
+	struct query *q;
+	const char *s;
+	if(!str || !*str)
+		return NULL;
+	q = malloc(sizeof(*q));
+	q->count = 1;
+	for(s = str; *s; s++) {
+		if(*s == QUERY_TERM_SEP)
+			q->count++;
+	}
+	q->terms = malloc(sizeof(*(q->terms))*q->count);
+	q->depth = whole_subtree;
+	q->fields = 0;
+	q->count = 0;
+	for(;;) {
+		const char *end = strchr(str, QUERY_TERM_SEP);
+		long long len = end ? end-str : (long long)strlen(str);
+		struct term *t = &q->terms[q->count];
+		if(len == 0 || parse_term(t, str, len) != 0) {
+			query_free(q);
+			return NULL;
+		}
+		q->count++;
+		if(t->type == term_path) {
+			int depth = path_depth(t->pattern);
+			if(q->depth == whole_subtree || depth < q->depth)
+				q->depth = depth;
+		} else
+			q->fields |= get_field_mask(t->field, strlen(t->field));
+		if(!end)
+			break;
+		str = end+1;
+	}
+	return q;
+}
+
+void query_free(struct query *q)
+{
+	int i;
+	if(!q)
+		return;
+	for(i = 0; i < q->count; i++) {
+		free(q->terms[i].field);
+		free(q->terms[i].pattern);
+	}
+	free(q->terms);
+	free(q);
+}
+
+char query_match_path(const struct query *q, const char *path)
+{
+	int i;
+	for(i = 0; i < q->count; i++) {
+		const struct term *t = &q->terms[i];
+		if(t->type == term_path &&
+			fnmatch(t->pattern, path, FNM_PATHNAME) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+char query_match_task(const struct query *q, const struct task *task)
+{
+	int i;
+	for(i = 0; i < q->count; i++) {
+		const struct term *t = &q->terms[i];
+		const char *value;
+		char equal;
+		if(t->type == term_path)
+			continue;
+		value = task_get_field(task, t->field);
+		equal = fnmatch(t->pattern, value ? value : "", 0) == 0;
+		if(equal != (t->type == term_equal))
+			return 0;
+	}
+	return 1;
+}
+
+/* a link to follow once the subtree has been collected */
+struct deferred {
+	char *path;
+	char *phys;
+	int depth;
+};
+
+struct selector {
+	const struct query *q;
+	int dirfd;
+	struct scan_cache *cache;
+	struct tasklog *log;	/* NULL unless the tasks are in the log */
+	const char *start;		/* in the log */
+	struct walk_set *seen;	/* NULL unless the links are followed */
+	struct deferred *links;	/* not followed yet */
+	long long link_count;
+	long long link_size;
+	struct query_match *items;
+	long long count;
+	long long size;
+};
+
+static char *join(const char *dir, const char *name)
+{
+	long long dlen = strlen(dir), nlen = strlen(name);
+	char *path;
+	if(dlen == 0)
+		return strdup(name);
+	path = malloc(dlen+nlen+2);
+	memcpy(path, dir, dlen);
+	path[dlen] = '/';
+	memcpy(path+dlen+1, name, nlen+1);
+	return path;
+}
+
+static void add_match(struct selector *s, char *path, char *phys)
+{
+	if(s->count == s->size) {
+		s->size = s->size ? s->size*2 : select_batch_size;
+		s->items = realloc(s->items, sizeof(*(s->items))*s->size);
+	}
+	s->items[s->count].path = path;
+	s->items[s->count].phys = phys;
+	s->items[s->count].task = NULL;
+	s->count++;
+}
+
+static void collect(struct selector *s, const char *path, const char *phys,
+	int depth);
+
+/* the task and, as deep as the query goes, its subtasks */
+static void visit(struct selector *s, char *path, char *phys, int depth)
+{
+	if(s->q->depth == whole_subtree || depth < s->q->depth)
+		collect(s, path, phys, depth);
+	if(query_match_path(s->q, path))
+		add_match(s, path, phys);
+	else {
+		free(path);
+		free(phys);
+	}
+}
+
+static void defer_link(struct selector *s, char *path, char *phys,
+	int depth)
+{
+	if(s->link_count == s->link_size) {
+		s->link_size = s->link_size ? s->link_size*2 : select_batch_size;
+		s->links = realloc(s->links, sizeof(*(s->links))*s->link_size);
+	}
+	s->links[s->link_count].path = path;
+	s->links[s->link_count].phys = phys;
+	s->links[s->link_count].depth = depth;
+	s->link_count++;
+}
+
+static void collect(struct selector *s, const char *path, const char *phys,
+	int depth)
+{
+	struct scan_entry *ents;
+	long long i, count = 0;
+	ents = scan_dir(s->dirfd, phys[0] ? phys : ".", s->cache, &count);
+	for(i = 0; i < count; i++) {
+		char *cpath, *cphys;
+		if(ents[i].is_link && !s->seen)
+			continue;
+		cpath = join(path, ents[i].name);
+		cphys = join(phys, scan_entry_path(&ents[i]));
+		if(ents[i].is_link) {
+			defer_link(s, cpath, cphys, depth+1);
+			continue;
+		}
+		if(s->seen && walk_set_add(s->seen, s->dirfd, cphys) != 0) {
+			free(cpath);
+			free(cphys);
+			continue;
+		}
+		visit(s, cpath, cphys, depth+1);
+	}
+	scan_free(ents, count);
+}
+
+/*
+ * The links go after the whole subtree, so a task in it is found at its
+ * own place and a link leads only to the tasks not found yet. The links
+ * found behind the links are added to the end and taken in turn.
+ */
+static void follow_links(struct selector *s)
+{
+	long long i;
+	for(i = 0; i < s->link_count; i++) {
+		struct deferred l = s->links[i];
+		if(walk_set_add(s->seen, s->dirfd, l.phys) != 0) {
+			free(l.path);
+			free(l.phys);
+			continue;
+		}
+		visit(s, l.path, l.phys, l.depth);
+	}
+	free(s->links);
+}
+
+static void collect_log(struct selector *s, const char *path, int depth)
+{
+	char **names, *full = join(s->start, path);
+	long long i, count;
+	names = logstore_list(s->log, full, 0, &count);
+	free(full);
+	for(i = 0; i < count; i++) {
+		char *cpath = join(path, names[i]);
+		if(s->q->depth == whole_subtree || depth+1 < s->q->depth)
+			collect_log(s, cpath, depth+1);
+		if(query_match_path(s->q, cpath))
+			add_match(s, cpath, strdup(cpath));
+		else
+			free(cpath);
+	}
+	logstore_free_list(names, count);
+}
+
+static void free_match(struct query_match *m)
+{
+	free(m->path);
+	free(m->phys);
+	task_free(m->task);
+}
+
+/* 
+ * Reads the tasks of the matches which have none yet or have been read
+ * without some of the fields, in batches.
+ */
+void query_read_tasks(int dirfd, struct query_match *matches,
+	long long count, int fields)
+{
+	struct batch_file files[select_batch_size];
+	struct query_match *batch[select_batch_size];
+	struct batchio *bio = batchio_open();
+	long long i, n;
+	while(count > 0) {
+		for(n = 0; n < select_batch_size && count > 0; matches++, count--) {
+			if(task_has_fields(matches->task, fields))
+				continue;
+			batch[n] = matches;
+			files[n].path = join(matches->phys, TASK_CORE_FILE);
+			n++;
+		}
+		batchio_read_heads(bio, dirfd, files, n);
+		for(i = 0; i < n; i++) {
+			struct query_match *m = batch[i];
+			task_free(m->task);
+			m->task = NULL;
+			if(files[i].err == 0)
+				m->task = task_parse_fields(files[i].data, files[i].len,
+					fields, files[i].is_head);
+			if(!m->task && files[i].is_head)
+				m->task = task_read_fields(dirfd, m->phys, fields);
+			free((char *)files[i].path);
+			free(files[i].data);
+		}
+	}
+	batchio_close(bio);
+}
+
+static void read_log_tasks(struct selector *s)
+{
+	long long i;
+	for(i = 0; i < s->count; i++) {
+		char *path = join(s->start, s->items[i].phys);
+		s->items[i].task = logstore_read(s->log, path);
+		free(path);
+	}
+}
+
+/* drops the matches the tasks of which don't match */
+static void filter_matches(struct selector *s, int fields)
+{
+	long long i, kept = 0;
+	if(s->log)
+		read_log_tasks(s);
+	else
+		query_read_tasks(s->dirfd, s->items, s->count, fields);
+	for(i = 0; i < s->count; i++) {
+		struct query_match *m = &s->items[i];
+		if(!m->task || !query_match_task(s->q, m->task)) {
+			free_match(m);
+			continue;
+		}
+		s->items[kept++] = *m;
+	}
+	s->count = kept;
+}
+
+static int match_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct query_match *)a)->path,
+		((const struct query_match *)b)->path);
+}
+
+/* 
+ * The matches are sorted by path, the tasks are kept if they've been read.
+ * Only the fields the query needs are read unless the tasks are wanted.
+ */
+struct query_match *query_select(const struct query *q, int dirfd,
+	struct scan_cache *cache, char read_tasks, int flags, long long *count)
+{
+	struct selector s;
+	s.q = q;
+	s.dirfd = dirfd;
+	s.cache = cache;
+	s.log = NULL;
+	s.start = NULL;
+	s.seen = NULL;
+	s.items = NULL;
+	s.count = 0;
+	s.size = 0;
+	s.links = NULL;
+	s.link_count = s.link_size = 0;
+	if(flags & walk_follow) {
+		s.seen = walk_set_new();
+		walk_set_add(s.seen, dirfd, ".");
+	}
+	collect(&s, "", "", 0);
+	if(s.seen) {
+		follow_links(&s);
+		walk_set_free(s.seen);
+	}
+	if(q->fields)
+		filter_matches(&s, read_tasks ? task_fld_all : q->fields);
+	else if(read_tasks)
+		query_read_tasks(dirfd, s.items, s.count, task_fld_all);
+	if(s.count > 0)
+		qsort(s.items, s.count, sizeof(*(s.items)), match_cmp);
+	*count = s.count;
+	return s.items;
+}
+
+/* the same for the tasks in the log, the search starts from the path */
+struct query_match *query_select_log(const struct query *q,
+	struct tasklog *log, const char *path, char read_tasks, long long *count)
+{
+	struct selector s;
+	s.q = q;
+	s.dirfd = -1;
+	s.cache = NULL;
+	s.log = log;
+	s.start = path;
+	s.seen = NULL;
+	s.links = NULL;
+	s.link_count = s.link_size = 0;
+	s.items = NULL;
+	s.count = 0;
+	s.size = 0;
+	collect_log(&s, "", 0);
+	if(q->fields)
+		filter_matches(&s, task_fld_all);
+	else if(read_tasks)
+		read_log_tasks(&s);
+	if(s.count > 0)
+		qsort(s.items, s.count, sizeof(*(s.items)), match_cmp);
+	*count = s.count;
+	return s.items;
+}
+
+void query_free_matches(struct query_match *matches, long long count)
+{
+	long long i;
+	for(i = 0; i < count; i++)
+		free_match(&matches[i]);
+	free(matches);
+}
@@ -0,0 +1,29 @@
+#ifndef QUERY_H_SENTRY
+#define QUERY_H_SENTRY
+
+#define QUERY_TERM_SEP ','
+
+struct query;
+struct task;
+struct scan_cache;
+struct tasklog;
+
+/* a task found by query_select, the paths are relative to the start */
+struct query_match {
+	char *path;			/* the way the user names it */
+	char *phys;			/* the way it's stored, see shard.c */
+	struct task *task;	/* NULL unless it has been read */
+};
+
+struct query *query_parse(const char *str);
+void query_free(struct query *q);
+char query_match_path(const struct query *q, const char *path);
+char query_match_task(const struct query *q, const struct task *task);
+struct query_match *query_select(const struct query *q, int dirfd,
+	struct scan_cache *cache, char read_tasks, int flags, long long *count);
+struct query_match *query_select_log(const struct query *q,
+	struct tasklog *log, const char *path, char read_tasks, long long *count);
+void query_read_tasks(int dirfd, struct query_match *matches,
+	long long count, int fields);
+void query_free_matches(struct query_match *matches, long long count);
+#endif
@@ -3,6 +3,7 @@
 #include "memlib.h"
 #include "fslib.h"
 #include "list.h"
+#include "trace.h"
 #include <termios.h>
 #include <string.h>
 #include <stdlib.h>
@@ -254,15 +255,19 @@ static void autocomplete_run(struct input *input,
 	char *prefix;
 	char *prefix_init;
 	long long i;
+	mem_area_t prev;
+	long long start;
 	if(!input || !lists)
 		return;
+	start = trace_begin();
+	prev = mem_enter(mem_completion);
 	prefix = get_prefix(input);
 	prefix_init = prefix;
 	for(i = 1; lists[i]; i++) {
 		if(!lists[i]->check_rule || !lists[i]->before_action)
 			continue;
 		if(lists[i]->check_rule(prefix)) {
-			lists[i]->before_action(lists[i]->value, prefix);
+			lists[i]->before_action(lists[i]->value, prefix, usrdata);
 			list = lists[i]->value;
 			prefix = get_shortname(prefix_init);
 			break;
@@ -286,6 +291,8 @@ quit:
 	free(prefix_init);
 	if(prefix_init != prefix)
 		free(prefix);
+	mem_leave(prev);
+	trace_end(start, "completion", "completion", NULL);
 }
 
 static void finish_input(struct input *input, char *exit)
@@ -396,8 +403,8 @@ char *readline(struct input *input, const struct readline_list **lists,
 	return input->value;
 }
 
-static struct termios mem_tconf;
-int readline_start()
+/* the settings to be restored are kept by the caller */
+int readline_start(struct termios *saved)
 {
 	struct termios tconf;
 	if(!isatty(0)) {
@@ -405,14 +412,14 @@ int readline_start()
 		return 1;
 	}
 	tcgetattr(0, &tconf);
-	memcpy(&mem_tconf, &tconf, sizeof(mem_tconf));
+	memcpy(saved, &tconf, sizeof(*saved));
 	tconf.c_lflag &= ~(ICANON|ECHO);
 	tcsetattr(0, TCSANOW, &tconf);
 	return 0;
 }
 
-int readline_end()
+int readline_end(const struct termios *saved)
 {
-	tcsetattr(0, TCSANOW, &mem_tconf);
+	tcsetattr(0, TCSANOW, saved);
 	return 0;
 }
@@ -1,13 +1,14 @@
 #ifndef READLINE_H_SENTRY
 #define READLINE_H_SENTRY
 #include "list.h"
+#include <termios.h>
 
 enum { input_max_size = 4096 };
 
 struct readline_list {
 	struct list *value;
 	char (*check_rule)(const char *);
-	void (*before_action)(struct list *, const char *);
+	void (*before_action)(struct list *, const char *, void *);
 };
 
 struct input {
@@ -19,6 +20,6 @@ typedef void (*readline_before_action_t)(void *);
 void input_init(struct input *input);
 char *readline(struct input *input, const struct readline_list **lists,
 	readline_before_action_t fn, void *usrdata);
-int readline_start();
-int readline_end();
+int readline_start(struct termios *saved);
+int readline_end(const struct termios *saved);
 #endif
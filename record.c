@@ -0,0 +1,172 @@
+#include "record.h"
+#include "outbuf.h"
+#include "task.h"
+#include <string.h>
+
+/*
+ * Every task is one line: in TSV the fields are separated by tabs and
+ * the tabs, newlines and backslashes inside them are escaped the way
+ * PostgreSQL's COPY does, in JSON lines each task is an object. A value
+ * is copied to the buffer by the runs between the characters which have
+ * to be escaped, so a field without them is a single memcpy.
+ *
+ * A text field which is empty is the same as a missing one: it's null in
+ * JSON lines and an empty field in TSV, so neither format tells them
+ * apart.
+ */
+
+static const char hex[] = "0123456789abcdef";
+
+format_t record_get_format(const char *name)
+{
+	if(!name || strcmp(name, FORMAT_TEXT) == 0)
+		return format_text;
+	if(strcmp(name, FORMAT_TSV) == 0)
+		return format_tsv;
+	if(strcmp(name, FORMAT_JSONL) == 0)
+		return format_jsonl;
+	return format_err;
+}
+
+void record_fill(struct record *rec, const struct task *task, 
+	const char *path)
+{
+	rec->path = path;
+	rec->name = task_get_name(task);
+	rec->info = task_get_field(task, TINFO_FLD);
+	rec->from = task_get_field(task, TFROM_FLD);
+	rec->to = task_get_field(task, TTO_FLD);
+	rec->is_filter = task_is_filter(task);
+	rec->completed = task_get_completed(task);
+}
+
+static void write_tsv_value(struct outbuf *ob, const char *s)
+{
+	const char *run = s;
+	if(!s)
+		return;
+	for(; *s; s++) {
+		char esc;
+		switch(*s) {
+			case '\t':
+				esc = 't';
+				break;
+			case '\n':
+				esc = 'n';
+				break;
+			case '\r':
+				esc = 'r';
+				break;
+			case '\\':
+				esc = '\\';
+				break;
+			default:
+				continue;
+		}
+		outbuf_write(ob, run, s-run);
+		outbuf_putc(ob, '\\');
+		outbuf_putc(ob, esc);
+		run = s+1;
+	}
+	outbuf_write(ob, run, s-run);
+}
+
+void record_write_json_string(struct outbuf *ob, const char *s)
+{
+	const char *run = s;
+	if(!s) {
+		outbuf_puts(ob, "null");
+		return;
+	}
+	outbuf_putc(ob, '"');
+	for(; *s; s++) {
+		unsigned char c = *s;
+		if(c >= 0x20 && c != '"' && c != '\\')
+			continue;
+		outbuf_write(ob, run, s-run);
+		outbuf_putc(ob, '\\');
+		switch(c) {
+			case '"':
+				outbuf_putc(ob, '"');
+				break;
+			case '\\':
+				outbuf_putc(ob, '\\');
+				break;
+			case '\n':
+				outbuf_putc(ob, 'n');
+				break;
+			case '\t':
+				outbuf_putc(ob, 't');
+				break;
+			case '\r':
+				outbuf_putc(ob, 'r');
+				break;
+			default:
+				outbuf_puts(ob, "u00");
+				outbuf_putc(ob, hex[c >> 4]);
+				outbuf_putc(ob, hex[c & 0xf]);
+		}
+		run = s+1;
+	}
+	outbuf_write(ob, run, s-run);
+	outbuf_putc(ob, '"');
+}
+
+void record_write_header(struct outbuf *ob, format_t format)
+{
+	if(format == format_tsv)
+		outbuf_puts(ob, "path\tname\ttype\tcompleted\tfrom\tto\tinfo\n");
+}
+
+static void write_tsv(struct outbuf *ob, const struct record *rec)
+{
+	write_tsv_value(ob, rec->path);
+	outbuf_putc(ob, '\t');
+	write_tsv_value(ob, rec->name);
+	outbuf_puts(ob, rec->is_filter ? "\tfilter\t" : "\ttask\t");
+	if(!rec->is_filter)
+		outbuf_puts(ob, rec->completed ? "true" : "false");
+	outbuf_putc(ob, '\t');
+	write_tsv_value(ob, rec->from);
+	outbuf_putc(ob, '\t');
+	write_tsv_value(ob, rec->to);
+	outbuf_putc(ob, '\t');
+	write_tsv_value(ob, rec->info);
+	outbuf_putc(ob, '\n');
+}
+
+static void write_json_field(struct outbuf *ob, const char *s)
+{
+	record_write_json_string(ob, s && *s ? s : NULL);
+}
+
+static void write_jsonl(struct outbuf *ob, const struct record *rec)
+{
+	outbuf_puts(ob, "{\"path\":");
+	record_write_json_string(ob, rec->path);
+	outbuf_puts(ob, ",\"name\":");
+	write_json_field(ob, rec->name);
+	outbuf_puts(ob, rec->is_filter ? ",\"type\":\"filter\"" : 
+		",\"type\":\"task\"");
+	outbuf_puts(ob, ",\"completed\":");
+	if(rec->is_filter)
+		outbuf_puts(ob, "null");
+	else
+		outbuf_puts(ob, rec->completed ? "true" : "false");
+	outbuf_puts(ob, ",\"from\":");
+	write_json_field(ob, rec->from);
+	outbuf_puts(ob, ",\"to\":");
+	write_json_field(ob, rec->to);
+	outbuf_puts(ob, ",\"info\":");
+	write_json_field(ob, rec->info);
+	outbuf_puts(ob, "}\n");
+}
+
+void record_write(struct outbuf *ob, format_t format, 
+	const struct record *rec)
+{
+	if(format == format_tsv)
+		write_tsv(ob, rec);
+	else if(format == format_jsonl)
+		write_jsonl(ob, rec);
+}
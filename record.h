@@ -0,0 +1,36 @@
+#ifndef RECORD_H_SENTRY
+#define RECORD_H_SENTRY
+
+#define FORMAT_TEXT "text"
+#define FORMAT_TSV "tsv"
+#define FORMAT_JSONL "jsonl"
+
+struct outbuf;
+struct task;
+
+typedef enum {
+	format_err = -1,
+	format_text,	/* for people, not written by this module */
+	format_tsv,
+	format_jsonl,
+} format_t;
+
+/* a task as one line of the machine readable output */
+struct record {
+	const char *path;
+	const char *name;
+	const char *info;
+	const char *from;
+	const char *to;
+	char is_filter;
+	char completed;
+};
+
+format_t record_get_format(const char *name);
+void record_fill(struct record *rec, const struct task *task, 
+	const char *path);
+void record_write_header(struct outbuf *ob, format_t format);
+void record_write(struct outbuf *ob, format_t format, 
+	const struct record *rec);
+void record_write_json_string(struct outbuf *ob, const char *s);
+#endif
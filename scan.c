@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include "scan.h"
+#include "task.h"
+#include "shard.h"
+#include "strlib.h"
+#include "trace.h"
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+/*
+ * Finds the children of a task which may be tasks too, that is the
+ * subdirectories and the links to directories. The type comes from d_type
+ * of getdents64, so the attachments and other stray files are skipped
+ * without a single syscall of their own; only the links and the entries
+ * of the file systems without d_type are looked at with statx, which is
+ * asked for the type alone.
+ *
+ * The children kept in the shard directories (see shard.c) are returned
+ * along with the others, with the path they are stored under.
+ *
+ * The cache keeps the directories which have been scanned by (dev, inode)
+ * with their mtime, so a directory which hasn't changed since is not read
+ * again. The links are checked every time as their targets can change
+ * while the directory doesn't.
+ */
+
+struct linux_dirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct cache_slot {
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	struct scan_entry *ents;
+	long long count;
+};
+
+struct scan_cache {
+	struct cache_slot slots[256];
+};
+
+enum { 
+	getdents_buf_size = 65536,
+	default_entries_size = 64,
+	cache_size = sizeof(((struct scan_cache *)0)->slots)/
+		sizeof(struct cache_slot),
+};
+
+struct scan_cache *scan_cache_new()
+{
+	return calloc(1, sizeof(struct scan_cache));
+}
+
+void scan_cache_free(struct scan_cache *cache)
+{
+	int i;
+	if(!cache)
+		return;
+	for(i = 0; i < cache_size; i++)
+		scan_free(cache->slots[i].ents, cache->slots[i].count);
+	free(cache);
+}
+
+const char *scan_entry_path(const struct scan_entry *ent)
+{
+	return ent->path ? ent->path : ent->name;
+}
+
+void scan_free(struct scan_entry *ents, long long count)
+{
+	long long i;
+	if(!ents)
+		return;
+	for(i = 0; i < count; i++) {
+		free(ents[i].name);
+		free(ents[i].path);
+	}
+	free(ents);
+}
+
+static char is_candidate(const char *name)
+{
+	return name[0] != '.' && strcmp(name, TASK_CORE_FILE) != 0;
+}
+
+static unsigned int get_type(int fd, const char *name, int flags)
+{
+	struct statx stx;
+	if(statx(fd, name, flags|AT_STATX_DONT_SYNC, STATX_TYPE, &stx) == -1)
+		return 0;
+	return stx.stx_mode & S_IFMT;
+}
+
+/* -1 if it's not a task, otherwise if it's a link */
+static char classify(int fd, const char *name, unsigned char dtype)
+{
+	unsigned int type;
+	if(dtype == DT_DIR)
+		return 0;
+	if(dtype != DT_LNK && dtype != DT_UNKNOWN)
+		return -1;
+	if(dtype == DT_UNKNOWN) {
+		type = get_type(fd, name, AT_SYMLINK_NOFOLLOW);
+		if(type == S_IFDIR)
+			return 0;
+		if(type != S_IFLNK)
+			return -1;
+	}
+	return get_type(fd, name, 0) == S_IFDIR ? 1 : -1;
+}
+
+struct entries {
+	struct scan_entry *items;
+	long long count;
+	long long size;
+	char sharded;
+};
+
+static void add_entry(struct entries *ents, const char *shard,
+	const char *name, char is_link)
+{
+	struct scan_entry *ent;
+	if(ents->count == ents->size) {
+		ents->size *= 2;
+		ents->items = realloc(ents->items, sizeof(*ent)*ents->size);
+	}
+	ent = &ents->items[ents->count];
+	ent->name = strdup(name);
+	ent->path = shard ? strings_concatenate(shard, "/", name, NULL) : NULL;
+	ent->is_link = is_link;
+	ents->count++;
+}
+
+/* the children in a shard directory are read as the ones of the task */
+static char read_dir(int fd, const char *shard, struct entries *ents)
+{
+	char *buf = malloc(getdents_buf_size);
+	long rc;
+	while((rc = syscall(SYS_getdents64, fd, buf, getdents_buf_size)) > 0) {
+		long pos;
+		for(pos = 0; pos < rc; ) {
+			struct linux_dirent64 *d = (struct linux_dirent64 *)(buf+pos);
+			char kind;
+			pos += d->d_reclen;
+			if(!shard && shard_is_dirname(d->d_name)) {
+				int sfd = openat(fd, d->d_name, O_RDONLY|O_DIRECTORY);
+				ents->sharded = 1;
+				if(sfd == -1)
+					continue;
+				read_dir(sfd, d->d_name, ents);
+				close(sfd);
+				continue;
+			}
+			if(!is_candidate(d->d_name))
+				continue;
+			kind = classify(fd, d->d_name, d->d_type);
+			if(kind >= 0)
+				add_entry(ents, shard, d->d_name, kind);
+		}
+	}
+	free(buf);
+	return rc < 0 ? -1 : 0;
+}
+
+static struct scan_entry *read_entries(int fd, long long *count, 
+	char *sharded)
+{
+	struct entries ents;
+	ents.size = default_entries_size;
+	ents.items = malloc(sizeof(*(ents.items))*ents.size);
+	ents.count = 0;
+	ents.sharded = 0;
+	if(read_dir(fd, NULL, &ents) != 0) {
+		scan_free(ents.items, ents.count);
+		return NULL;
+	}
+	*count = ents.count;
+	*sharded = ents.sharded;
+	return ents.items;
+}
+
+static struct scan_entry *copy_entries(int fd, const struct scan_entry *src,
+	long long srccount, long long *count)
+{
+	struct entries ents;
+	long long i;
+	ents.size = srccount+1;
+	ents.items = malloc(sizeof(*(ents.items))*ents.size);
+	ents.count = 0;
+	for(i = 0; i < srccount; i++) {
+		/* the target of a link may have stopped being a directory */
+		if(src[i].is_link && classify(fd, src[i].name, DT_LNK) < 0)
+			continue;
+		add_entry(&ents, NULL, src[i].name, src[i].is_link);
+	}
+	*count = ents.count;
+	return ents.items;
+}
+
+static struct cache_slot *get_slot(struct scan_cache *cache, 
+	const struct stat *st)
+{
+	unsigned long long h = (unsigned long long)st->st_ino*0x9e3779b97f4a7c15ULL
+		^ (unsigned long long)st->st_dev;
+	return &cache->slots[(h >> 32) % cache_size];
+}
+
+static char slot_matches(const struct cache_slot *slot, const struct stat *st)
+{
+	return slot->ents && slot->dev == st->st_dev && slot->ino == st->st_ino &&
+		slot->mtime.tv_sec == st->st_mtim.tv_sec && 
+		slot->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static struct scan_entry *scan_entries(int dirfd, const char *path, 
+	struct scan_cache *cache, long long *count)
+{
+	struct scan_entry *ents;
+	struct cache_slot *slot;
+	struct stat st;
+	char sharded;
+	int fd = openat(dirfd, path, O_RDONLY|O_DIRECTORY);
+	if(fd == -1)
+		return NULL;
+	if(!cache || fstat(fd, &st) == -1) {
+		ents = read_entries(fd, count, &sharded);
+		close(fd);
+		return ents;
+	}
+	slot = get_slot(cache, &st);
+	if(!slot_matches(slot, &st)) {
+		scan_free(slot->ents, slot->count);
+		slot->ents = read_entries(fd, &slot->count, &sharded);
+		slot->dev = st.st_dev;
+		slot->ino = st.st_ino;
+		slot->mtime = st.st_mtim;
+		/* the mtime of the task doesn't change with its shards */
+		if(slot->ents && sharded) {
+			ents = slot->ents;
+			*count = slot->count;
+			slot->ents = NULL;
+			close(fd);
+			return ents;
+		}
+	}
+	ents = slot->ents ? 
+		copy_entries(fd, slot->ents, slot->count, count) : NULL;
+	close(fd);
+	return ents;
+}
+
+struct scan_entry *scan_dir(int dirfd, const char *path, 
+	struct scan_cache *cache, long long *count)
+{
+	long long start = trace_begin();
+	struct scan_entry *ents = scan_entries(dirfd, path, cache, count);
+	trace_end(start, "scan", "scan_dir", path);
+	return ents;
+}
@@ -0,0 +1,19 @@
+#ifndef SCAN_H_SENTRY
+#define SCAN_H_SENTRY
+
+/* a child of a task which can be a task itself */
+struct scan_entry {
+	char *name;
+	char *path;		/* where it's stored if it's in a shard, NULL otherwise */
+	char is_link;
+};
+
+struct scan_cache;
+
+struct scan_cache *scan_cache_new();
+void scan_cache_free(struct scan_cache *cache);
+struct scan_entry *scan_dir(int dirfd, const char *path, 
+	struct scan_cache *cache, long long *count);
+const char *scan_entry_path(const struct scan_entry *ent);
+void scan_free(struct scan_entry *ents, long long count);
+#endif
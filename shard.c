@@ -0,0 +1,312 @@
+#include "shard.h"
+#include "strlib.h"
+#include "merkle.h"
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+
+/*
+ * A task with very many children can keep them in a fan-out layout: the
+ * child "name" is stored as ".sXX/name", where XX is a byte of the hash
+ * of the name, and the task has the SHARD_FILE marker. The shard
+ * directories start with a dot, so nothing takes them for tasks, and the
+ * paths the user types are translated into the stored ones by
+ * shard_resolve. While a task is being resharded its children are in
+ * both places, so a child which isn't where the layout says is looked
+ * for in the other one.
+ */
+
+enum { shard_name_size = sizeof(SHARD_PREFIX)-1+2 };
+
+char shard_is_dirname(const char *name)
+{
+	long long plen = sizeof(SHARD_PREFIX)-1;
+	return strncmp(name, SHARD_PREFIX, plen) == 0 && 
+		strlen(name) == shard_name_size &&
+		strspn(name+plen, "0123456789abcdef") == 2;
+}
+
+static void get_shard_name(const char *name, long long len, 
+	char buf[shard_name_size+1])
+{
+	unsigned int h = 2166136261u;
+	long long i;
+	for(i = 0; i < len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	sprintf(buf, "%s%02x", SHARD_PREFIX, (h ^ (h >> 8) ^ (h >> 16)) & 0xff);
+}
+
+char shard_is_sharded(int dirfd, const char *path)
+{
+	char *marker = strings_concatenate(path, "/", SHARD_FILE, NULL);
+	char res = faccessat(dirfd, marker, F_OK, AT_SYMLINK_NOFOLLOW) == 0;
+	free(marker);
+	return res;
+}
+
+/* where a child of a sharded task is kept */
+char *shard_child_path(const char *name)
+{
+	char shard[shard_name_size+1];
+	get_shard_name(name, strlen(name), shard);
+	return strings_concatenate(shard, "/", name, NULL);
+}
+
+static char exists(int dirfd, const char *path)
+{
+	return faccessat(dirfd, path, F_OK, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+/* 
+ * The stored path of the one relative to the dirfd. The dot names are
+ * never sharded, so a path which has been resolved stays as it is.
+ */
+char *shard_resolve(int dirfd, const char *path)
+{
+	char *result;
+	long long len = 0;
+	const char *p = path;
+	if(!path)
+		return NULL;
+	if(path[0] == '/')
+		return strdup(path);
+	result = malloc(strlen(path)*(shard_name_size+2)+2);
+	result[0] = 0;
+	while(*p) {
+		const char *sep = strchr(p, '/');
+		int clen = sep ? sep-p : (int)strlen(p);
+		const char *delim = len ? "/" : "";
+		char shard[shard_name_size+1];
+		if(clen == 0) {
+			p++;
+			continue;
+		}
+		if(p[0] != '.' && shard_is_sharded(dirfd, len ? result : ".")) {
+			get_shard_name(p, clen, shard);
+			sprintf(result+len, "%s%s/%.*s", delim, shard, clen, p);
+			/* a child not moved yet by an unfinished reshard */
+			if(!exists(dirfd, result)) {
+				sprintf(result+len, "%s%.*s", delim, clen, p);
+				if(!exists(dirfd, result))
+					sprintf(result+len, "%s%s/%.*s", delim, shard, clen, p);
+			}
+		} else
+			sprintf(result+len, "%s%.*s", delim, clen, p);
+		len = strlen(result);
+		p += sep ? clen+1 : clen;
+	}
+	if(!len)
+		strcpy(result, ".");
+	return result;
+}
+
+/* the path without the shard directories */
+char *shard_logical(const char *path)
+{
+	char *result = malloc(strlen(path)+1);
+	long long len = 0;
+	const char *p = path;
+	while(*p) {
+		const char *sep = strchr(p, '/');
+		long long clen = sep ? sep-p : (long long)strlen(p);
+		char comp[shard_name_size+1];
+		char is_shard = 0;
+		if(clen == shard_name_size) {
+			memcpy(comp, p, clen);
+			comp[clen] = 0;
+			is_shard = shard_is_dirname(comp);
+		}
+		if(clen > 0 && !is_shard) {
+			if(len > 0 || path[0] == '/')
+				result[len++] = '/';
+			memcpy(result+len, p, clen);
+			len += clen;
+		}
+		p += sep ? clen+1 : clen;
+	}
+	result[len] = 0;
+	return result;
+}
+
+/* the shard directory of a new child may not exist yet */
+char shard_make_parent(int dirfd, const char *path)
+{
+	const char *sep = strrchr(path, '/');
+	const char *shard;
+	char *parent;
+	char ok = 0;
+	if(!sep)
+		return 0;
+	for(shard = sep; shard > path && shard[-1] != '/'; shard--)
+		;
+	if(sep-shard != shard_name_size || 
+		strncmp(shard, SHARD_PREFIX, sizeof(SHARD_PREFIX)-1) != 0)
+		return 0;
+	parent = malloc(sep-path+1);
+	memcpy(parent, path, sep-path);
+	parent[sep-path] = 0;
+	if(mkdirat(dirfd, parent, 0777) == -1 && errno != EEXIST)
+		ok = -1;
+	free(parent);
+	return ok;
+}
+
+static char is_moved(int fd, const struct dirent *dent)
+{
+	struct stat st;
+	if(dent->d_name[0] == '.')
+		return 0;
+	if(dent->d_type != DT_UNKNOWN)
+		return dent->d_type == DT_DIR || dent->d_type == DT_LNK;
+	if(fstatat(fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+		return 0;
+	return S_ISDIR(st.st_mode) || S_ISLNK(st.st_mode);
+}
+
+/* the shard directories or the children which can be tasks */
+static char **get_names(int fd, char shards, long long *count)
+{
+	char **names;
+	long long size = 64;
+	struct dirent *dent;
+	DIR *dir;
+	int dupfd = dup(fd);
+	*count = 0;
+	dir = dupfd == -1 ? NULL : fdopendir(dupfd);
+	if(!dir) {
+		if(dupfd != -1)
+			close(dupfd);
+		return NULL;
+	}
+	names = malloc(sizeof(*names)*size);
+	while((dent = readdir(dir)) != NULL) {
+		if(shards ? !shard_is_dirname(dent->d_name) : !is_moved(fd, dent))
+			continue;
+		if(*count == size) {
+			size *= 2;
+			names = realloc(names, sizeof(*names)*size);
+		}
+		names[(*count)++] = strdup(dent->d_name);
+	}
+	closedir(dir);
+	return names;
+}
+
+static void free_names(char **names, long long count)
+{
+	long long i;
+	for(i = 0; i < count; i++)
+		free(names[i]);
+	free(names);
+}
+
+/* every child is moved on its own, so the task stays usable meanwhile */
+static char move_child(int fd, const char *oldpath, const char *newpath,
+	shard_move_fn_t fn, void *usrdata)
+{
+	if(renameat(fd, oldpath, fd, newpath) != 0)
+		return -1;
+	if(fn)
+		fn(oldpath, newpath, usrdata);
+	return 0;
+}
+
+static char shard_children(int fd, shard_move_fn_t fn, void *usrdata)
+{
+	char **names;
+	long long count, i;
+	char ok = 0;
+	names = get_names(fd, 0, &count);
+	if(!names)
+		return -1;
+	for(i = 0; i < count && ok == 0; i++) {
+		char shard[shard_name_size+1];
+		char *newpath;
+		get_shard_name(names[i], strlen(names[i]), shard);
+		if(mkdirat(fd, shard, 0777) == -1 && errno != EEXIST) {
+			ok = -1;
+			break;
+		}
+		newpath = strings_concatenate(shard, "/", names[i], NULL);
+		ok = move_child(fd, names[i], newpath, fn, usrdata);
+		free(newpath);
+		/* the shard has changed, so its hash is to be counted again */
+		newpath = strings_concatenate(shard, "/", HASH_FILE, NULL);
+		unlinkat(fd, newpath, 0);
+		free(newpath);
+	}
+	free_names(names, count);
+	return ok;
+}
+
+static char unshard_children(int fd, shard_move_fn_t fn, void *usrdata)
+{
+	char **shards;
+	long long scount, i;
+	char ok = 0;
+	shards = get_names(fd, 1, &scount);
+	if(!shards)
+		return -1;
+	for(i = 0; i < scount && ok == 0; i++) {
+		char **names;
+		long long count, j;
+		int sfd = openat(fd, shards[i], O_RDONLY|O_DIRECTORY);
+		names = sfd == -1 ? NULL : get_names(sfd, 0, &count);
+		if(sfd != -1)
+			close(sfd);
+		if(!names) {
+			ok = -1;
+			break;
+		}
+		for(j = 0; j < count && ok == 0; j++) {
+			char *oldpath = strings_concatenate(shards[i], "/", names[j],
+				NULL);
+			ok = move_child(fd, oldpath, names[j], fn, usrdata);
+			free(oldpath);
+		}
+		free_names(names, count);
+		if(ok == 0) {
+			char *hashpath = strings_concatenate(shards[i], "/", HASH_FILE, 
+				NULL);
+			unlinkat(fd, hashpath, 0);
+			free(hashpath);
+			ok = unlinkat(fd, shards[i], AT_REMOVEDIR) == 0 ? 0 : -1;
+		}
+	}
+	free_names(shards, scount);
+	return ok;
+}
+
+/* 
+ * Turns the layout on or off. The marker is made first and removed last,
+ * so if it's stopped halfway it's enough to run it again.
+ */
+char shard_reshard(int dirfd, const char *path, char enable, 
+	shard_move_fn_t fn, void *usrdata)
+{
+	char ok;
+	int mfd, fd = openat(dirfd, path, O_RDONLY|O_DIRECTORY);
+	if(fd == -1)
+		return -1;
+	if(enable) {
+		mfd = openat(fd, SHARD_FILE, O_WRONLY|O_CREAT, 0666);
+		ok = mfd == -1 ? -1 : 0;
+		if(mfd != -1)
+			close(mfd);
+		if(ok == 0)
+			ok = shard_children(fd, fn, usrdata);
+	} else {
+		ok = unshard_children(fd, fn, usrdata);
+		if(ok == 0 && unlinkat(fd, SHARD_FILE, 0) != 0 && errno != ENOENT)
+			ok = -1;
+	}
+	close(fd);
+	return ok;
+}
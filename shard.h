@@ -0,0 +1,19 @@
+#ifndef SHARD_H_SENTRY
+#define SHARD_H_SENTRY
+
+#define SHARD_FILE ".shards"
+#define SHARD_PREFIX ".s"
+
+/* called for every child moved by a reshard, the paths are physical */
+typedef void (*shard_move_fn_t)(const char *oldpath, const char *newpath,
+	void *usrdata);
+
+char shard_is_dirname(const char *name);
+char shard_is_sharded(int dirfd, const char *path);
+char *shard_child_path(const char *name);
+char *shard_resolve(int dirfd, const char *path);
+char *shard_logical(const char *path);
+char shard_make_parent(int dirfd, const char *path);
+char shard_reshard(int dirfd, const char *path, char enable, 
+	shard_move_fn_t fn, void *usrdata);
+#endif
@@ -6,12 +6,32 @@
 #include "fslib.h"
 #include "task.h"
 #include "path.h"
+#include "listing.h"
+#include "linkidx.h"
+#include "copy.h"
+#include "merkle.h"
+#include "sync.h"
+#include "archive.h"
+#include "tasklog.h"
+#include "logstore.h"
+#include "snapshot.h"
+#include "scan.h"
+#include "shard.h"
+#include "query.h"
+#include "record.h"
+#include "outbuf.h"
+#include "ingest.h"
+#include "libtask.h"
+#include "grep.h"
+#include "trace.h"
+#include "walk.h"
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <dirent.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 
@@ -26,12 +46,27 @@
 #define CMD_MV "mv"
 #define CMD_SET "set"
 #define CMD_CLEAR "clear"
+#define CMD_CP "cp"
+#define CMD_SYNC "sync"
+#define CMD_EXPORT "export"
+#define CMD_IMPORT "import"
+#define CMD_RESHARD "reshard"
+#define CMD_FIND "find"
+#define CMD_IMPORT_CSV "import-csv"
+#define CMD_IMPORT_TODOTXT "import-todotxt"
+#define CMD_GREP "grep"
+#define CMD_MEMSTATS "memstats"
 
 #define FILTER_TASK_FLAG "-f"
-
-enum {
-    bsize = 4096,
-};
+#define RECURSIVE_FLAG "-r"
+#define MATCH_FLAG "-m"
+#define OFF_FLAG "--off"
+#define MEMORY_FLAG "--memory"
+#define ICASE_FLAG "-i"
+#define FOLLOW_FLAG "--follow"
+#define ENGINE_PARAM "--engine"
+#define ENGINE_FS "fs"
+#define ENGINE_LOG "log"
 
 typedef enum {
     cmd_help,
@@ -45,6 +80,16 @@ typedef enum {
 	cmd_mv,
 	cmd_set,
 	cmd_clear,
+	cmd_cp,
+	cmd_sync,
+	cmd_export,
+	cmd_import,
+	cmd_reshard,
+	cmd_find,
+	cmd_import_csv,
+	cmd_import_todotxt,
+	cmd_grep,
+	cmd_memstats,
     cmd_empty, 
     cmd_err,
 } cmd_type;
@@ -59,77 +104,196 @@ typedef enum {
     err_failed_rm,
     err_failed_show,
 	err_failed_run,
+	err_invalid_pipe,
 	err_failed_ln,
 	err_failed_mv,
 	err_failed_clear,
 	err_failed_set,
+	err_failed_cp,
+	err_failed_sync,
+	err_failed_export,
+	err_failed_import,
+	err_failed_reshard,
+	err_failed_find,
+	err_failed_import_csv,
+	err_failed_import_todotxt,
+	err_failed_grep,
 } status;
 
+/* the tasks a command passes to the next one through '|' */
+struct task_pipe {
+	struct query_match *tasks;	/* the paths are from the root */
+	long long count;
+	char in;		/* the current command takes the tasks */
+	char out;		/* the current command passes the tasks on */
+};
+
+/*
+ * The root and the current task are held as open directories and every
+ * operation is done relative to them, so the paths are resolved by the
+ * kernel from there instead of from the file system root each time.
+ */
 struct state {
-	char root[bsize];
-	char cwd[bsize];
+	struct libtask lib;
+	int cwdfd;
+	char *cwd;	/* current task relative to the root, "" for the root */
 	cmd_type last_cmd;
 	struct task *cur_task;
+	char use_snapshot;		/* show may be answered from the snapshot */
+	struct task_pipe pipe;
 };
 
-static int change_dir(const char *path, struct state *state)
-{
-	int ok = chdir(path);
-	if(ok == -1)
-		return -1;
-	getcwd(state->cwd, sizeof(state->cwd));
-	return 0;
-}
+/* a path in the form it's passed to the *at() calls */
+struct location {
+	int dirfd;
+	char *path;
+};
 
 static char state_init(struct state *state)
 {
-	char *tmp;
 	if(!state)
 		return -1;
-	tmp = getcwd(state->root, sizeof(state->root));
-	if(!tmp)
+	if(libtask_open(&state->lib, ".") != 0)
+		return -1;
+	state->cwdfd = open(".", O_RDONLY|O_DIRECTORY);
+	if(state->cwdfd == -1)
 		return -1;
-	strcpy(state->cwd, state->root);
+	state->cwd = strdup("");
 	state->cur_task = NULL;
+	state->use_snapshot = 0;
+	state->pipe.tasks = NULL;
+	state->pipe.count = 0;
+	state->pipe.in = 0;
+	state->pipe.out = 0;
 	return 0;
 }
 
+static void state_free(struct state *state)
+{
+	libtask_close(&state->lib);
+	close(state->cwdfd);
+	free(state->cwd);
+	task_free(state->cur_task);
+	query_free_matches(state->pipe.tasks, state->pipe.count);
+}
+
 static void print_shortcwd(struct state *state)
 {
-	char *shortpath;
-	shortpath = get_shortpath(state->root, state->cwd);
-	if(!shortpath)
-		return;
-	printf("~%s$ ", shortpath);
+	printf("~%s%s$ ", state->cwd[0] ? "/" : "", state->cwd);
 	fflush(stdout);
 }
 
-static char *process_path(const char *path, const struct state *state)
+/* absolute path where "." and ".." are resolved without the file system */
+static char *get_abspath(const char *path, const struct state *state)
 {
-	char *newpath;
-	if(!path)
-		return NULL;
-	if(path[0] != '~')
-		return strdup(path);
-	if(!state)
-		return NULL;
-	path++; /* skip '~' */
-	if(path[0] == '/')
-		path++; /* skip '/' */
-	newpath = paths_union(state->root, path);
-	return newpath;
+	char *fullpath, *result;
+	if(path[0] == '~')
+		fullpath = strings_concatenate(state->lib.root, "/", path+1, NULL);
+	else if(is_abspath(path))
+		fullpath = strdup(path);
+	else
+		fullpath = strings_concatenate(state->lib.root, "/", state->cwd, "/", 
+			path, NULL);
+	result = path_normalize(fullpath);
+	free(fullpath);
+	return result;
+}
+
+/* path relative to the root, NULL if it's outside of the project */
+static char *get_relpath(const char *path, const struct state *state)
+{
+	char *abspath, *result;
+	abspath = get_abspath(path, state);
+	result = path_strip_root(state->lib.root, abspath);
+	free(abspath);
+	return result;
+}
+
+/* the path relative to the root with its last component not resolved */
+static char *get_link_relpath(const char *path, const struct state *state)
+{
+	char *abspath, *result;
+	abspath = get_abspath(path, state);
+	result = path_get_relative(state->lib.root, abspath, 0);
+	free(abspath);
+	return result;
+}
+
+/* the path in the log, which can't reach anything outside of the project */
+static char *get_log_path(const char *path, const struct state *state,
+	const char *cmd)
+{
+	char *relpath = get_relpath(path, state);
+	if(!relpath)
+		fprintf(stderr, "%s: %s is outside of the project\n", cmd, path);
+	return relpath;
+}
+
+/* the absolute path the object is stored under */
+static char *get_stored_abspath(const char *path, const struct state *state)
+{
+	char *relpath, *physpath, *result;
+	relpath = get_relpath(path, state);
+	if(!relpath)
+		return get_abspath(path, state);
+	physpath = shard_resolve(state->lib.rootfd, relpath);
+	result = strcmp(physpath, ".") == 0 ? strdup(state->lib.root) :
+		paths_union(state->lib.root, physpath);
+	free(relpath);
+	free(physpath);
+	return result;
+}
+
+static char has_parent_ref(const char *path)
+{
+	const char *match = path;
+	while((match = strstr(match, "..")) != NULL) {
+		if((match == path || match[-1] == '/') && 
+			(match[2] == 0 || match[2] == '/'))
+			return 1;
+		match += 2;
+	}
+	return 0;
+}
+
+/*
+ * "~" paths start from the root and the relative ones from the current
+ * task. The ones going up with ".." are resolved the same way as the
+ * prompt is, so "go .." from a linked task returns to where it's linked.
+ * The resulting path is the stored one, with the shards of the sharded
+ * tasks in it.
+ */
+static void get_location(const char *path, const struct state *state,
+	struct location *loc)
+{
+	char *relpath;
+	if(path[0] == '~' || (!is_abspath(path) && has_parent_ref(path))) {
+		relpath = get_relpath(path, state);
+		if(relpath) {
+			loc->dirfd = state->lib.rootfd;
+			loc->path = shard_resolve(state->lib.rootfd, relpath);
+			free(relpath);
+			return;
+		}
+		loc->dirfd = AT_FDCWD;
+		loc->path = get_abspath(path, state);
+		return;
+	}
+	loc->dirfd = is_abspath(path) ? AT_FDCWD : state->cwdfd;
+	loc->path = shard_resolve(loc->dirfd, path);
 }
 
 static char *get_full_destpath(const char *path, const char *ext)
 {
-	char *result, *shortname;
+	char *result;
+	const char *shortname;
 	long long len;
 	len = strlen(path);
 	if(path[len-1] != '/')
 		return strdup(path);	
-	shortname = get_shortname(ext);
+	shortname = strrchr(ext, '/');
+	shortname = shortname ? shortname+1 : ext;
 	result = strings_concatenate(path, shortname, NULL);	
-	free(shortname);
 	return result;
 }
 
@@ -137,17 +301,58 @@ static char *get_full_destpath(const char *path, const char *ext)
 "Commands:\n" \
 "help -- display this information.\n" \
 "init -- initialize the project.\n" \
+"init --engine=log -- initialize the project which keeps all its tasks in\n" \
+"  one log file.\n" \
 "exit -- exit from the program.\n" \
 "mk [taskname] -- making an object of task.\n" \
 "mk [taskname] -f -- making an object of filter.\n" \
 "rm [taskname] -- removing an object.\n" \
+"rm -m [query] -- remove all the subtasks matching the query (see find).\n" \
 "go [path] -- moving between objects.\n" \
 "show -- display content of current object.\n" \
 "show [path] -- display content of an object.\n" \
+"show [path] --sort=status|deadline|name --limit=N --offset=N -- display\n" \
+"  sorted and paged content of an object.\n" \
+"show [path] --format=tsv|jsonl -- print the subtasks one per line for\n" \
+"  the other programs; find takes --format as well.\n" \
 "ln [target] [linkpath] -- link an object to another object.\n" \
 "mv [oldpath] [newpath] -- move or rename task.\n" \
 "set [field] [value] -- set a value of task's field.\n" \
-"clear -- clear the terminal screen.\n"
+"set -m [query] [field] [value] -- set the field of all the subtasks\n" \
+"  matching the query (see find).\n" \
+"cp [src] [dst] -- copy a task without its subtasks.\n" \
+"cp -r [src] [dst] -- copy a task with all its subtasks.\n" \
+"sync [src-root] [dst-root] -- make the second project equal to the first one.\n" \
+"export [file] -- pack the whole project into one file.\n" \
+"import [file] [path] -- unpack the project into the path (the current\n" \
+"  object by default).\n" \
+"reshard [path] -- keep the subtasks of an object in hashed subdirectories,\n" \
+"  which keeps the objects with very many subtasks fast.\n" \
+"reshard [path] --off -- keep the subtasks of an object directly in it.\n" \
+"find [query] -- list the subtasks matching the query, which is a list of\n" \
+"  terms separated by commas: field=pattern, field!=pattern or a pattern\n" \
+"  of the path like * or */bug*; without a path pattern the whole subtree\n" \
+"  is searched.\n" \
+"find [query] --memory -- read the matching tasks and report the memory\n" \
+"  they take.\n" \
+"find [query] --follow -- go into the linked tasks as well, each task is\n" \
+"  listed once however many links lead to it; grep takes --follow too.\n" \
+"import-csv [file] [path] -- create the tasks listed in the CSV file in the\n" \
+"  path (the current object by default); the header names the columns:\n" \
+"  path, name, info, completed, from, to, type.\n" \
+"import-todotxt [file] [path] -- create the tasks of the todo.txt file in the\n" \
+"  path, the +project of a task is the filter it goes into.\n" \
+"grep [regex] [path] -- print the lines of the names and the infos of the\n" \
+"  subtasks matching the extended regular expression, -i ignores case.\n" \
+"memstats -- print the allocations of the program by its area: the parser,\n" \
+"  the tokenizer, the completion and the listing.\n" \
+"clear -- clear the terminal screen.\n" \
+"Commands can be chained:\n" \
+"a; b -- run the commands one after another.\n" \
+"a && b -- run the second command if the first one has succeeded.\n" \
+"find [query] | b, show [path] | b -- pass the found tasks or the subtasks\n" \
+"  to b, which is one of set [field] [value], rm or mv [dir]. The pipe is\n" \
+"  a | with spaces around it, one inside of a word is a part of the word.\n"
 
 static status help_action()
 {
@@ -155,39 +360,320 @@ static status help_action()
     return 0;
 }
 
-static status exit_action(struct state *state)
+static void update_hashes(const struct state *state, const char *relpath)
 {
-	char ok = task_write(state->cwd, state->cur_task);
-	if(ok != 0)
+	if(relpath && libtask_update_hashes(&state->lib, relpath) != 0)
+		perror(HASH_FILE);
+}
+
+/* for the objects which have been removed or which are links */
+static void update_parent_hashes(const struct state *state,
+	const char *relpath)
+{
+	char *parent, *sep;
+	if(!relpath)
+		return;
+	parent = shard_resolve(state->lib.rootfd, relpath);
+	sep = strrchr(parent, '/');
+	if(sep)
+		*sep = 0;
+	else
+		parent[0] = 0;
+	update_hashes(state, parent);
+	free(parent);
+}
+
+static void save_cur_task(const struct state *state)
+{
+	char ok;
+	if(!task_is_edited(state->cur_task))
+		return;
+	if(state->lib.log) {
+		if(logstore_write(state->lib.log, state->cwd, state->cur_task) != 0)
+			perror(TASKLOG_FILE);
+		return;
+	}
+	ok = task_write(state->cwdfd, ".", state->cur_task);
+	if(ok != 0) {
 		perror("task_write");
+		return;
+	}
+	update_hashes(state, state->cwd);
+}
+
+static status exit_action(struct state *state)
+{
+	save_cur_task(state);
     return 0;
 }
 
-static status init_action()
+static status init_log_action(struct state *state)
 {
-    int fd = open(TASK_CORE_FILE, O_WRONLY|O_CREAT, 0666);
+	if(state->lib.log)
+		return 0;
+	if(state->cwd[0]) {
+		fprintf(stderr, "%s: the log is made in the project root\n", 
+			CMD_INIT);
+		return err_failed_init;
+	}
+	state->lib.log = tasklog_open(state->lib.rootfd, TASKLOG_FILE, 1);
+	if(!state->lib.log || tasklog_put(state->lib.log, "", "", 0) != 0) {
+		perror(CMD_INIT);
+		return err_failed_init;
+	}
+	return 0;
+}
+
+static status init_action(const char *params[], struct state *state)
+{
+	const char *engine = params ? param_get_value(params, ENGINE_PARAM) : 
+		NULL;
+	int fd;
+	if(engine && strcmp(engine, ENGINE_LOG) == 0)
+		return init_log_action(state);
+	if(engine && strcmp(engine, ENGINE_FS) != 0)
+		return err_invalid_params;
+	if(state->lib.log)
+		return 0;
+    fd = openat(state->cwdfd, TASK_CORE_FILE, O_WRONLY|O_CREAT, 0666);
     if(fd == -1) {
 		perror(CMD_INIT);
         return err_failed_init;
 	}
+	close(fd);
+	update_hashes(state, state->cwd);
     return 0;
 }
 
+#define SORT_PARAM "--sort"
+#define LIMIT_PARAM "--limit"
+#define FORMAT_PARAM "--format"
+#define OFFSET_PARAM "--offset"
+
+static char get_count_param(const char *params[], const char *name,
+	long long *count)
+{
+	const char *value = param_get_value(params, name);
+	char *end;
+	if(!value)
+		return 0;
+	*count = strtoll(value, &end, 10);
+	if(!*value || *end || *count < 0)
+		return -1;
+	return 0;
+}
+
+static char get_listing_opts(const char *params[], 
+	struct listing_opts *opts)
+{
+	const char *sort;
+	listing_opts_init(opts);
+	if(!params)
+		return 0;
+	sort = param_get_value(params, SORT_PARAM);
+	if(sort) {
+		opts->sort = listing_get_sort(sort);
+		if(opts->sort == sort_err)
+			return -1;
+	}
+	if(get_count_param(params, LIMIT_PARAM, &opts->limit) != 0)
+		return -1;
+	if(get_count_param(params, OFFSET_PARAM, &opts->offset) != 0)
+		return -1;
+	opts->format = record_get_format(param_get_value(params, FORMAT_PARAM));
+	if(opts->format == format_err)
+		return -1;
+	return 0;
+}
+
+static status show_log_action(const char *operand, 
+	const struct listing_opts *opts, struct state *state)
+{
+	struct task *task = state->cur_task;
+	struct outbuf ob;
+	char *relpath;
+	char ok;
+	relpath = operand ? get_log_path(operand, state, CMD_SHOW) : 
+		strdup(state->cwd);
+	if(!relpath)
+		return err_failed_show;
+	if(operand)
+		task = logstore_read(state->lib.log, relpath);
+	outbuf_init(&ob, 1);
+	ok = logstore_print(state->lib.log, task, relpath, opts, &ob);
+	outbuf_free(&ob);
+	free(relpath);
+	if(state->cur_task != task)
+		task_free(task);
+	if(ok == -1) {
+		perror(CMD_SHOW);
+		return err_failed_show;
+	}
+	return 0;
+}
+
+static struct snapshot *rebuild_snapshot(const struct merkle *mk,
+	struct snapshot *old, char recheck)
+{
+	if(snapshot_build(mk, old, recheck) != 0)
+		perror(SNAPSHOT_FILE);
+	snapshot_close(old);
+	return snapshot_open(mk->rootfd);
+}
+
+/* 
+ * The snapshot is rebuilt first if the project has changed since it was
+ * made, and once more without trusting the hashes if what is shown has
+ * been changed behind the shell's back. -1 means it can't answer and the
+ * tasks have to be read.
+ */
+static char show_snapshot(const char *operand, 
+	const struct listing_opts *opts, const struct state *state)
+{
+	struct snapshot *snap;
+	struct merkle mk;
+	struct outbuf ob;
+	char *relpath;
+	char ok = -1;
+	relpath = operand ? get_relpath(operand, state) : strdup(state->cwd);
+	if(!relpath)
+		return -1;
+	mk.rootfd = state->lib.rootfd;
+	mk.root = state->lib.root;
+	snap = snapshot_open(state->lib.rootfd);
+	if(!snapshot_is_fresh(snap, &mk))
+		snap = rebuild_snapshot(&mk, snap, 0);
+	if(snap && outbuf_init(&ob, 1) == 0) {
+		ok = snapshot_show(snap, relpath, opts, &ob);
+		if(ok != 0 && errno == ESTALE) {
+			snap = rebuild_snapshot(&mk, snap, 1);
+			ok = snap ? snapshot_show(snap, relpath, opts, &ob) : -1;
+		}
+		outbuf_free(&ob);
+	}
+	snapshot_close(snap);
+	free(relpath);
+	return ok;
+}
+
+/* the name appended to the path, where "" and "." are the root */
+static char *join_path(const char *dir, const char *name)
+{
+	if(!dir[0] || strcmp(dir, ".") == 0)
+		return string_duplicate(name);
+	return strings_concatenate(dir, "/", name, NULL);
+}
+
+static void pipe_clear(struct state *state)
+{
+	query_free_matches(state->pipe.tasks, state->pipe.count);
+	state->pipe.tasks = NULL;
+	state->pipe.count = 0;
+}
+
+static void pipe_pass(struct state *state, struct query_match *tasks,
+	long long count)
+{
+	pipe_clear(state);
+	state->pipe.tasks = tasks;
+	state->pipe.count = count;
+}
+
+static status show_log_pipe_action(const char *operand, struct state *state)
+{
+	struct query_match *tasks;
+	char **names, *relpath;
+	long long i, count;
+	relpath = get_log_path(operand ? operand : ".", state, CMD_SHOW);
+	if(!relpath)
+		return err_failed_show;
+	names = logstore_list(state->lib.log, relpath, 0, &count);
+	if(count == -1) {
+		perror(CMD_SHOW);
+		free(relpath);
+		return err_failed_show;
+	}
+	tasks = malloc(sizeof(*tasks)*(count+1));
+	for(i = 0; i < count; i++) {
+		tasks[i].path = join_path(relpath, names[i]);
+		tasks[i].phys = string_duplicate(tasks[i].path);
+		tasks[i].task = NULL;
+	}
+	pipe_pass(state, tasks, count);
+	logstore_free_list(names, count);
+	free(relpath);
+	return 0;
+}
+
+/* the subtasks are passed on to the next command instead */
+static status show_pipe_action(const char *operand, struct state *state)
+{
+	struct scan_entry *ents;
+	struct query_match *tasks;
+	char *relpath, *physpath;
+	long long i, count = -1, n = 0;
+	if(state->lib.log)
+		return show_log_pipe_action(operand, state);
+	relpath = get_relpath(operand ? operand : ".", state);
+	if(!relpath) {
+		fprintf(stderr, "%s: %s is outside of the project\n", CMD_SHOW,
+			operand);
+		return err_failed_show;
+	}
+	physpath = shard_resolve(state->lib.rootfd, relpath);
+	ents = scan_dir(state->lib.rootfd, physpath, state->lib.scan_cache, &count);
+	if(count == -1) {
+		perror(CMD_SHOW);
+		free(relpath);
+		free(physpath);
+		return err_failed_show;
+	}
+	tasks = malloc(sizeof(*tasks)*(count+1));
+	for(i = 0; i < count; i++) {
+		if(ents[i].is_link)
+			continue;
+		tasks[n].path = join_path(relpath, ents[i].name);
+		tasks[n].phys = join_path(physpath, scan_entry_path(&ents[i]));
+		tasks[n].task = NULL;
+		n++;
+	}
+	pipe_pass(state, tasks, n);
+	scan_free(ents, count);
+	free(relpath);
+	free(physpath);
+	return 0;
+}
+
 static status show_action(const char *params[], struct state *state)
 {
 	struct task *task = state->cur_task;
-    char cdir[bsize];
+	struct listing_opts opts;
+	struct location loc;
+	struct outbuf ob;
+	const char *operand;
     char ok;
-	if(params && params[0]) {
-		char *path;
-		path = process_path(params[0], state);
-		strcpy(cdir, path);
-		task = task_read(cdir);
-		free(path);
+	if(get_listing_opts(params, &opts) != 0)
+		return err_invalid_params;
+	opts.cache = state->lib.scan_cache;
+	operand = param_get_operand(params, 0);
+	if(state->pipe.out)
+		return show_pipe_action(operand, state);
+	if(state->lib.log)
+		return show_log_action(operand, &opts, state);
+	if(state->use_snapshot && opts.format == format_text && 
+		show_snapshot(operand, &opts, state) == 0)
+		return 0;
+	if(operand) {
+		get_location(operand, state, &loc);
+		task = task_read(loc.dirfd, loc.path);
+	} else {
+		loc.dirfd = state->cwdfd;
+		loc.path = strdup(".");
 	}
-	else
-		memcpy(cdir, state->cwd, sizeof(cdir));
-    ok = task_print(task, cdir);
+	outbuf_init(&ob, 1);
+    ok = task_print(task, loc.dirfd, loc.path, &opts, &ob);
+	outbuf_free(&ob);
+	free(loc.path);
 	if(state->cur_task != task)
 		task_free(task);
     if(ok == -1) {
@@ -197,83 +683,349 @@ static status show_action(const char *params[], struct state *state)
     return 0;
 }
 
+static status go_log_action(char *relpath, struct state *state)
+{
+	if(!tasklog_exists(state->lib.log, relpath)) {
+		fprintf(stderr, "%s: %s: no such task\n", CMD_GO, relpath);
+		free(relpath);
+		return err_failed_go;
+	}
+	save_cur_task(state);
+	free(state->cwd);
+	state->cwd = relpath;
+	task_free(state->cur_task);
+	state->cur_task = logstore_read(state->lib.log, relpath);
+	return show_action(NULL, state);
+}
+
 static status go_action(const char *params[], struct state *state)
 {
 	struct task *new_task;
-	char *path;
-	char ok;
+	struct location loc;
+	char *relpath;
+	int fd;
 	if(!params || !params[0])
 		return err_invalid_params;
-	path = process_path(params[0], state);
-	ok = task_write(state->cwd, state->cur_task);
-	if(ok != 0)
-		perror("task_write");
-	new_task = task_read(path);
-	ok = change_dir(path, state);
-	free(path);
-	if(ok == -1) {
+	relpath = get_relpath(params[0], state);
+	if(!relpath) {
+		fprintf(stderr, "%s: %s is outside of the project\n", CMD_GO,
+			params[0]);
+		return err_failed_go;
+	}
+	if(state->lib.log)
+		return go_log_action(relpath, state);
+	get_location(params[0], state, &loc);
+	fd = openat(loc.dirfd, loc.path, O_RDONLY|O_DIRECTORY);
+	free(loc.path);
+	if(fd == -1) {
 		perror(CMD_GO);
-		task_free(new_task);
+		free(relpath);
 		return err_failed_go;
 	}
+	save_cur_task(state);
+	new_task = task_read(fd, ".");
+	close(state->cwdfd);
+	state->cwdfd = fd;
+	free(state->cwd);
+	state->cwd = relpath;
 	task_free(state->cur_task);
 	state->cur_task = new_task;
     return show_action(NULL, state);
 }
 
-static status mk_action(const char *params[])
+static status mk_action(const char *params[], const struct state *state)
 {
+	struct location loc;
+    char *relpath;
     char is_filter = 0;
     char ok;
     int fd;
     if(!params || !params[0])
         return err_invalid_params;
-    ok = create_block(params[0], TASK_CORE_FILE, &fd);
+    if(param_search(params, FILTER_TASK_FLAG, NULL) != -1)
+		is_filter = 1;
+	if(state->lib.log) {
+		relpath = get_log_path(params[0], state, CMD_MK);
+		ok = relpath ? logstore_make(state->lib.log, relpath, is_filter) : -1;
+		if(relpath && ok != 0)
+			perror(CMD_MK);
+		free(relpath);
+		return ok == 0 ? 0 : err_failed_mk;
+	}
+    get_location(params[0], state, &loc);
+    shard_make_parent(loc.dirfd, loc.path);
+    ok = create_block(loc.dirfd, loc.path, TASK_CORE_FILE, &fd);
+    free(loc.path);
     if(ok != 0) {
 		perror(CMD_MK);
         return err_failed_mk;
 	}
-    if(param_search(params, FILTER_TASK_FLAG, NULL) != -1)
-		is_filter = 1;
     ok = task_make_file(fd, is_filter);
     close(fd);
+    relpath = get_link_relpath(params[0], state);
+    update_hashes(state, relpath);
+    free(relpath);
     return ok;
 }
 
-static status rm_action(const char *params[])
+static void remove_dangling_link(const struct link_entry *ent, void *usrdata)
+{
+	const struct state *state = usrdata;
+	if(unlinkat(state->lib.rootfd, ent->link, 0) == 0)
+		printf("%s: removed the link ~/%s\n", CMD_RM, ent->link);
+}
+
+static void retarget_link(const struct link_entry *ent, void *usrdata)
+{
+	const struct state *state = usrdata;
+	char *target;
+	target = paths_union(state->lib.root, ent->target);
+	if(unlinkat(state->lib.rootfd, ent->link, 0) != 0 || 
+		symlinkat(target, state->lib.rootfd, ent->link) != 0)
+		perror(CMD_MV);
+	else /* the hash of a link is the one of its target path */
+		update_parent_hashes(state, ent->link);
+	free(target);
+}
+
+static void update_links(const char *oldpath, const char *newpath,
+	struct state *state)
+{
+	struct linkidx *idx;
+	char *oldphys, *newphys;
+	if(!oldpath)
+		return;
+	idx = linkidx_load(state->lib.rootfd);
+	oldphys = shard_resolve(state->lib.rootfd, oldpath);
+	newphys = shard_resolve(state->lib.rootfd, newpath);
+	if(newphys)
+		linkidx_move(idx, oldphys, newphys, retarget_link, state);
+	else
+		linkidx_remove(idx, oldphys, remove_dangling_link, state);
+	free(oldphys);
+	free(newphys);
+	if(linkidx_save(idx, state->lib.rootfd) != 0)
+		perror(LINKS_FILE);
+	linkidx_free(idx);
+}
+
+static status rm_log_action(const char *path, struct state *state)
+{
+	char *relpath = get_log_path(path, state, CMD_RM);
+	char ok;
+	if(!relpath)
+		return err_failed_rm;
+	ok = tasklog_remove(state->lib.log, relpath);
+	free(relpath);
+	if(ok != 0) {
+		perror(CMD_RM);
+		return err_failed_rm;
+	}
+	return 0;
+}
+
+/* the subtasks of the current task matching the query, from the root */
+static char select_matches(const char *query, const char *cmd,
+	const struct state *state, char read_tasks, int flags,
+	struct query_match **matches, long long *count)
 {
+	if(libtask_query(&state->lib, state->cwd, query, read_tasks, flags,
+		matches, count) == 0)
+		return 0;
+	if(errno == EINVAL)
+		fprintf(stderr, "%s: %s: invalid query\n", cmd, query);
+	else
+		perror(cmd);
+	return -1;
+}
+
+static int match_path_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct query_match *)a)->path,
+		((const struct query_match *)b)->path);
+}
+
+/* the matches are sorted by path, so the ancestors come first */
+static char has_matched_ancestor(const struct query_match *matches,
+	long long index)
+{
+	struct query_match key;
+	char *sep, found = 0;
+	key.path = string_duplicate(matches[index].path);
+	while(!found && (sep = strrchr(key.path, '/')) != NULL) {
+		*sep = 0;
+		found = bsearch(&key, matches, index, sizeof(key),
+			match_path_cmp) != NULL;
+	}
+	free(key.path);
+	return found;
+}
+
+/* the links into the removed tasks go away with them in the log */
+static status rm_log_tasks(struct state *state, struct query_match *tasks,
+	long long count)
+{
+	long long i, removed = 0;
+	if(count > 0)
+		qsort(tasks, count, sizeof(*tasks), match_path_cmp);
+	for(i = 0; i < count; i++) {
+		if(!has_matched_ancestor(tasks, i) &&
+			tasklog_remove(state->lib.log, tasks[i].phys) != 0) {
+			fprintf(stderr, "%s: %s: ", CMD_RM, tasks[i].path);
+			perror(NULL);
+			continue;
+		}
+		removed++;
+	}
+	printf("%s: %lld of %lld tasks removed\n", CMD_RM, removed, count);
+	return removed == count ? 0 : err_failed_rm;
+}
+
+/* the index of the links and the hashes are saved once for all the tasks */
+static status rm_tasks(struct state *state, struct query_match *tasks,
+	long long count)
+{
+	struct linkidx *idx;
+	struct merkle mk;
+	char **parents;
+	long long i, removed = 0, skipped = 0;
+	if(state->lib.log)
+		return rm_log_tasks(state, tasks, count);
+	if(count > 0)
+		qsort(tasks, count, sizeof(*tasks), match_path_cmp);
+	parents = malloc(sizeof(*parents)*(count+1));
+	idx = linkidx_load(state->lib.rootfd);
+	for(i = 0; i < count; i++) {
+		struct query_match *m = &tasks[i];
+		char *parent, *sep;
+		if(has_matched_ancestor(tasks, i)) {
+			skipped++;	/* it has been removed along with the ancestor */
+			continue;
+		}
+		if(remove_dir(state->lib.rootfd, m->phys) != 0) {
+			fprintf(stderr, "%s: %s: ", CMD_RM, m->path);
+			perror(NULL);
+			continue;
+		}
+		linkidx_remove(idx, m->phys, remove_dangling_link, state);
+		parent = string_duplicate(m->phys);
+		sep = strrchr(parent, '/');
+		if(sep)
+			*sep = 0;
+		else
+			parent[0] = 0;
+		parents[removed++] = parent;
+	}
+	if(linkidx_save(idx, state->lib.rootfd) != 0)
+		perror(LINKS_FILE);
+	linkidx_free(idx);
+	mk.rootfd = state->lib.rootfd;
+	mk.root = state->lib.root;
+	if(merkle_update_many(&mk, (const char **)parents, removed) != 0)
+		perror(HASH_FILE);
+	printf("%s: %lld of %lld tasks removed\n", CMD_RM, removed+skipped,
+		count);
+	for(i = 0; i < removed; i++)
+		free(parents[i]);
+	free(parents);
+	return removed+skipped == count ? 0 : err_failed_rm;
+}
+
+static status rm_match_action(const char *params[], struct state *state)
+{
+	struct query_match *matches;
+	const char *query = param_get_operand(params, 0);
+	long long count;
+	status st;
+	if(!query)
+		return err_invalid_params;
+	if(select_matches(query, CMD_RM, state, 0, 0, &matches, &count) != 0)
+		return err_failed_rm;
+	st = rm_tasks(state, matches, count);
+	query_free_matches(matches, count);
+	return st;
+}
+
+static status rm_action(const char *params[], struct state *state)
+{
+	struct location loc;
+	char *relpath;
     char ok;
+	if(state->pipe.in)
+		return rm_tasks(state, state->pipe.tasks, state->pipe.count);
 	if(!params || !params[0])
         return err_invalid_params;
-	ok = unlink(params[0]);
-	if(ok == 0) /* it means that it was a symbolic link on directory */
-		return 0;
-    ok = remove_dir(params[0]);
+	if(param_search(params, MATCH_FLAG, NULL) != -1)
+		return rm_match_action(params, state);
+	if(state->lib.log)
+		return rm_log_action(params[0], state);
+	relpath = get_link_relpath(params[0], state);
+	get_location(params[0], state, &loc);
+	ok = unlinkat(loc.dirfd, loc.path, 0);
+	if(ok != 0) /* otherwise it was a symbolic link on directory */
+		ok = remove_dir(loc.dirfd, loc.path);
+	free(loc.path);
     if(ok != 0) {
 		perror(CMD_RM);
+		free(relpath);
         return err_failed_rm;
 	}
+	update_links(relpath, NULL, state);
+	update_parent_hashes(state, relpath);
+	free(relpath);
     return 0;
 }
 
+static status ln_log_action(const char *params[], const struct state *state)
+{
+	char *target, *full_linkpath, *linkpath;
+	char ok = -1;
+	target = get_log_path(params[0], state, CMD_LN);
+	full_linkpath = get_full_destpath(params[1], params[0]);
+	linkpath = get_log_path(full_linkpath, state, CMD_LN);
+	if(target && linkpath) {
+		ok = tasklog_link(state->lib.log, linkpath, target);
+		if(ok != 0)
+			perror(CMD_LN);
+	}
+	free(target);
+	free(full_linkpath);
+	free(linkpath);
+	return ok == 0 ? 0 : err_failed_ln;
+}
+
 static status ln_action(const char *params[], const struct state *state)
 {
+	struct location loc;
 	char ok;
-	char *target, *linkpath, *full_linkpath;
+	char *target, *full_linkpath;
 	if(!params || !params[0] || !params[1])
 		return err_invalid_params;
-	target = process_path(params[0], state);
-	linkpath = process_path(params[1], state);
-	full_linkpath = get_full_destpath(linkpath, target);
-	if(!is_abspath(target)) {
-		char *tmp = target;
-		target = paths_union(state->cwd, target);
-		free(tmp);
-	}
-	ok = symlink(target, full_linkpath);
+	if(state->lib.log)
+		return ln_log_action(params, state);
+	target = get_stored_abspath(params[0], state);
+	full_linkpath = get_full_destpath(params[1], target);
+	get_location(full_linkpath, state, &loc);
+	shard_make_parent(loc.dirfd, loc.path);
+	ok = symlinkat(target, loc.dirfd, loc.path);
+	free(loc.path);
+	if(ok == 0) {
+		char *reltarget, *rellink, *physlink;
+		struct linkidx *idx = linkidx_load(state->lib.rootfd);
+		reltarget = path_get_relative(state->lib.root, target, 1);
+		rellink = get_link_relpath(full_linkpath, state);
+		physlink = shard_resolve(state->lib.rootfd, rellink);
+		linkidx_add(idx, reltarget, physlink);
+		free(physlink);
+		if(linkidx_save(idx, state->lib.rootfd) != 0)
+			perror(LINKS_FILE);
+		linkidx_free(idx);
+		update_parent_hashes(state, rellink);
+		free(reltarget);
+		free(rellink);
+	}
 	free(full_linkpath);
 	free(target);
-	free(linkpath);
 	if(ok == -1) {
 		perror(CMD_LN);
 		return err_failed_ln;
@@ -281,31 +1033,727 @@ static status ln_action(const char *params[], const struct state *state)
 	return 0;
 }
 
-static status mv_action(const char *params[], const struct state *state)
+/* rename() can't cross file systems, so it's a copy and a removal then */
+static char move_across(const struct location *oldloc,
+	const struct location *newloc)
 {
 	char ok;
-	char *oldpath, *newpath, *completed_newpath;
-	if(!params || !params[0] || !params[1])
-		return err_invalid_params;
-	oldpath = process_path(params[0], state);
-	newpath = process_path(params[1], state);
+	ok = copy_tree(oldloc->dirfd, oldloc->path, newloc->dirfd, newloc->path,
+		copy_recursive, NULL, NULL);
+	if(ok != 0) {
+		remove_dir(newloc->dirfd, newloc->path);
+		return -1;
+	}
+	return remove_dir(oldloc->dirfd, oldloc->path);
+}
+
+static char move_log_object(const char *oldpath, const char *newpath,
+	struct state *state)
+{
+	char *completed_newpath, *reloldpath, *relnewpath;
+	char ok = -1;
 	completed_newpath = get_full_destpath(newpath, oldpath);
-	ok = rename(oldpath, completed_newpath);
+	reloldpath = get_log_path(oldpath, state, CMD_MV);
+	relnewpath = get_log_path(completed_newpath, state, CMD_MV);
+	if(reloldpath && relnewpath)
+		ok = tasklog_move(state->lib.log, reloldpath, relnewpath);
+	else
+		errno = EINVAL;
 	free(completed_newpath);
-	free(oldpath);
-	free(newpath);
-	if(ok == -1) {
+	free(reloldpath);
+	free(relnewpath);
+	return ok;
+}
+
+static status mv_log_action(const char *params[], struct state *state)
+{
+	if(move_log_object(params[0], params[1], state) != 0) {
 		perror(CMD_MV);
 		return err_failed_mv;
 	}
 	return 0;
 }
 
+static char move_object(const char *oldpath, const char *newpath,
+	struct state *state)
+{
+	struct location oldloc, newloc;
+	char ok;
+	char *completed_newpath, *reloldpath, *relnewpath;
+	completed_newpath = get_full_destpath(newpath, oldpath);
+	reloldpath = get_link_relpath(oldpath, state);
+	get_location(oldpath, state, &oldloc);
+	get_location(completed_newpath, state, &newloc);
+	shard_make_parent(newloc.dirfd, newloc.path);
+	ok = renameat(oldloc.dirfd, oldloc.path, newloc.dirfd, newloc.path);
+	if(ok == -1 && errno == EXDEV)
+		ok = move_across(&oldloc, &newloc);
+	if(ok == 0) {
+		relnewpath = get_link_relpath(completed_newpath, state);
+		if(relnewpath)
+			update_links(reloldpath, relnewpath, state);
+		else /* it has left the project */
+			update_links(reloldpath, NULL, state);
+		update_parent_hashes(state, reloldpath);
+		update_parent_hashes(state, relnewpath);
+		free(relnewpath);
+	}
+	free(oldloc.path);
+	free(newloc.path);
+	free(reloldpath);
+	free(completed_newpath);
+	return ok;
+}
+
+/* the piped tasks are moved into the directory one by one */
+static status mv_tasks(struct state *state, const struct query_match *tasks,
+	long long count, const char *dstdir)
+{
+	char *dst, *src;
+	long long i, moved = 0;
+	dst = dstdir[strlen(dstdir)-1] == '/' ? string_duplicate(dstdir) :
+		strings_concatenate(dstdir, "/", NULL);
+	for(i = 0; i < count; i++) {
+		src = strings_concatenate("~/", tasks[i].path, NULL);
+		if((state->lib.log ? move_log_object(src, dst, state) :
+			move_object(src, dst, state)) == 0)
+			moved++;
+		else {
+			fprintf(stderr, "%s: %s: ", CMD_MV, tasks[i].path);
+			perror(NULL);
+		}
+		free(src);
+	}
+	printf("%s: %lld of %lld tasks moved\n", CMD_MV, moved, count);
+	free(dst);
+	return moved == count ? 0 : err_failed_mv;
+}
+
+static status mv_action(const char *params[], struct state *state)
+{
+	if(state->pipe.in && params && params[0])
+		return mv_tasks(state, state->pipe.tasks, state->pipe.count,
+			params[0]);
+	if(!params || !params[0] || !params[1])
+		return err_invalid_params;
+	if(state->lib.log)
+		return mv_log_action(params, state);
+	if(move_object(params[0], params[1], state) != 0) {
+		perror(CMD_MV);
+		return err_failed_mv;
+	}
+	return 0;
+}
+
+struct copy_links {
+	const struct state *state;
+	struct linkidx *idx;
+	const char *dstpath;	/* the copy or the import, from the root */
+};
+
+static void index_copied_link(const char *target, const char *linkpath,
+	void *usrdata)
+{
+	struct copy_links *cl = usrdata;
+	char *reltarget, *rellink;
+	reltarget = path_strip_root(cl->state->lib.root, target);
+	rellink = cl->dstpath[0] ? paths_union(cl->dstpath, linkpath) :
+		string_duplicate(linkpath);
+	if(reltarget && rellink)
+		linkidx_add(cl->idx, reltarget, rellink);
+	free(reltarget);
+	free(rellink);
+}
+
+static status cp_log_action(const char *src, const char *dst,
+	char recursive, struct state *state)
+{
+	char *completed_dst, *srcpath, *dstpath;
+	char ok = -1;
+	completed_dst = get_full_destpath(dst, src);
+	srcpath = get_log_path(src, state, CMD_CP);
+	dstpath = get_log_path(completed_dst, state, CMD_CP);
+	if(srcpath && dstpath) {
+		ok = logstore_copy(state->lib.log, srcpath, dstpath, recursive);
+		if(ok != 0)
+			perror(CMD_CP);
+	}
+	free(completed_dst);
+	free(srcpath);
+	free(dstpath);
+	return ok == 0 ? 0 : err_failed_cp;
+}
+
+static status cp_action(const char *params[], struct state *state)
+{
+	struct location srcloc, dstloc;
+	struct copy_links cl;
+	const char *src, *dst;
+	char *completed_dst, *dstpath, *relpath;
+	char ok;
+	int flags = 0;
+	src = param_get_operand(params, 0);
+	dst = param_get_operand(params, 1);
+	if(!src || !dst)
+		return err_invalid_params;
+	if(param_search(params, RECURSIVE_FLAG, NULL) != -1)
+		flags |= copy_recursive;
+	if(state->lib.log)
+		return cp_log_action(src, dst, flags & copy_recursive, state);
+	completed_dst = get_full_destpath(dst, src);
+	get_location(src, state, &srcloc);
+	get_location(completed_dst, state, &dstloc);
+	relpath = get_link_relpath(completed_dst, state);
+	dstpath = shard_resolve(state->lib.rootfd, relpath);
+	free(relpath);
+	shard_make_parent(dstloc.dirfd, dstloc.path);
+	cl.state = state;
+	cl.idx = linkidx_load(state->lib.rootfd);
+	cl.dstpath = dstpath;
+	ok = copy_tree(srcloc.dirfd, srcloc.path, dstloc.dirfd, dstloc.path, 
+		flags, dstpath ? index_copied_link : NULL, &cl);
+	if(linkidx_save(cl.idx, state->lib.rootfd) != 0)
+		perror(LINKS_FILE);
+	linkidx_free(cl.idx);
+	if(ok == 0)
+		update_hashes(state, dstpath);
+	free(srcloc.path);
+	free(dstloc.path);
+	free(dstpath);
+	free(completed_dst);
+	if(ok != 0) {
+		perror(CMD_CP);
+		return err_failed_cp;
+	}
+	return 0;
+}
+
+static char open_merkle(const char *path, const struct state *state,
+	struct merkle *mk)
+{
+	struct location loc;
+	get_location(path, state, &loc);
+	mk->rootfd = openat(loc.dirfd, loc.path, O_RDONLY|O_DIRECTORY);
+	free(loc.path);
+	mk->root = get_abspath(path, state);
+	return mk->rootfd == -1 ? -1 : 0;
+}
+
+static void close_merkle(struct merkle *mk)
+{
+	if(mk->rootfd != -1)
+		close(mk->rootfd);
+	free((char *)mk->root);
+}
+
+/* the log of the project at the root, the open one if it's this project */
+static struct tasklog *open_project_log(const struct merkle *mk,
+	const struct state *state)
+{
+	char *root = realpath(mk->root, NULL);
+	struct tasklog *log = NULL;
+	if(root && state->lib.log && strcmp(root, state->lib.root) == 0)
+		log = state->lib.log;
+	else
+		log = tasklog_open(mk->rootfd, TASKLOG_FILE, 0);
+	free(root);
+	return log;
+}
+
+static char sync_logs(const struct merkle *src, const struct merkle *dst,
+	const struct state *state)
+{
+	struct tasklog *srclog, *dstlog;
+	char ok = -1;
+	srclog = open_project_log(src, state);
+	dstlog = open_project_log(dst, state);
+	if(srclog && dstlog)
+		ok = logstore_sync(srclog, dstlog);
+	if(srclog != state->lib.log)
+		tasklog_close(srclog);
+	if(dstlog != state->lib.log)
+		tasklog_close(dstlog);
+	return ok;
+}
+
+static char is_log_project(const struct merkle *mk)
+{
+	return faccessat(mk->rootfd, TASKLOG_FILE, F_OK, 0) == 0;
+}
+
+/* the projects are synced by the engine they are both kept by */
+static status sync_action(const char *params[], struct state *state)
+{
+	struct merkle src, dst;
+	char ok;
+	if(!params || !params[0] || !params[1])
+		return err_invalid_params;
+	ok = open_merkle(params[0], state, &src);
+	if(ok == 0)
+		ok = open_merkle(params[1], state, &dst);
+	else
+		dst.rootfd = -1, dst.root = NULL;
+	if(ok == 0 && is_log_project(&src) != is_log_project(&dst)) {
+		fprintf(stderr, "%s: the projects are kept by different engines, "
+			"use %s and %s\n", CMD_SYNC, CMD_EXPORT, CMD_IMPORT);
+		close_merkle(&src);
+		close_merkle(&dst);
+		return err_failed_sync;
+	}
+	if(ok == 0)
+		ok = is_log_project(&src) ? sync_logs(&src, &dst, state) :
+			sync_trees(&src, &dst);
+	if(ok != 0)
+		perror(CMD_SYNC);
+	close_merkle(&src);
+	close_merkle(&dst);
+	if(ok != 0)
+		return err_failed_sync;
+	/* the current task could be the one which has been synced */
+	task_free(state->cur_task);
+	state->cur_task = state->lib.log ? 
+		logstore_read(state->lib.log, state->cwd) :
+		task_read(state->cwdfd, ".");
+	return 0;
+}
+
+static status export_action(const char *params[], struct state *state)
+{
+	struct location loc;
+	char ok;
+	int fd;
+	if(!params || !params[0])
+		return err_invalid_params;
+	save_cur_task(state);
+	get_location(params[0], state, &loc);
+	fd = openat(loc.dirfd, loc.path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	free(loc.path);
+	if(fd == -1) {
+		perror(CMD_EXPORT);
+		return err_failed_export;
+	}
+	if(state->lib.log)
+		ok = archive_export_log(state->lib.log, fd);
+	else
+		ok = archive_export(state->lib.rootfd, ".", state->lib.root, fd);
+	if(close(fd) != 0)
+		ok = -1;
+	if(ok != 0) {
+		perror(CMD_EXPORT);
+		return err_failed_export;
+	}
+	return 0;
+}
+
+/* the archive files are outside of the log, the tasks go into it */
+static status import_log_action(int fd, const char *dst,
+	struct state *state)
+{
+	char *relpath = get_log_path(dst, state, CMD_IMPORT);
+	char ok = -1;
+	if(relpath) {
+		save_cur_task(state);
+		ok = archive_import_log(fd, state->lib.log, relpath);
+		if(ok != 0)
+			perror(CMD_IMPORT);
+	}
+	close(fd);
+	free(relpath);
+	if(ok != 0)
+		return err_failed_import;
+	task_free(state->cur_task);
+	state->cur_task = logstore_read(state->lib.log, state->cwd);
+	return 0;
+}
+
+static status import_action(const char *params[], struct state *state)
+{
+	struct location loc;
+	struct copy_links cl;
+	char *abspath, *relpath, *physpath;
+	const char *dst;
+	char ok;
+	int fd;
+	if(!params || !params[0])
+		return err_invalid_params;
+	dst = params[1] ? params[1] : ".";
+	get_location(params[0], state, &loc);
+	fd = openat(loc.dirfd, loc.path, O_RDONLY);
+	free(loc.path);
+	if(fd == -1) {
+		perror(CMD_IMPORT);
+		return err_failed_import;
+	}
+	if(state->lib.log)
+		return import_log_action(fd, dst, state);
+	get_location(dst, state, &loc);
+	abspath = get_abspath(dst, state);
+	relpath = get_relpath(dst, state);
+	physpath = shard_resolve(state->lib.rootfd, relpath);
+	/* the imported links join the index of the project */
+	cl.state = state;
+	cl.idx = linkidx_load(state->lib.rootfd);
+	cl.dstpath = physpath && strcmp(physpath, ".") != 0 ? physpath : "";
+	ok = archive_import(fd, loc.dirfd, loc.path, abspath,
+		physpath ? index_copied_link : NULL, &cl);
+	if(linkidx_save(cl.idx, state->lib.rootfd) != 0)
+		perror(LINKS_FILE);
+	linkidx_free(cl.idx);
+	close(fd);
+	free(loc.path);
+	free(abspath);
+	free(physpath);
+	if(ok != 0) {
+		free(relpath);
+		perror(CMD_IMPORT);
+		return err_failed_import;
+	}
+	update_hashes(state, relpath);
+	free(relpath);
+	task_free(state->cur_task);
+	state->cur_task = task_read(state->cwdfd, ".");
+	return 0;
+}
+
+static status ingest_log_action(int fd, const char *dst, ingest_t type,
+	const char *cmd, struct state *state)
+{
+	struct ingest_stats stats;
+	char *relpath = get_log_path(dst, state, cmd);
+	char ok = -1;
+	if(relpath) {
+		save_cur_task(state);
+		ok = ingest_file_log(fd, type, state->lib.log, relpath, &stats);
+		if(ok != 0)
+			perror(cmd);
+	}
+	close(fd);
+	free(relpath);
+	if(ok != 0)
+		return -1;
+	task_free(state->cur_task);
+	state->cur_task = logstore_read(state->lib.log, state->cwd);
+	printf("%lld imported, %lld failed\n", stats.imported, stats.failed);
+	return stats.failed == 0 ? 0 : -1;
+}
+
+static status ingest_action(const char *params[], struct state *state,
+	ingest_t type)
+{
+	struct ingest_stats stats;
+	struct location loc;
+	const char *cmd, *dst;
+	status err;
+	char *relpath;
+	char ok;
+	int fd;
+	cmd = type == ingest_csv ? CMD_IMPORT_CSV : CMD_IMPORT_TODOTXT;
+	err = type == ingest_csv ? err_failed_import_csv :
+		err_failed_import_todotxt;
+	if(!params || !params[0])
+		return err_invalid_params;
+	dst = params[1] ? params[1] : ".";
+	get_location(params[0], state, &loc);
+	fd = openat(loc.dirfd, loc.path, O_RDONLY);
+	free(loc.path);
+	if(fd == -1) {
+		perror(cmd);
+		return err;
+	}
+	if(state->lib.log)
+		return ingest_log_action(fd, dst, type, cmd, state) == 0 ? 0 : err;
+	get_location(dst, state, &loc);
+	ok = ingest_file(fd, type, loc.dirfd, loc.path, &stats);
+	close(fd);
+	free(loc.path);
+	if(ok != 0) {
+		perror(cmd);
+		return err;
+	}
+	relpath = get_relpath(dst, state);
+	update_hashes(state, relpath);
+	free(relpath);
+	task_free(state->cur_task);
+	state->cur_task = task_read(state->cwdfd, ".");
+	printf("%lld imported, %lld failed\n", stats.imported, stats.failed);
+	return stats.failed == 0 ? 0 : err;
+}
+
+struct reshard_links {
+	struct state *state;
+	struct linkidx *idx;
+	const char *dirpath;	/* the resharded task relative to the root */
+};
+
+static void move_links(const char *oldpath, const char *newpath, 
+	void *usrdata)
+{
+	struct reshard_links *rl = usrdata;
+	char *oldrel, *newrel;
+	oldrel = rl->dirpath[0] ? paths_union(rl->dirpath, oldpath) : 
+		strdup(oldpath);
+	newrel = rl->dirpath[0] ? paths_union(rl->dirpath, newpath) : 
+		strdup(newpath);
+	linkidx_move(rl->idx, oldrel, newrel, retarget_link, rl->state);
+	free(oldrel);
+	free(newrel);
+}
+
+static status reshard_action(const char *params[], struct state *state)
+{
+	struct reshard_links rl;
+	const char *operand;
+	char *relpath, *physpath;
+	char ok;
+	if(state->lib.log) /* the log finds any child by its path at once */
+		return 0;
+	operand = param_get_operand(params, 0);
+	relpath = get_relpath(operand ? operand : ".", state);
+	if(!relpath) {
+		fprintf(stderr, "%s: %s is outside of the project\n", CMD_RESHARD,
+			operand);
+		return err_failed_reshard;
+	}
+	save_cur_task(state);
+	physpath = shard_resolve(state->lib.rootfd, relpath);
+	rl.state = state;
+	rl.idx = linkidx_load(state->lib.rootfd);
+	rl.dirpath = strcmp(physpath, ".") == 0 ? "" : physpath;
+	ok = shard_reshard(state->lib.rootfd, physpath, 
+		param_search(params, OFF_FLAG, NULL) == -1, move_links, &rl);
+	if(linkidx_save(rl.idx, state->lib.rootfd) != 0)
+		perror(LINKS_FILE);
+	linkidx_free(rl.idx);
+	update_hashes(state, relpath);
+	free(relpath);
+	free(physpath);
+	if(ok != 0) {
+		perror(CMD_RESHARD);
+		return err_failed_reshard;
+	}
+	return 0;
+}
+
+static void print_matches(const struct query_match *matches, 
+	long long count, format_t format, const struct state *state)
+{
+	struct outbuf ob;
+	struct record rec;
+	long long i, skip;
+	skip = state->cwd[0] ? strlen(state->cwd)+1 : 0;
+	if(format == format_text) {
+		for(i = 0; i < count; i++)
+			printf("%s\n", matches[i].path+skip);
+		return;
+	}
+	if(outbuf_init(&ob, 1) != 0)
+		return;
+	record_write_header(&ob, format);
+	for(i = 0; i < count; i++) {
+		if(!matches[i].task)
+			continue;
+		record_fill(&rec, matches[i].task, matches[i].path+skip);
+		record_write(&ob, format, &rec);
+	}
+	outbuf_free(&ob);
+}
+
+static void print_memory_report(const struct query_match *matches, 
+	long long count)
+{
+	long long i, read = 0, size = 0;
+	for(i = 0; i < count; i++) {
+		if(!matches[i].task)
+			continue;
+		read++;
+		size += task_memory_size(matches[i].task);
+	}
+	printf("%s: %lld tasks, %lld bytes, %lld bytes per task\n", CMD_FIND,
+		read, size, read ? size/read : 0);
+}
+
+static status find_action(const char *params[], struct state *state)
+{
+	struct query_match *matches;
+	const char *query = param_get_operand(params, 0);
+	format_t format;
+	long long count;
+	char memory;
+	int follow;
+	if(!query)
+		return err_invalid_params;
+	format = record_get_format(param_get_value(params, FORMAT_PARAM));
+	if(format == format_err)
+		return err_invalid_params;
+	memory = param_search(params, MEMORY_FLAG, NULL) != -1;
+	follow = param_search(params, FOLLOW_FLAG, NULL) != -1 ? walk_follow : 0;
+	if(select_matches(query, CMD_FIND, state, 
+		memory || format != format_text, follow, &matches, &count) != 0)
+		return err_failed_find;
+	if(state->pipe.out) {
+		pipe_pass(state, matches, count);
+		return 0;
+	}
+	if(memory)
+		print_memory_report(matches, count);
+	else
+		print_matches(matches, count, format, state);
+	query_free_matches(matches, count);
+	return 0;
+}
+
+static status grep_action(const char *params[], struct state *state)
+{
+	struct grep *g;
+	struct outbuf ob;
+	const char *pattern, *operand;
+	char *relpath;
+	long long found;
+	int follow;
+	pattern = param_get_operand(params, 0);
+	if(!pattern)
+		return err_invalid_params;
+	operand = param_get_operand(params, 1);
+	relpath = get_relpath(operand ? operand : ".", state);
+	if(!relpath) {
+		fprintf(stderr, "%s: %s is outside of the project\n", CMD_GREP,
+			operand);
+		return err_failed_grep;
+	}
+	g = grep_new(pattern, param_search(params, ICASE_FLAG, NULL) != -1);
+	if(!g) {
+		fprintf(stderr, "%s: invalid regular expression\n", CMD_GREP);
+		free(relpath);
+		return err_failed_grep;
+	}
+	if(outbuf_init(&ob, 1) != 0) {
+		grep_free(g);
+		free(relpath);
+		return err_failed_grep;
+	}
+	follow = param_search(params, FOLLOW_FLAG, NULL) != -1 ? walk_follow : 0;
+	found = libtask_grep(&state->lib, relpath, g, operand ? operand : "",
+		follow, &ob);
+	outbuf_free(&ob);
+	grep_free(g);
+	free(relpath);
+	if(found == -1) {
+		perror(CMD_GREP);
+		return err_failed_grep;
+	}
+	return 0;
+}
+
+static void print_mem_stats(const char *name, const struct mem_stats *st)
+{
+	printf("%-12s%12lld%12lld%12lld%12lld%12lld\n", name, st->allocs,
+		st->frees, st->blocks, st->bytes, st->peak);
+}
+
+static status memstats_action()
+{
+	struct mem_stats areas[mem_areas_count], total;
+	int i;
+	mem_get_stats(areas, &total);
+	printf("%-12s%12s%12s%12s%12s%12s\n", "area", "allocs", "frees",
+		"blocks", "bytes", "peak");
+	for(i = 0; i < mem_areas_count; i++)
+		print_mem_stats(mem_area_name(i), &areas[i]);
+	print_mem_stats("total", &total);
+	return 0;
+}
+
+static status set_log_tasks(const struct state *state,
+	struct query_match *tasks, long long count, const char *field,
+	const char *value)
+{
+	long long i, written = 0;
+	for(i = 0; i < count; i++) {
+		struct query_match *m = &tasks[i];
+		if(!m->task)
+			m->task = logstore_read(state->lib.log, m->phys);
+		if(!m->task) {
+			fprintf(stderr, "%s: %s: no such task\n", CMD_SET, m->path);
+			continue;
+		}
+		task_set_field(m->task, field, value, 1);
+		if(logstore_write(state->lib.log, m->phys, m->task) != 0) {
+			fprintf(stderr, "%s: %s: ", CMD_SET, m->path);
+			perror(NULL);
+			continue;
+		}
+		written++;
+	}
+	printf("%s: %lld of %lld tasks updated\n", CMD_SET, written, count);
+	return written == count ? 0 : err_failed_set;
+}
+
+/*
+ * The tasks are read in batches, all written and then the hashes are
+ * recounted once for all of them, so the directories they share are not
+ * hashed again for every task.
+ */
+static status set_tasks(const struct state *state, struct query_match *tasks,
+	long long count, const char *field, const char *value)
+{
+	struct merkle mk;
+	const char **paths;
+	long long i, written = 0;
+	if(state->lib.log)
+		return set_log_tasks(state, tasks, count, field, value);
+	query_read_tasks(state->lib.rootfd, tasks, count, task_fld_all);
+	paths = malloc(sizeof(*paths)*(count+1));
+	for(i = 0; i < count; i++) {
+		struct query_match *m = &tasks[i];
+		if(!m->task) {
+			fprintf(stderr, "%s: %s: no such task\n", CMD_SET, m->path);
+			continue;
+		}
+		task_set_field(m->task, field, value, 1);
+		if(task_write(state->lib.rootfd, m->phys, m->task) != 0) {
+			fprintf(stderr, "%s: %s: ", CMD_SET, m->path);
+			perror(NULL);
+			continue;
+		}
+		paths[written++] = m->phys;
+	}
+	mk.rootfd = state->lib.rootfd;
+	mk.root = state->lib.root;
+	if(merkle_update_many(&mk, paths, written) != 0)
+		perror(HASH_FILE);
+	printf("%s: %lld of %lld tasks updated\n", CMD_SET, written, count);
+	free(paths);
+	return written == count ? 0 : err_failed_set;
+}
+
+static status set_match_action(const char *params[],
+	const struct state *state)
+{
+	struct query_match *matches;
+	const char *query = param_get_operand(params, 0);
+	const char *field = param_get_operand(params, 1);
+	long long count;
+	status st;
+	if(!query || !field)
+		return err_invalid_params;
+	if(select_matches(query, CMD_SET, state, 1, 0, &matches, &count) != 0)
+		return err_failed_set;
+	st = set_tasks(state, matches, count, field, 
+		param_get_operand(params, 2));
+	query_free_matches(matches, count);
+	return st;
+}
+
 static status set_action(const char *params[], const struct state *state)
 {
 	char ok;
 	if(!params || !params[0])
 		return err_invalid_params;
+	if(state->pipe.in)
+		return set_tasks(state, state->pipe.tasks, state->pipe.count,
+			params[0], params[1]);
+	if(param_search(params, MATCH_FLAG, NULL) != -1)
+		return set_match_action(params, state);
 	ok = task_set_field(state->cur_task, params[0], params[1], 1);
 	if(ok == -1)
 		return err_failed_set;
@@ -336,11 +1784,11 @@ static status cmd_exec(cmd_type ctype, const char *params[],
         case cmd_exit:
             return exit_action(state);
         case cmd_init:
-            return init_action();
+            return init_action(params, state);
         case cmd_mk:
-            return mk_action(params);
+            return mk_action(params, state);
         case cmd_rm:
-            return rm_action(params);
+            return rm_action(params, state);
         case cmd_go:
             return go_action(params, state);
         case cmd_show:
@@ -353,6 +1801,26 @@ static status cmd_exec(cmd_type ctype, const char *params[],
 			return set_action(params, state);
 		case cmd_clear:
 			return clear_action();
+		case cmd_cp:
+			return cp_action(params, state);
+		case cmd_sync:
+			return sync_action(params, state);
+		case cmd_export:
+			return export_action(params, state);
+		case cmd_import:
+			return import_action(params, state);
+		case cmd_reshard:
+			return reshard_action(params, state);
+		case cmd_find:
+			return find_action(params, state);
+		case cmd_import_csv:
+			return ingest_action(params, state, ingest_csv);
+		case cmd_import_todotxt:
+			return ingest_action(params, state, ingest_todotxt);
+		case cmd_grep:
+			return grep_action(params, state);
+		case cmd_memstats:
+			return memstats_action();
         case cmd_empty:
             return 0;
         case cmd_err:
@@ -387,6 +1855,26 @@ static cmd_type get_ctype(const char *cmd)
 		return cmd_set;
 	if(strcmp(cmd, CMD_CLEAR) == 0)
 		return cmd_clear;
+	if(strcmp(cmd, CMD_CP) == 0)
+		return cmd_cp;
+	if(strcmp(cmd, CMD_SYNC) == 0)
+		return cmd_sync;
+	if(strcmp(cmd, CMD_EXPORT) == 0)
+		return cmd_export;
+	if(strcmp(cmd, CMD_IMPORT) == 0)
+		return cmd_import;
+	if(strcmp(cmd, CMD_RESHARD) == 0)
+		return cmd_reshard;
+	if(strcmp(cmd, CMD_FIND) == 0)
+		return cmd_find;
+	if(strcmp(cmd, CMD_IMPORT_CSV) == 0)
+		return cmd_import_csv;
+	if(strcmp(cmd, CMD_IMPORT_TODOTXT) == 0)
+		return cmd_import_todotxt;
+	if(strcmp(cmd, CMD_GREP) == 0)
+		return cmd_grep;
+	if(strcmp(cmd, CMD_MEMSTATS) == 0)
+		return cmd_memstats;
     return cmd_err;
 }
 
@@ -423,12 +1911,42 @@ static void error_log(status st)
 		case err_failed_clear:
 			fprintf(stdout, "Failed to clear the screen\n");
 			break;
+		case err_failed_cp:
+			fprintf(stdout, "Failed to copy\n");
+			break;
+		case err_failed_sync:
+			fprintf(stdout, "Failed to sync the projects\n");
+			break;
+		case err_failed_export:
+			fprintf(stdout, "Failed to export the project\n");
+			break;
+		case err_failed_import:
+			fprintf(stdout, "Failed to import the project\n");
+			break;
+		case err_failed_reshard:
+			fprintf(stdout, "Failed to reshard the object\n");
+			break;
+		case err_failed_find:
+			fprintf(stdout, "Failed to find the objects\n");
+			break;
+		case err_failed_import_csv:
+			fprintf(stdout, "Failed to import the CSV file\n");
+			break;
+		case err_failed_import_todotxt:
+			fprintf(stdout, "Failed to import the todo.txt file\n");
+			break;
+		case err_failed_grep:
+			fprintf(stdout, "Failed to search the tasks\n");
+			break;
         case err_failed_init:
             fprintf(stdout, "Failed to init the project\n");
             break;
 		case err_failed_run:
 			fprintf(stdout, "Failed to run the program\n");
 			break;
+		case err_invalid_pipe:
+			fprintf(stdout, "The command can't be used in the pipeline\n");
+			break;
         case success:
             break;
     }
@@ -442,53 +1960,203 @@ static void process_params(char **params)
 	}
 }
 
+static char passes_tasks(cmd_type ctype)
+{
+	return ctype == cmd_find || ctype == cmd_show;
+}
+
+static char takes_tasks(cmd_type ctype)
+{
+	return ctype == cmd_set || ctype == cmd_rm || ctype == cmd_mv;
+}
+
 static status process_cmd(const char *cmd, struct state *state)
 {
     status st;
     cmd_type ctype;
     char **params = NULL;
+    long long start;
     if(!cmd)
         return err_invalid_cmd;
+    start = trace_begin();
     params = get_tokens(cmd);
     ctype = get_ctype(params[0]);
 	if(ctype == cmd_err)
-        return err_invalid_cmd;
-	process_params(params);
-    st = cmd_exec(ctype, (const char **)(params+1), state);
+		st = err_invalid_cmd;
+	else if((state->pipe.out && !passes_tasks(ctype)) ||
+		(state->pipe.in && !takes_tasks(ctype)))
+		st = err_invalid_pipe;
+	else {
+		process_params(params);
+		st = cmd_exec(ctype, (const char **)(params+1), state);
+	}
+	trace_end(start, "cmd", params[0], cmd);
     mem_free((void **)params);
+	free(params);
     return st;
 }
 
-static void fill_by_path(struct list *lst, const char *path)
+typedef enum {
+	chain_end,
+	chain_seq,		/* "a; b" runs both */
+	chain_and,		/* "a && b" runs b if a has succeeded */
+	chain_pipe,		/* "a | b" passes the tasks found by a to b */
+} chain_t;
+
+/* "|" inside of a word, as in a regex, doesn't split the line */
+static char is_pipe(const char *start, const char *s)
+{
+	return s > start && (s[-1] == ' ' || s[-1] == '\t') &&
+		(s[1] == ' ' || s[1] == '\t');
+}
+
+/* cuts the next command off the line, the quoted separators are skipped */
+static char *next_cmd(const char **line, chain_t *sep)
+{
+	const char *s, *start = *line;
+	char *cmd, quoted = 0;
+	if(!*start)
+		return NULL;
+	*sep = chain_end;
+	for(s = start; *s; s++) {
+		if(*s == '"' && (s == start || s[-1] != '\\'))
+			quoted = !quoted;
+		if(quoted)
+			continue;
+		if(*s == ';')
+			*sep = chain_seq;
+		else if(*s == '|' && is_pipe(start, s))
+			*sep = chain_pipe;
+		else if(*s == '&' && s[1] == '&')
+			*sep = chain_and;
+		if(*sep != chain_end)
+			break;
+	}
+	cmd = malloc(s-start+1);
+	memcpy(cmd, start, s-start);
+	cmd[s-start] = 0;
+	*line = *sep == chain_and ? s+2 : (*sep == chain_end ? s : s+1);
+	return cmd;
+}
+
+/*
+ * Runs the chain of commands of the line. The tasks go through a pipe as
+ * they are, so a consumer neither reads the printed paths back nor looks
+ * the tasks up again.
+ */
+static status process_line(const char *line, struct state *state)
+{
+	status st = 0;
+	chain_t sep = chain_end, prev = chain_end;
+	char *cmd, skip = 0;
+	if(!*line)
+		return process_cmd(line, state);
+	while((cmd = next_cmd(&line, &sep)) != NULL) {
+		if(prev == chain_pipe)
+			skip = skip || st != 0;
+		else
+			skip = prev == chain_and && st != 0;
+		state->pipe.in = prev == chain_pipe;
+		state->pipe.out = sep == chain_pipe;
+		if(!skip) {
+			st = process_cmd(cmd, state);
+			if(st != 0)
+				error_log(st);
+		}
+		if(state->pipe.in)
+			pipe_clear(state);
+		free(cmd);
+		prev = sep;
+		if(!skip && state->last_cmd == cmd_exit)
+			break;
+	}
+	if(prev == chain_pipe && state->last_cmd != cmd_exit) {
+		st = err_invalid_pipe;	/* nothing has taken the tasks */
+		error_log(st);
+	}
+	pipe_clear(state);
+	state->pipe.in = 0;
+	state->pipe.out = 0;
+	return st;
+}
+
+static void add_word(const char *name, char is_link, void *usrdata)
+{
+	list_append(usrdata, name);
+}
+
+static void fill_by_log(struct list *lst, const char *path, 
+	const struct state *state)
+{
+	char *relpath = get_relpath(path[1] == '.' ? ".." : ".", state);
+	if(!relpath)
+		return;
+	if(tasklog_list(state->lib.log, relpath, add_word, lst) >= 0) {
+		list_append(lst, ".");
+		list_append(lst, "..");
+	}
+	free(relpath);
+}
+
+/* the children of the shards are completed as the ones of the task */
+static void fill_by_dir(struct list *lst, int fd, char is_shard)
 {
-	DIR *dir;
 	struct dirent *dent;
-	struct list *tmp;
-	long long i;
-	if(path[0] != '.')
+	DIR *dir;
+	int dupfd = dup(fd);
+	dir = dupfd == -1 ? NULL : fdopendir(dupfd);
+	if(!dir) {
+		if(dupfd != -1)
+			close(dupfd);
 		return;
-	if(lst->count != 0) {
-		for(i = 0; i < lst->count; i++)
-			free(lst->words[i]);
-		free(lst->words);
-		tmp = list_create(NULL);
-		memcpy(lst, tmp, sizeof(*tmp));
-	}
-	if(path[1] == '/') 
-		dir = opendir(".");
-	else if(path[1] == '.')
-		dir = opendir("..");
-	for(i = 0; (dent = readdir(dir)) != NULL; i++)
+	}
+	while((dent = readdir(dir)) != NULL) {
+		if(!is_shard && shard_is_dirname(dent->d_name)) {
+			int sfd = openat(fd, dent->d_name, O_RDONLY|O_DIRECTORY);
+			if(sfd != -1) {
+				fill_by_dir(lst, sfd, 1);
+				close(sfd);
+			}
+			continue;
+		}
+		if(is_shard && dent->d_name[0] == '.')
+			continue;
 		list_append(lst, dent->d_name);
-	lst->words[i] = NULL;
+	}
 	closedir(dir);
 }
 
+static void fill_by_path(struct list *lst, const char *path, void *usrdata)
+{
+	const struct state *state = usrdata;
+	struct location loc;
+	int fd;
+	long long i;
+	if(path[0] != '.')
+		return;
+	for(i = 0; i < lst->count; i++)
+		free(lst->words[i]);
+	lst->count = 0;
+	if(state->lib.log) {
+		fill_by_log(lst, path, state);
+		return;
+	}
+	get_location(path[1] == '.' ? ".." : ".", state, &loc);
+	fd = openat(loc.dirfd, loc.path, O_RDONLY|O_DIRECTORY);
+	free(loc.path);
+	if(fd == -1)
+		return;
+	fill_by_dir(lst, fd, 0);
+	close(fd);
+}
+
 static void get_lists(struct readline_list *(*lists)[3])
 {
 	(*lists)[0] = malloc(sizeof((*lists)[0]));
 	(*lists)[0]->value = list_create(CMD_HELP, CMD_EXIT, CMD_INIT, CMD_MK,
 			CMD_RM, CMD_GO, CMD_SHOW, CMD_LN, CMD_MV, CMD_SET, CMD_CLEAR,
+			CMD_CP, CMD_SYNC, CMD_EXPORT, CMD_IMPORT, CMD_RESHARD, CMD_FIND,
+			CMD_IMPORT_CSV, CMD_IMPORT_TODOTXT, CMD_GREP, CMD_MEMSTATS,
 			TNAME_FLD, TINFO_FLD, TFROM_FLD, TTO_FLD, TTYPE_FLD, 
 			TCOMPLETED_FLD, NULL);
 	(*lists)[0]->before_action = NULL;
@@ -508,6 +2176,22 @@ static void free_lists(struct readline_list *lists[3])
 	free(lists[1]);
 }
 
+/* runs the command without the prompt, the way "task -c" does */
+char shell_exec(const char *cmd)
+{
+	struct state state;
+	status st;
+	if(state_init(&state) == -1) {
+		perror("task");
+		return err_failed_run;
+	}
+	state.use_snapshot = 1;
+	st = process_line(cmd, &state);
+	save_cur_task(&state);
+	state_free(&state);
+	return st;
+}
+
 char shell_run()
 {
 	struct state state;
@@ -515,24 +2199,24 @@ char shell_run()
 	struct readline_list *(lists[3]);
 	char ok;
 	ok = state_init(&state);
-	if(ok == -1)
+	if(ok == -1) {
+		perror("task");
 		return err_failed_run;
+	}
 	get_lists(&lists);
 	input_init(&input);
 	while(readline(&input, (const struct readline_list **)&lists,
 			(readline_before_action_t)print_shortcwd,
 			(void *)(&state)) != NULL) {
-		status st;
 		input.value[strlen(input.value)-1] = 0; /* to remove the newline */
-        st = process_cmd(input.value, &state);
+        process_line(input.value, &state);
         if(state.last_cmd == cmd_exit)
             break;
         if(state.last_cmd == cmd_empty)
             continue;
-        if(st != 0)
-			error_log(st);
 		input_init(&input);
 	}
 	free_lists(lists);
+	state_free(&state);
     return 0;
 }
@@ -2,4 +2,5 @@
 #define SHELL_H_SENTRY
 
 char shell_run();
+char shell_exec(const char *cmd);
 #endif
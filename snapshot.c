@@ -0,0 +1,864 @@
+#include "snapshot.h"
+#include "merkle.h"
+#include "task.h"
+#include "listing.h"
+#include "outbuf.h"
+#include "path.h"
+#include "batchio.h"
+#include "scan.h"
+#include "shard.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ * A frozen copy of the whole project which is mapped into memory and
+ * queried in place. All the references in the file are offsets, so it
+ * doesn't matter where it's mapped:
+ *
+ *   header | nodes | children | children by name | strings
+ *
+ * The nodes are directories and links, the root is the first one. The
+ * children of a node go one after another in the order the directory
+ * listing has them, and the same indices sorted by name follow to find
+ * them by. Each node keeps the header of its task already rendered.
+ *
+ * The snapshot is made for the generation of the project, so it's stale
+ * as soon as the shell has changed anything. It's rebuilt then with the
+ * subtrees whose hashes and stat data are the same copied from the old
+ * snapshot instead of being read again. What is changed behind the
+ * shell's back is caught when a node is shown: the stat data of its
+ * directory and of the task files of the children it lists are compared
+ * with the stored ones first, and if they differ the snapshot is rebuilt
+ * without trusting the hashes.
+ */
+
+struct snap_header {
+	char magic[8];
+	unsigned long long hash;	/* of the root the snapshot is made for */
+	unsigned long long generation;
+	unsigned long long size;
+	unsigned int node_count;
+	unsigned int nodes;			/* offsets of the sections */
+	unsigned int children;
+	unsigned int by_name;
+	unsigned int strings;
+};
+
+struct snap_node {
+	unsigned long long hash;
+	unsigned long long dir_stamp;	/* of the directory and its shards */
+	unsigned long long file_stamp;	/* of the task file, 0 if there's none */
+	unsigned int name;			/* offsets in the strings, 0 is NULL */
+	unsigned int path;			/* root-relative, where it's stored */
+	unsigned int title;
+	unsigned int deadline;
+	unsigned int target;		/* root-relative path of a link */
+	unsigned int header;
+	unsigned int header_len;
+	unsigned int first_child;	/* index in the children */
+	unsigned int child_count;
+	unsigned char is_filter;
+	unsigned char completed;
+	unsigned char is_link;
+	unsigned char pad;
+};
+
+struct snapshot {
+	char *base;
+	long long size;
+	const struct snap_header *hdr;
+	const struct snap_node *nodes;
+	const unsigned int *children;
+	const unsigned int *by_name;
+	const char *strings;
+	int rootfd;
+};
+
+enum { 
+	max_link_depth = 16, 
+	no_node = -1,
+	default_builder_size = 256,
+};
+
+#define SNAPSHOT_TMP_FILE SNAPSHOT_FILE ".tmp"
+
+static char check_layout(const struct snapshot *snap)
+{
+	const struct snap_header *hdr = snap->hdr;
+	unsigned long long nodes_end;
+	if(snap->size < (long long)sizeof(*hdr) || 
+		memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->size != snap->size || hdr->node_count == 0)
+		return -1;
+	nodes_end = hdr->nodes+
+		(unsigned long long)hdr->node_count*sizeof(struct snap_node);
+	if(hdr->nodes < sizeof(*hdr) || nodes_end > hdr->children || 
+		hdr->children > hdr->by_name || 
+		hdr->by_name-hdr->children != hdr->strings-hdr->by_name ||
+		hdr->strings >= hdr->size ||
+		snap->base[snap->size-1] != 0)
+		return -1;
+	return 0;
+}
+
+struct snapshot *snapshot_open(int rootfd)
+{
+	struct snapshot *snap;
+	struct stat st;
+	void *base;
+	int fd = openat(rootfd, SNAPSHOT_FILE, O_RDONLY);
+	if(fd == -1)
+		return NULL;
+	if(fstat(fd, &st) == -1 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED)
+		return NULL;
+	snap = malloc(sizeof(*snap));
+	snap->base = base;
+	snap->size = st.st_size;
+	snap->hdr = base;
+	if(check_layout(snap) != 0) {
+		snapshot_close(snap);
+		return NULL;
+	}
+	snap->nodes = (const struct snap_node *)(snap->base+snap->hdr->nodes);
+	snap->children = (const unsigned int *)(snap->base+snap->hdr->children);
+	snap->by_name = (const unsigned int *)(snap->base+snap->hdr->by_name);
+	snap->strings = snap->base+snap->hdr->strings;
+	snap->rootfd = rootfd;
+	return snap;
+}
+
+void snapshot_close(struct snapshot *snap)
+{
+	if(!snap)
+		return;
+	munmap(snap->base, snap->size);
+	free(snap);
+}
+
+char snapshot_is_fresh(const struct snapshot *snap, const struct merkle *mk)
+{
+	unsigned long long hash;
+	if(!snap || snap->hdr->generation != merkle_generation(mk) || 
+		merkle_get(mk, mk->rootfd, ".", &hash) != 0)
+		return 0;
+	return snap->hdr->hash == hash;
+}
+
+static const char *get_string(const struct snapshot *snap, unsigned int off)
+{
+	return off ? snap->strings+off : NULL;
+}
+
+static unsigned long long stamp_add(unsigned long long h, 
+	unsigned long long value)
+{
+	return h ^ (value+0x9e3779b97f4a7c15ULL+(h << 6)+(h >> 2));
+}
+
+static unsigned long long stat_stamp(const struct stat *st)
+{
+	unsigned long long h = 1;
+	h = stamp_add(h, st->st_ino);
+	h = stamp_add(h, st->st_size);
+	h = stamp_add(h, st->st_mtim.tv_sec);
+	h = stamp_add(h, st->st_mtim.tv_nsec);
+	h = stamp_add(h, st->st_ctim.tv_sec);
+	return stamp_add(h, st->st_ctim.tv_nsec);
+}
+
+/* the stamp of the task file in the directory, 0 if it has none */
+static unsigned long long task_stamp(int dirfd, const char *path)
+{
+	struct stat st;
+	char *file = path[0] && strcmp(path, ".") != 0 ? 
+		paths_union(path, TASK_CORE_FILE) : strdup(TASK_CORE_FILE);
+	int rc = fstatat(dirfd, file, &st, 0);
+	free(file);
+	return rc == 0 ? stat_stamp(&st) : 0;
+}
+
+/* where the nodes are stored, the same for a snapshot and a builder */
+struct node_table {
+	const char *strings;
+	const struct snap_node *nodes;
+	const unsigned int *children;
+};
+
+/* 
+ * The directory changes with its children unless it's sharded, then the
+ * shards they're in do, so those are stamped along with it.
+ */
+static char dir_stamp(int rootfd, const struct node_table *nt, 
+	const struct snap_node *node, unsigned long long *stamp)
+{
+	const char *path = nt->strings+node->path, *prev = NULL;
+	long long plen = strlen(path), prevlen = 0, i;
+	struct stat st;
+	if(fstatat(rootfd, plen ? path : ".", &st, 0) == -1)
+		return -1;
+	*stamp = stat_stamp(&st);
+	for(i = 0; i < node->child_count; i++) {
+		const struct snap_node *child = 
+			&nt->nodes[nt->children[node->first_child+i]];
+		const char *cpath = nt->strings+child->path+(plen ? plen+1 : 0);
+		const char *sep = strrchr(cpath, '/');
+		char *shard;
+		int rc;
+		if(!sep || (prev && sep-cpath == prevlen && 
+			strncmp(cpath, prev, prevlen) == 0))
+			continue;
+		prev = cpath;
+		prevlen = sep-cpath;
+		shard = malloc(plen+prevlen+2);
+		if(plen)
+			sprintf(shard, "%s/%.*s", path, (int)prevlen, cpath);
+		else
+			sprintf(shard, "%.*s", (int)prevlen, cpath);
+		rc = fstatat(rootfd, shard, &st, 0);
+		free(shard);
+		if(rc == -1)
+			return -1;
+		*stamp = stamp_add(*stamp, stat_stamp(&st));
+	}
+	return 0;
+}
+
+static long long find_child(const struct snapshot *snap, long long idx,
+	const char *name, long long len)
+{
+	const struct snap_node *node = &snap->nodes[idx];
+	long long lo = 0, hi = (long long)node->child_count-1;
+	while(lo <= hi) {
+		long long mid = (lo+hi)/2;
+		unsigned int child = snap->by_name[node->first_child+mid];
+		const char *cname = get_string(snap, snap->nodes[child].name);
+		int res = strncmp(cname, name, len);
+		if(res == 0 && cname[len] != 0)
+			res = 1;
+		if(res == 0)
+			return child;
+		if(res < 0)
+			lo = mid+1;
+		else
+			hi = mid-1;
+	}
+	return no_node;
+}
+
+static long long find_node(const struct snapshot *snap, const char *path,
+	int depth);
+
+static long long resolve_link(const struct snapshot *snap, long long idx,
+	int depth)
+{
+	if(idx == no_node || !snap->nodes[idx].is_link)
+		return idx;
+	if(depth >= max_link_depth)
+		return no_node;
+	return find_node(snap, get_string(snap, snap->nodes[idx].target),
+		depth+1);
+}
+
+static long long find_node(const struct snapshot *snap, const char *path,
+	int depth)
+{
+	long long idx = 0;
+	while(path && *path && idx != no_node) {
+		const char *sep = strchr(path, '/');
+		long long len = sep ? sep-path : strlen(path);
+		if(len > 0) {
+			idx = resolve_link(snap, idx, depth);
+			if(idx != no_node)
+				idx = find_child(snap, idx, path, len);
+		}
+		path += sep ? len+1 : len;
+	}
+	return resolve_link(snap, idx, depth);
+}
+
+struct snap_source {
+	const struct snapshot *snap;
+	const struct snap_node *parent;
+	unsigned int pos;
+};
+
+static char next_snap_item(void *data, struct listing_item *item)
+{
+	struct snap_source *ss = data;
+	const struct snapshot *snap = ss->snap;
+	while(ss->pos < ss->parent->child_count) {
+		unsigned int child = snap->children[ss->parent->first_child+ss->pos];
+		long long idx = resolve_link(snap, child, 0);
+		const struct snap_node *node;
+		ss->pos++;
+		if(idx == no_node)
+			continue;
+		node = &snap->nodes[idx];
+		item->shortname = get_string(snap, snap->nodes[child].name);
+		item->name = get_string(snap, node->title);
+		item->deadline = get_string(snap, node->deadline);
+		item->info = NULL;	/* only the text is shown from the snapshot */
+		item->from = NULL;
+		item->to = NULL;
+		item->is_filter = node->is_filter;
+		item->completed = node->completed;
+		return 0;
+	}
+	return -1;
+}
+
+/* 
+ * The node and the children it's going to list are the same as on the
+ * disk. A child added, removed or renamed changes the directory, so only
+ * the task files of the listed children have to be looked at. Those are
+ * known before the listing only when it isn't sorted; a sorted page takes
+ * the children's files as the directory has them.
+ */
+static char check_node(const struct snapshot *snap, long long idx,
+	const struct listing_opts *opts)
+{
+	const struct snap_node *node = &snap->nodes[idx];
+	struct node_table nt;
+	unsigned long long stamp;
+	long long i, listed = 0, first = 0, end = -1;
+	nt.strings = snap->strings;
+	nt.nodes = snap->nodes;
+	nt.children = snap->children;
+	if(dir_stamp(snap->rootfd, &nt, node, &stamp) != 0 || 
+		stamp != node->dir_stamp || 
+		task_stamp(snap->rootfd, snap->strings+node->path) != node->file_stamp)
+		return -1;
+	if(opts->limit >= 0) {
+		if(opts->sort != sort_none)
+			return 0;
+		first = opts->offset;
+		end = opts->offset+opts->limit;
+	}
+	for(i = 0; i < node->child_count && (end < 0 || listed < end); i++) {
+		long long child = resolve_link(snap, 
+			snap->children[node->first_child+i], 0);
+		const struct snap_node *cn;
+		if(child == no_node)
+			continue;	/* skipped by the listing as well */
+		if(listed++ < first)
+			continue;
+		cn = &snap->nodes[child];
+		if(task_stamp(snap->rootfd, snap->strings+cn->path) != cn->file_stamp)
+			return -1;
+	}
+	return 0;
+}
+
+/* ESTALE means the node has been changed behind the shell's back */
+char snapshot_show(const struct snapshot *snap, const char *relpath,
+	const struct listing_opts *opts, struct outbuf *ob)
+{
+	struct listing_source src;
+	struct snap_source ss;
+	const struct snap_node *node;
+	long long idx;
+	if(!snap || !relpath)
+		return -1;
+	idx = find_node(snap, relpath, 0);
+	if(idx == no_node) {
+		errno = ENOENT;
+		return -1;
+	}
+	if(check_node(snap, idx, opts) != 0) {
+		errno = ESTALE;
+		return -1;
+	}
+	node = &snap->nodes[idx];
+	if(node->header_len > 0)
+		outbuf_write(ob, snap->strings+node->header, node->header_len);
+	ss.snap = snap;
+	ss.parent = node;
+	ss.pos = 0;
+	src.next = next_snap_item;
+	src.data = &ss;
+	return listing_print_source(&src, opts, ob);
+}
+
+struct builder {
+	const struct merkle *mk;
+	const struct snapshot *old;
+	char recheck;			/* the hashes of the old one aren't trusted */
+	struct snap_node *nodes;
+	long long ncount, nsize;
+	unsigned int *children;
+	unsigned int *by_name;
+	long long ccount, csize;
+	struct outbuf strings;
+	struct batchio *bio;
+};
+
+static unsigned int add_blob(struct builder *b, const char *data, 
+	long long len)
+{
+	unsigned int off = b->strings.len;
+	outbuf_write(&b->strings, data, len);
+	outbuf_putc(&b->strings, 0);
+	return off;
+}
+
+static unsigned int add_string(struct builder *b, const char *str)
+{
+	return str ? add_blob(b, str, strlen(str)) : 0;
+}
+
+static long long add_node(struct builder *b)
+{
+	if(b->ncount == b->nsize) {
+		b->nsize *= 2;
+		b->nodes = realloc(b->nodes, sizeof(*(b->nodes))*b->nsize);
+	}
+	memset(&b->nodes[b->ncount], 0, sizeof(*(b->nodes)));
+	b->ncount++;
+	return b->ncount-1;
+}
+
+struct named_child {
+	const char *name;
+	unsigned int idx;
+};
+
+static int named_child_cmp(const void *a, const void *b)
+{
+	const struct named_child *c1 = a, *c2 = b;
+	return strcmp(c1->name, c2->name);
+}
+
+static void add_children(struct builder *b, long long idx,
+	const unsigned int *children, long long count)
+{
+	struct named_child *named;
+	long long i;
+	if(b->ccount+count > b->csize) {
+		while(b->ccount+count > b->csize)
+			b->csize *= 2;
+		b->children = realloc(b->children, sizeof(*(b->children))*b->csize);
+		b->by_name = realloc(b->by_name, sizeof(*(b->by_name))*b->csize);
+	}
+	memcpy(b->children+b->ccount, children, sizeof(*children)*count);
+	named = malloc(sizeof(*named)*(count+1));
+	for(i = 0; i < count; i++) {
+		named[i].name = b->strings.data+b->nodes[children[i]].name;
+		named[i].idx = children[i];
+	}
+	qsort(named, count, sizeof(*named), named_child_cmp);
+	for(i = 0; i < count; i++)
+		b->by_name[b->ccount+i] = named[i].idx;
+	free(named);
+	b->nodes[idx].first_child = b->ccount;
+	b->nodes[idx].child_count = count;
+	b->ccount += count;
+}
+
+static char *child_path(const char *parent, const char *path)
+{
+	return parent[0] ? paths_union(parent, path) : strdup(path);
+}
+
+/* 
+ * The subtree hasn't changed, so it's taken as it is from the old one,
+ * only put where it's stored now.
+ */
+static long long copy_node(struct builder *b, long long oldidx, 
+	const char *path)
+{
+	const struct snapshot *old = b->old;
+	const struct snap_node *on = &old->nodes[oldidx];
+	const char *oldpath = get_string(old, on->path);
+	unsigned int *children;
+	long long idx = add_node(b), i, plen = strlen(oldpath);
+	struct snap_node *node = &b->nodes[idx];
+	*node = *on;
+	node->name = add_string(b, get_string(old, on->name));
+	node->path = add_string(b, path);
+	node->title = add_string(b, get_string(old, on->title));
+	node->deadline = add_string(b, get_string(old, on->deadline));
+	node->target = add_string(b, get_string(old, on->target));
+	node->header = on->header_len > 0 ?
+		add_blob(b, old->strings+on->header, on->header_len) : 0;
+	children = malloc(sizeof(*children)*(on->child_count+1));
+	for(i = 0; i < on->child_count; i++) {
+		unsigned int child = old->children[on->first_child+i];
+		const char *cpath = get_string(old, old->nodes[child].path);
+		char *newpath = child_path(path, cpath+(plen ? plen+1 : 0));
+		children[i] = copy_node(b, child, newpath);
+		free(newpath);
+	}
+	add_children(b, idx, children, on->child_count);
+	free(children);
+	return idx;
+}
+
+static void fill_task(struct builder *b, long long idx, 
+	const struct task *task)
+{
+	struct outbuf ob;
+	struct snap_node *node = &b->nodes[idx];
+	node->title = add_string(b, task_get_name(task));
+	node->deadline = add_string(b, task_get_deadline(task));
+	node->is_filter = task_is_filter(task);
+	node->completed = task_get_completed(task);
+	if(outbuf_init(&ob, -1) != 0)
+		return;
+	task_render_header(task, &ob);
+	node = &b->nodes[idx];
+	if(ob.len > 0) {
+		node->header = add_blob(b, ob.data, ob.len);
+		node->header_len = ob.len;
+	}
+	outbuf_free(&ob);
+}
+
+/* the task file is the same as the old one was made of */
+static void reuse_task(struct builder *b, long long idx, long long oldidx)
+{
+	const struct snapshot *old = b->old;
+	const struct snap_node *on = &old->nodes[oldidx];
+	unsigned int title, deadline, header;
+	title = add_string(b, get_string(old, on->title));
+	deadline = add_string(b, get_string(old, on->deadline));
+	header = on->header_len > 0 ?
+		add_blob(b, old->strings+on->header, on->header_len) : 0;
+	b->nodes[idx].title = title;
+	b->nodes[idx].deadline = deadline;
+	b->nodes[idx].header = header;
+	b->nodes[idx].header_len = on->header_len;
+	b->nodes[idx].is_filter = on->is_filter;
+	b->nodes[idx].completed = on->completed;
+}
+
+/* what is known about a directory before it's built */
+struct dir_info {
+	const char *name;
+	const char *path;		/* relative to the parent's fd */
+	const char *physpath;	/* relative to the root */
+	unsigned long long hash;
+	unsigned long long file_stamp;
+	long long oldidx;
+};
+
+static long long build_dir(struct builder *b, int dirfd, 
+	const struct dir_info *di, const struct task *task);
+
+static long long build_link(struct builder *b, int fd, const char *path,
+	const char *physpath, const char *name)
+{
+	char target[4096];
+	char *reltarget, *logical;
+	long long idx;
+	ssize_t len = readlinkat(fd, path, target, sizeof(target)-1);
+	if(len < 0)
+		return no_node;
+	target[len] = 0;
+	/* the snapshot can't answer for what is outside of the project */
+	reltarget = path_strip_root(b->mk->root, target);
+	if(!reltarget)
+		return no_node;
+	idx = add_node(b);
+	b->nodes[idx].is_link = 1;
+	b->nodes[idx].name = add_string(b, name);
+	b->nodes[idx].path = add_string(b, physpath);
+	/* the nodes are found by the names, not by where they're stored */
+	logical = shard_logical(reltarget);
+	b->nodes[idx].target = add_string(b, logical);
+	free(logical);
+	free(reltarget);
+	return idx;
+}
+
+/* what is known about a child before it's built */
+struct child_plan {
+	struct dir_info di;
+	char kind;				/* plan_* */
+	long long file;			/* index of its task file in the batch */
+};
+
+enum { plan_skip, plan_link, plan_copy, plan_build };
+
+/* the old node is stored where it was and nothing in it has been touched */
+static char is_unchanged(struct builder *b, const struct dir_info *di)
+{
+	const struct snapshot *old = b->old;
+	const struct snap_node *on = &old->nodes[di->oldidx];
+	struct node_table nt;
+	unsigned long long stamp;
+	if(b->recheck || on->hash != di->hash || 
+		on->file_stamp != di->file_stamp ||
+		strcmp(get_string(old, on->path), di->physpath) != 0)
+		return 0;
+	nt.strings = old->strings;
+	nt.nodes = old->nodes;
+	nt.children = old->children;
+	return dir_stamp(b->mk->rootfd, &nt, on, &stamp) == 0 &&
+		stamp == on->dir_stamp;
+}
+
+static void plan_child(struct builder *b, int fd, long long oldidx,
+	const char *parent, const struct scan_entry *ent, struct child_plan *cp)
+{
+	cp->di.name = ent->name;
+	cp->di.path = scan_entry_path(ent);
+	cp->di.physpath = child_path(parent, cp->di.path);
+	cp->kind = plan_skip;
+	cp->di.oldidx = no_node;
+	cp->file = -1;
+	if(ent->is_link) {
+		cp->kind = plan_link;
+		return;
+	}
+	if(merkle_get(b->mk, fd, cp->di.path, &cp->di.hash) != 0)
+		return;
+	/* taken before the file is read, a change in between is seen later */
+	cp->di.file_stamp = task_stamp(fd, cp->di.path);
+	if(oldidx != no_node)
+		cp->di.oldidx = find_child(b->old, oldidx, cp->di.name, 
+			strlen(cp->di.name));
+	if(cp->di.oldidx != no_node && b->old->nodes[cp->di.oldidx].is_link)
+		cp->di.oldidx = no_node;
+	if(cp->di.oldidx != no_node && is_unchanged(b, &cp->di))
+		cp->kind = plan_copy;
+	else
+		cp->kind = plan_build;
+}
+
+/* the old task is taken if its file hasn't been touched */
+static char can_reuse(struct builder *b, const struct dir_info *di)
+{
+	return di->oldidx != no_node && di->file_stamp != 0 &&
+		b->old->nodes[di->oldidx].file_stamp == di->file_stamp;
+}
+
+/* 
+ * The hashes tell which children have to be read again, and the task
+ * files of those are read in one batch before any of them is built.
+ */
+static void build_children(struct builder *b, long long idx, int fd,
+	long long oldidx)
+{
+	struct node_table nt;
+	struct child_plan *plans;
+	struct batch_file *files;
+	struct scan_entry *ents;
+	unsigned int *children;
+	long long count, ccount = 0, fcount = 0, i;
+	char *parent;
+	ents = scan_dir(fd, ".", NULL, &count);
+	if(!ents)
+		return;
+	parent = strdup(b->strings.data+b->nodes[idx].path);
+	plans = malloc(sizeof(*plans)*(count+1));
+	files = malloc(sizeof(*files)*(count+1));
+	for(i = 0; i < count; i++) {
+		plan_child(b, fd, oldidx, parent, &ents[i], &plans[i]);
+		if(plans[i].kind != plan_build || can_reuse(b, &plans[i].di))
+			continue;
+		plans[i].file = fcount;
+		files[fcount].path = paths_union(plans[i].di.path, TASK_CORE_FILE);
+		fcount++;
+	}
+	batchio_read(b->bio, fd, files, fcount);
+	children = malloc(sizeof(*children)*(count+1));
+	for(i = 0; i < count; i++) {
+		struct child_plan *cp = &plans[i];
+		long long child = no_node;
+		struct task *task;
+		switch(cp->kind) {
+			case plan_link:
+				child = build_link(b, fd, cp->di.path, cp->di.physpath,
+					cp->di.name);
+				break;
+			case plan_copy:
+				child = copy_node(b, cp->di.oldidx, cp->di.physpath);
+				break;
+			case plan_build:
+				task = cp->file >= 0 && files[cp->file].data ? task_parse(
+					files[cp->file].data, files[cp->file].len) : NULL;
+				child = build_dir(b, fd, &cp->di, task);
+				task_free(task);
+				if(child != no_node && cp->file < 0)
+					reuse_task(b, child, cp->di.oldidx);
+				break;
+		}
+		if(child != no_node) {
+			children[ccount] = child;
+			ccount++;
+		}
+	}
+	add_children(b, idx, children, ccount);
+	nt.strings = b->strings.data;
+	nt.nodes = b->nodes;
+	nt.children = b->children;
+	dir_stamp(b->mk->rootfd, &nt, &b->nodes[idx], &b->nodes[idx].dir_stamp);
+	for(i = 0; i < fcount; i++) {
+		free((char *)files[i].path);
+		free(files[i].data);
+	}
+	for(i = 0; i < count; i++)
+		free((char *)plans[i].di.physpath);
+	scan_free(ents, count);
+	free(parent);
+	free(children);
+	free(files);
+	free(plans);
+}
+
+static long long build_dir(struct builder *b, int dirfd, 
+	const struct dir_info *di, const struct task *task)
+{
+	long long idx;
+	int fd = openat(dirfd, di->path, O_RDONLY|O_DIRECTORY);
+	if(fd == -1)
+		return no_node;
+	idx = add_node(b);
+	b->nodes[idx].hash = di->hash;
+	b->nodes[idx].file_stamp = di->file_stamp;
+	b->nodes[idx].name = add_string(b, di->name);
+	b->nodes[idx].path = add_string(b, di->physpath);
+	if(task)
+		fill_task(b, idx, task);
+	build_children(b, idx, fd, di->oldidx);
+	close(fd);
+	return idx;
+}
+
+static long long build_root(struct builder *b)
+{
+	struct dir_info di;
+	struct task *task;
+	long long idx;
+	if(merkle_get(b->mk, b->mk->rootfd, ".", &di.hash) != 0)
+		return no_node;
+	di.name = "";
+	di.path = ".";
+	di.physpath = "";
+	di.file_stamp = task_stamp(b->mk->rootfd, ".");
+	di.oldidx = b->old ? 0 : no_node;
+	task = task_read(b->mk->rootfd, ".");
+	idx = build_dir(b, b->mk->rootfd, &di, task);
+	task_free(task);
+	return idx;
+}
+
+/* the snapshot is written into the root, so the root has changed with it */
+static char restamp_root(const struct builder *b, int rootfd,
+	unsigned int nodes)
+{
+	struct node_table nt;
+	unsigned long long stamp;
+	ssize_t rc;
+	int fd;
+	nt.strings = b->strings.data;
+	nt.nodes = b->nodes;
+	nt.children = b->children;
+	if(dir_stamp(rootfd, &nt, &b->nodes[0], &stamp) != 0)
+		return -1;
+	fd = openat(rootfd, SNAPSHOT_FILE, O_WRONLY);
+	if(fd == -1)
+		return -1;
+	rc = pwrite(fd, &stamp, sizeof(stamp), 
+		nodes+offsetof(struct snap_node, dir_stamp));
+	close(fd);
+	return rc == sizeof(stamp) ? 0 : -1;
+}
+
+static char write_snapshot(const struct builder *b, int rootfd,
+	unsigned long long generation)
+{
+	struct snap_header hdr;
+	struct outbuf ob;
+	char ok;
+	int fd;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	hdr.hash = b->nodes[0].hash;
+	hdr.generation = generation;
+	hdr.node_count = b->ncount;
+	hdr.nodes = sizeof(hdr);
+	hdr.children = hdr.nodes+sizeof(*(b->nodes))*b->ncount;
+	hdr.by_name = hdr.children+sizeof(*(b->children))*b->ccount;
+	hdr.strings = hdr.by_name+sizeof(*(b->by_name))*b->ccount;
+	hdr.size = hdr.strings+b->strings.len;
+	fd = openat(rootfd, SNAPSHOT_TMP_FILE, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if(fd == -1)
+		return -1;
+	if(outbuf_init(&ob, fd) != 0) {
+		close(fd);
+		return -1;
+	}
+	ok = outbuf_write(&ob, (const char *)&hdr, sizeof(hdr));
+	if(ok == 0)
+		ok = outbuf_write(&ob, (const char *)b->nodes, 
+			sizeof(*(b->nodes))*b->ncount);
+	if(ok == 0)
+		ok = outbuf_write(&ob, (const char *)b->children, 
+			sizeof(*(b->children))*b->ccount);
+	if(ok == 0)
+		ok = outbuf_write(&ob, (const char *)b->by_name, 
+			sizeof(*(b->by_name))*b->ccount);
+	if(ok == 0)
+		ok = outbuf_write(&ob, b->strings.data, b->strings.len);
+	if(ok == 0)
+		ok = outbuf_flush(&ob);
+	outbuf_free(&ob);
+	if(close(fd) != 0)
+		ok = -1;
+	if(ok == 0)
+		ok = renameat(rootfd, SNAPSHOT_TMP_FILE, rootfd, SNAPSHOT_FILE);
+	if(ok != 0)
+		unlinkat(rootfd, SNAPSHOT_TMP_FILE, 0);
+	else
+		ok = restamp_root(b, rootfd, hdr.nodes);
+	return ok == 0 ? 0 : -1;
+}
+
+/* 
+ * With recheck the old snapshot is used for the task files which haven't
+ * been touched only, every directory is scanned again.
+ */
+char snapshot_build(const struct merkle *mk, const struct snapshot *old,
+	char recheck)
+{
+	struct builder b;
+	unsigned long long generation;
+	char ok;
+	/* taken first, so a change made while it's built makes it stale */
+	generation = merkle_generation(mk);
+	b.mk = mk;
+	b.old = old;
+	b.recheck = recheck;
+	b.nsize = b.csize = default_builder_size;
+	b.ncount = b.ccount = 0;
+	b.nodes = malloc(sizeof(*(b.nodes))*b.nsize);
+	b.children = malloc(sizeof(*(b.children))*b.csize);
+	b.by_name = malloc(sizeof(*(b.by_name))*b.csize);
+	if(outbuf_init(&b.strings, -1) != 0)
+		return -1;
+	outbuf_putc(&b.strings, 0);	/* so that no string is at 0 */
+	b.bio = batchio_open();
+	ok = build_root(&b) == 0 ? 0 : -1;
+	if(ok == 0)
+		ok = write_snapshot(&b, mk->rootfd, generation);
+	outbuf_free(&b.strings);
+	batchio_close(b.bio);
+	free(b.nodes);
+	free(b.children);
+	free(b.by_name);
+	return ok;
+}
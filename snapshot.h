@@ -0,0 +1,19 @@
+#ifndef SNAPSHOT_H_SENTRY
+#define SNAPSHOT_H_SENTRY
+
+#define SNAPSHOT_FILE ".snapshot"
+#define SNAPSHOT_MAGIC "TSKSNAP2"
+
+struct snapshot;
+struct merkle;
+struct listing_opts;
+struct outbuf;
+
+struct snapshot *snapshot_open(int rootfd);
+void snapshot_close(struct snapshot *snap);
+char snapshot_is_fresh(const struct snapshot *snap, const struct merkle *mk);
+char snapshot_build(const struct merkle *mk, const struct snapshot *old,
+	char recheck);
+char snapshot_show(const struct snapshot *snap, const char *relpath,
+	const struct listing_opts *opts, struct outbuf *ob);
+#endif
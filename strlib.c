@@ -3,10 +3,268 @@
 #include <stdlib.h>
 #include <string.h> 
 #include <stdarg.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define STRLIB_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * The length, the search for a byte and the prefix comparison go over
+ * 16 or 32 bytes at once with SSE2 or AVX2, whichever the CPU has, and
+ * byte by byte elsewhere. The vector loads never cross a page the string
+ * doesn't reach: the scans of one string load aligned blocks, and the
+ * prefix comparison, which walks two strings at once, goes byte by byte
+ * near the end of a page.
+ *
+ * Tokens and completion candidates are short, so their first bytes are
+ * looked at one by one before anything is loaded: most tokens end and
+ * most candidates differ there.
+ */
+
+struct simd_ops {
+	long long (*length)(const char *s);
+	const char *(*find)(const char *s, char c);
+	char (*has_prefix)(const char *str, const char *prefix);
+};
+
+enum { page_size = 4096 };
+
+static char crosses_page(const char *p, long long len)
+{
+	return ((uintptr_t)p & (page_size-1)) > page_size-len;
+}
+
+static long long scalar_length(const char *s)
+{
+	const char *tmp = s;
+	while(*s)
+		s++;
+	return s-tmp;
+}
+
+/* returns the first c or the end of the string */
+static const char *scalar_find(const char *s, char c)
+{
+	while(*s && *s != c)
+		s++;
+	return s;
+}
+
+static char scalar_has_prefix(const char *str, const char *prefix)
+{
+	for(; *prefix; str++, prefix++)
+		if(*str != *prefix)
+			return 0;
+	return 1;
+}
+
+/* whether the prefix ends in the first len bytes and is matched */
+static char scalar_block_prefix(const char *str, const char *prefix,
+	long long len, char *ended)
+{
+	long long i;
+	*ended = 1;
+	for(i = 0; i < len; i++) {
+		if(!prefix[i])
+			return 1;
+		if(str[i] != prefix[i])
+			return 0;
+	}
+	*ended = 0;
+	return 1;
+}
+
+static const struct simd_ops scalar_ops = {
+	scalar_length, scalar_find, scalar_has_prefix
+};
+
+#ifdef STRLIB_X86
+__attribute__((target("sse2")))
+static long long sse2_length(const char *s)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+	unsigned int mask;
+	mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+		_mm_load_si128((const __m128i *)p), zero)) >> (s-p);
+	if(mask)
+		return __builtin_ctz(mask);
+	for(;;) {
+		p += 16;
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_load_si128((const __m128i *)p), zero));
+		if(mask)
+			return p-s+__builtin_ctz(mask);
+	}
+}
+
+__attribute__((target("sse2")))
+static const char *sse2_find(const char *s, char c)
+{
+	const __m128i zero = _mm_setzero_si128(), cv = _mm_set1_epi8(c);
+	const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+	unsigned int mask;
+	__m128i v = _mm_load_si128((const __m128i *)p);
+	mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, zero),
+		_mm_cmpeq_epi8(v, cv))) >> (s-p);
+	if(mask)
+		return s+__builtin_ctz(mask);
+	for(;;) {
+		p += 16;
+		v = _mm_load_si128((const __m128i *)p);
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, zero),
+			_mm_cmpeq_epi8(v, cv)));
+		if(mask)
+			return p+__builtin_ctz(mask);
+	}
+}
+
+__attribute__((target("sse2")))
+static char sse2_has_prefix(const char *str, const char *prefix)
+{
+	const __m128i zero = _mm_setzero_si128();
+	for(;; str += 16, prefix += 16) {
+		unsigned int end, diff;
+		__m128i s, p;
+		if(crosses_page(str, 16) || crosses_page(prefix, 16)) {
+			char ended, ok = scalar_block_prefix(str, prefix, 16, &ended);
+			if(!ok || ended)
+				return ok;
+			continue;
+		}
+		s = _mm_loadu_si128((const __m128i *)str);
+		p = _mm_loadu_si128((const __m128i *)prefix);
+		end = _mm_movemask_epi8(_mm_cmpeq_epi8(p, zero));
+		diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(s, p)) & 0xffff;
+		if(end)
+			return !(diff & ((end & -end)-1));
+		if(diff)
+			return 0;
+	}
+}
+
+static const struct simd_ops sse2_ops = {
+	sse2_length, sse2_find, sse2_has_prefix
+};
+
+__attribute__((target("avx2")))
+static long long avx2_length(const char *s)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)31);
+	unsigned int mask;
+	mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+		_mm256_load_si256((const __m256i *)p), zero)) >> (s-p);
+	if(mask)
+		return __builtin_ctz(mask);
+	for(;;) {
+		p += 32;
+		mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_load_si256((const __m256i *)p), zero));
+		if(mask)
+			return p-s+__builtin_ctz(mask);
+	}
+}
+
+__attribute__((target("avx2")))
+static const char *avx2_find(const char *s, char c)
+{
+	const __m256i zero = _mm256_setzero_si256(), cv = _mm256_set1_epi8(c);
+	const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)31);
+	unsigned int mask;
+	__m256i v = _mm256_load_si256((const __m256i *)p);
+	mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+		_mm256_cmpeq_epi8(v, zero), _mm256_cmpeq_epi8(v, cv))) >> (s-p);
+	if(mask)
+		return s+__builtin_ctz(mask);
+	for(;;) {
+		p += 32;
+		v = _mm256_load_si256((const __m256i *)p);
+		mask = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(v, zero), _mm256_cmpeq_epi8(v, cv)));
+		if(mask)
+			return p+__builtin_ctz(mask);
+	}
+}
+
+__attribute__((target("avx2")))
+static char avx2_has_prefix(const char *str, const char *prefix)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	for(;; str += 32, prefix += 32) {
+		unsigned int end, diff;
+		__m256i s, p;
+		if(crosses_page(str, 32) || crosses_page(prefix, 32)) {
+			char ended, ok = scalar_block_prefix(str, prefix, 32, &ended);
+			if(!ok || ended)
+				return ok;
+			continue;
+		}
+		s = _mm256_loadu_si256((const __m256i *)str);
+		p = _mm256_loadu_si256((const __m256i *)prefix);
+		end = _mm256_movemask_epi8(_mm256_cmpeq_epi8(p, zero));
+		diff = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(s, p));
+		if(end)
+			return !(diff & ((end & -end)-1));
+		if(diff)
+			return 0;
+	}
+}
+
+static const struct simd_ops avx2_ops = {
+	avx2_length, avx2_find, avx2_has_prefix
+};
+#endif
+
+static const struct simd_ops *ops = &scalar_ops;
+static simd_t cur_simd = simd_scalar;
+
+char strlib_set_simd(simd_t simd)
+{
+#ifdef STRLIB_X86
+	__builtin_cpu_init();
+#endif
+	switch(simd) {
+		case simd_scalar:
+			ops = &scalar_ops;
+			break;
+#ifdef STRLIB_X86
+		case simd_sse2:
+			if(!__builtin_cpu_supports("sse2"))
+				return -1;
+			ops = &sse2_ops;
+			break;
+		case simd_avx2:
+			if(!__builtin_cpu_supports("avx2"))
+				return -1;
+			ops = &avx2_ops;
+			break;
+#endif
+		default:
+			return -1;
+	}
+	cur_simd = simd;
+	return 0;
+}
+
+simd_t strlib_get_simd()
+{
+	return cur_simd;
+}
+
+/* the best the CPU has is chosen before main, while there's one thread */
+__attribute__((constructor))
+static void select_simd()
+{
+	if(strlib_set_simd(simd_avx2) != 0 && strlib_set_simd(simd_sse2) != 0)
+		strlib_set_simd(simd_scalar);
+}
 
 enum {
     comma_chr = '"',
-    space_chr = ' '
+    space_chr = ' ',
+    short_token = 16
 };
 
 static char is_space(char c)
@@ -26,10 +284,23 @@ static char string_is_empty(const char *s)
     return 1;
 } 
 
+/* 
+ * Most tokens end in a few bytes, before a vector load would pay off, so
+ * those are searched byte by byte and only a longer one goes to ops.
+ */
+static const char *find_in_token(const char *s, char c)
+{
+    int i;
+    for(i = 0; i < short_token; i++, s++)
+        if(!*s || *s == c)
+            return s;
+    return ops->find(s, c);
+}
+
 static char *get_token(const char *s, long long *offset)
 {
     char *token;
-    long long i, len;
+    long long i;
     const char *tmp = s;
     char quoted = 0;
     *offset = 0;
@@ -43,13 +314,13 @@ static char *get_token(const char *s, long long *offset)
         quoted = 1;
         s++;
     }
-    len = strlen(s);
-    for(i = 0; i < len; i++) {
-        if(quoted && (s[i] == comma_chr) && (s[i-1] != '\\'))
-            break;
-        if(!quoted && s[i] == space_chr)
-            break;
-    }
+    if(quoted) {
+        const char *end = find_in_token(s, comma_chr);
+        while(*end && end[-1] == '\\')
+            end = find_in_token(end+1, comma_chr);
+        i = end-s;
+    } else
+        i = find_in_token(s, space_chr)-s;
     if(i == 0)
         return NULL;
     token = malloc(sizeof(*token)*(i+1));
@@ -64,8 +335,10 @@ char **get_tokens(const char *s)
     char **items;
     char *token;
     long long i, offset;
+    mem_area_t prev;
     if(!s)
         return NULL;
+    prev = mem_enter(mem_tokenizer);
     items = malloc(sizeof(*items)*(strlen(s)+1));
     i = 0;
     while((token = get_token(s, &offset)) != NULL) {
@@ -74,6 +347,7 @@ char **get_tokens(const char *s)
         i++;
     }
     items[i] = NULL;
+    mem_leave(prev);
     return items;
 }
 
@@ -116,54 +390,42 @@ char *strings_concatenate(const char *s, ...)
 
 long long string_length(const char *s)
 {
-    const char *tmp;
     if(!s)
         return 0;
-    tmp = s;
-    while(*s)
-        s++;
-    return s-tmp;
+    return ops->length(s);
 }
 
 char *string_duplicate(const char *s)
 {
     char *result;
-    long long len, i;
+    long long len;
     if(!s)
         return NULL;
-    len = strlen(s);
+    len = ops->length(s);
     result = malloc(sizeof(*s)*(len+1));
-    for(i = 0; s[i]; i++)
-        result[i] = s[i];
-    result[i] = 0;
+    memcpy(result, s, len+1);
     return result;
 }
 
 char *string_catenate(char *dest, const char *src)
 {
-    long long len, i;
     if(!dest || !src)
         return NULL;
-    len = strlen(src);
-    dest += strlen(dest);
-    for(i = 0; i < len; i++)
-        dest[i] = src[i];
-    dest[i] = 0;
+    dest += ops->length(dest);
+    memcpy(dest, src, ops->length(src)+1);
     return dest;
 }
 
 char *get_word(const char *s, long long *offset)
 {
 	char *word;
-	long long i, len;
+	long long i;
 	if(!s)
 		return NULL;
-	len = strlen(s);
-	word = malloc(sizeof(*word)*(len+1));
-	for(i = 0; (i < len) && (s[i] != ' '); i++)
-		word[i] = s[i];
+	i = ops->find(s, ' ')-s;
+	word = malloc(sizeof(*word)*(i+1));
+	memcpy(word, s, i);
 	word[i] = 0;
-	word = realloc(word, sizeof(*word)*(i+1));
 	*offset = i;
 	return word;
 }
@@ -244,19 +506,16 @@ char is_number(int ch)
 	return (ch >= '0') && (ch <= '9');
 }
 
+/* most of the strings differ at once, which a vector load only slows down */
 static char has_prefix(const char *str, const char *prefix)
 {
-	long long slen, plen, i;
 	if(!str || !prefix)
 		return 0;
-	plen = strlen(prefix);
-	slen = strlen(str);
-	if(plen > slen)
+	if(!prefix[0])
+		return 1;
+	if(str[0] != prefix[0])
 		return 0;
-	for(i = 0; i < plen; i++)
-		if(str[i] != prefix[i])
-			return 0;
-	return 1;
+	return ops->has_prefix(str+1, prefix+1);
 }
 
 const char **get_strings_by_prefix(const char **strs, long long count,
@@ -1,6 +1,13 @@
 #ifndef STRLIB_H_SENTRY
 #define STRLIB_H_SENTRY
 
+/* the vector instructions the string functions use */
+typedef enum {
+	simd_scalar,
+	simd_sse2,
+	simd_avx2
+} simd_t;
+
 char **get_tokens(const char *s);
 char *strings_concatenate(const char *s, ...);
 long long string_length(const char *s);
@@ -13,5 +20,7 @@ char string_shift(char *str, long long shift);
 char is_number(int ch);
 const char **get_strings_by_prefix(const char **strs, long long count,
 	const char *prefix);
+char strlib_set_simd(simd_t simd);
+simd_t strlib_get_simd();
 
 #endif
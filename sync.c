@@ -0,0 +1,210 @@
+#include "sync.h"
+#include "strlib.h"
+#include "merkle.h"
+#include "linkidx.h"
+#include "fslib.h"
+#include "copy.h"
+#include "task.h"
+#include "shard.h"
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+
+/*
+ * Makes the destination project equal to the source one going down only
+ * into the subtrees whose hashes differ. The links into the source project
+ * are pointed to the same places of the destination one.
+ */
+
+struct sync_ctx {
+	const struct merkle *src;
+	const struct merkle *dst;
+	int copyfd;				/* the directory a subtree is copied into */
+	const char *copyname;
+};
+
+enum { no_entry = -1 };
+
+static int get_type(int dirfd, const char *name)
+{
+	struct stat st;
+	if(fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+		return no_entry;
+	if(S_ISDIR(st.st_mode))
+		return DT_DIR;
+	return S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+}
+
+static char *get_dst_target(const struct sync_ctx *ctx, const char *target)
+{
+	long long rlen = strlen(ctx->src->root);
+	if(strncmp(target, ctx->src->root, rlen) != 0 || 
+		(target[rlen] != '/' && target[rlen] != 0))
+		return strdup(target);
+	return strings_concatenate(ctx->dst->root, target+rlen, NULL);
+}
+
+static char sync_link(const struct sync_ctx *ctx, int sfd, int dfd,
+	const char *name, const char *linkpath)
+{
+	char target[4096], current[4096];
+	char *dsttarget;
+	ssize_t len;
+	char ok = 0;
+	len = readlinkat(sfd, name, target, sizeof(target)-1);
+	if(len == -1)
+		return -1;
+	target[len] = 0;
+	dsttarget = get_dst_target(ctx, target);
+	len = readlinkat(dfd, linkpath, current, sizeof(current)-1);
+	if(len >= 0) {
+		current[len] = 0;
+		if(strcmp(current, dsttarget) == 0)
+			goto quit;
+		unlinkat(dfd, linkpath, 0);
+	}
+	if(symlinkat(dsttarget, dfd, linkpath) == -1)
+		ok = -1;
+quit:
+	free(dsttarget);
+	return ok;
+}
+
+static void relink_copied(const char *target, const char *linkpath,
+	void *usrdata)
+{
+	const struct sync_ctx *ctx = usrdata;
+	char *dsttarget, *fullpath;
+	dsttarget = get_dst_target(ctx, target);
+	fullpath = strings_concatenate(ctx->copyname, "/", linkpath, NULL);
+	if(strcmp(dsttarget, target) != 0) {
+		unlinkat(ctx->copyfd, fullpath, 0);
+		symlinkat(dsttarget, ctx->copyfd, fullpath);
+	}
+	free(fullpath);
+	free(dsttarget);
+}
+
+static char sync_dir(struct sync_ctx *ctx, int sfd, int dfd);
+
+static char sync_subdir(struct sync_ctx *ctx, int sfd, int dfd, 
+	const char *name, int dtype)
+{
+	int subsfd, subdfd;
+	char ok;
+	if(dtype != DT_DIR) {
+		if(dtype != no_entry)
+			remove_dir(dfd, name);
+		ctx->copyfd = dfd;
+		ctx->copyname = name;
+		return copy_tree(sfd, name, dfd, name, copy_recursive, 
+			relink_copied, ctx);
+	}
+	subsfd = openat(sfd, name, O_RDONLY|O_DIRECTORY);
+	subdfd = openat(dfd, name, O_RDONLY|O_DIRECTORY);
+	ok = (subsfd == -1 || subdfd == -1) ? -1 : sync_dir(ctx, subsfd, subdfd);
+	if(subsfd != -1)
+		close(subsfd);
+	if(subdfd != -1)
+		close(subdfd);
+	return ok;
+}
+
+static char sync_entry(struct sync_ctx *ctx, int sfd, int dfd, 
+	const char *name)
+{
+	int stype = get_type(sfd, name), dtype = get_type(dfd, name);
+	if(stype == DT_DIR)
+		return sync_subdir(ctx, sfd, dfd, name, dtype);
+	if(dtype == DT_DIR || (dtype != no_entry && dtype != stype))
+		remove_dir(dfd, name);
+	if(stype == DT_LNK)
+		return sync_link(ctx, sfd, dfd, name, name);
+	if(dtype == stype && 
+		merkle_file_hash(sfd, name) == merkle_file_hash(dfd, name))
+		return 0;
+	return copy_file_at(sfd, name, dfd, name);
+}
+
+static char is_synced(const char *name)
+{
+	return name[0] != '.' || shard_is_dirname(name) || 
+		strcmp(name, SHARD_FILE) == 0;
+}
+
+static char remove_extra(int sfd, int dfd)
+{
+	struct dirent *dent;
+	DIR *dir;
+	int fd = dup(dfd);
+	char ok = 0;
+	dir = fd == -1 ? NULL : fdopendir(fd);
+	if(!dir) {
+		if(fd != -1)
+			close(fd);
+		return -1;
+	}
+	while((dent = readdir(dir)) != NULL) {
+		if(!is_synced(dent->d_name))
+			continue;
+		if(get_type(sfd, dent->d_name) == no_entry && 
+			remove_dir(dfd, dent->d_name) != 0)
+			ok = -1;
+	}
+	closedir(dir);
+	return ok;
+}
+
+static char sync_dir(struct sync_ctx *ctx, int sfd, int dfd)
+{
+	unsigned long long shash, dhash;
+	struct dirent *dent;
+	DIR *dir;
+	int fd;
+	char ok = 0;
+	if(merkle_get(ctx->src, sfd, ".", &shash) != 0)
+		return -1;
+	if(merkle_get(ctx->dst, dfd, ".", &dhash) == 0 && shash == dhash)
+		return 0;
+	fd = dup(sfd);
+	dir = fd == -1 ? NULL : fdopendir(fd);
+	if(!dir) {
+		if(fd != -1)
+			close(fd);
+		return -1;
+	}
+	while((dent = readdir(dir)) != NULL) {
+		if(!is_synced(dent->d_name))
+			continue;
+		if(sync_entry(ctx, sfd, dfd, dent->d_name) != 0)
+			ok = -1;
+	}
+	closedir(dir);
+	if(remove_extra(sfd, dfd) != 0)
+		ok = -1;
+	if(ok == 0)
+		merkle_set(dfd, ".", shash);
+	return ok;
+}
+
+char sync_trees(const struct merkle *src, const struct merkle *dst)
+{
+	struct sync_ctx ctx;
+	char ok;
+	ctx.src = src;
+	ctx.dst = dst;
+	ok = sync_dir(&ctx, src->rootfd, dst->rootfd);
+	merkle_bump(dst);
+	if(ok != 0)
+		return ok;
+	/* the index is relative to the root, so it's valid as it is */
+	if(copy_file_at(src->rootfd, LINKS_FILE, dst->rootfd, LINKS_FILE) != 0
+		&& errno == ENOENT)
+		unlinkat(dst->rootfd, LINKS_FILE, 0);
+	return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef SYNC_H_SENTRY
+#define SYNC_H_SENTRY
+#include "merkle.h"
+
+char sync_trees(const struct merkle *src, const struct merkle *dst);
+#endif
@@ -3,65 +3,173 @@
 #include "memlib.h"
 #include "fslib.h"
 #include "path.h"
+#include "outbuf.h"
+#include "listing.h"
+#include "trace.h"
 #include <stdio.h>
-#include <dirent.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #define TASK_FILTER_TEMPLATE TNAME_FLD "\n" TINFO_FLD "\n"
-#define TASK_TEMPLATE TNAME_FLD "\n" TINFO_FLD "\n" TCOMPLETED_FLD \
-	" false\n" TFROM_FLD "\n" TTO_FLD "\n"
+#define TASK_TEMPLATE TNAME_FLD "\n" TCOMPLETED_FLD " false\n" TFROM_FLD \
+	"\n" TTO_FLD "\n" TINFO_FLD "\n"
 
-typedef enum {
-    task_default,
-    task_filter,
-} task_t;
+enum {
+	max_record_text = 65535,	/* the longer text stays on the heap */
+	head_size = 4096,			/* most of the task files fit in it */
+};
+
+/* the text fields, kept one after another as "name\0info\0from\0to\0" */
+enum {
+	text_name,
+	text_info,
+	text_from,
+	text_to,
+	text_fields_count,
+};
+
+enum {
+	flag_filter = 1,
+	flag_completed = 2,
+	flag_edited = 4,
+	flag_name = 8,		/* the name and the info may be set empty */
+	flag_info = 16,
+	flag_dlines = 32,	/* the deadlines are written even if empty */
+};
 
-struct deadlines {
-    char *from;
-    char *to;
+enum {
+	head_is_short = -1,	/* the fields may go on past the head */
 };
 
+/*
+ * A task is allocated with room for the text it's read with, so it takes
+ * a single allocation. The text moves to the heap only if it outgrows the
+ * record when a field is set. The empty deadlines are kept as no
+ * deadlines.
+ */
 struct task {
-    task_t type;
-    char *name;
-    char *info;
-	char edited;
-    char completed;
-    struct deadlines *dlines;
+	char *heap;
+	unsigned int offsets[text_fields_count-1];	/* of the fields but name */
+	unsigned short size;	/* of the text the record has room for */
+	unsigned char flags;
+	unsigned char fields;	/* the ones which have been read */
+	char text[];
 };
 
-static void task_init(struct task *task)
+static const char *field_names[] = { TNAME_FLD, TINFO_FLD, TCOMPLETED_FLD,
+	TFROM_FLD, TTO_FLD, TTYPE_FLD, NULL };
+
+static const int field_masks[] = { task_fld_name, task_fld_info,
+	task_fld_completed, task_fld_from, task_fld_to, task_fld_completed };
+
+/* the field names are compared and kept as these pointers */
+static const char *intern_field(const char *name, long long len, int *mask)
 {
-    if(!task)
-        return;
-    task->name = NULL;
-    task->info = NULL;
-    task->dlines = NULL;
-    task->completed = 0;
-	task->edited = 0;
-    task->type = task_filter;
+	int i;
+	for(i = 0; field_names[i]; i++) {
+		if((long long)strlen(field_names[i]) == len && 
+			strncmp(field_names[i], name, len) == 0) {
+			*mask = field_masks[i];
+			return field_names[i];
+		}
+	}
+	*mask = 0;
+	return NULL;
+}
+
+static struct task *task_new(long long size)
+{
+	struct task *task;
+	int i;
+	if(size < text_fields_count)
+		size = text_fields_count;
+	task = malloc(sizeof(*task)+size);
+	task->heap = NULL;
+	for(i = 0; i < text_fields_count-1; i++)
+		task->offsets[i] = i+1;		/* all the fields are empty */
+	task->size = size;
+	task->flags = flag_filter;
+	task->fields = task_fld_all;
+	memset(task->text, 0, text_fields_count);
+	return task;
+}
+
+static char *get_text_base(const struct task *task)
+{
+	return task->heap ? task->heap : (char *)task->text;
+}
+
+static const char *get_raw_text(const struct task *task, int field)
+{
+	return get_text_base(task) + 
+		(field == text_name ? 0 : task->offsets[field-1]);
 }
 
-static char **get_record(const char *s)
+static const char *get_text(const struct task *task, int field)
 {
-	char **rec;
-	long long offset;
-	if(!s)
+	const char *text;
+	if(field == text_name && !(task->flags & flag_name))
+		return NULL;
+	if(field == text_info && !(task->flags & flag_info))
+		return NULL;
+	text = get_raw_text(task, field);
+	if((field == text_from || field == text_to) && !*text)
 		return NULL;
-	rec = malloc(sizeof(*rec)*3);
-	if(*s != ' ') {
-		rec[0] = get_word(s, &offset);
-		s += offset;
+	return text;
+}
+
+static long long get_text_len(const struct task *task)
+{
+	return task->offsets[text_to-1]+strlen(get_raw_text(task, text_to))+1;
+}
+
+static void set_text(struct task *task, int field, const char *value)
+{
+	const char *fields[text_fields_count];
+	char *text, *p;
+	long long len = 0;
+	int i;
+	for(i = 0; i < text_fields_count; i++) {
+		fields[i] = i == field ? value : get_raw_text(task, i);
+		if(!fields[i])
+			fields[i] = "";
+		len += strlen(fields[i])+1;
+	}
+	text = malloc(len);
+	for(i = 0, p = text; i < text_fields_count; i++) {
+		long long flen = strlen(fields[i])+1;
+		memcpy(p, fields[i], flen);
+		if(i > 0)
+			task->offsets[i-1] = p-text;
+		p += flen;
+	}
+	free(task->heap);
+	task->heap = NULL;
+	if(len <= task->size) {
+		memcpy(task->text, text, len);
+		free(text);
 	} else
-		rec[0] = NULL; /* there's no any record name */
-	while(*s == ' ')
-		s++;
-	rec[1] = string_duplicate(s);
-	rec[2] = NULL;
-	return rec;
+		task->heap = text;
+}
+
+/* the copy of the task which has no more room than it needs */
+static struct task *task_compact(struct task *task)
+{
+	long long len = get_text_len(task);
+	struct task *result;
+	if((!task->heap && len == task->size) || len > max_record_text)
+		return task;
+	result = task_new(len);
+	memcpy(result->offsets, task->offsets, sizeof(task->offsets));
+	memcpy(result->text, get_text_base(task), len);
+	result->flags = task->flags;
+	result->fields = task->fields;
+	task_free(task);
+	return result;
 }
 
 static char *field_extend(const char *str, const char *ext)
@@ -81,57 +189,53 @@ static char *field_extend(const char *str, const char *ext)
 	return newstr;
 }
 
-static void task_set_text_field(char **pfield, const char *value, 
-	char rewrite)
+static void task_set_text_field(struct task *task, int field, 
+	const char *value, char rewrite)
 {
+	const char *old = get_text(task, field);
 	char *newval;
-	if(!pfield || !*pfield || rewrite)
-		newval = string_duplicate(value);
-	else {
-		newval = field_extend(*pfield, value);
-		free(*pfield);
+	if(!old || rewrite) {
+		set_text(task, field, value);
+		return;
 	}
-	*pfield = newval;
+	newval = field_extend(old, value);
+	set_text(task, field, newval);
+	free(newval);
 }
 
 static void task_set_name(struct task *task, const char *value,
 	char rewrite)
 {
-	task_set_text_field(&task->name, value, rewrite);
+	task_set_text_field(task, text_name, value, rewrite);
+	task->flags |= flag_name;
 }
 
 static void task_set_info(struct task *task, const char *value, 
 	char rewrite)
 {
-	task_set_text_field(&task->info, value, rewrite);
+	task_set_text_field(task, text_info, value, rewrite);
+	task->flags |= flag_info;
 }
 
 static void task_set_completed(struct task *task, const char *value)
 {
 	if(!value)
 		return;
+	task->flags &= ~(flag_completed|flag_filter);
 	if((strcmp(value, "true") == 0) || (strcmp(value, "1") == 0))
-		task->completed = 1;
-	else if((strcmp(value, "false") == 0) || (strcmp(value, "0") == 0))
-		task->completed = 0;
-	else 
-		task->completed = -1;
-	task->type = task->completed >= 0 ? task_default : task_filter;
+		task->flags |= flag_completed;
+	else if((strcmp(value, "false") != 0) && (strcmp(value, "0") != 0))
+		task->flags |= flag_filter;
 }
 
 static void task_set_deadlines(struct task *task, const char *name, 
 	const char *value)
 {
-	if(!task->dlines) {
-		task->dlines = malloc(sizeof(*(task->dlines)));
-		task->dlines->from = NULL;
-		task->dlines->to = NULL;
-	}
-	value = (value && *value) ? string_duplicate(value) : NULL;
-	if(strcmp(name, "from") == 0)
-		task->dlines->from = (char *)value;
-	else if(strcmp(name, "to") == 0)
-		task->dlines->to = (char *)value;
+	task->flags |= flag_dlines;
+	if(strcmp(name, TFROM_FLD) == 0)
+		set_text(task, text_from, value);
+	else
+		set_text(task, text_to, value);
 }
 
 static void task_set_type(struct task *task, const char *type)
@@ -139,9 +243,9 @@ static void task_set_type(struct task *task, const char *type)
 	if(!task || !type)
 		return;
 	if((strcmp(type, "filter") == 0) || strcmp(type, "f") == 0)
-		task->type = task_filter;
+		task->flags |= flag_filter;
 	else
-		task->type = task_default;
+		task->flags &= ~flag_filter;
 }
 
 char task_set_field(struct task *task, const char *name, const char *value,
@@ -149,7 +253,7 @@ char task_set_field(struct task *task, const char *name, const char *value,
 {
 	if(!task || !name)
 		return -1;
-	task->edited = 1;
+	task->flags |= flag_edited;
     if(strcmp(name, TNAME_FLD) == 0)
 		task_set_name(task, value, rewrite);
     else if(strcmp(name, TINFO_FLD) == 0)
@@ -165,55 +269,176 @@ char task_set_field(struct task *task, const char *name, const char *value,
 
 void task_free(struct task *task)
 {
-    if(!task)
-        return;
-    if(task->name)
-        free(task->name); 
-    if(task->info)
-        free(task->info);
-    if(task->dlines) {
-        if(task->dlines->from)
-            free(task->dlines->from);
-        if(task->dlines->to)
-            free(task->dlines->to);
-        free(task->dlines);
-    }
-    free(task);
-}
-
-struct task *task_read(const char *path)
-{
-    char *corename, *recname, *s;
-    struct task *task;
-    char buf[4096];
-    FILE *f;
-    if(!path)
-        return NULL;
-    corename = paths_union(path, TASK_CORE_FILE);
-    f = fopen(corename, "r");
-    free(corename);
-    if(!f)
-        return NULL;
-    task = malloc(sizeof(*task));
-    task_init(task);
-	recname = NULL;
-    while((s = fgets_m(buf, sizeof(buf), f)) != NULL) {
-		char **rec = get_record(s);
-		if(!rec[1]) {
-			mem_free((void **)rec);
-			free(rec);
-			continue;
+	if(!task)
+		return;
+	free(task->heap);
+	free(task);
+}
+
+/* the bytes the allocator has given to the task */
+long long task_memory_size(const struct task *task)
+{
+	long long size;
+	if(!task)
+		return 0;
+	size = malloc_usable_size((void *)task);
+	if(task->heap)
+		size += malloc_usable_size(task->heap);
+	return size;
+}
+
+static FILE *open_core_file(int dirfd, const char *path, char writing)
+{
+	char *corename;
+	int fd, flags = writing ? O_WRONLY|O_CREAT|O_TRUNC : O_RDONLY;
+	FILE *f;
+	corename = paths_union(path, TASK_CORE_FILE);
+	fd = openat(dirfd, corename, flags, 0666);
+	free(corename);
+	if(fd == -1)
+		return NULL;
+	f = fdopen(fd, writing ? "w" : "r");
+	if(!f)
+		close(fd);
+	return f;
+}
+
+/*
+ * The lines starting with a space go on with the field of the line before.
+ * Once all the wanted fields have been found the parsing stops at the next
+ * field, so the info, which is written last, isn't even looked at when
+ * it's not wanted, and the other fields not wanted are skipped without
+ * being copied. A head is the start of a longer file: head_is_short is
+ * returned if it ends before the parsing could stop.
+ */
+static char parse_fields(struct task *task, const char *data, long long len,
+	int fields, char is_head)
+{
+	const char *p = data, *end = data+len, *recname = NULL;
+	char *value = NULL;
+	long long vsize = 0;
+	int seen = 0, mask = 0;
+	char stopped = 0;
+	while(p < end) {
+		const char *eol = memchr(p, '\n', end-p);
+		const char *lend = eol ? eol : end;
+		if(!eol && is_head)
+			break;	/* the line may go on past the head */
+		if(*p != ' ') {
+			const char *wend;
+			if((seen & fields) == fields) {
+				stopped = 1;
+				break;
+			}
+			wend = memchr(p, ' ', lend-p);
+			if(!wend)
+				wend = lend;
+			recname = intern_field(p, wend-p, &mask);
+			seen |= mask;
+			p = wend;
 		}
-		if(rec[0]) {
-			if(recname)
-				free(recname);
-			recname = string_duplicate(rec[0]);
+		while(p < lend && *p == ' ')
+			p++;
+		if(recname && (mask & fields)) {
+			if(vsize < lend-p+1) {
+				vsize = lend-p+1;
+				value = realloc(value, vsize);
+			}
+			memcpy(value, p, lend-p);
+			value[lend-p] = 0;
+			task_set_field(task, recname, value, 0);
 		}
-		task_set_field(task, recname, rec[1], 0);
-    }
-	task->edited = 0;
-	fclose(f);
-    return task;
+		p = eol ? eol+1 : end;
+	}
+	free(value);
+	return is_head && !stopped ? head_is_short : 0;
+}
+
+static struct task *parse_task(const char *data, long long len, int fields,
+	char is_head)
+{
+	mem_area_t prev = mem_enter(mem_parser);
+	struct task *task = task_new(0);
+	if(parse_fields(task, data, len, fields, is_head) == head_is_short) {
+		task_free(task);
+		mem_leave(prev);
+		return NULL;
+	}
+	task->flags &= ~flag_edited;
+	task->fields = fields;
+	task = task_compact(task);
+	mem_leave(prev);
+	return task;
+}
+
+/* the file is read by the head first, the rest is read if it's needed */
+static struct task *read_task_fields(int dirfd, const char *path,
+	int fields)
+{
+	struct task *task = NULL;
+	char *corename, *data;
+	long long len = 0, size = head_size;
+	int fd;
+	if(!path)
+		return NULL;
+	corename = paths_union(path, TASK_CORE_FILE);
+	fd = openat(dirfd, corename, O_RDONLY);
+	free(corename);
+	if(fd == -1)
+		return NULL;
+	data = malloc(size);
+	for(;;) {
+		ssize_t rc = read(fd, data+len, size-len);
+		if(rc == -1) {
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		len += rc;
+		if(rc == 0 || len < size) {
+			task = parse_task(data, len, fields, 0);
+			break;
+		}
+		task = parse_task(data, len, fields, 1);
+		if(task)
+			break;
+		size *= 2;
+		data = realloc(data, size);
+	}
+	free(data);
+	close(fd);
+	return task;
+}
+
+struct task *task_read_fields(int dirfd, const char *path, int fields)
+{
+	long long start = trace_begin();
+	struct task *task = read_task_fields(dirfd, path, fields);
+	trace_end(start, "io", "task_read", path);
+	return task;
+}
+
+struct task *task_read(int dirfd, const char *path)
+{
+	return task_read_fields(dirfd, path, task_fld_all);
+}
+
+struct task *task_parse_fields(const char *data, long long len, int fields,
+	char is_head)
+{
+	if(!data || len < 0)
+		return NULL;
+	return parse_task(data, len, fields, is_head);
+}
+
+struct task *task_parse(const char *data, long long len)
+{
+	return task_parse_fields(data, len, task_fld_all, 0);
+}
+
+char task_has_fields(const struct task *task, int fields)
+{
+	return task && (task->fields & fields) == fields;
 }
 
 static char *get_record_str(const char *name, const char *value)
@@ -275,47 +500,83 @@ static char write_completed_record(FILE *f, char completed)
 	return ok;
 }
 
-static char write_deadlines_record(FILE *f, const struct deadlines *dlines)
+static char write_deadlines_record(FILE *f, const struct task *task)
 {
 	char ok;
 	char *rec;
-	if(!dlines)
+	if(!(task->flags & flag_dlines))
 		return -1;
-	rec = strings_concatenate(TFROM_FLD, " ", dlines->from, "\n", 
-		TTO_FLD, " ", dlines->to, "\n", NULL);
+	rec = strings_concatenate(TFROM_FLD, " ", get_raw_text(task, text_from),
+		"\n", TTO_FLD, " ", get_raw_text(task, text_to), "\n", NULL);
 	ok = fputs(rec, f) != EOF;
 	free(rec);
 	return ok;
 }
 
-char task_write(const char *path, const struct task *task)
+static void write_fields(FILE *f, const struct task *task)
+{
+	write_name_record(f, get_text(task, text_name));
+	if(!task_is_filter(task)) {
+		write_completed_record(f, task_get_completed(task));
+		write_deadlines_record(f, task);
+	}
+	write_info_record(f, get_text(task, text_info));
+}
+
+static char write_task(int dirfd, const char *path,
+	const struct task *task)
 {
 	FILE *f;
-	char *corename;
-	if(!task || !task->edited)
+	if(!task || !task_is_edited(task))
 		return 0;
-    corename = paths_union(path, TASK_CORE_FILE);
-	f = fopen(corename, "w");
-	free(corename);
-	if(!f)
+	if(task->fields != task_fld_all) {
+		errno = EINVAL;		/* the fields not read would be lost */
 		return -1;
-	write_name_record(f, task->name);
-	write_info_record(f, task->info);
-	if(task->type == task_default) {
-		write_completed_record(f, task->completed);
-		write_deadlines_record(f, task->dlines);
 	}
+	f = open_core_file(dirfd, path, 1);
+	if(!f)
+		return -1;
+	write_fields(f, task);
 	fclose(f);
 	return 0;
 }
 
+char task_write(int dirfd, const char *path, const struct task *task)
+{
+	long long start = trace_begin();
+	char ok = write_task(dirfd, path, task);
+	trace_end(start, "io", "task_write", path);
+	return ok;
+}
+
+char *task_serialize(const struct task *task, long long *len)
+{
+	char *data = NULL;
+	size_t size = 0;
+	FILE *f;
+	if(!task || task->fields != task_fld_all)
+		return NULL;
+	f = open_memstream(&data, &size);
+	if(!f)
+		return NULL;
+	write_fields(f, task);
+	fclose(f);
+	*len = size;
+	return data;
+}
+
+const char *task_get_template(char is_filter)
+{
+    return is_filter ? TASK_FILTER_TEMPLATE : TASK_TEMPLATE;
+}
+
 char task_make_file(int fd, char is_filter)
 {
     const char *template;
     char ok;
     if(fd < 0)
         return -1;
-    template = is_filter ? TASK_FILTER_TEMPLATE : TASK_TEMPLATE;
+    template = task_get_template(is_filter);
     ok = write(fd, template, strlen(template));
     if(ok == -1)
         return -1; 
@@ -324,98 +585,126 @@ char task_make_file(int fd, char is_filter)
 
 static char get_task_status(const struct task *task)
 {
-    return task->completed ? 'v' : 'x';
+    return task_get_completed(task) ? 'v' : 'x';
 }
 
-static void print_header(const struct task *task)
+static void print_header(const struct task *task, struct outbuf *ob)
 {
-	char status;
-	char *info, *name;
-	if(!task->name || !(task->name[0]))
+	const char *name = get_text(task, text_name);
+	const char *info = get_text(task, text_info);
+	if(!name || !name[0])
 		return;
-	name = strdup(task->name);
-	info = task->info ? strdup(task->info) : "";
-	status = get_task_status(task);
-    if(task->type == task_filter) {
-        printf("====%s====\n%s\n\n", name, info);
-    } else {
-        printf("====[%c] %s====\n%s\n\n", status, name, info);
-    }
-	free(name);
-	if(*info)
-		free(info);
+    if(task_is_filter(task))
+		outbuf_puts(ob, "====");
+	else
+		outbuf_printf(ob, "====[%c] ", get_task_status(task));
+	outbuf_puts(ob, name);
+	outbuf_puts(ob, "====\n");
+	outbuf_puts(ob, info ? info : "");
+	outbuf_puts(ob, "\n\n");
 }
 
 #define DLINES_SEP " -- "
 #define DLINES_TITLE "====DEADLINES====\n"
-static void print_deadlines(struct deadlines *dls)
+static void print_deadlines(const struct task *task, struct outbuf *ob)
 {
-    char *str;
-	if(!dls || (!dls->from && !dls->to))
+	const char *from = get_text(task, text_from);
+	const char *to = get_text(task, text_to);
+	if(!from && !to)
         return;
-	if(dls->from && dls->to)
-		str = strings_concatenate(DLINES_TITLE, dls->from, DLINES_SEP,
-			dls->to, NULL);
-	else
-		str = strings_concatenate(DLINES_TITLE,
-			dls->from ? dls->from : dls->to, NULL);
-    printf("%s\n\n", str);
-    free(str);
+	outbuf_puts(ob, DLINES_TITLE);
+	if(from && to) {
+		outbuf_puts(ob, from);
+		outbuf_puts(ob, DLINES_SEP);
+		outbuf_puts(ob, to);
+	} else
+		outbuf_puts(ob, from ? from : to);
+	outbuf_puts(ob, "\n\n");
 }
 
-static void print_addinfo(const struct task *task)
+static void print_addinfo(const struct task *task, struct outbuf *ob)
 {
-    if(task->type == task_filter)
+    if(task_is_filter(task))
         return;
-    print_deadlines(task->dlines);
+    print_deadlines(task, ob);
 }
 
-static void print_subtask(struct task *task, const char *shortname)
+void task_render_header(const struct task *task, struct outbuf *ob)
 {
-	char status;
-    if(!task)
-        return;
-    status = get_task_status(task);
-    if(task->type == task_default)
-        printf("[%c] %s (%s)\n", status, task->name, shortname);
-    else
-        printf("%s (%s)\n", task->name, shortname);
+    if(task && get_text(task, text_name)) {
+        print_header(task, ob);
+        print_addinfo(task, ob);
+    }
 }
 
-static void print_subtasks(const char *path)
+/* the task and its children are written into the caller's buffer */
+char task_print(const struct task *task, int dirfd, const char *taskpath,
+	const struct listing_opts *opts, struct outbuf *ob)
 {
-    DIR *dir;
-    struct dirent *dent;
-	char taskpath[4096];
-    if(!path)
-        return;
-    dir = opendir(path);
-    if(!dir)
-        return;
-    while((dent = readdir(dir)) != NULL) {
-        struct task *task;
-        if((strcmp(dent->d_name, ".") == 0) || 
-           (strcmp(dent->d_name, "..") == 0) || 
-           (strcmp(dent->d_name, TASK_CORE_FILE) == 0))
-            continue;
-		strcpy(taskpath, path);
-		path_extend(taskpath, dent->d_name);
-        task = task_read(taskpath);
-        print_subtask(task, dent->d_name);
-        task_free(task);
-    }
-	closedir(dir);
-    putchar('\n');
+	if(opts->format == format_text)
+		task_render_header(task, ob);
+    return listing_print(dirfd, taskpath, opts, ob);
 }
 
-char task_print(const struct task *task, const char *taskpath)
+char task_print_source(const struct task *task, 
+	const struct listing_source *src, const struct listing_opts *opts,
+	struct outbuf *ob)
 {
-    if(task && task->name) {
-        print_header(task);
-        print_addinfo(task);
-    }
-    print_subtasks(taskpath);
-    return 0;
+	if(opts->format == format_text)
+		task_render_header(task, ob);
+    return listing_print_source(src, opts, ob);
+}
+
+const char *task_get_name(const struct task *task)
+{
+	return task ? get_text(task, text_name) : NULL;
+}
+
+char task_is_filter(const struct task *task)
+{
+	return task && (task->flags & flag_filter);
+}
+
+char task_get_completed(const struct task *task)
+{
+	return task && (task->flags & flag_completed);
+}
+
+char task_is_edited(const struct task *task)
+{
+	return task && (task->flags & flag_edited);
+}
+
+const char *task_get_deadline(const struct task *task)
+{
+	const char *to;
+	if(!task)
+		return NULL;
+	to = get_text(task, text_to);
+	return to ? to : get_text(task, text_from);
+}
+
+/* the value as it would be set by task_set_field, NULL if there's none */
+const char *task_get_field(const struct task *task, const char *name)
+{
+	if(!task || !name)
+		return NULL;
+	if(strcmp(name, TNAME_FLD) == 0)
+		return get_text(task, text_name);
+	if(strcmp(name, TINFO_FLD) == 0)
+		return get_text(task, text_info);
+	if(strcmp(name, TCOMPLETED_FLD) == 0) {
+		if(task_is_filter(task))
+			return NULL;
+		return task_get_completed(task) ? "true" : "false";
+	}
+	if(strcmp(name, TTYPE_FLD) == 0)
+		return task_is_filter(task) ? "filter" : "task";
+	if(strcmp(name, TFROM_FLD) == 0)
+		return get_text(task, text_from);
+	if(strcmp(name, TTO_FLD) == 0)
+		return get_text(task, text_to);
+	return NULL;
 }
 
 char is_taskname(const char *str)
@@ -11,15 +11,49 @@
 #define TTO_FLD "to"
 #define TTYPE_FLD "type"
 
+/* the fields to be read, the type goes with completed */
+enum {
+	task_fld_name = 1,
+	task_fld_info = 2,
+	task_fld_completed = 4,
+	task_fld_from = 8,
+	task_fld_to = 16,
+	task_fld_deadlines = task_fld_from|task_fld_to,
+	task_fld_listed = task_fld_name|task_fld_completed|task_fld_deadlines,
+	task_fld_all = task_fld_listed|task_fld_info,
+};
+
 struct task;
+struct listing_opts;
+struct listing_source;
+struct outbuf;
 
 void task_free(struct task *task);
-char task_write(const char *path, const struct task *task);
+char task_write(int dirfd, const char *path, const struct task *task);
 char task_make_file(int fd, char is_filter);
-struct task *task_read(const char *path);
-char task_print(const struct task *task, const char *taskpath);
+struct task *task_read(int dirfd, const char *path);
+struct task *task_read_fields(int dirfd, const char *path, int fields);
+struct task *task_parse(const char *data, long long len);
+struct task *task_parse_fields(const char *data, long long len, int fields,
+	char is_head);
+char task_has_fields(const struct task *task, int fields);
+char *task_serialize(const struct task *task, long long *len);
+const char *task_get_template(char is_filter);
+char task_print(const struct task *task, int dirfd, const char *taskpath,
+	const struct listing_opts *opts, struct outbuf *ob);
+void task_render_header(const struct task *task, struct outbuf *ob);
+char task_print_source(const struct task *task, 
+	const struct listing_source *src, const struct listing_opts *opts,
+	struct outbuf *ob);
 char task_set_field(struct task *task, const char *name, const char *value,
 	char rewrite);
+const char *task_get_field(const struct task *task, const char *name);
 char is_taskname(const char *str);
 char *task_get_shortname(const char *fullname);
+const char *task_get_name(const struct task *task);
+char task_is_filter(const struct task *task);
+char task_get_completed(const struct task *task);
+const char *task_get_deadline(const struct task *task);
+char task_is_edited(const struct task *task);
+long long task_memory_size(const struct task *task);
 #endif
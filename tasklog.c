@@ -0,0 +1,716 @@
+#include "tasklog.h"
+#include "strlib.h"
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ * The storage engine which keeps all the tasks of a project in one file.
+ * Every change is a record appended to the log:
+ *
+ *   op(1) pathlen(4) datalen(4) path data checksum(4)
+ *
+ * and the log is replayed on open into a hash index from a task path to
+ * its node, which knows where the task data is in the file and what its
+ * children are. A torn record at the end is cut off by the replay. When
+ * the most of the file is dead records, the live ones are rewritten into
+ * a new log which replaces the old one.
+ *
+ * A link points to the node of its target, and every node has the list
+ * of the links into it, so a move doesn't touch the links at all and a
+ * removal drops only the ones into the removed subtree.
+ */
+
+enum {
+	op_put = 1,
+	op_del = 2,
+	op_move = 3,		/* data is the new path */
+	op_link = 4,		/* data is the target path */
+	rec_header_size = 9,
+	rec_checksum_size = 4,
+	magic_size = 8,
+	default_buckets = 1024,
+	max_link_depth = 16,
+	compact_threshold = 1 << 20,
+};
+
+#define TASKLOG_TMP_FILE TASKLOG_FILE ".tmp"
+
+struct lnode {
+	char *path;
+	struct lnode *link_to;		/* the target, NULL unless it's a link */
+	struct lnode *first_inlink;	/* the links into the node */
+	struct lnode *next_inlink;
+	long long offset;		/* of the data in the log, -1 if there's none */
+	long long len;
+	long long reclen;		/* the whole record */
+	struct lnode *parent;
+	struct lnode *first_child;
+	struct lnode *next_sibling;
+	struct lnode *hnext;
+	char dying;				/* its subtree is being deleted */
+};
+
+struct tasklog {
+	int dirfd;
+	int fd;
+	long long size;			/* of the file */
+	long long live;			/* bytes of the records still used */
+	struct lnode **buckets;
+	unsigned long long bcount;
+	unsigned long long ncount;
+};
+
+static unsigned int fnv32(const char *data, long long len, unsigned int h)
+{
+	long long i;
+	for(i = 0; i < len; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static unsigned long long path_hash(const char *path)
+{
+	return fnv32(path, strlen(path), 2166136261u);
+}
+
+static void put_le32(char *dest, unsigned int value)
+{
+	dest[0] = value & 0xff;
+	dest[1] = (value >> 8) & 0xff;
+	dest[2] = (value >> 16) & 0xff;
+	dest[3] = (value >> 24) & 0xff;
+}
+
+static unsigned int get_le32(const char *src)
+{
+	const unsigned char *s = (const unsigned char *)src;
+	return s[0] | (s[1] << 8) | (s[2] << 16) | ((unsigned int)s[3] << 24);
+}
+
+static struct lnode *node_find(const struct tasklog *log, const char *path)
+{
+	struct lnode *node = log->buckets[path_hash(path) & (log->bcount-1)];
+	while(node && strcmp(node->path, path) != 0)
+		node = node->hnext;
+	return node;
+}
+
+static void hash_insert(struct tasklog *log, struct lnode *node)
+{
+	unsigned long long i = path_hash(node->path) & (log->bcount-1);
+	node->hnext = log->buckets[i];
+	log->buckets[i] = node;
+}
+
+static void hash_delete(struct tasklog *log, struct lnode *node)
+{
+	struct lnode **pp = &log->buckets[path_hash(node->path) & (log->bcount-1)];
+	while(*pp && *pp != node)
+		pp = &(*pp)->hnext;
+	if(*pp)
+		*pp = node->hnext;
+}
+
+static void hash_grow(struct tasklog *log)
+{
+	struct lnode **old = log->buckets;
+	unsigned long long i, oldcount = log->bcount;
+	log->bcount *= 2;
+	log->buckets = calloc(log->bcount, sizeof(*(log->buckets)));
+	for(i = 0; i < oldcount; i++) {
+		struct lnode *node = old[i], *next;
+		for(; node; node = next) {
+			next = node->hnext;
+			hash_insert(log, node);
+		}
+	}
+	free(old);
+}
+
+static char *get_parent_path(const char *path)
+{
+	char *parent = string_duplicate(path);
+	char *sep = strrchr(parent, '/');
+	if(sep)
+		*sep = 0;
+	else
+		parent[0] = 0;
+	return parent;
+}
+
+static void child_attach(struct lnode *parent, struct lnode *node)
+{
+	node->parent = parent;
+	node->next_sibling = parent ? parent->first_child : NULL;
+	if(parent)
+		parent->first_child = node;
+}
+
+static void child_detach(struct lnode *node)
+{
+	struct lnode **pp;
+	if(!node->parent)
+		return;
+	pp = &node->parent->first_child;
+	while(*pp && *pp != node)
+		pp = &(*pp)->next_sibling;
+	if(*pp)
+		*pp = node->next_sibling;
+	node->parent = NULL;
+}
+
+/* the node of the path with all the missing parents made as empty ones */
+static struct lnode *node_get(struct tasklog *log, const char *path)
+{
+	struct lnode *node = node_find(log, path);
+	if(node)
+		return node;
+	node = calloc(1, sizeof(*node));
+	node->path = string_duplicate(path);
+	node->offset = -1;
+	if((log->ncount+1) > log->bcount)
+		hash_grow(log);
+	hash_insert(log, node);
+	log->ncount++;
+	if(path[0]) {
+		char *parent = get_parent_path(path);
+		child_attach(node_get(log, parent), node);
+		free(parent);
+	}
+	return node;
+}
+
+static void inlink_add(struct lnode *link, struct lnode *target)
+{
+	link->link_to = target;
+	link->next_inlink = target->first_inlink;
+	target->first_inlink = link;
+}
+
+static void inlink_remove(struct lnode *link)
+{
+	struct lnode **pp;
+	if(!link->link_to)
+		return;
+	pp = &link->link_to->first_inlink;
+	while(*pp && *pp != link)
+		pp = &(*pp)->next_inlink;
+	if(*pp)
+		*pp = link->next_inlink;
+	link->link_to = NULL;
+}
+
+static void node_release(struct tasklog *log, struct lnode *node)
+{
+	log->live -= node->reclen;
+	node->reclen = 0;
+	node->offset = -1;
+	node->len = 0;
+	inlink_remove(node);
+}
+
+/* the links into the subtree go away together with it */
+static void subtree_delete(struct tasklog *log, struct lnode *node)
+{
+	node->dying = 1;
+	while(node->first_child) {
+		struct lnode *child = node->first_child;
+		node->first_child = child->next_sibling;
+		child->parent = NULL;
+		subtree_delete(log, child);
+	}
+	while(node->first_inlink) {
+		struct lnode *link = node->first_inlink;
+		node->first_inlink = link->next_inlink;
+		link->link_to = NULL;
+		if(!link->dying) {
+			child_detach(link);
+			subtree_delete(log, link);
+		}
+	}
+	node_release(log, node);
+	hash_delete(log, node);
+	log->ncount--;
+	free(node->path);
+	free(node);
+}
+
+static void subtree_rekey(struct tasklog *log, struct lnode *node, 
+	long long oldlen, const char *newprefix)
+{
+	struct lnode *child;
+	char *newpath;
+	hash_delete(log, node);
+	newpath = strings_concatenate(newprefix, node->path+oldlen, NULL);
+	if(!newpath) /* both are empty */
+		newpath = string_duplicate("");
+	free(node->path);
+	node->path = newpath;
+	hash_insert(log, node);
+	for(child = node->first_child; child; child = child->next_sibling)
+		subtree_rekey(log, child, oldlen, newprefix);
+}
+
+static char is_subpath(const char *path, const char *prefix)
+{
+	long long len = strlen(prefix);
+	if(len == 0)
+		return 1;
+	return strncmp(path, prefix, len) == 0 && 
+		(path[len] == 0 || path[len] == '/');
+}
+
+static void apply_move(struct tasklog *log, const char *oldpath, 
+	const char *newpath)
+{
+	struct lnode *node = node_find(log, oldpath), *old;
+	char *parent;
+	if(!node || !oldpath[0] || is_subpath(newpath, oldpath))
+		return;
+	old = node_find(log, newpath);
+	if(old) {
+		child_detach(old);
+		subtree_delete(log, old);
+	}
+	child_detach(node);
+	subtree_rekey(log, node, strlen(oldpath), newpath);
+	parent = get_parent_path(newpath);
+	child_attach(node_get(log, parent), node);
+	free(parent);
+}
+
+static void apply_record(struct tasklog *log, char op, const char *path,
+	const char *data, long long datalen, long long offset, long long reclen)
+{
+	struct lnode *node, *target;
+	char *str;
+	switch(op) {
+		case op_put:
+			node = node_get(log, path);
+			node_release(log, node);
+			node->offset = offset;
+			node->len = datalen;
+			node->reclen = reclen;
+			log->live += reclen;
+			break;
+		case op_link:
+			str = malloc(datalen+1);
+			memcpy(str, data, datalen);
+			str[datalen] = 0;
+			target = node_find(log, str);
+			free(str);
+			if(!target)		/* it can't be linked if it isn't there */
+				break;
+			node = node_get(log, path);
+			node_release(log, node);
+			inlink_add(node, target);
+			node->reclen = reclen;
+			log->live += reclen;
+			break;
+		case op_del:
+			node = node_find(log, path);
+			if(node && path[0]) {
+				child_detach(node);
+				subtree_delete(log, node);
+			}
+			break;
+		case op_move:
+			str = malloc(datalen+1);
+			memcpy(str, data, datalen);
+			str[datalen] = 0;
+			apply_move(log, path, str);
+			free(str);
+			break;
+	}
+}
+
+static char *read_all(int fd, long long *size)
+{
+	char *data;
+	long long done = 0;
+	struct stat st;
+	if(fstat(fd, &st) == -1)
+		return NULL;
+	data = malloc(st.st_size+1);
+	while(done < st.st_size) {
+		ssize_t rc = pread(fd, data+done, st.st_size-done, done);
+		if(rc <= 0)
+			break;
+		done += rc;
+	}
+	*size = done;
+	return data;
+}
+
+/* returns the length of the valid part of the log */
+static long long replay(struct tasklog *log, const char *data, long long size)
+{
+	long long pos = magic_size;
+	while(pos+rec_header_size+rec_checksum_size <= size) {
+		const char *rec = data+pos;
+		unsigned int plen = get_le32(rec+1), dlen = get_le32(rec+5);
+		long long reclen = rec_header_size+(long long)plen+dlen+
+			rec_checksum_size;
+		char *path;
+		if(pos+reclen > size)
+			break;
+		if(fnv32(rec, reclen-rec_checksum_size, 2166136261u) != 
+			get_le32(rec+reclen-rec_checksum_size))
+			break;
+		path = malloc(plen+1);
+		memcpy(path, rec+rec_header_size, plen);
+		path[plen] = 0;
+		apply_record(log, rec[0], path, rec+rec_header_size+plen, dlen,
+			pos+rec_header_size+plen, reclen);
+		free(path);
+		pos += reclen;
+	}
+	return pos;
+}
+
+static struct tasklog *log_alloc(int dirfd)
+{
+	struct tasklog *log = malloc(sizeof(*log));
+	log->dirfd = dirfd;
+	log->fd = -1;
+	log->size = 0;
+	log->live = 0;
+	log->bcount = default_buckets;
+	log->buckets = calloc(log->bcount, sizeof(*(log->buckets)));
+	log->ncount = 0;
+	return log;
+}
+
+struct tasklog *tasklog_open(int dirfd, const char *name, char create)
+{
+	struct tasklog *log;
+	char *data;
+	long long size, valid;
+	int flags = O_RDWR|(create ? O_CREAT|O_EXCL : 0);
+	int fd = openat(dirfd, name, flags, 0666);
+	if(fd == -1)
+		return NULL;
+	if(create && write(fd, TASKLOG_MAGIC, magic_size) != magic_size) {
+		close(fd);
+		return NULL;
+	}
+	data = read_all(fd, &size);
+	if(!data || size < magic_size || 
+		memcmp(data, TASKLOG_MAGIC, magic_size) != 0) {
+		free(data);
+		close(fd);
+		errno = EBADMSG;
+		return NULL;
+	}
+	log = log_alloc(dirfd);
+	log->fd = fd;
+	valid = replay(log, data, size);
+	free(data);
+	if(valid < size) /* the record written during a crash */
+		ftruncate(fd, valid);
+	log->size = valid;
+	node_get(log, "");
+	return log;
+}
+
+static void log_free_nodes(struct tasklog *log)
+{
+	struct lnode *root = node_find(log, "");
+	if(root)
+		subtree_delete(log, root);
+	free(log->buckets);
+}
+
+void tasklog_close(struct tasklog *log)
+{
+	if(!log)
+		return;
+	if(log->size > compact_threshold && log->live*2 < log->size)
+		tasklog_compact(log);
+	fdatasync(log->fd);
+	close(log->fd);
+	log_free_nodes(log);
+	free(log);
+}
+
+static char append_record(struct tasklog *log, char op, const char *path,
+	const char *data, long long datalen)
+{
+	long long plen = strlen(path);
+	long long reclen = rec_header_size+plen+datalen+rec_checksum_size;
+	char *rec = malloc(reclen);
+	ssize_t wc;
+	rec[0] = op;
+	put_le32(rec+1, plen);
+	put_le32(rec+5, datalen);
+	memcpy(rec+rec_header_size, path, plen);
+	if(datalen > 0)
+		memcpy(rec+rec_header_size+plen, data, datalen);
+	put_le32(rec+reclen-rec_checksum_size, 
+		fnv32(rec, reclen-rec_checksum_size, 2166136261u));
+	wc = pwrite(log->fd, rec, reclen, log->size);
+	if(wc != reclen) {
+		free(rec);
+		return -1;
+	}
+	apply_record(log, op, path, rec+rec_header_size+plen, datalen,
+		log->size+rec_header_size+plen, reclen);
+	log->size += reclen;
+	free(rec);
+	return 0;
+}
+
+/* the node behind the path with the links on the way followed */
+static struct lnode *node_resolve(struct tasklog *log, const char *path)
+{
+	struct lnode *node;
+	char *cur = string_duplicate(path);
+	int depth;
+	for(depth = 0; depth < max_link_depth; depth++) {
+		long long len;
+		char *next;
+		node = node_find(log, cur);
+		if(node && !node->link_to)
+			break;
+		if(node) {
+			next = string_duplicate(node->link_to->path);
+		} else {
+			/* look for a link among the parents */
+			struct lnode *link = NULL;
+			for(len = strlen(cur); len > 0 && !link; len--) {
+				char saved;
+				if(cur[len] != '/')
+					continue;
+				saved = cur[len];
+				cur[len] = 0;
+				link = node_find(log, cur);
+				cur[len] = saved;
+				if(link && !link->link_to)
+					link = NULL;
+			}
+			if(!link)
+				break;
+			len++;
+			next = link->link_to->path[0] ? 
+				strings_concatenate(link->link_to->path, "/", cur+len+1,
+					NULL) :
+				string_duplicate(cur+len+1);
+		}
+		free(cur);
+		cur = next;
+		node = NULL;
+	}
+	free(cur);
+	return node;
+}
+
+char tasklog_put(struct tasklog *log, const char *path, const char *data,
+	long long len)
+{
+	struct lnode *node;
+	char *parent;
+	if(!log || !path)
+		return -1;
+	node = node_resolve(log, path);
+	if(node)
+		return append_record(log, op_put, node->path, data, len);
+	parent = get_parent_path(path);
+	node = node_resolve(log, parent);
+	free(parent);
+	if(!node) {
+		errno = ENOENT;
+		return -1;
+	}
+	if(strchr(path, '/')) {
+		const char *name = strrchr(path, '/')+1;
+		char *fullpath = node->path[0] ? 
+			strings_concatenate(node->path, "/", name, NULL) :
+			string_duplicate(name);
+		char ok = append_record(log, op_put, fullpath, data, len);
+		free(fullpath);
+		return ok;
+	}
+	return append_record(log, op_put, path, data, len);
+}
+
+char *tasklog_get(struct tasklog *log, const char *path, long long *len)
+{
+	struct lnode *node;
+	char *data;
+	if(!log || !path)
+		return NULL;
+	node = node_resolve(log, path);
+	if(!node || node->offset < 0)
+		return NULL;
+	data = malloc(node->len+1);
+	if(pread(log->fd, data, node->len, node->offset) != node->len) {
+		free(data);
+		return NULL;
+	}
+	data[node->len] = 0;
+	*len = node->len;
+	return data;
+}
+
+char tasklog_exists(struct tasklog *log, const char *path)
+{
+	return log && path && node_resolve(log, path) != NULL;
+}
+
+char tasklog_remove(struct tasklog *log, const char *path)
+{
+	if(!log || !path || !path[0])
+		return -1;
+	if(!node_find(log, path)) {
+		errno = ENOENT;
+		return -1;
+	}
+	return append_record(log, op_del, path, NULL, 0);
+}
+
+char tasklog_move(struct tasklog *log, const char *oldpath,
+	const char *newpath)
+{
+	char *parent;
+	char ok;
+	if(!log || !oldpath || !newpath || !oldpath[0] || !newpath[0])
+		return -1;
+	if(!node_find(log, oldpath)) {
+		errno = ENOENT;
+		return -1;
+	}
+	parent = get_parent_path(newpath);
+	ok = node_find(log, parent) ? 0 : -1;
+	free(parent);
+	if(ok != 0 || is_subpath(newpath, oldpath)) {
+		errno = ok != 0 ? ENOENT : EINVAL;
+		return -1;
+	}
+	return append_record(log, op_move, oldpath, newpath, strlen(newpath));
+}
+
+char tasklog_link(struct tasklog *log, const char *path, const char *target)
+{
+	char *parent;
+	char ok;
+	if(!log || !path || !target || !path[0])
+		return -1;
+	if(node_find(log, path) || !node_find(log, target)) {
+		errno = node_find(log, path) ? EEXIST : ENOENT;
+		return -1;
+	}
+	parent = get_parent_path(path);
+	ok = node_find(log, parent) ? 0 : -1;
+	free(parent);
+	if(ok != 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	return append_record(log, op_link, path, target, strlen(target));
+}
+
+long long tasklog_list(struct tasklog *log, const char *path,
+	tasklog_list_fn_t fn, void *usrdata)
+{
+	struct lnode *node, *child;
+	long long count = 0;
+	if(!log || !path)
+		return -1;
+	node = node_resolve(log, path);
+	if(!node)
+		return -1;
+	for(child = node->first_child; child; child = child->next_sibling) {
+		const char *name = strrchr(child->path, '/');
+		fn(name ? name+1 : child->path, child->link_to != NULL, usrdata);
+		count++;
+	}
+	return count;
+}
+
+/* the target of the link at the path, NULL if it isn't a link */
+char *tasklog_readlink(struct tasklog *log, const char *path)
+{
+	struct lnode *node;
+	if(!log || !path)
+		return NULL;
+	node = node_find(log, path);
+	if(!node || !node->link_to)
+		return NULL;
+	return string_duplicate(node->link_to->path);
+}
+
+static int link_depth(const struct lnode *node)
+{
+	int depth = 0;
+	for(; node->link_to; node = node->link_to)
+		depth++;
+	return depth;
+}
+
+/*
+ * The tasks are written first and then the links, those into the tasks
+ * before those into the links, so every target is there already. A pass
+ * writes the nodes at the depth and tells if there are deeper ones.
+ */
+static char compact_node(struct tasklog *log, struct tasklog *newlog,
+	struct lnode *node, int depth, char *deeper)
+{
+	struct lnode *child;
+	int ndepth = link_depth(node);
+	char ok = 0;
+	if(ndepth > depth)
+		*deeper = 1;
+	if(ndepth == depth && node->link_to) {
+		ok = append_record(newlog, op_link, node->path,
+			node->link_to->path, strlen(node->link_to->path));
+	} else if(ndepth == depth && node->offset >= 0) {
+		long long len;
+		char *data = tasklog_get(log, node->path, &len);
+		if(!data)
+			return -1;
+		ok = append_record(newlog, op_put, node->path, data, len);
+		free(data);
+	}
+	for(child = node->first_child; child && ok == 0; 
+		child = child->next_sibling)
+		ok = compact_node(log, newlog, child, depth, deeper);
+	return ok;
+}
+
+char tasklog_compact(struct tasklog *log)
+{
+	struct tasklog *newlog;
+	char ok = 0, deeper = 1;
+	int depth;
+	unlinkat(log->dirfd, TASKLOG_TMP_FILE, 0);
+	newlog = tasklog_open(log->dirfd, TASKLOG_TMP_FILE, 1);
+	if(!newlog)
+		return -1;
+	for(depth = 0; deeper && ok == 0; depth++) {
+		deeper = 0;
+		ok = compact_node(log, newlog, node_find(log, ""), depth, &deeper);
+	}
+	if(ok == 0)
+		ok = fdatasync(newlog->fd) == 0 ? 0 : -1;
+	if(ok == 0) 
+		ok = renameat(log->dirfd, TASKLOG_TMP_FILE, log->dirfd, 
+			TASKLOG_FILE) == 0 ? 0 : -1;
+	if(ok != 0) {
+		tasklog_close(newlog);
+		unlinkat(log->dirfd, TASKLOG_TMP_FILE, 0);
+		return -1;
+	}
+	/* the new log takes the place of the old one */
+	close(log->fd);
+	log_free_nodes(log);
+	*log = *newlog;
+	free(newlog);
+	return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef TASKLOG_H_SENTRY
+#define TASKLOG_H_SENTRY
+
+#define TASKLOG_FILE ".tasklog"
+#define TASKLOG_MAGIC "TSKLOG01"
+
+struct tasklog;
+
+typedef void (*tasklog_list_fn_t)(const char *name, char is_link,
+	void *usrdata);
+
+struct tasklog *tasklog_open(int dirfd, const char *name, char create);
+void tasklog_close(struct tasklog *log);
+char tasklog_put(struct tasklog *log, const char *path, const char *data,
+	long long len);
+char *tasklog_get(struct tasklog *log, const char *path, long long *len);
+char tasklog_exists(struct tasklog *log, const char *path);
+char tasklog_remove(struct tasklog *log, const char *path);
+char tasklog_move(struct tasklog *log, const char *oldpath,
+	const char *newpath);
+char tasklog_link(struct tasklog *log, const char *path, const char *target);
+long long tasklog_list(struct tasklog *log, const char *path,
+	tasklog_list_fn_t fn, void *usrdata);
+char *tasklog_readlink(struct tasklog *log, const char *path);
+char tasklog_compact(struct tasklog *log);
+#endif
@@ -0,0 +1,21 @@
+#ifndef CHECK_H_SENTRY
+#define CHECK_H_SENTRY
+#include <stdio.h>
+
+/*
+ * The tests are plain programs: a failed check is printed and counted,
+ * and the exit code of the test is 1 if any of them has failed.
+ */
+
+static int check_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			check_failures++; \
+		} \
+	} while(0)
+
+#define CHECK_RESULT() (check_failures > 0 ? 1 : 0)
+#endif
@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#include "check.h"
+#include "../archive.h"
+#include "../fslib.h"
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+/*
+ * An exported project is imported back the same, and an archive which is
+ * corrupted or would write outside of the destination is refused before
+ * anything is made.
+ */
+
+enum { rec_dir = 1, rec_file = 2, rec_link = 3, max_records = 16 };
+
+struct record {
+	char type;
+	const char *path;
+	const char *data;
+	const char *toc_path;	/* NULL if it's the path */
+};
+
+static char base[] = "/tmp/test_archive.XXXXXX";
+
+static void put_le(char *dest, unsigned long long value, int size)
+{
+	int i;
+	for(i = 0; i < size; i++) {
+		dest[i] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+static unsigned long long fnv(unsigned long long h, const char *data,
+	long long len)
+{
+	long long i;
+	for(i = 0; i < len; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static void put(int fd, unsigned long long *h, const char *data, long long len)
+{
+	*h = fnv(*h, data, len);
+	CHECK(write(fd, data, len) == len);
+}
+
+/* the archive the way archive_export writes it */
+static void write_archive(const char *path, const struct record *recs)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL, offset, offsets[max_records];
+	char buf[32];
+	int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666), i;
+	put(fd, &h, ARCHIVE_MAGIC, 8);
+	offset = 8;
+	for(i = 0; recs[i].type; i++) {
+		long long plen = strlen(recs[i].path), dlen = strlen(recs[i].data);
+		offsets[i] = offset;
+		buf[0] = recs[i].type;
+		put_le(buf+1, plen, 4);
+		put_le(buf+5, dlen, 8);
+		put(fd, &h, buf, 13);
+		put(fd, &h, recs[i].path, plen);
+		put(fd, &h, recs[i].data, dlen);
+		offset += 13+plen+dlen;
+	}
+	for(i = 0; recs[i].type; i++) {
+		const char *p = recs[i].toc_path ? recs[i].toc_path : recs[i].path;
+		buf[0] = recs[i].type;
+		put_le(buf+1, strlen(p), 4);
+		put_le(buf+5, offsets[i], 8);
+		put(fd, &h, buf, 13);
+		put(fd, &h, p, strlen(p));
+	}
+	put_le(buf, offset, 8);
+	put_le(buf+8, i, 8);
+	put_le(buf+16, h, 8);
+	memcpy(buf+24, ARCHIVE_TOC_MAGIC, 8);
+	CHECK(write(fd, buf, 32) == 32);
+	close(fd);
+}
+
+static int count_entries(const char *path)
+{
+	struct dirent *dent;
+	DIR *dir = opendir(path);
+	int count = 0;
+	if(!dir)
+		return -1;
+	while((dent = readdir(dir)) != NULL) {
+		if(strcmp(dent->d_name, ".") != 0 && strcmp(dent->d_name, "..") != 0)
+			count++;
+	}
+	closedir(dir);
+	return count;
+}
+
+static char *read_text(const char *path)
+{
+	static char buf[256];
+	int fd = open(path, O_RDONLY);
+	ssize_t len;
+	if(fd == -1)
+		return NULL;
+	len = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	buf[len > 0 ? len : 0] = 0;
+	return buf;
+}
+
+static void write_text(const char *path, const char *text)
+{
+	int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	CHECK(write(fd, text, strlen(text)) == (ssize_t)strlen(text));
+	close(fd);
+}
+
+static char imported_link[4096];	/* the last one the import reported */
+
+static void save_link(const char *target, const char *linkpath,
+	void *usrdata)
+{
+	strcpy(usrdata, linkpath);
+}
+
+static char import(const char *archive, const char *dst)
+{
+	char ok;
+	int fd = open(archive, O_RDONLY);
+	imported_link[0] = 0;
+	ok = archive_import(fd, AT_FDCWD, dst, dst, save_link, imported_link);
+	close(fd);
+	return ok;
+}
+
+static void test_round_trip()
+{
+	char src[256], dst[256], arc[256], path[4096], target[4096];
+	ssize_t len;
+	int rootfd, fd;
+	sprintf(src, "%s/src", base);
+	sprintf(dst, "%s/dst", base);
+	sprintf(arc, "%s/project.arc", base);
+	mkdir(src, 0777);
+	mkdir(dst, 0777);
+	sprintf(path, "%s/a", src);
+	mkdir(path, 0777);
+	sprintf(path, "%s/a/x", src);
+	mkdir(path, 0777);
+	sprintf(path, "%s/b", src);
+	mkdir(path, 0777);
+	sprintf(path, "%s/main.tsk", src);
+	write_text(path, "name root\n");
+	sprintf(path, "%s/a/x/main.tsk", src);
+	write_text(path, "name x\ninfo deep\n");
+	sprintf(path, "%s/a", src);
+	sprintf(target, "%s/b/a", src);
+	CHECK(symlink(path, target) == 0);
+	/* what is made of the rest doesn't go */
+	sprintf(path, "%s/.links", src);
+	write_text(path, "a\tb/a\n");
+	sprintf(path, "%s/a/.hash", src);
+	write_text(path, "0123456789abcdef\n");
+	rootfd = open(src, O_RDONLY|O_DIRECTORY);
+	fd = open(arc, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	CHECK(archive_export(rootfd, ".", src, fd) == 0);
+	close(fd);
+	close(rootfd);
+	CHECK(import(arc, dst) == 0);
+	sprintf(path, "%s/main.tsk", dst);
+	CHECK(read_text(path) && strcmp(read_text(path), "name root\n") == 0);
+	sprintf(path, "%s/a/x/main.tsk", dst);
+	CHECK(read_text(path) &&
+		strcmp(read_text(path), "name x\ninfo deep\n") == 0);
+	/* the link into the project now leads into the imported one */
+	sprintf(path, "%s/b/a", dst);
+	len = readlink(path, target, sizeof(target)-1);
+	CHECK(len > 0);
+	target[len > 0 ? len : 0] = 0;
+	sprintf(path, "%s/a", dst);
+	CHECK(strcmp(target, path) == 0);
+	CHECK(strcmp(imported_link, "b/a") == 0);
+	sprintf(path, "%s/.links", dst);
+	CHECK(access(path, F_OK) == -1);
+	sprintf(path, "%s/a/.hash", dst);
+	CHECK(access(path, F_OK) == -1);
+	/* an import over a project replaces its files */
+	sprintf(path, "%s/main.tsk", dst);
+	write_text(path, "name changed\n");
+	CHECK(import(arc, dst) == 0);
+	CHECK(read_text(path) && strcmp(read_text(path), "name root\n") == 0);
+	remove_dir(AT_FDCWD, src);
+	remove_dir(AT_FDCWD, dst);
+}
+
+/* every refused archive leaves both the destination and its parent alone */
+static void check_refused(const char *name, const struct record *recs)
+{
+	char dst[256], arc[256];
+	int before;
+	sprintf(dst, "%s/dst", base);
+	sprintf(arc, "%s/bad.arc", base);
+	mkdir(dst, 0777);
+	write_archive(arc, recs);
+	before = count_entries(base);
+	if(import(arc, dst) != -1)
+		fprintf(stderr, "%s: imported\n", name);
+	CHECK(count_entries(dst) == 0);
+	CHECK(count_entries(base) == before);
+	remove_dir(AT_FDCWD, dst);
+	unlink(arc);
+}
+
+static void test_refused()
+{
+	const struct record parent[] = {
+		{ rec_dir, "", "", NULL },
+		{ rec_file, "../evil", "x", NULL },
+		{ 0, NULL, NULL, NULL }
+	};
+	const struct record absolute[] = {
+		{ rec_dir, "", "", NULL },
+		{ rec_file, "/tmp/test_archive_evil", "x", NULL },
+		{ 0, NULL, NULL, NULL }
+	};
+	const struct record empty[] = {
+		{ rec_dir, "", "", NULL },
+		{ rec_dir, "a", "", NULL },
+		{ rec_file, "a//main.tsk", "x", NULL },
+		{ 0, NULL, NULL, NULL }
+	};
+	const struct record dot[] = {
+		{ rec_dir, "", "", NULL },
+		{ rec_dir, "a", "", NULL },
+		{ rec_file, "a/./main.tsk", "x", NULL },
+		{ 0, NULL, NULL, NULL }
+	};
+	const struct record through_link[] = {
+		{ rec_dir, "", "", NULL },
+		{ rec_link, "l", base, NULL },
+		{ rec_file, "l/evil", "x", NULL },
+		{ 0, NULL, NULL, NULL }
+	};
+	const struct record no_parent[] = {
+		{ rec_dir, "", "", NULL },
+		{ rec_file, "a/main.tsk", "x", NULL },
+		{ 0, NULL, NULL, NULL }
+	};
+	const struct record twice[] = {
+		{ rec_dir, "", "", NULL },
+		{ rec_dir, "l", "", NULL },
+		{ rec_link, "l", base, NULL },
+		{ 0, NULL, NULL, NULL }
+	};
+	const struct record other_toc[] = {
+		{ rec_dir, "", "", NULL },
+		{ rec_file, "main.tsk", "x", NULL },
+		{ rec_file, "../evil", "x", "other.tsk" },
+		{ 0, NULL, NULL, NULL }
+	};
+	check_refused("parent", parent);
+	check_refused("absolute", absolute);
+	check_refused("empty", empty);
+	check_refused("dot", dot);
+	check_refused("through_link", through_link);
+	check_refused("no_parent", no_parent);
+	check_refused("twice", twice);
+	check_refused("other_toc", other_toc);
+	CHECK(access("/tmp/test_archive_evil", F_OK) == -1);
+}
+
+/* a corrupted byte is found before the first file is written */
+static void test_corrupted()
+{
+	const struct record recs[] = {
+		{ rec_dir, "", "", NULL },
+		{ rec_file, "main.tsk", "name root\n", NULL },
+		{ rec_dir, "a", "", NULL },
+		{ rec_file, "a/main.tsk", "name a\n", NULL },
+		{ 0, NULL, NULL, NULL }
+	};
+	char dst[256], arc[256], *data;
+	struct stat st;
+	int fd;
+	sprintf(dst, "%s/dst", base);
+	sprintf(arc, "%s/bad.arc", base);
+	mkdir(dst, 0777);
+	write_archive(arc, recs);
+	fd = open(arc, O_RDWR);
+	fstat(fd, &st);
+	data = malloc(st.st_size);
+	CHECK(read(fd, data, st.st_size) == st.st_size);
+	data[memmem(data, st.st_size, "a/main.tsk", 10)-(void *)data+3] = 'X';
+	CHECK(pwrite(fd, data, st.st_size, 0) == st.st_size);
+	close(fd);
+	free(data);
+	CHECK(import(arc, dst) == -1);
+	CHECK(count_entries(dst) == 0);
+	remove_dir(AT_FDCWD, dst);
+	unlink(arc);
+}
+
+/* a link which is in the destination already isn't written through */
+static void test_existing_link()
+{
+	const struct record recs[] = {
+		{ rec_dir, "", "", NULL },
+		{ rec_dir, "a", "", NULL },
+		{ rec_file, "a/main.tsk", "x", NULL },
+		{ 0, NULL, NULL, NULL }
+	};
+	char dst[256], arc[256], outside[256], path[4096];
+	sprintf(dst, "%s/dst", base);
+	sprintf(arc, "%s/link.arc", base);
+	sprintf(outside, "%s/outside", base);
+	mkdir(dst, 0777);
+	mkdir(outside, 0777);
+	sprintf(path, "%s/a", dst);
+	CHECK(symlink(outside, path) == 0);
+	write_archive(arc, recs);
+	CHECK(import(arc, dst) == -1);
+	CHECK(count_entries(outside) == 0);
+	remove_dir(AT_FDCWD, dst);
+	remove_dir(AT_FDCWD, outside);
+	unlink(arc);
+}
+
+int main()
+{
+	if(!mkdtemp(base)) {
+		perror(base);
+		return 1;
+	}
+	test_round_trip();
+	test_refused();
+	test_corrupted();
+	test_existing_link();
+	remove_dir(AT_FDCWD, base);
+	return CHECK_RESULT();
+}
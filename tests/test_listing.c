@@ -0,0 +1,83 @@
+#include "check.h"
+#include "../listing.h"
+#include "../outbuf.h"
+#include "../fslib.h"
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*
+ * The children are listed sorted and paged whatever their task files
+ * have, a task without a name line included.
+ */
+
+static char base[] = "/tmp/test_listing.XXXXXX";
+
+static void write_task(const char *name, const char *text)
+{
+	char path[4096];
+	int fd;
+	sprintf(path, "%s/%s", base, name);
+	mkdir(path, 0777);
+	sprintf(path, "%s/%s/main.tsk", base, name);
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	CHECK(write(fd, text, strlen(text)) == (ssize_t)strlen(text));
+	close(fd);
+}
+
+/* what is listed of the root, NULL if it has failed */
+static char *list(sort_t sort, long long limit, format_t format)
+{
+	struct listing_opts opts;
+	struct outbuf ob;
+	char *text = NULL;
+	listing_opts_init(&opts);
+	opts.sort = sort;
+	opts.limit = limit;
+	opts.format = format;
+	outbuf_init(&ob, -1);
+	if(listing_print(AT_FDCWD, base, &opts, &ob) == 0) {
+		outbuf_putc(&ob, 0);
+		text = strdup(ob.data);
+	}
+	outbuf_free(&ob);
+	return text;
+}
+
+static void test_nameless()
+{
+	const sort_t sorts[] = { sort_none, sort_status, sort_deadline, 
+		sort_name };
+	char *text;
+	int i;
+	write_task("a", "completed false\n");
+	write_task("b", "completed false\n");
+	write_task("c", "completed false\n");
+	write_task("d", "completed false\n");
+	for(i = 0; i < 4; i++) {
+		text = list(sorts[i], 1, format_tsv);
+		CHECK(text != NULL);
+		free(text);
+		text = list(sorts[i], -1, format_text);
+		CHECK(text != NULL);
+		free(text);
+	}
+	/* the one named comes after the ones without a name */
+	write_task("e", "name first\ncompleted false\n");
+	text = list(sort_name, 1, format_text);
+	CHECK(text && strstr(text, "(a)") && !strstr(text, "first"));
+	free(text);
+}
+
+int main()
+{
+	if(!mkdtemp(base)) {
+		perror(base);
+		return 1;
+	}
+	test_nameless();
+	remove_dir(AT_FDCWD, base);
+	return CHECK_RESULT();
+}
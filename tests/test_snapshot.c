@@ -0,0 +1,135 @@
+#include "check.h"
+#include "../snapshot.h"
+#include "../merkle.h"
+#include "../listing.h"
+#include "../outbuf.h"
+#include "../fslib.h"
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ * The snapshot lists the children the way the directory listing does,
+ * goes stale with every change counted by the hashes and sees the ones
+ * made behind the shell's back when it's shown.
+ */
+
+static char base[] = "/tmp/test_snapshot.XXXXXX";
+
+static void write_task(const char *dir, const char *name, const char *text)
+{
+	char path[4096];
+	int fd;
+	if(name) {
+		sprintf(path, "%s/%s", dir, name);
+		mkdir(path, 0777);
+		sprintf(path, "%s/%s/main.tsk", dir, name);
+	} else
+		sprintf(path, "%s/main.tsk", dir);
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	CHECK(write(fd, text, strlen(text)) == (ssize_t)strlen(text));
+	close(fd);
+}
+
+/* what is shown of the root, NULL if the snapshot can't answer */
+static char *show_page(const struct snapshot *snap, long long limit)
+{
+	struct listing_opts opts;
+	struct outbuf ob;
+	char *text = NULL;
+	listing_opts_init(&opts);
+	opts.sort = sort_none;
+	opts.limit = limit;
+	outbuf_init(&ob, -1);
+	if(snapshot_show(snap, "", &opts, &ob) == 0) {
+		outbuf_putc(&ob, 0);
+		text = strdup(ob.data);
+	}
+	outbuf_free(&ob);
+	return text;
+}
+
+static char *show(const struct snapshot *snap)
+{
+	return show_page(snap, -1);
+}
+
+static struct snapshot *rebuild(const struct merkle *mk,
+	struct snapshot *old, char recheck)
+{
+	CHECK(snapshot_build(mk, old, recheck) == 0);
+	snapshot_close(old);
+	return snapshot_open(mk->rootfd);
+}
+
+static void test_order(const struct merkle *mk, struct snapshot *snap)
+{
+	struct listing_opts opts;
+	struct outbuf ob;
+	char *text = show(snap);
+	listing_opts_init(&opts);
+	opts.sort = sort_none;
+	outbuf_init(&ob, -1);
+	CHECK(listing_print(mk->rootfd, ".", &opts, &ob) == 0);
+	outbuf_putc(&ob, 0);
+	/* the header of the root goes first, then the same listing */
+	CHECK(text && strlen(text) >= strlen(ob.data) &&
+		strcmp(text+strlen(text)-strlen(ob.data), ob.data) == 0);
+	outbuf_free(&ob);
+	free(text);
+}
+
+int main()
+{
+	struct snapshot *snap;
+	struct merkle mk;
+	char *text;
+	if(!mkdtemp(base)) {
+		perror(base);
+		return 1;
+	}
+	write_task(base, NULL, "name root\n");
+	write_task(base, "zeta", "name zeta\n");
+	write_task(base, "alpha", "name alpha\n");
+	write_task(base, "mid", "name mid\n");
+	mk.rootfd = open(base, O_RDONLY|O_DIRECTORY);
+	mk.root = base;
+	snap = rebuild(&mk, NULL, 0);
+	CHECK(snap != NULL);
+	CHECK(snapshot_is_fresh(snap, &mk));
+	test_order(&mk, snap);
+	/* a change made through the hashes is counted */
+	CHECK(merkle_update(&mk, "alpha") == 0);
+	CHECK(!snapshot_is_fresh(snap, &mk));
+	snap = rebuild(&mk, snap, 0);
+	CHECK(snapshot_is_fresh(snap, &mk));
+	/* an edit from outside is found when the root is shown */
+	write_task(base, "alpha", "name edited outside\n");
+	CHECK(snapshot_is_fresh(snap, &mk));
+	/* but only if the child is listed */
+	text = show_page(snap, 0);
+	CHECK(text != NULL);
+	free(text);
+	errno = 0;
+	CHECK(show(snap) == NULL && errno == ESTALE);
+	snap = rebuild(&mk, snap, 1);
+	text = show(snap);
+	CHECK(text && strstr(text, "edited outside"));
+	free(text);
+	/* and so is a new task */
+	write_task(base, "new", "name made outside\n");
+	errno = 0;
+	CHECK(show(snap) == NULL && errno == ESTALE);
+	snap = rebuild(&mk, snap, 1);
+	text = show(snap);
+	CHECK(text && strstr(text, "made outside"));
+	free(text);
+	test_order(&mk, snap);
+	snapshot_close(snap);
+	close(mk.rootfd);
+	remove_dir(AT_FDCWD, base);
+	return CHECK_RESULT();
+}
@@ -0,0 +1,161 @@
+#include "check.h"
+#include "../strlib.h"
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The vector versions of the string functions give what the scalar ones
+ * do at every alignment and at every length around the vector sizes, with
+ * the string both at the start of a page and right before an unreadable
+ * one.
+ */
+
+enum { max_len = 70, max_align = 64 };
+
+static char *page;		/* readable, the next one isn't */
+static long long page_size;
+
+static const simd_t simds[] = { simd_sse2, simd_avx2 };
+
+/* the string ends with its zero byte at the end of the page */
+static char *place_at_end(const char *s, long long len)
+{
+	char *p = page+page_size-len-1;
+	memcpy(p, s, len+1);
+	return p;
+}
+
+static char *place_at(const char *s, long long len, long long align)
+{
+	memset(page, 'z', page_size);
+	memcpy(page+align, s, len+1);
+	return page+align;
+}
+
+static char same_tokens(char **a, char **b)
+{
+	long long i;
+	for(i = 0; a[i] && b[i]; i++)
+		if(strcmp(a[i], b[i]) != 0)
+			return 0;
+	return !a[i] && !b[i];
+}
+
+static void free_tokens(char **tokens)
+{
+	long long i;
+	for(i = 0; tokens[i]; i++)
+		free(tokens[i]);
+	free(tokens);
+}
+
+/* a line of two tokens, the first one quoted if asked */
+static long long make_line(char *buf, long long first, long long second,
+	char quoted)
+{
+	long long len = 0;
+	if(quoted)
+		buf[len++] = '"';
+	memset(buf+len, 'a', first);
+	len += first;
+	if(quoted)
+		buf[len++] = '"';
+	buf[len++] = ' ';
+	memset(buf+len, 'b', second);
+	len += second;
+	buf[len] = 0;
+	return len;
+}
+
+static void check_string(const char *s, long long len, simd_t simd)
+{
+	char **ref, **tokens;
+	char *word;
+	long long ref_off, off;
+	strlib_set_simd(simd_scalar);
+	ref = get_tokens(s);
+	word = get_word(s, &ref_off);
+	free(word);
+	strlib_set_simd(simd);
+	CHECK(string_length(s) == len);
+	word = get_word(s, &off);
+	CHECK(off == ref_off);
+	free(word);
+	tokens = get_tokens(s);
+	CHECK(same_tokens(ref, tokens));
+	free_tokens(tokens);
+	free_tokens(ref);
+}
+
+static void test_lines(simd_t simd)
+{
+	char line[2*max_len+8];
+	long long first, second, align;
+	char quoted;
+	for(quoted = 0; quoted < 2; quoted++)
+		for(first = 1; first < max_len; first++)
+			for(second = 0; second < 40; second += 13) {
+				long long len = make_line(line, first, second, quoted);
+				check_string(place_at_end(line, len), len, simd);
+				for(align = 0; align < max_align; align += 7)
+					check_string(place_at(line, len, align), len, simd);
+			}
+}
+
+/* the prefix is matched or is not by its last byte */
+static void test_prefixes(simd_t simd)
+{
+	char str[max_len+1], prefix[max_len+1];
+	long long len, plen, align;
+	memset(str, 'p', max_len);
+	memset(prefix, 'p', max_len);
+	for(len = 0; len < max_len; len++)
+		for(plen = 1; plen <= len+1 && plen < max_len; plen++) {
+			char differs;
+			for(differs = 0; differs < 2; differs++) {
+				const char *strs[1], **ref, **got;
+				str[len] = 0;
+				prefix[plen] = 0;
+				prefix[plen-1] = differs ? 'q' : 'p';
+				for(align = 0; align < max_align; align += 5) {
+					strs[0] = align ? place_at(str, len, align) :
+						place_at_end(str, len);
+					strlib_set_simd(simd_scalar);
+					ref = get_strings_by_prefix(strs, 1, prefix);
+					strlib_set_simd(simd);
+					got = get_strings_by_prefix(strs, 1, prefix);
+					CHECK((ref[0] == NULL) == (got[0] == NULL));
+					CHECK((ref[0] != NULL) == (!differs && plen <= len));
+					free(ref);
+					free(got);
+				}
+				prefix[plen-1] = 'p';
+				prefix[plen] = 'p';
+				str[len] = 'p';
+			}
+		}
+}
+
+int main()
+{
+	unsigned long i;
+	page_size = sysconf(_SC_PAGESIZE);
+	page = mmap(NULL, 2*page_size, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(page == MAP_FAILED ||
+		mprotect(page+page_size, page_size, PROT_NONE) != 0) {
+		perror("mmap");
+		return 1;
+	}
+	for(i = 0; i < sizeof(simds)/sizeof(*simds); i++) {
+		if(strlib_set_simd(simds[i]) != 0)
+			continue;	/* the CPU doesn't have it */
+		test_lines(simds[i]);
+		test_prefixes(simds[i]);
+	}
+	strlib_set_simd(simd_scalar);
+	munmap(page, 2*page_size);
+	return CHECK_RESULT();
+}
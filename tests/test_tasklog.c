@@ -0,0 +1,113 @@
+#include "check.h"
+#include "../tasklog.h"
+#include "../fslib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*
+ * The links follow their targets when those are moved, go away together
+ * with them and come back the same from the replay and the compaction.
+ */
+
+static char base[] = "/tmp/test_tasklog.XXXXXX";
+
+static char target_is(struct tasklog *log, const char *path,
+	const char *target)
+{
+	char *t = tasklog_readlink(log, path);
+	char ok = t && strcmp(t, target) == 0;
+	free(t);
+	return ok;
+}
+
+static char data_is(struct tasklog *log, const char *path, const char *data)
+{
+	long long len;
+	char *d = tasklog_get(log, path, &len);
+	char ok = d && len == (long long)strlen(data) &&
+		memcmp(d, data, len) == 0;
+	free(d);
+	return ok;
+}
+
+static struct tasklog *reopen(struct tasklog *log, int dirfd)
+{
+	tasklog_close(log);
+	return tasklog_open(dirfd, TASKLOG_FILE, 0);
+}
+
+static void fill(struct tasklog *log)
+{
+	CHECK(tasklog_put(log, "", "", 0) == 0);
+	CHECK(tasklog_put(log, "a", "name a\n", 7) == 0);
+	CHECK(tasklog_put(log, "a/x", "name x\n", 7) == 0);
+	CHECK(tasklog_put(log, "b", "name b\n", 7) == 0);
+	CHECK(tasklog_link(log, "b/a", "a") == 0);
+	CHECK(tasklog_link(log, "lx", "a/x") == 0);
+	CHECK(tasklog_link(log, "llx", "lx") == 0);
+}
+
+static void test_move(int dirfd)
+{
+	struct tasklog *log = tasklog_open(dirfd, TASKLOG_FILE, 1);
+	fill(log);
+	CHECK(tasklog_move(log, "a", "c") == 0);
+	CHECK(target_is(log, "b/a", "c"));
+	CHECK(target_is(log, "lx", "c/x"));
+	CHECK(target_is(log, "llx", "lx"));
+	CHECK(data_is(log, "llx", "name x\n"));
+	CHECK(data_is(log, "b/a/x", "name x\n"));
+	log = reopen(log, dirfd);
+	CHECK(log != NULL);
+	CHECK(target_is(log, "lx", "c/x"));
+	CHECK(data_is(log, "b/a/x", "name x\n"));
+	CHECK(tasklog_compact(log) == 0);
+	log = reopen(log, dirfd);
+	CHECK(target_is(log, "b/a", "c"));
+	CHECK(target_is(log, "llx", "lx"));
+	CHECK(data_is(log, "llx", "name x\n"));
+	tasklog_close(log);
+	unlinkat(dirfd, TASKLOG_FILE, 0);
+}
+
+static void test_remove(int dirfd)
+{
+	struct tasklog *log = tasklog_open(dirfd, TASKLOG_FILE, 1);
+	fill(log);
+	CHECK(tasklog_remove(log, "a/x") == 0);
+	CHECK(!tasklog_exists(log, "lx"));
+	CHECK(!tasklog_exists(log, "llx"));	/* it has led into the other one */
+	CHECK(target_is(log, "b/a", "a"));
+	CHECK(tasklog_remove(log, "a") == 0);
+	CHECK(!tasklog_exists(log, "b/a"));
+	CHECK(tasklog_exists(log, "b"));
+	log = reopen(log, dirfd);
+	CHECK(!tasklog_exists(log, "b/a"));
+	CHECK(!tasklog_exists(log, "lx"));
+	CHECK(data_is(log, "b", "name b\n"));
+	/* a link removed alone leaves the target */
+	CHECK(tasklog_put(log, "a", "name a\n", 7) == 0);
+	CHECK(tasklog_link(log, "b/a", "a") == 0);
+	CHECK(tasklog_remove(log, "b/a") == 0);
+	CHECK(data_is(log, "a", "name a\n"));
+	CHECK(tasklog_link(log, "b/a", "a") == 0);
+	tasklog_close(log);
+	unlinkat(dirfd, TASKLOG_FILE, 0);
+}
+
+int main()
+{
+	int dirfd;
+	if(!mkdtemp(base)) {
+		perror(base);
+		return 1;
+	}
+	dirfd = open(base, O_RDONLY|O_DIRECTORY);
+	test_move(dirfd);
+	test_remove(dirfd);
+	close(dirfd);
+	remove_dir(AT_FDCWD, base);
+	return CHECK_RESULT();
+}
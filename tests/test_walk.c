@@ -0,0 +1,92 @@
+#include "check.h"
+#include "../walk.h"
+#include "../fslib.h"
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*
+ * Without walk_follow the links are reported as they are; with it the
+ * directories behind them are visited once, a link closing a loop is
+ * reported as a cycle and a link to a file stays a link.
+ */
+
+static char base[] = "/tmp/test_walk.XXXXXX";
+
+struct counts {
+	int pre, file, link, dup, cycle;
+};
+
+static int count_entry(const struct walk_entry *ent, void *usrdata)
+{
+	struct counts *c = usrdata;
+	switch(ent->event) {
+	case walk_pre:
+		c->pre++;
+		break;
+	case walk_file:
+		c->file++;
+		break;
+	case walk_link:
+		c->link++;
+		break;
+	case walk_dup:
+		c->dup++;
+		break;
+	case walk_cycle:
+		c->cycle++;
+		break;
+	default:
+		break;
+	}
+	return walk_continue;
+}
+
+static struct counts walk_base(int flags)
+{
+	struct counts c;
+	memset(&c, 0, sizeof(c));
+	CHECK(walk(AT_FDCWD, base, flags, count_entry, &c) == 0);
+	return c;
+}
+
+static void make(const char *fmt, const char *target)
+{
+	char path[4096];
+	sprintf(path, fmt, base);
+	if(!target)
+		CHECK(mkdir(path, 0777) == 0);
+	else
+		CHECK(symlink(target, path) == 0);
+}
+
+int main()
+{
+	struct counts c;
+	int fd;
+	char path[4096];
+	if(!mkdtemp(base)) {
+		perror(base);
+		return 1;
+	}
+	make("%s/a", NULL);
+	make("%s/a/x", NULL);
+	make("%s/b", NULL);
+	sprintf(path, "%s/a/main.tsk", base);
+	fd = open(path, O_WRONLY|O_CREAT, 0666);
+	close(fd);
+	make("%s/b/la", "../a");		/* a second way to a */
+	make("%s/a/x/up", "../..");		/* back to the start */
+	make("%s/b/file", "../a/main.tsk");
+	c = walk_base(0);
+	CHECK(c.pre == 4 && c.file == 1 && c.link == 3);
+	CHECK(c.dup == 0 && c.cycle == 0);
+	c = walk_base(walk_follow);
+	/* a is reached once, from either side, the other way is a dup */
+	CHECK(c.pre == 4 && c.file == 1 && c.link == 1);
+	CHECK(c.dup == 1 && c.cycle == 1);
+	remove_dir(AT_FDCWD, base);
+	return CHECK_RESULT();
+}
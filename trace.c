@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include "outbuf.h"
+#include "record.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+enum {
+	chunk_events = 256,
+	chunk_text = 16384,
+	max_text = 4096,	/* the longer names and args are cut */
+};
+
+struct trace_event {
+	long long start;	/* ns since the tracing was opened */
+	long long end;
+	const char *cat;	/* static */
+	int name;			/* in the text of the chunk */
+	int arg;			/* -1 if there's none */
+};
+
+/* the names and the args are copied into the text, not allocated */
+struct trace_chunk {
+	struct trace_event events[chunk_events];
+	int count;
+	char text[chunk_text];
+	int text_len;
+};
+
+/* the spans of one thread, only that thread adds to them */
+struct trace_buf {
+	long tid;
+	struct trace_chunk chunk;
+	struct trace_buf *next;
+};
+
+static char enabled = 0;
+static int trace_fd = -1;
+static long long origin;
+static char first_event;
+static struct trace_buf *bufs = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;	/* bufs */
+/* the file and first_event, held only while the text is written */
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct trace_buf *thread_buf = NULL;
+static __thread char thread_off = 0;	/* its buffer couldn't be made */
+
+static long long get_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+#define TRACE_START "{\"traceEvents\":["
+#define TRACE_END "\n],\"displayTimeUnit\":\"ns\"}\n"
+
+char trace_open(const char *path)
+{
+	trace_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if(trace_fd == -1)
+		return -1;
+	if(write(trace_fd, TRACE_START, sizeof(TRACE_START)-1) != 
+		sizeof(TRACE_START)-1) {
+		close(trace_fd);
+		return -1;
+	}
+	origin = get_ns();
+	first_event = 1;
+	enabled = 1;
+	return 0;
+}
+
+/* 0 means the span isn't traced */
+long long trace_begin()
+{
+	if(!enabled || thread_off)
+		return 0;
+	return get_ns()-origin+1;
+}
+
+static struct trace_buf *get_thread_buf()
+{
+	struct trace_buf *buf = thread_buf;
+	if(buf || thread_off)
+		return buf;
+	buf = malloc(sizeof(*buf));
+	if(!buf) {		/* the thread goes on untraced */
+		thread_off = 1;
+		return NULL;
+	}
+	buf->tid = syscall(SYS_gettid);
+	buf->chunk.count = 0;
+	buf->chunk.text_len = 0;
+	pthread_mutex_lock(&lock);
+	buf->next = bufs;
+	bufs = buf;
+	pthread_mutex_unlock(&lock);
+	thread_buf = buf;
+	return buf;
+}
+
+/* the length the string is cut to, not in the middle of a character */
+static long long get_text_len(const char *s)
+{
+	long long len = strlen(s);
+	if(len < max_text)
+		return len;
+	len = max_text-1;
+	while(len > 0 && ((unsigned char)s[len] & 0xc0) == 0x80)
+		len--;
+	return len;
+}
+
+static int add_text(struct trace_chunk *chunk, const char *s, long long len)
+{
+	int pos = chunk->text_len;
+	memcpy(chunk->text+pos, s, len);
+	chunk->text[pos+len] = 0;
+	chunk->text_len += len+1;
+	return pos;
+}
+
+/* every event goes after a comma, which the first one in the file skips */
+static void write_event(struct outbuf *ob, const struct trace_chunk *chunk,
+	const struct trace_event *ev, long tid)
+{
+	outbuf_puts(ob, ",\n");
+	outbuf_puts(ob, "{\"name\":");
+	record_write_json_string(ob, chunk->text+ev->name);
+	outbuf_printf(ob, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld.%03lld,"
+		"\"dur\":%lld.%03lld,\"pid\":%ld,\"tid\":%ld", ev->cat,
+		ev->start/1000, ev->start%1000, (ev->end-ev->start)/1000,
+		(ev->end-ev->start)%1000, (long)getpid(), tid);
+	if(ev->arg != -1) {
+		outbuf_puts(ob, ",\"args\":{\"arg\":");
+		record_write_json_string(ob, chunk->text+ev->arg);
+		outbuf_putc(ob, '}');
+	}
+	outbuf_putc(ob, '}');
+}
+
+/*
+ * The events are rendered by their own thread into memory, and only the
+ * file is locked to write them, so the other threads go on recording
+ * meanwhile. The chunk is empty then.
+ */
+static void write_chunk(struct trace_buf *buf)
+{
+	struct trace_chunk *chunk = &buf->chunk;
+	struct outbuf ob;
+	int i;
+	if(chunk->count > 0 && outbuf_init(&ob, -1) == 0) {
+		for(i = 0; i < chunk->count; i++)
+			write_event(&ob, chunk, &chunk->events[i], buf->tid);
+		pthread_mutex_lock(&file_lock);
+		if(first_event) {
+			memmove(ob.data, ob.data+1, --ob.len);
+			first_event = 0;
+		}
+		ob.fd = trace_fd;
+		outbuf_flush(&ob);
+		pthread_mutex_unlock(&file_lock);
+		outbuf_free(&ob);
+	}
+	chunk->count = 0;
+	chunk->text_len = 0;
+}
+
+void trace_end(long long start, const char *cat, const char *name,
+	const char *arg)
+{
+	struct trace_buf *buf;
+	struct trace_chunk *chunk;
+	struct trace_event *ev;
+	long long nlen, alen;
+	if(!start || !enabled)
+		return;
+	if(!name)
+		name = cat;
+	nlen = get_text_len(name);
+	alen = arg ? get_text_len(arg) : 0;
+	buf = get_thread_buf();
+	if(!buf)
+		return;
+	chunk = &buf->chunk;
+	if(chunk->count == chunk_events ||
+		chunk->text_len+nlen+alen+2 > chunk_text)
+		write_chunk(buf);
+	ev = &chunk->events[chunk->count];
+	ev->start = start-1;
+	ev->end = get_ns()-origin;
+	ev->cat = cat;
+	ev->name = add_text(chunk, name, nlen);
+	ev->arg = arg ? add_text(chunk, arg, alen) : -1;
+	chunk->count++;
+}
+
+/* meant for the exit, when the other threads are done */
+void trace_close()
+{
+	struct trace_buf *buf;
+	struct outbuf ob;
+	if(!enabled)
+		return;
+	enabled = 0;
+	pthread_mutex_lock(&lock);
+	for(buf = bufs; buf; ) {
+		struct trace_buf *next = buf->next;
+		write_chunk(buf);
+		free(buf);
+		buf = next;
+	}
+	bufs = NULL;
+	pthread_mutex_unlock(&lock);
+	if(outbuf_init(&ob, trace_fd) == 0) {
+		outbuf_puts(&ob, TRACE_END);
+		outbuf_free(&ob);
+	}
+	close(trace_fd);
+	thread_buf = NULL;
+	thread_off = 0;
+}
@@ -0,0 +1,21 @@
+#ifndef TRACE_H_SENTRY
+#define TRACE_H_SENTRY
+
+/*
+ * Spans of the time spent in the program, written as a Chrome trace. A
+ * span is begun with trace_begin and ended with trace_end, which records
+ * it unless the tracing is off: then the two only check a flag. Each
+ * thread collects its spans in a chunk of its own without any locking,
+ * and a full chunk is rendered by the thread, written to the file under
+ * a lock of the file alone and reused, so the memory doesn't grow with
+ * the trace. The last chunks are written when the tracing is closed.
+ */
+
+#define TRACE_ENV "TASK_TRACE"
+
+char trace_open(const char *path);
+void trace_close();
+long long trace_begin();
+void trace_end(long long start, const char *cat, const char *name,
+	const char *arg);
+#endif
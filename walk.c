@@ -0,0 +1,275 @@
+#include "walk.h"
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * The traversal used by every recursive operation. The directories are
+ * remembered by (dev, inode) in an open addressing hash set, so with
+ * links followed each of them is visited once and a loop made by ln
+ * ends as soon as it's closed. The same set is given to the walks which
+ * go through scan (find, grep), see walk_set_add.
+ */
+
+struct vkey {
+	dev_t dev;
+	ino_t ino;
+	char used;
+};
+
+struct visited {
+	struct vkey *slots;
+	unsigned long long size;	/* power of two */
+	unsigned long long count;
+};
+
+struct walk_set {
+	struct visited dirs;
+};
+
+struct walker {
+	struct visited set;
+	struct vkey *stack;		/* directories on the current path */
+	int stack_size;
+	char *path;
+	long long path_size;
+	int flags;
+	walk_fn_t fn;
+	void *usrdata;
+};
+
+enum { default_set_size = 256, default_stack_size = 32, 
+	default_path_size = 4096 };
+
+static unsigned long long vkey_hash(dev_t dev, ino_t ino)
+{
+	unsigned long long h = (unsigned long long)ino*0x9E3779B97F4A7C15ULL;
+	h ^= (unsigned long long)dev+(h >> 29);
+	return h ^ (h >> 32);
+}
+
+static void visited_init(struct visited *set)
+{
+	set->size = default_set_size;
+	set->count = 0;
+	set->slots = calloc(set->size, sizeof(*(set->slots)));
+}
+
+static struct vkey *visited_find(struct visited *set, dev_t dev, ino_t ino)
+{
+	unsigned long long i = vkey_hash(dev, ino) & (set->size-1);
+	while(set->slots[i].used) {
+		if(set->slots[i].dev == dev && set->slots[i].ino == ino)
+			return &set->slots[i];
+		i = (i+1) & (set->size-1);
+	}
+	return &set->slots[i];
+}
+
+static void visited_grow(struct visited *set)
+{
+	struct vkey *old = set->slots;
+	unsigned long long i, oldsize = set->size;
+	set->size *= 2;
+	set->slots = calloc(set->size, sizeof(*(set->slots)));
+	for(i = 0; i < oldsize; i++) {
+		if(old[i].used)
+			*visited_find(set, old[i].dev, old[i].ino) = old[i];
+	}
+	free(old);
+}
+
+/* returns 0 if the key was added, 1 if it was there already */
+static char visited_add(struct visited *set, dev_t dev, ino_t ino)
+{
+	struct vkey *slot;
+	if((set->count+1)*2 > set->size)
+		visited_grow(set);
+	slot = visited_find(set, dev, ino);
+	if(slot->used)
+		return 1;
+	slot->dev = dev;
+	slot->ino = ino;
+	slot->used = 1;
+	set->count++;
+	return 0;
+}
+
+static char is_ancestor(const struct walker *w, int depth, dev_t dev, 
+	ino_t ino)
+{
+	int i;
+	for(i = 0; i < depth; i++) {
+		if(w->stack[i].dev == dev && w->stack[i].ino == ino)
+			return 1;
+	}
+	return 0;
+}
+
+static void stack_push(struct walker *w, int depth, dev_t dev, ino_t ino)
+{
+	if(depth >= w->stack_size) {
+		w->stack_size *= 2;
+		w->stack = realloc(w->stack, sizeof(*(w->stack))*w->stack_size);
+	}
+	w->stack[depth].dev = dev;
+	w->stack[depth].ino = ino;
+}
+
+/* appends the name to the current path and returns the old length */
+static long long path_push(struct walker *w, const char *name)
+{
+	long long len = strlen(w->path), nlen = strlen(name);
+	if(len+nlen+2 > w->path_size) {
+		while(len+nlen+2 > w->path_size)
+			w->path_size *= 2;
+		w->path = realloc(w->path, w->path_size);
+	}
+	if(len > 0)
+		w->path[len++] = '/';
+	memcpy(w->path+len, name, nlen+1);
+	return len > 0 ? len-1 : 0;
+}
+
+static int walk_aux(struct walker *w, int dirfd, const char *name, 
+	int depth, unsigned char dtype);
+
+static int walk_dir(struct walker *w, int fd, int depth)
+{
+	struct dirent *dent;
+	DIR *dir = fdopendir(fd);
+	int res = walk_continue;
+	if(!dir) {
+		close(fd);
+		return walk_stop;
+	}
+	while((dent = readdir(dir)) != NULL) {
+		if((strcmp(dent->d_name, ".") == 0) || 
+			(strcmp(dent->d_name, "..") == 0))
+			continue;
+		res = walk_aux(w, dirfd(dir), dent->d_name, depth+1, dent->d_type);
+		if(res == walk_stop)
+			break;
+	}
+	closedir(dir);
+	return res == walk_stop ? walk_stop : walk_continue;
+}
+
+static int walk_aux(struct walker *w, int dirfd, const char *name, 
+	int depth, unsigned char dtype)
+{
+	struct walk_entry ent;
+	struct stat st;
+	long long oldlen;
+	int res, fd;
+	char follow = 0;
+	if(dtype == DT_UNKNOWN || depth == 0) {
+		if(fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+			return walk_stop;
+		dtype = S_ISDIR(st.st_mode) ? DT_DIR : 
+			(S_ISLNK(st.st_mode) ? DT_LNK : DT_REG);
+	}
+	/* a link to a file stays a link */
+	if(dtype == DT_LNK && (w->flags & walk_follow) &&
+		fstatat(dirfd, name, &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+		follow = 1;
+		dtype = DT_DIR;
+	}
+	oldlen = depth > 0 ? path_push(w, name) : 0;
+	ent.dirfd = dirfd;
+	ent.name = name;
+	ent.path = w->path;
+	ent.depth = depth;
+	ent.dev = 0;
+	ent.ino = 0;
+	if(dtype != DT_DIR) {
+		ent.event = dtype == DT_LNK ? walk_link : walk_file;
+		res = w->fn(&ent, w->usrdata);
+		goto quit;
+	}
+	fd = openat(dirfd, name, O_RDONLY|O_DIRECTORY|(follow ? 0 : O_NOFOLLOW));
+	if(fd == -1 || fstat(fd, &st) == -1) {
+		if(fd != -1)
+			close(fd);
+		res = walk_stop;
+		goto quit;
+	}
+	ent.dev = st.st_dev;
+	ent.ino = st.st_ino;
+	if(visited_add(&w->set, st.st_dev, st.st_ino)) {
+		close(fd);
+		ent.event = is_ancestor(w, depth, st.st_dev, st.st_ino) ? 
+			walk_cycle : walk_dup;
+		res = w->fn(&ent, w->usrdata);
+		goto quit;
+	}
+	ent.event = walk_pre;
+	res = w->fn(&ent, w->usrdata);
+	if(res != walk_continue) {
+		close(fd);
+		goto quit;
+	}
+	stack_push(w, depth, st.st_dev, st.st_ino);
+	res = walk_dir(w, fd, depth);
+	if(res == walk_stop)
+		goto quit;
+	ent.event = walk_post;
+	ent.path = w->path;
+	res = w->fn(&ent, w->usrdata);
+quit:
+	w->path[oldlen] = 0;
+	return res == walk_stop ? walk_stop : walk_continue;
+}
+
+struct walk_set *walk_set_new()
+{
+	struct walk_set *set = malloc(sizeof(*set));
+	visited_init(&set->dirs);
+	return set;
+}
+
+/*
+ * Adds the directory at the path, the link followed, and returns 0 if it
+ * is new, 1 if it's been added already and -1 if it isn't a directory.
+ */
+char walk_set_add(struct walk_set *set, int dirfd, const char *path)
+{
+	struct stat st;
+	if(fstatat(dirfd, path, &st, 0) == -1 || !S_ISDIR(st.st_mode))
+		return -1;
+	return visited_add(&set->dirs, st.st_dev, st.st_ino);
+}
+
+void walk_set_free(struct walk_set *set)
+{
+	if(!set)
+		return;
+	free(set->dirs.slots);
+	free(set);
+}
+
+char walk(int dirfd, const char *path, int flags, walk_fn_t fn,
+	void *usrdata)
+{
+	struct walker w;
+	int res;
+	if(!path || !fn)
+		return -1;
+	visited_init(&w.set);
+	w.stack_size = default_stack_size;
+	w.stack = malloc(sizeof(*(w.stack))*w.stack_size);
+	w.path_size = default_path_size;
+	w.path = malloc(w.path_size);
+	w.path[0] = 0;
+	w.flags = flags;
+	w.fn = fn;
+	w.usrdata = usrdata;
+	res = walk_aux(&w, dirfd, path, 0, DT_UNKNOWN);
+	free(w.set.slots);
+	free(w.stack);
+	free(w.path);
+	return res == walk_stop ? -1 : 0;
+}
@@ -0,0 +1,43 @@
+#ifndef WALK_H_SENTRY
+#define WALK_H_SENTRY
+#include <sys/types.h>
+
+enum walk_flags {
+	walk_follow = 1,	/* go into the directories behind symlinks */
+};
+
+typedef enum {
+	walk_pre,		/* directory, before its content */
+	walk_post,		/* directory, after its content */
+	walk_file,
+	walk_link,		/* symlink which is not followed */
+	walk_dup,		/* directory which has been visited already */
+	walk_cycle,		/* directory which is an ancestor of itself */
+} walk_event;
+
+enum {
+	walk_continue = 0,
+	walk_skip = 1,		/* don't go into the directory (for walk_pre) */
+	walk_stop = -1,
+};
+
+struct walk_entry {
+	walk_event event;
+	int dirfd;			/* the parent directory */
+	const char *name;	/* name in the parent directory */
+	const char *path;	/* path from the start of the walk */
+	int depth;
+	dev_t dev;
+	ino_t ino;
+};
+
+typedef int (*walk_fn_t)(const struct walk_entry *ent, void *usrdata);
+
+struct walk_set;
+
+char walk(int dirfd, const char *path, int flags, walk_fn_t fn,
+	void *usrdata);
+struct walk_set *walk_set_new();
+char walk_set_add(struct walk_set *set, int dirfd, const char *path);
+void walk_set_free(struct walk_set *set);
+#endif